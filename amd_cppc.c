@@ -45,14 +45,24 @@
 #include <sys/param.h>
 #include <sys/bus.h>
 #include <sys/cpu.h>
+#include <sys/devctl.h>
+#include <sys/eventhandler.h>
 #include <sys/kernel.h>
+#include <sys/lock.h>
 #include <sys/malloc.h>
 #include <sys/module.h>
+#include <sys/pcpu.h>
+#include <sys/power.h>
 #include <sys/proc.h>
+#include <sys/resource.h>
+#include <sys/sbuf.h>
 #include <sys/sched.h>
 #include <sys/smp.h>
+#include <sys/sx.h>
 #include <sys/sysctl.h>
 #include <sys/systm.h>
+#include <sys/taskqueue.h>
+#include <sys/time.h>
 
 #include <machine/cputypes.h>
 #include <machine/md_var.h>
@@ -63,33 +73,8 @@
 
 #include "cpufreq_if.h"
 
-/*
- * AMD CPPC MSR definitions.
- */
-#define MSR_AMD_CPPC_CAP1		0xC00102B0
-#define MSR_AMD_CPPC_ENABLE		0xC00102B1
-#define MSR_AMD_CPPC_REQ		0xC00102B3
-
-/* CPPC_CAP1 fields (read-only) */
-#define AMD_CPPC_LOWEST_PERF(x)		(((x) >> 0) & 0xFF)
-#define AMD_CPPC_LOWNONLIN_PERF(x)	(((x) >> 8) & 0xFF)
-#define AMD_CPPC_NOMINAL_PERF(x)	(((x) >> 16) & 0xFF)
-#define AMD_CPPC_HIGHEST_PERF(x)	(((x) >> 24) & 0xFF)
-
-/* CPPC_REQ fields (read-write) */
-#define AMD_CPPC_MAX_PERF_SHIFT		0
-#define AMD_CPPC_MIN_PERF_SHIFT		8
-#define AMD_CPPC_DES_PERF_SHIFT		16
-#define AMD_CPPC_EPP_PERF_SHIFT		24
-
-#define AMD_CPPC_REQ_BUILD(max, min, des, epp)	\
-	(((uint64_t)(epp) << AMD_CPPC_EPP_PERF_SHIFT) |	\
-	 ((uint64_t)(des) << AMD_CPPC_DES_PERF_SHIFT) |	\
-	 ((uint64_t)(min) << AMD_CPPC_MIN_PERF_SHIFT) |	\
-	 ((uint64_t)(max) << AMD_CPPC_MAX_PERF_SHIFT))
-
-/* CPPC_ENABLE */
-#define AMD_CPPC_ENABLE_BIT		(1ULL << 0)
+#include "amd_cppc_var.h"
+#include "amd_cppc_quirk.h"
 
 /* CPUID feature detection */
 #define CPUID_AMD_EXT_FEATURES		0x80000008
@@ -97,47 +82,54 @@
 /* Maximum frequency steps we expose to cpufreq */
 #define AMD_CPPC_MAX_SETTINGS		64
 
-extern uint64_t tsc_freq;
+/* Power source profiles */
+#define AMD_CPPC_PROFILE_AC		0
+#define AMD_CPPC_PROFILE_BATTERY	1
+#define AMD_CPPC_PROFILE_COUNT		2
 
-static int	amd_cppc_verbose = 0;
-SYSCTL_INT(_debug, OID_AUTO, amd_cppc_verbose, CTLFLAG_RWTUN,
-	   &amd_cppc_verbose, 0, "Debug AMD CPPC driver");
+/* Number of profile switches remembered */
+#define AMD_CPPC_PROFILE_LOG		16
 
-#define CPPC_DEBUG(dev, fmt, ...)					\
-	do {								\
-		if (amd_cppc_verbose)					\
-			device_printf(dev, fmt, ## __VA_ARGS__);	\
-	} while (0)
+/*
+ * Serializes all request state and MSR programming. Everything that
+ * touches the request registers sleeps (sched_bind), so an sx lock is used.
+ */
+struct sx	amd_cppc_lock;
+SX_SYSINIT(amd_cppc_lock, &amd_cppc_lock, "amd_cppc");
 
-struct amd_cppc_softc {
-	device_t	dev;
-	int		cpu_id;
+static uint64_t	amd_cppc_req_writes;
+static uint64_t	amd_cppc_req_elided;
 
-	/* Capabilities from CPPC_CAP1 */
-	uint8_t		highest_perf;
-	uint8_t		nominal_perf;
-	uint8_t		lowest_nonlinear_perf;
-	uint8_t		lowest_perf;
+/*
+ * The power source profile in force, layered over the admin settings of
+ * every CPU. All -1 while profiles are off.
+ */
+static struct amd_cppc_override amd_cppc_profile_ovr = {
+	.epp = -1, .min_perf = -1, .max_perf = -1, .boost = -1, .mode = -1,
+	.vcache = -1,
+};
+
+int		amd_cppc_verbose = 0;
+SYSCTL_INT(_debug, OID_AUTO, amd_cppc_verbose, CTLFLAG_RWTUN,
+	   &amd_cppc_verbose, 0, "Debug AMD CPPC driver");
 
-	/* Current request state */
-	uint8_t		req_max_perf;
-	uint8_t		req_min_perf;
-	uint8_t		req_des_perf;
-	uint8_t		req_epp;
+SYSCTL_NODE(_hw, OID_AUTO, amd_cppc, CTLFLAG_RD | CTLFLAG_MPSAFE,
+		   NULL, "AMD CPPC driver");
 
-	/* Frequency mapping */
-	int		base_freq_mhz;	/* nominal frequency in MHz */
+static int	amd_cppc_watchdog_ms = 1000;
 
-	/* EPP control */
-	int		epp;	/* 0-100 user-facing scale */
+SYSCTL_U64(_hw_amd_cppc, OID_AUTO, req_writes, CTLFLAG_RD,
+	   &amd_cppc_req_writes, 0, "Number of CPPC_REQ writes");
+SYSCTL_U64(_hw_amd_cppc, OID_AUTO, req_elided, CTLFLAG_RD,
+	   &amd_cppc_req_elided, 0,
+	   "Number of CPPC_REQ writes skipped as unchanged");
 
-	bool		cppc_enabled;
-};
+static void	amd_cppc_watchdog_arm(struct amd_cppc_softc *sc);
 
 /*
  * Bind current thread to a specific CPU for MSR access.
  */
-static void
+void
 amd_cppc_bind_cpu(int cpu_id)
 {
 
@@ -146,7 +138,7 @@ amd_cppc_bind_cpu(int cpu_id)
 	thread_unlock(curthread);
 }
 
-static void
+void
 amd_cppc_unbind_cpu(void)
 {
 
@@ -181,16 +173,84 @@ amd_cppc_wrmsr(struct amd_cppc_softc *sc, uint32_t msr, uint64_t val)
 }
 
 /*
- * Convert abstract performance level to MHz. Uses the relationship: freq =
- * base_freq * perf / nominal_perf
+ * Convert abstract performance level to MHz. Uses the calibrated map if
+ * there is one, else the relationship: freq = base_freq * perf /
+ * nominal_perf. On parts where highest_perf is a rank, the boost range
+ * nominal..highest is spread over nominal..boost_ratio first.
  */
-static int
+int
 amd_cppc_perf_to_mhz(struct amd_cppc_softc *sc, uint8_t perf)
 {
+	int		mhz, ratio;
 
+	if ((mhz = amd_cppc_calib_mhz(sc, perf)) >= 0)
+		return (mhz);
 	if (sc->nominal_perf == 0)
 		return (0);
-	return ((int)((uint64_t) sc->base_freq_mhz * perf / sc->nominal_perf));
+	ratio = perf;
+	if (perf > sc->nominal_perf && sc->boost_ratio != sc->highest_perf)
+		ratio = sc->nominal_perf + (perf - sc->nominal_perf) *
+		    (sc->boost_ratio - sc->nominal_perf) /
+		    (sc->highest_perf - sc->nominal_perf);
+	return ((int)((uint64_t) sc->base_freq_mhz * ratio /
+	    sc->nominal_perf));
+}
+
+/*
+ * Busy percentage of a CPU since the previous call, from its statclock tick
+ * counters. prev holds the CPUSTATES counters seen by the previous call.
+ */
+int
+amd_cppc_cpu_util(int cpu, long *prev)
+{
+	struct pcpu	*pc;
+	long		busy, cur, delta, total;
+	int		i;
+
+	pc = pcpu_find(cpu);
+	busy = total = 0;
+	for (i = 0; i < CPUSTATES; i++) {
+		cur = pc->pc_cp_time[i];
+		delta = cur - prev[i];
+		prev[i] = cur;
+		total += delta;
+		if (i != CP_IDLE)
+			busy += delta;
+	}
+	return (total > 0 ? (int)(busy * 100 / total) : 0);
+}
+
+/*
+ * Energy model.
+ *
+ * Dynamic power goes with f * V^2. Voltage is roughly proportional to
+ * frequency above lowest_nonlinear_perf and flat below it. Work is fixed, so
+ * busy time goes with 1/f and energy per unit of work with V^2 alone. The
+ * result is in arbitrary units and only meaningful as a ratio between two
+ * operating points of the same CPU.
+ */
+uint64_t
+amd_cppc_model_energy(struct amd_cppc_softc *sc, int perf)
+{
+	uint64_t	v;
+
+	v = MAX(perf, sc->lowest_nonlinear_perf);
+	return (v * v);
+}
+
+/*
+ * Estimate the performance level a request settles at. A desired_perf
+ * pins it; otherwise the hardware picks within [min, max], biased by EPP
+ * towards max (EPP 0) or min (EPP 255).
+ */
+int
+amd_cppc_req_opp(const struct amd_cppc_req *req)
+{
+
+	if (req->des_perf != 0)
+		return (req->des_perf);
+	return (req->min_perf +
+	    (req->max_perf - req->min_perf) * (255 - req->epp) / 255);
 }
 
 /*
@@ -201,9 +261,19 @@ static uint8_t
 amd_cppc_mhz_to_perf(struct amd_cppc_softc *sc, int mhz){
 	int		perf;
 
-	if (sc->base_freq_mhz == 0)
+	if (sc->cal_n >= 2)
+		perf = amd_cppc_calib_perf(sc, mhz);
+	else if (sc->base_freq_mhz == 0)
 		return (sc->nominal_perf);
-	perf = (int)((uint64_t) mhz * sc->nominal_perf / sc->base_freq_mhz);
+	else {
+		perf = (int)((uint64_t) mhz * sc->nominal_perf /
+		    sc->base_freq_mhz);
+		if (perf > sc->nominal_perf &&
+		    sc->boost_ratio != sc->highest_perf)
+			perf = sc->nominal_perf + (perf - sc->nominal_perf) *
+			    (sc->highest_perf - sc->nominal_perf) /
+			    (sc->boost_ratio - sc->nominal_perf);
+	}
 	if (perf < sc->lowest_perf)
 		perf = sc->lowest_perf;
 	if (perf > sc->highest_perf)
@@ -213,16 +283,27 @@ amd_cppc_mhz_to_perf(struct amd_cppc_softc *sc, int mhz){
 
 /*
  * Convert user-facing EPP (0-100) to hardware EPP (0-255). 0 = maximum
- * performance, 100 = maximum efficiency.
+ * performance, 100 = maximum efficiency, 50 = the part's balanced value.
  */
-static uint8_t
-amd_cppc_epp_to_hw(int epp){
+uint8_t
+amd_cppc_epp_to_hw(int epp)
+{
+
+	return (amd_cppc_quirk_epp(amd_cppc_quirk, epp));
+}
 
-	if (epp < 0)
-		epp = 0;
-	if (epp > 100)
-		epp = 100;
-	return ((uint8_t) (epp * 255 / 100));
+/*
+ * The CPPC_REQ value for this CPU: its own request, merged with the rest of
+ * its coordination domain when domain coordination is on.
+ */
+static uint64_t
+amd_cppc_req_value(struct amd_cppc_softc *sc)
+{
+	struct amd_cppc_req req;
+
+	amd_cppc_domain_req(sc, &req);
+	return (AMD_CPPC_REQ_BUILD(req.max_perf, req.min_perf, req.des_perf,
+				   req.epp));
 }
 
 /*
@@ -233,9 +314,378 @@ amd_cppc_write_req(struct amd_cppc_softc *sc)
 {
 	uint64_t	val;
 
-	val = AMD_CPPC_REQ_BUILD(sc->req_max_perf, sc->req_min_perf,
-				 sc->req_des_perf, sc->req_epp);
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	val = amd_cppc_req_value(sc);
+	sc->req_shadow = val;
 	amd_cppc_wrmsr(sc, MSR_AMD_CPPC_REQ, val);
+	amd_cppc_req_writes++;
+}
+
+/*
+ * Derive the request fields from the policy inputs. The boost switch and
+ * the admin floor/ceiling bound the range; the mode decides what the last
+ * cpufreq setting means within it.
+ */
+void
+amd_cppc_override_clear(struct amd_cppc_override *o)
+{
+
+	o->epp = o->min_perf = o->max_perf = o->boost = o->mode = -1;
+	o->vcache = -1;
+}
+
+/* Source of each effective setting, AMD_CPPC_SRC_* */
+struct amd_cppc_override_src {
+	uint8_t		epp;
+	uint8_t		min_perf;
+	uint8_t		max_perf;
+	uint8_t		boost;
+};
+
+/*
+ * Layer an override from source src onto the effective settings.
+ */
+static void
+amd_cppc_override_merge(const struct amd_cppc_override *o,
+			struct amd_cppc_override *eff, int src,
+			struct amd_cppc_override_src *from)
+{
+
+	if (o->epp >= 0) {
+		eff->epp = o->epp;
+		from->epp = src;
+	}
+	if (o->min_perf >= 0) {
+		eff->min_perf = o->min_perf;
+		from->min_perf = src;
+	}
+	if (o->max_perf >= 0) {
+		eff->max_perf = o->max_perf;
+		from->max_perf = src;
+	}
+	if (o->boost >= 0) {
+		eff->boost = o->boost;
+		from->boost = src;
+	}
+	if (o->mode >= 0)
+		eff->mode = o->mode;
+	if (o->vcache >= 0)
+		eff->vcache = o->vcache;
+}
+
+/*
+ * Evaluate the request a CPU would get in the given mode with the given
+ * policy override layered over its admin settings, the power source
+ * profile and its cpuset policy settings. Has no
+ * side effects, so it can also be used to evaluate policies that are not in
+ * control. If bind is not NULL, the source deciding each field is stored
+ * there.
+ */
+void
+amd_cppc_req_eval(struct amd_cppc_softc *sc, int mode,
+		  const struct amd_cppc_override *ovr, struct amd_cppc_req *req,
+		  uint8_t *bind)
+{
+	struct amd_cppc_override eff;
+	struct amd_cppc_override_src from;
+	uint8_t		hi, lo, target, hi_src, lo_src, target_src;
+	int		epp;
+
+	eff.epp = sc->epp;
+	eff.min_perf = sc->floor_perf;
+	eff.max_perf = sc->ceil_perf;
+	eff.boost = sc->boost;
+	eff.mode = mode;
+	eff.vcache = -1;
+	from.epp = from.min_perf = from.max_perf = from.boost =
+	    AMD_CPPC_SRC_ADMIN;
+	amd_cppc_override_merge(&amd_cppc_profile_ovr, &eff,
+				AMD_CPPC_SRC_PROFILE, &from);
+	amd_cppc_override_merge(&sc->set_ovr, &eff, AMD_CPPC_SRC_POLICY,
+				&from);
+	amd_cppc_override_merge(ovr, &eff, AMD_CPPC_SRC_GOVERNOR, &from);
+
+	hi = eff.boost ? sc->highest_perf : sc->nominal_perf;
+	hi_src = eff.boost ? AMD_CPPC_SRC_HW : from.boost;
+	if (eff.max_perf != 0 && eff.max_perf < hi) {
+		hi = eff.max_perf;
+		hi_src = from.max_perf;
+	}
+	target = hi;
+	epp = eff.epp;
+	amd_cppc_vcache_bias(sc, &eff, &hi);
+	if (hi != target)
+		hi_src = AMD_CPPC_SRC_VCACHE;
+	if (eff.epp != epp)
+		from.epp = AMD_CPPC_SRC_VCACHE;
+	lo = MAX(sc->lowest_perf, eff.min_perf);
+	lo_src = eff.min_perf > sc->lowest_perf ? from.min_perf :
+	    AMD_CPPC_SRC_HW;
+	if (lo > hi) {
+		lo = hi;
+		lo_src = hi_src;
+	}
+	/* A source binds only if it moved the value. */
+	if (sc->cf_perf >= hi) {
+		target = hi;
+		target_src = hi_src;
+	} else if (sc->cf_perf <= lo) {
+		target = lo;
+		target_src = lo_src;
+	} else {
+		target = sc->cf_perf;
+		target_src = AMD_CPPC_SRC_CPUFREQ;
+	}
+
+	req->min_perf = lo;
+	switch (eff.mode) {
+	case AMD_CPPC_MODE_AUTONOMOUS:
+		req->max_perf = hi;
+		req->des_perf = 0;
+		target_src = AMD_CPPC_SRC_NONE;
+		break;
+	case AMD_CPPC_MODE_GUIDED:
+		req->max_perf = hi;
+		req->des_perf = target;
+		break;
+	case AMD_CPPC_MODE_CAP:
+	default:
+		req->max_perf = target;
+		req->des_perf = 0;	/* 0 = autonomous, let CPU decide */
+		hi_src = target_src;
+		target_src = AMD_CPPC_SRC_NONE;
+		break;
+	}
+	req->epp = amd_cppc_epp_to_hw(eff.epp);
+
+	if (bind != NULL) {
+		bind[AMD_CPPC_BIND_MAX] = hi_src;
+		bind[AMD_CPPC_BIND_MIN] = lo_src;
+		bind[AMD_CPPC_BIND_DES] = target_src;
+		bind[AMD_CPPC_BIND_EPP] = from.epp;
+	}
+}
+
+/*
+ * Adjust a request evaluated by amd_cppc_req_eval() by the sources layered
+ * over the policy: the boost budget, CCD parking, the boost windows and
+ * last the arbitration slots and limits, so a thermal cap or limit_max_perf
+ * holds even inside a window. If bind is not NULL, the source deciding
+ * each field is updated there.
+ */
+void
+amd_cppc_req_clamp(struct amd_cppc_softc *sc, struct amd_cppc_req *req,
+		   uint8_t *bind)
+{
+	struct amd_cppc_req prev;
+
+	prev = *req;
+	amd_cppc_boost_clamp(sc, req);
+	amd_cppc_arb_note(&prev, req, AMD_CPPC_SRC_POWERCAP, bind);
+	prev = *req;
+	amd_cppc_ccd_clamp(sc, req);
+	amd_cppc_arb_note(&prev, req, AMD_CPPC_SRC_PARK, bind);
+	prev = *req;
+	amd_cppc_phase_clamp(sc, req);
+	amd_cppc_arb_note(&prev, req, AMD_CPPC_SRC_PHASE, bind);
+	amd_cppc_arb_apply(sc, req, bind);
+}
+
+/*
+ * Merge every source into the request, noting which one decided each
+ * field.
+ */
+static void
+amd_cppc_compute_req(struct amd_cppc_softc *sc)
+{
+	struct amd_cppc_req req;
+	uint8_t		bind[AMD_CPPC_BIND_COUNT];
+
+	amd_cppc_req_eval(sc, sc->mode, &sc->rule_ovr, &req, bind);
+	amd_cppc_req_clamp(sc, &req, bind);
+
+	sc->req_max_perf = req.max_perf;
+	sc->req_min_perf = req.min_perf;
+	sc->req_des_perf = req.des_perf;
+	sc->req_epp = req.epp;
+	if (memcmp(bind, sc->arb_bind, sizeof(bind)) != 0) {
+		memcpy(sc->arb_bind, bind, sizeof(bind));
+		sc->arb_rebinds++;
+	}
+}
+
+/*
+ * Recompute the request and write it if it differs from what the hardware
+ * was last given.
+ */
+void
+amd_cppc_update_req(struct amd_cppc_softc *sc)
+{
+	struct amd_cppc_softc *m;
+	cpuset_t	members;
+	int		cpu;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	amd_cppc_compute_req(sc);
+	if (!sc->cppc_enabled)
+		return;
+
+	/* A change can move the merged request of the whole domain. */
+	amd_cppc_domain_members(sc, &members);
+	CPU_FOREACH(cpu) {
+		if (!CPU_ISSET(cpu, &members))
+			continue;
+		m = cpu == sc->cpu_id ? sc : amd_cppc_softc_get(cpu);
+		if (m == NULL)
+			continue;
+		if (amd_cppc_req_value(m) != m->req_shadow)
+			amd_cppc_write_req(m);
+		else
+			amd_cppc_req_elided++;
+	}
+}
+
+/*
+ * Look up the softc of an attached, enabled CPU by unit number.
+ */
+struct amd_cppc_softc *
+amd_cppc_softc_get(int unit)
+{
+	struct amd_cppc_softc *sc;
+	devclass_t	dc;
+	device_t	dev;
+
+	dc = devclass_find("amd_cppc");
+	if (dc == NULL)
+		return (NULL);
+	dev = devclass_get_device(dc, unit);
+	if (dev == NULL || !device_is_attached(dev))
+		return (NULL);
+	sc = device_get_softc(dev);
+	if (!sc->cppc_enabled || sc->detaching)
+		return (NULL);
+	return (sc);
+}
+
+/*
+ * Batched request commit. Collects the new request of every CPU whose
+ * computed request changed and writes them all in one rendezvous instead of
+ * migrating to each CPU in turn.
+ */
+static void
+amd_cppc_batch_action(void *arg)
+{
+	struct amd_cppc_batch *b;
+
+	b = arg;
+	if (CPU_ISSET(curcpu, &b->cpus))
+		wrmsr(MSR_AMD_CPPC_REQ, b->req[curcpu]);
+}
+
+struct amd_cppc_batch *
+amd_cppc_batch_alloc(void)
+{
+
+	return (malloc(sizeof(struct amd_cppc_batch), M_TEMP,
+		       M_WAITOK | M_ZERO));
+}
+
+/*
+ * Queue the recomputed request of this CPU if it changed.
+ */
+void
+amd_cppc_batch_add(struct amd_cppc_batch *b, struct amd_cppc_softc *sc)
+{
+	struct amd_cppc_softc *m;
+	cpuset_t	members;
+	uint64_t	val;
+	int		cpu;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	amd_cppc_compute_req(sc);
+
+	amd_cppc_domain_members(sc, &members);
+	CPU_FOREACH(cpu) {
+		if (!CPU_ISSET(cpu, &members))
+			continue;
+		m = cpu == sc->cpu_id ? sc : amd_cppc_softc_get(cpu);
+		if (m == NULL)
+			continue;
+		val = amd_cppc_req_value(m);
+		if (val == m->req_shadow) {
+			amd_cppc_req_elided++;
+			continue;
+		}
+		m->req_shadow = val;
+		b->req[cpu] = val;
+		CPU_SET(cpu, &b->cpus);
+	}
+}
+
+/*
+ * Write all queued requests and free the batch. Returns the number of CPUs
+ * written.
+ */
+int
+amd_cppc_batch_commit(struct amd_cppc_batch *b)
+{
+	int		n;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	n = CPU_COUNT(&b->cpus);
+	amd_cppc_req_writes += n;
+	if (n != 0)
+		smp_rendezvous_cpus(b->cpus, smp_no_rendezvous_barrier,
+				    amd_cppc_batch_action,
+				    smp_no_rendezvous_barrier, b);
+	free(b, M_TEMP);
+	return (n);
+}
+
+static const char *const amd_cppc_mode_names[AMD_CPPC_MODE_COUNT] = {
+	[AMD_CPPC_MODE_CAP] = "cap",
+	[AMD_CPPC_MODE_AUTONOMOUS] = "autonomous",
+	[AMD_CPPC_MODE_GUIDED] = "guided",
+};
+
+const char *
+amd_cppc_mode_name(int mode)
+{
+
+	return (amd_cppc_mode_names[mode]);
+}
+
+int
+amd_cppc_mode_parse(const char *name)
+{
+	int		i;
+
+	for (i = 0; i < AMD_CPPC_MODE_COUNT; i++)
+		if (strcmp(name, amd_cppc_mode_names[i]) == 0)
+			return (i);
+	return (-1);
+}
+
+/*
+ * Sysctl helper for a mode stored as an int but presented by name.
+ * Returns the new mode in *modep.
+ */
+static int
+amd_cppc_sysctl_handle_mode(struct sysctl_oid *oidp, struct sysctl_req *req,
+			    int *modep)
+{
+	char		buf[16];
+	int		error, mode;
+
+	strlcpy(buf, amd_cppc_mode_names[*modep], sizeof(buf));
+	error = sysctl_handle_string(oidp, buf, sizeof(buf), req);
+	if (error || req->newptr == NULL)
+		return (error);
+	mode = amd_cppc_mode_parse(buf);
+	if (mode < 0)
+		return (EINVAL);
+	*modep = mode;
+	return (0);
 }
 
 /*
@@ -276,6 +726,7 @@ amd_cppc_disable(struct amd_cppc_softc *sc)
 		return;
 
 	/* Zero out the request register first */
+	sc->req_shadow = 0;
 	amd_cppc_wrmsr(sc, MSR_AMD_CPPC_REQ, 0);
 
 	val = amd_cppc_rdmsr(sc, MSR_AMD_CPPC_ENABLE);
@@ -298,6 +749,8 @@ amd_cppc_read_caps(struct amd_cppc_softc *sc)
 	sc->nominal_perf = AMD_CPPC_NOMINAL_PERF(cap1);
 	sc->lowest_nonlinear_perf = AMD_CPPC_LOWNONLIN_PERF(cap1);
 	sc->lowest_perf = AMD_CPPC_LOWEST_PERF(cap1);
+	sc->boost_ratio = amd_cppc_quirk_highest(amd_cppc_quirk,
+	    sc->highest_perf, sc->nominal_perf);
 
 	if (sc->highest_perf == 0 || sc->nominal_perf == 0 ||
 	    sc->lowest_perf == 0) {
@@ -318,6 +771,155 @@ amd_cppc_read_caps(struct amd_cppc_softc *sc)
 	return (0);
 }
 
+/*
+ * Record a divergence between the hardware request state and our shadow,
+ * then re-assert the shadow. Firmware (SMM handlers for AC, lid or dock
+ * events) is known to rewrite CPPC_REQ or clear the enable bit.
+ */
+static void
+amd_cppc_tamper(struct amd_cppc_softc *sc, uint64_t req, uint64_t enable)
+{
+	struct amd_cppc_tamper *t;
+	char		data[96];
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+
+	t = &sc->tamper_log[sc->tamper_next % AMD_CPPC_TAMPER_LOG];
+	getnanotime(&t->ts);
+	t->expected_req = sc->req_shadow;
+	t->observed_req = req;
+	t->observed_enable = enable;
+	sc->tamper_next++;
+	sc->tamper_count++;
+
+	device_printf(sc->dev, "CPU %d: firmware changed CPPC state "
+		      "(req 0x%016jx -> 0x%016jx, enable 0x%jx), restoring\n",
+		      sc->cpu_id, (uintmax_t)sc->req_shadow, (uintmax_t)req,
+		      (uintmax_t)enable);
+	snprintf(data, sizeof(data), "cpu=%d expected=0x%jx observed=0x%jx "
+		 "enable=0x%jx", sc->cpu_id, (uintmax_t)sc->req_shadow,
+		 (uintmax_t)req, (uintmax_t)enable);
+	devctl_notify("AMD_CPPC", "WATCHDOG", "TAMPER", data);
+
+	if ((enable & AMD_CPPC_ENABLE_BIT) == 0)
+		amd_cppc_wrmsr(sc, MSR_AMD_CPPC_ENABLE,
+			       enable | AMD_CPPC_ENABLE_BIT);
+	amd_cppc_wrmsr(sc, MSR_AMD_CPPC_REQ, sc->req_shadow);
+}
+
+/*
+ * Periodic verifier: compare CPPC_REQ and CPPC_ENABLE against the state we
+ * last programmed.
+ */
+static void
+amd_cppc_watchdog(void *arg, int pending __unused)
+{
+	struct amd_cppc_softc *sc;
+	uint64_t	req, enable;
+
+	sc = arg;
+	sx_xlock(&amd_cppc_lock);
+	if (sc->detaching) {
+		sx_xunlock(&amd_cppc_lock);
+		return;
+	}
+	if (sc->cppc_enabled) {
+		amd_cppc_bind_cpu(sc->cpu_id);
+		req = rdmsr(MSR_AMD_CPPC_REQ);
+		enable = rdmsr(MSR_AMD_CPPC_ENABLE);
+		amd_cppc_unbind_cpu();
+
+		/* Lock owner boost and pre-ramp are expected deviations. */
+		if ((req != sc->req_shadow && req != sc->ob_req &&
+		    req != sc->pr_req) ||
+		    (enable & AMD_CPPC_ENABLE_BIT) == 0)
+			amd_cppc_tamper(sc, req, enable);
+	}
+	amd_cppc_watchdog_arm(sc);
+	sx_xunlock(&amd_cppc_lock);
+}
+
+static void
+amd_cppc_watchdog_arm(struct amd_cppc_softc *sc)
+{
+	int		ms;
+
+	ms = amd_cppc_watchdog_ms;
+	if (ms <= 0 || sc->detaching)
+		return;
+	taskqueue_enqueue_timeout(taskqueue_thread, &sc->wdog_task,
+				  MAX(1, (int)((int64_t)ms * hz / 1000)));
+}
+
+/*
+ * Sysctl handler for the watchdog interval. Re-arms every CPU so that a
+ * previously disabled watchdog starts again.
+ */
+static int
+amd_cppc_sysctl_watchdog_ms(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	devclass_t	dc;
+	int		error, i, ms;
+
+	ms = amd_cppc_watchdog_ms;
+	error = sysctl_handle_int(oidp, &ms, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (ms < 0)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_watchdog_ms = ms;
+	dc = devclass_find("amd_cppc");
+	for (i = 0; dc != NULL && i < devclass_get_maxunit(dc); i++) {
+		sc = devclass_get_softc(dc, i);
+		if (sc != NULL && sc->cppc_enabled)
+			amd_cppc_watchdog_arm(sc);
+	}
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, watchdog_ms,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_watchdog_ms, "I",
+	    "Interval in ms between firmware tamper checks (0 = disabled)");
+
+/*
+ * Sysctl handler dumping the most recent tamper events, oldest first.
+ */
+static int
+amd_cppc_sysctl_tamper_log(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	struct amd_cppc_tamper *t;
+	struct sbuf	*sb;
+	u_int		i, first;
+	int		error;
+
+	sc = arg1;
+	sb = sbuf_new_for_sysctl(NULL, NULL, 256, req);
+	if (sb == NULL)
+		return (ENOMEM);
+
+	sx_slock(&amd_cppc_lock);
+	first = sc->tamper_next > AMD_CPPC_TAMPER_LOG ?
+	    sc->tamper_next - AMD_CPPC_TAMPER_LOG : 0;
+	for (i = first; i < sc->tamper_next; i++) {
+		t = &sc->tamper_log[i % AMD_CPPC_TAMPER_LOG];
+		sbuf_printf(sb, "\n%jd.%09ld req 0x%016jx -> 0x%016jx "
+			    "enable 0x%jx", (intmax_t)t->ts.tv_sec,
+			    t->ts.tv_nsec, (uintmax_t)t->expected_req,
+			    (uintmax_t)t->observed_req,
+			    (uintmax_t)t->observed_enable);
+	}
+	sx_sunlock(&amd_cppc_lock);
+
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+	return (error);
+}
+
 /*
  * Sysctl handler for EPP (Energy Performance Preference). User-facing range:
  * 0 (max performance) to 100 (max efficiency).
@@ -340,17 +942,397 @@ amd_cppc_sysctl_epp(SYSCTL_HANDLER_ARGS)
 	if (epp < 0 || epp > 100)
 		return (EINVAL);
 
+	sx_xlock(&amd_cppc_lock);
 	sc->epp = epp;
-	sc->req_epp = amd_cppc_epp_to_hw(epp);
-
-	if (sc->cppc_enabled)
-		amd_cppc_write_req(sc);
+	amd_cppc_update_req(sc);
+	sx_xunlock(&amd_cppc_lock);
 
 	CPPC_DEBUG(dev, "EPP set to %d (hw: %u) on CPU %d\n",
 		   epp, sc->req_epp, sc->cpu_id);
 	return (0);
 }
 
+/*
+ * Per-CPU policy sysctls. arg2 selects the field.
+ */
+#define AMD_CPPC_POLICY_MODE		0
+#define AMD_CPPC_POLICY_BOOST		1
+#define AMD_CPPC_POLICY_MIN_PERF	2
+#define AMD_CPPC_POLICY_MAX_PERF	3
+
+static int
+amd_cppc_sysctl_policy(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	int		error, val;
+
+	sc = arg1;
+	if (arg2 == AMD_CPPC_POLICY_MODE) {
+		val = sc->mode;
+		error = amd_cppc_sysctl_handle_mode(oidp, req, &val);
+	} else {
+		switch (arg2) {
+		case AMD_CPPC_POLICY_BOOST:
+			val = sc->boost;
+			break;
+		case AMD_CPPC_POLICY_MIN_PERF:
+			val = sc->floor_perf;
+			break;
+		default:
+			val = sc->ceil_perf;
+			break;
+		}
+		error = sysctl_handle_int(oidp, &val, 0, req);
+		if (error == 0 && req->newptr != NULL &&
+		    (val < 0 || val > 255))
+			error = EINVAL;
+	}
+	if (error || req->newptr == NULL)
+		return (error);
+
+	sx_xlock(&amd_cppc_lock);
+	switch (arg2) {
+	case AMD_CPPC_POLICY_MODE:
+		sc->mode = val;
+		break;
+	case AMD_CPPC_POLICY_BOOST:
+		sc->boost = val != 0;
+		break;
+	case AMD_CPPC_POLICY_MIN_PERF:
+		sc->floor_perf = val;
+		break;
+	default:
+		sc->ceil_perf = val;
+		break;
+	}
+	amd_cppc_update_req(sc);
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+
+/*
+ * AC/battery profile switching.
+ *
+ * When enabled, the driver follows the ACPI power profile (set by acpi_acad
+ * on AC plug/unplug) and applies the matching profile to every CPU in one
+ * batch. The profile is a layer over the per-CPU epp/mode/boost/min_perf/
+ * max_perf settings, which it leaves alone: they are in force again once
+ * power_profile is turned off. A profile can also limit the idle state
+ * depth, so that a low latency profile is not undone by deep C-state
+ * exits.
+ */
+struct amd_cppc_profile {
+	int		epp;
+	int		mode;
+	int		boost;
+	int		min_perf;	/* 0 = lowest_perf */
+	int		max_perf;	/* 0 = highest_perf */
+	int		cx_lowest;	/* deepest C-state, 0 = unchanged */
+};
+
+static struct amd_cppc_profile amd_cppc_profiles[AMD_CPPC_PROFILE_COUNT] = {
+	[AMD_CPPC_PROFILE_AC] = {
+		.epp = 25, .mode = AMD_CPPC_MODE_CAP, .boost = 1,
+		.cx_lowest = 0,
+	},
+	[AMD_CPPC_PROFILE_BATTERY] = {
+		.epp = 75, .mode = AMD_CPPC_MODE_CAP, .boost = 0,
+		.cx_lowest = 0,
+	},
+};
+
+static const char *const amd_cppc_profile_names[AMD_CPPC_PROFILE_COUNT] = {
+	[AMD_CPPC_PROFILE_AC] = "ac",
+	[AMD_CPPC_PROFILE_BATTERY] = "battery",
+};
+
+static int	amd_cppc_power_profile = 0;
+static int	amd_cppc_profile_active = -1;
+static uint64_t	amd_cppc_profile_switches;
+static sbintime_t amd_cppc_profile_event_sbt;
+static eventhandler_tag amd_cppc_profile_tag;
+static struct task amd_cppc_profile_task;
+static int	amd_cppc_nattached;	/* CPUs attached */
+
+static u_int	amd_cppc_profile_next;
+static struct amd_cppc_profile_switch {
+	struct timespec	ts;
+	int		profile;
+	int		ncpus;		/* CPUs whose request changed */
+	uint64_t	latency_us;	/* event to last MSR write */
+} amd_cppc_profile_log[AMD_CPPC_PROFILE_LOG];
+
+/*
+ * Apply a profile to every CPU. Called with the driver lock held.
+ */
+static void
+amd_cppc_profile_apply(int profile, sbintime_t event_sbt)
+{
+	struct amd_cppc_profile *p;
+	struct amd_cppc_profile_switch *ps;
+	struct amd_cppc_softc *sc;
+	struct amd_cppc_batch *b;
+	int		cpu, n;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	p = &amd_cppc_profiles[profile];
+	amd_cppc_profile_ovr.epp = p->epp;
+	amd_cppc_profile_ovr.mode = p->mode;
+	amd_cppc_profile_ovr.boost = p->boost != 0;
+	amd_cppc_profile_ovr.min_perf = p->min_perf;
+	amd_cppc_profile_ovr.max_perf = p->max_perf;
+	b = amd_cppc_batch_alloc();
+	CPU_FOREACH(cpu)
+		if ((sc = amd_cppc_softc_get(cpu)) != NULL)
+			amd_cppc_batch_add(b, sc);
+	n = amd_cppc_batch_commit(b);
+	amd_cppc_idle_apply(p->cx_lowest);
+
+	/* Re-applying at attach is no switch unless it changed something. */
+	if (n == 0 && profile == amd_cppc_profile_active)
+		return;
+	ps = &amd_cppc_profile_log[amd_cppc_profile_next % AMD_CPPC_PROFILE_LOG];
+	getnanotime(&ps->ts);
+	ps->profile = profile;
+	ps->ncpus = n;
+	ps->latency_us = sbttous(sbinuptime() - event_sbt);
+	amd_cppc_profile_next++;
+	amd_cppc_profile_switches++;
+	amd_cppc_profile_active = profile;
+
+	if (amd_cppc_verbose)
+		printf("amd_cppc: switched to %s profile on %d CPUs in %ju us\n",
+		       amd_cppc_profile_names[profile], n,
+		       (uintmax_t)ps->latency_us);
+}
+
+/*
+ * Drop the profile layer, returning every CPU to its own settings.
+ */
+static void
+amd_cppc_profile_clear(void)
+{
+	struct amd_cppc_softc *sc;
+	struct amd_cppc_batch *b;
+	int		cpu;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	amd_cppc_override_clear(&amd_cppc_profile_ovr);
+	b = amd_cppc_batch_alloc();
+	CPU_FOREACH(cpu)
+		if ((sc = amd_cppc_softc_get(cpu)) != NULL)
+			amd_cppc_batch_add(b, sc);
+	amd_cppc_batch_commit(b);
+	amd_cppc_idle_apply(0);
+	amd_cppc_profile_active = -1;
+}
+
+static int
+amd_cppc_profile_current(void)
+{
+
+	return (power_profile_get_state() == POWER_PROFILE_ECONOMY ?
+	    AMD_CPPC_PROFILE_BATTERY : AMD_CPPC_PROFILE_AC);
+}
+
+static void
+amd_cppc_profile_task_fn(void *arg __unused, int pending __unused)
+{
+
+	sx_xlock(&amd_cppc_lock);
+	if (amd_cppc_power_profile)
+		amd_cppc_profile_apply(amd_cppc_profile_current(),
+				       amd_cppc_profile_event_sbt);
+	sx_xunlock(&amd_cppc_lock);
+}
+
+/*
+ * power_profile_change event handler. May be called from ACPI notify
+ * context, so defer the MSR writes to a task.
+ */
+static void
+amd_cppc_profile_changed(void *arg __unused, int unused __unused)
+{
+
+	if (!amd_cppc_power_profile)
+		return;
+	amd_cppc_profile_event_sbt = sbinuptime();
+	taskqueue_enqueue(taskqueue_thread, &amd_cppc_profile_task);
+}
+
+static int
+amd_cppc_sysctl_power_profile(SYSCTL_HANDLER_ARGS)
+{
+	int		error, val;
+
+	val = amd_cppc_power_profile;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	/*
+	 * As a tunable this runs before any CPU attaches; each CPU applies
+	 * the profile as it attaches.
+	 */
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_power_profile = val != 0;
+	if (amd_cppc_nattached != 0) {
+		if (amd_cppc_power_profile)
+			amd_cppc_profile_apply(amd_cppc_profile_current(),
+					       sbinuptime());
+		else
+			amd_cppc_profile_clear();
+	}
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, power_profile,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_power_profile, "I",
+	    "Switch between the ac and battery profiles on power source change");
+
+/*
+ * Profile field sysctls. arg1 is the profile, arg2 the field (one of the
+ * AMD_CPPC_POLICY_* selectors plus epp and cx_lowest).
+ */
+#define AMD_CPPC_POLICY_EPP		4
+#define AMD_CPPC_POLICY_CX_LOWEST	5
+
+static int
+amd_cppc_sysctl_profile(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_profile *p;
+	int		error, *field, max, val;
+
+	p = arg1;
+	switch (arg2) {
+	case AMD_CPPC_POLICY_MODE:
+		field = &p->mode;
+		break;
+	case AMD_CPPC_POLICY_BOOST:
+		field = &p->boost;
+		break;
+	case AMD_CPPC_POLICY_MIN_PERF:
+		field = &p->min_perf;
+		break;
+	case AMD_CPPC_POLICY_MAX_PERF:
+		field = &p->max_perf;
+		break;
+	case AMD_CPPC_POLICY_CX_LOWEST:
+		field = &p->cx_lowest;
+		break;
+	default:
+		field = &p->epp;
+		break;
+	}
+
+	val = *field;
+	if (arg2 == AMD_CPPC_POLICY_MODE)
+		error = amd_cppc_sysctl_handle_mode(oidp, req, &val);
+	else
+		error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	max = arg2 == AMD_CPPC_POLICY_EPP ? 100 :
+	    arg2 == AMD_CPPC_POLICY_CX_LOWEST ? AMD_CPPC_IDLE_STATES : 255;
+	if (val < 0 || val > max)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	*field = val;
+	if (amd_cppc_power_profile && amd_cppc_nattached != 0 &&
+	    p == &amd_cppc_profiles[amd_cppc_profile_current()])
+		amd_cppc_profile_apply(amd_cppc_profile_current(),
+				       sbinuptime());
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+
+#define AMD_CPPC_PROFILE_SYSCTLS(name, idx)				\
+	static SYSCTL_NODE(_hw_amd_cppc, OID_AUTO, name,		\
+	    CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, #name " profile");	\
+	SYSCTL_PROC(_hw_amd_cppc_##name, OID_AUTO, epp,			\
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE,		\
+	    &amd_cppc_profiles[idx], AMD_CPPC_POLICY_EPP,		\
+	    amd_cppc_sysctl_profile, "I", "Energy Performance Preference"); \
+	SYSCTL_PROC(_hw_amd_cppc_##name, OID_AUTO, mode,		\
+	    CTLTYPE_STRING | CTLFLAG_RWTUN | CTLFLAG_MPSAFE,		\
+	    &amd_cppc_profiles[idx], AMD_CPPC_POLICY_MODE,		\
+	    amd_cppc_sysctl_profile, "A",				\
+	    "Request mode (cap, autonomous, guided)");			\
+	SYSCTL_PROC(_hw_amd_cppc_##name, OID_AUTO, boost,		\
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE,		\
+	    &amd_cppc_profiles[idx], AMD_CPPC_POLICY_BOOST,		\
+	    amd_cppc_sysctl_profile, "I", "Allow boost above nominal");	\
+	SYSCTL_PROC(_hw_amd_cppc_##name, OID_AUTO, min_perf,		\
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE,		\
+	    &amd_cppc_profiles[idx], AMD_CPPC_POLICY_MIN_PERF,		\
+	    amd_cppc_sysctl_profile, "I", "Performance floor (0 = lowest)"); \
+	SYSCTL_PROC(_hw_amd_cppc_##name, OID_AUTO, max_perf,		\
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE,		\
+	    &amd_cppc_profiles[idx], AMD_CPPC_POLICY_MAX_PERF,		\
+	    amd_cppc_sysctl_profile, "I", "Performance ceiling (0 = highest)"); \
+	SYSCTL_PROC(_hw_amd_cppc_##name, OID_AUTO, cx_lowest,		\
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE,		\
+	    &amd_cppc_profiles[idx], AMD_CPPC_POLICY_CX_LOWEST,		\
+	    amd_cppc_sysctl_profile, "I",				\
+	    "Deepest idle state, as in Cn (0 = unchanged)")
+
+AMD_CPPC_PROFILE_SYSCTLS(ac, AMD_CPPC_PROFILE_AC);
+AMD_CPPC_PROFILE_SYSCTLS(battery, AMD_CPPC_PROFILE_BATTERY);
+
+static int
+amd_cppc_sysctl_profile_active(SYSCTL_HANDLER_ARGS)
+{
+	char		buf[16];
+	int		active;
+
+	active = amd_cppc_profile_active;
+	strlcpy(buf, active < 0 ? "none" : amd_cppc_profile_names[active],
+		sizeof(buf));
+	return (sysctl_handle_string(oidp, buf, sizeof(buf), req));
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, profile_active,
+	    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_profile_active, "A",
+	    "Power source profile currently applied");
+
+SYSCTL_U64(_hw_amd_cppc, OID_AUTO, profile_switches, CTLFLAG_RD,
+	   &amd_cppc_profile_switches, 0, "Number of profile switches");
+
+static int
+amd_cppc_sysctl_profile_history(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_profile_switch *ps;
+	struct sbuf	*sb;
+	u_int		i, first;
+	int		error;
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 256, req);
+	if (sb == NULL)
+		return (ENOMEM);
+
+	sx_slock(&amd_cppc_lock);
+	first = amd_cppc_profile_next > AMD_CPPC_PROFILE_LOG ?
+	    amd_cppc_profile_next - AMD_CPPC_PROFILE_LOG : 0;
+	for (i = first; i < amd_cppc_profile_next; i++) {
+		ps = &amd_cppc_profile_log[i % AMD_CPPC_PROFILE_LOG];
+		sbuf_printf(sb, "\n%jd.%09ld %s cpus=%d latency=%juus",
+			    (intmax_t)ps->ts.tv_sec, ps->ts.tv_nsec,
+			    amd_cppc_profile_names[ps->profile], ps->ncpus,
+			    (uintmax_t)ps->latency_us);
+	}
+	sx_sunlock(&amd_cppc_lock);
+
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, profile_history,
+	    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_profile_history, "A",
+	    "Recent profile switches with switch latency");
+
 /*
  * Check if this CPU supports AMD CPPC via CPUID.
  */
@@ -366,6 +1348,11 @@ amd_cppc_supported(void)
 	if (CPUID_TO_FAMILY(cpu_id) < 0x17)
 		return (false);
 
+	/* Zen and Zen+ may set the CPUID bit without having the MSRs */
+	amd_cppc_quirk_init();
+	if (AMD_CPPC_QUIRK(AMD_CPPC_QUIRK_NO_CPPC))
+		return (false);
+
 	/* Check CPPC bit in extended features */
 	do_cpuid(CPUID_AMD_EXT_FEATURES, regs);
 	if ((regs[1] & AMDFEID_CPPC) == 0)
@@ -444,20 +1431,45 @@ amd_cppc_attach(device_t dev)
 
 	/* Set default EPP to balanced */
 	sc->epp = 50;
-	sc->req_epp = amd_cppc_epp_to_hw(50);
 
 	/* Default request: full range, autonomous mode */
-	sc->req_max_perf = sc->highest_perf;
-	sc->req_min_perf = sc->lowest_perf;
-	sc->req_des_perf = 0;	/* 0 = autonomous, let CPU decide */
+	sc->mode = AMD_CPPC_MODE_CAP;
+	sc->boost = true;
+	sc->cf_perf = sc->highest_perf;
+	sc->domain = -1;
+	amd_cppc_override_clear(&sc->set_ovr);
+	sc->set_policy = -1;
+	amd_cppc_override_clear(&sc->rule_ovr);
+	sc->rule_idx = -1;
+	amd_cppc_arb_attach(sc);
+	amd_cppc_compute_req(sc);
+
+	TIMEOUT_TASK_INIT(taskqueue_thread, &sc->wdog_task, 0,
+			  amd_cppc_watchdog, sc);
 
 	/* Enable CPPC */
+	sx_xlock(&amd_cppc_lock);
 	error = amd_cppc_enable(sc);
-	if (error)
+	if (error) {
+		sx_xunlock(&amd_cppc_lock);
 		return (error);
+	}
 
 	/* Write initial request */
 	amd_cppc_write_req(sc);
+	sx_xunlock(&amd_cppc_lock);
+
+	/*
+	 * Register with the cpufreq framework while nothing else knows about
+	 * the softc, so that a failure only has CPPC to turn off again.
+	 */
+	error = cpufreq_register(dev);
+	if (error) {
+		sx_xlock(&amd_cppc_lock);
+		amd_cppc_disable(sc);
+		sx_xunlock(&amd_cppc_lock);
+		return (error);
+	}
 
 	/* Create sysctl nodes */
 	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
@@ -482,8 +1494,91 @@ amd_cppc_attach(device_t dev)
 		      "lowest_perf", CTLFLAG_RD, &sc->lowest_perf, 0,
 		      "Lowest performance capability");
 
-	/* Register with cpufreq framework */
-	return (cpufreq_register(dev));
+	SYSCTL_ADD_U8(device_get_sysctl_ctx(dev),
+		      SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+		      "boost_ratio", CTLFLAG_RD, &sc->boost_ratio, 0,
+		      "Boost ratio highest_perf stands for (see hw.amd_cppc.quirk)");
+
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(dev),
+		       SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+		       "tamper_count", CTLFLAG_RD, &sc->tamper_count, 0,
+		       "Number of times firmware changed the CPPC request");
+
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+		     SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+			"tamper_log", CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+			sc, 0, amd_cppc_sysctl_tamper_log, "A",
+			"Recent firmware changes to the CPPC request");
+
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+		     SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+			"mode", CTLTYPE_STRING | CTLFLAG_RW | CTLFLAG_MPSAFE,
+			sc, AMD_CPPC_POLICY_MODE, amd_cppc_sysctl_policy, "A",
+			"Request mode (cap, autonomous, guided)");
+
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+		     SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+			"boost", CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE,
+			sc, AMD_CPPC_POLICY_BOOST, amd_cppc_sysctl_policy, "I",
+			"Allow performance above nominal");
+
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+		     SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+			"min_perf", CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE,
+			sc, AMD_CPPC_POLICY_MIN_PERF, amd_cppc_sysctl_policy,
+			"I", "Performance floor (0 = lowest_perf)");
+
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(dev),
+		     SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+			"max_perf", CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE,
+			sc, AMD_CPPC_POLICY_MAX_PERF, amd_cppc_sysctl_policy,
+			"I", "Performance ceiling (0 = highest_perf)");
+
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(dev),
+		       SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+		       "set_policy", CTLFLAG_RD, &sc->set_policy, 0,
+		       "Index of the applying cpuset policy (-1 = none)");
+
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(dev),
+		       SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+		       "rule", CTLFLAG_RD, &sc->rule_idx, 0,
+		       "Index of the matching policy rule (-1 = none)");
+
+	SYSCTL_ADD_U64(device_get_sysctl_ctx(dev),
+		       SYSCTL_CHILDREN(device_get_sysctl_tree(dev)), OID_AUTO,
+		       "rule_changes", CTLFLAG_RD, &sc->rule_changes, 0,
+		       "Number of times the matching policy rule changed");
+
+	amd_cppc_calib_attach(sc);
+	amd_cppc_shadow_attach(sc);
+	amd_cppc_boost_attach(sc);
+	amd_cppc_hsmp_attach(sc);
+	amd_cppc_idle_attach(sc);
+	amd_cppc_smu_attach(sc);
+	amd_cppc_owner_attach(sc);
+	amd_cppc_ramp_attach(sc);
+	amd_cppc_energy_attach(sc);
+	amd_cppc_em_attach(sc);
+	amd_cppc_pmc_attach(sc);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_vcache_attach(sc);
+	amd_cppc_domain_attach(sc);
+	amd_cppc_cpuset_attach(sc);
+	amd_cppc_update_req(sc);
+	amd_cppc_watchdog_arm(sc);
+	/*
+	 * Apply the profile again so that this CPU gets its idle depth too;
+	 * CPUs that fail to attach must not hold it back. A CPU only counts
+	 * as attached when this returns, so the task does it.
+	 */
+	amd_cppc_nattached++;
+	if (amd_cppc_power_profile) {
+		amd_cppc_profile_event_sbt = sbinuptime();
+		taskqueue_enqueue(taskqueue_thread, &amd_cppc_profile_task);
+	}
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
 }
 
 static int
@@ -492,7 +1587,22 @@ amd_cppc_detach(device_t dev)
 	struct amd_cppc_softc *sc;
 
 	sc = device_get_softc(dev);
+	sx_xlock(&amd_cppc_lock);
+	sc->detaching = true;
+	sx_xunlock(&amd_cppc_lock);
+	taskqueue_drain_timeout(taskqueue_thread, &sc->wdog_task);
+	amd_cppc_calib_detach(sc);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_pmc_detach(sc);
+	amd_cppc_em_detach(sc);
+	amd_cppc_energy_detach(sc);
+	amd_cppc_owner_detach(sc);
+	amd_cppc_idle_detach(sc);
+	amd_cppc_ramp_detach(sc);
 	amd_cppc_disable(sc);
+	amd_cppc_nattached--;
+	sx_xunlock(&amd_cppc_lock);
 	return (cpufreq_unregister(dev));
 }
 
@@ -502,7 +1612,9 @@ amd_cppc_suspend(device_t dev)
 	struct amd_cppc_softc *sc;
 
 	sc = device_get_softc(dev);
+	sx_xlock(&amd_cppc_lock);
 	amd_cppc_disable(sc);
+	sx_xunlock(&amd_cppc_lock);
 	return (0);
 }
 
@@ -514,17 +1626,23 @@ amd_cppc_resume(device_t dev)
 
 	sc = device_get_softc(dev);
 
+	sx_xlock(&amd_cppc_lock);
+
 	/* Re-read caps in case firmware changed anything */
 	error = amd_cppc_read_caps(sc);
 	if (error)
-		return (error);
+		goto out;
 
 	/* Re-enable and restore request */
 	error = amd_cppc_enable(sc);
 	if (error)
-		return (error);
+		goto out;
+	amd_cppc_phase_resume();
+	amd_cppc_compute_req(sc);
 	amd_cppc_write_req(sc);
-	return (0);
+out:
+	sx_xunlock(&amd_cppc_lock);
+	return (error);
 }
 
 /*
@@ -606,16 +1724,17 @@ amd_cppc_set(device_t dev, const struct cf_setting *cf)
 	uint8_t		target_perf;
 
 	sc = device_get_softc(dev);
-	if (!sc->cppc_enabled)
+	sx_xlock(&amd_cppc_lock);
+	if (!sc->cppc_enabled) {
+		sx_xunlock(&amd_cppc_lock);
 		return (ENXIO);
+	}
 
 	target_perf = amd_cppc_mhz_to_perf(sc, cf->freq);
 
-	sc->req_max_perf = target_perf;
-	sc->req_min_perf = sc->lowest_perf;
-	sc->req_des_perf = 0;	/* autonomous mode */
-
-	amd_cppc_write_req(sc);
+	sc->cf_perf = target_perf;
+	amd_cppc_update_req(sc);
+	sx_xunlock(&amd_cppc_lock);
 
 	CPPC_DEBUG(dev, "CPU %d: set max_perf=%u (%d MHz), epp=%u\n",
 		   sc->cpu_id, target_perf, cf->freq, sc->req_epp);
@@ -637,8 +1756,13 @@ amd_cppc_get(device_t dev, struct cf_setting *cf)
 	if (!sc->cppc_enabled)
 		return (ENXIO);
 
+	/*
+	 * Report the cap actually programmed, which under domain
+	 * coordination can differ from what this CPU asked for.
+	 */
 	memset(cf, 0, sizeof(*cf));
-	cf->freq = amd_cppc_perf_to_mhz(sc, sc->req_max_perf);
+	cf->freq = amd_cppc_perf_to_mhz(sc, (sc->req_shadow >>
+	    AMD_CPPC_MAX_PERF_SHIFT) & 0xFF);
 	cf->volts = CPUFREQ_VAL_UNKNOWN;
 	cf->power = CPUFREQ_VAL_UNKNOWN;
 	cf->lat = CPUFREQ_VAL_UNKNOWN;
@@ -680,5 +1804,48 @@ static driver_t amd_cppc_driver = {
 		sizeof(struct amd_cppc_softc),
 };
 
-DRIVER_MODULE(amd_cppc, cpu, amd_cppc_driver, NULL, NULL);
+static int
+amd_cppc_modevent(module_t mod __unused, int what, void *arg __unused)
+{
+
+	switch (what) {
+	case MOD_LOAD:
+		TASK_INIT(&amd_cppc_profile_task, 0, amd_cppc_profile_task_fn,
+			  NULL);
+		amd_cppc_profile_tag = EVENTHANDLER_REGISTER(
+		    power_profile_change, amd_cppc_profile_changed, NULL,
+		    EVENTHANDLER_PRI_ANY);
+		amd_cppc_phase_init();
+		amd_cppc_energy_init();
+		amd_cppc_em_init();
+		amd_cppc_rules_init();
+		amd_cppc_cpuset_init();
+		amd_cppc_boost_init();
+		amd_cppc_ccd_init();
+		amd_cppc_smu_init();
+		return (0);
+	case MOD_UNLOAD:
+		amd_cppc_ramp_fini();
+		amd_cppc_owner_fini();
+		amd_cppc_idle_fini();
+		amd_cppc_smu_fini();
+		amd_cppc_ccd_fini();
+		amd_cppc_boost_fini();
+		amd_cppc_cpuset_fini();
+		amd_cppc_rules_fini();
+		amd_cppc_shadow_fini();
+		amd_cppc_hsmp_fini();
+		amd_cppc_phase_fini();
+		amd_cppc_em_fini();
+		amd_cppc_energy_fini();
+		EVENTHANDLER_DEREGISTER(power_profile_change,
+					amd_cppc_profile_tag);
+		taskqueue_drain(taskqueue_thread, &amd_cppc_profile_task);
+		return (0);
+	default:
+		return (EOPNOTSUPP);
+	}
+}
+
+DRIVER_MODULE(amd_cppc, cpu, amd_cppc_driver, amd_cppc_modevent, NULL);
 MODULE_VERSION(amd_cppc, 1);
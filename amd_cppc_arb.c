@@ -0,0 +1,324 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Request arbitration.
+ *
+ * The request of a CPU is merged from its sources: the admin settings, the
+ * cpufreq setting, cpuset policy and the rule table decide the base
+ * request (amd_cppc_req_eval), then the boost budget, CCD parking and the
+ * boost windows adjust it. The registered thermal and lease contributions
+ * and the global limits come last, so their ceilings hold over every
+ * other source, boost windows included. The merge is a pure
+ * function of the sources, and the result is written only if it differs
+ * from what the CPU was last given.
+ *
+ * Every field remembers the last source that moved it. The binding is
+ * exported per CPU as dev.amd_cppc.N.binding and in the snapshot, so a
+ * capped core shows what caps it.
+ *
+ * Other kernel code contributes through amd_cppc_arb_set(), in the thermal
+ * or lease slot of a CPU. hw.amd_cppc.limit_min_perf and limit_max_perf
+ * apply to all CPUs.
+ */
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/pcpu.h>
+#include <sys/sbuf.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+
+#include "amd_cppc_var.h"
+
+static const char *const amd_cppc_arb_names[AMD_CPPC_SRC_COUNT] =
+    AMD_CPPC_SRC_NAMES;
+
+static const char *const amd_cppc_arb_fields[AMD_CPPC_BIND_COUNT] = {
+	[AMD_CPPC_BIND_MAX] = "max_perf",
+	[AMD_CPPC_BIND_MIN] = "min_perf",
+	[AMD_CPPC_BIND_DES] = "des_perf",
+	[AMD_CPPC_BIND_EPP] = "epp",
+};
+
+/* Global limits, 0 = none */
+static int	amd_cppc_arb_limit_min;
+static int	amd_cppc_arb_limit_max;
+
+const char *
+amd_cppc_arb_name(int src)
+{
+
+	if (src < 0 || src >= AMD_CPPC_SRC_COUNT)
+		return ("unknown");
+	return (amd_cppc_arb_names[src]);
+}
+
+static void
+amd_cppc_arb_clear(struct amd_cppc_contrib *c)
+{
+
+	c->floor = c->ceil = c->des = c->epp = -1;
+}
+
+/*
+ * Credit src with every field that changed from prev to req, unless bind
+ * is NULL.
+ */
+void
+amd_cppc_arb_note(const struct amd_cppc_req *prev,
+		  const struct amd_cppc_req *req, int src, uint8_t *bind)
+{
+
+	if (bind == NULL)
+		return;
+	if (req->max_perf != prev->max_perf)
+		bind[AMD_CPPC_BIND_MAX] = src;
+	if (req->min_perf != prev->min_perf)
+		bind[AMD_CPPC_BIND_MIN] = src;
+	if (req->des_perf != prev->des_perf)
+		bind[AMD_CPPC_BIND_DES] = src;
+	if (req->epp != prev->epp)
+		bind[AMD_CPPC_BIND_EPP] = src;
+}
+
+static void
+amd_cppc_arb_merge(struct amd_cppc_softc *sc, const struct amd_cppc_contrib *c,
+		   int src, struct amd_cppc_req *req, uint8_t *bind)
+{
+	struct amd_cppc_req prev;
+
+	prev = *req;
+	if (c->ceil >= 0) {
+		req->max_perf = MIN(req->max_perf,
+				    MAX(c->ceil, sc->lowest_perf));
+		req->min_perf = MIN(req->min_perf, req->max_perf);
+		req->des_perf = MIN(req->des_perf, req->max_perf);
+	}
+	if (c->floor >= 0)
+		req->min_perf = MIN(MAX(req->min_perf, c->floor),
+				    req->max_perf);
+	if (c->des == 0)
+		req->des_perf = 0;
+	else if (c->des > 0)
+		req->des_perf = MIN(MAX(c->des, req->min_perf),
+				    req->max_perf);
+	if (c->epp >= 0)
+		req->epp = amd_cppc_epp_to_hw(c->epp);
+	amd_cppc_arb_note(&prev, req, src, bind);
+}
+
+/*
+ * Merge the registered contributions and the global limits.
+ */
+void
+amd_cppc_arb_apply(struct amd_cppc_softc *sc, struct amd_cppc_req *req,
+		   uint8_t *bind)
+{
+	struct amd_cppc_contrib limit;
+	int		i;
+
+	for (i = 0; i < AMD_CPPC_ARB_SLOTS; i++)
+		amd_cppc_arb_merge(sc, &sc->arb_contrib[i],
+				   AMD_CPPC_SRC_THERMAL + i, req, bind);
+
+	if (amd_cppc_arb_limit_min == 0 && amd_cppc_arb_limit_max == 0)
+		return;
+	amd_cppc_arb_clear(&limit);
+	if (amd_cppc_arb_limit_min != 0)
+		limit.floor = amd_cppc_arb_limit_min;
+	if (amd_cppc_arb_limit_max != 0)
+		limit.ceil = amd_cppc_arb_limit_max;
+	amd_cppc_arb_merge(sc, &limit, AMD_CPPC_SRC_LIMIT, req, bind);
+}
+
+/*
+ * Binding of the value written to the CPU: the CPU's own, except for the
+ * fields its coordination domain merge changed.
+ */
+void
+amd_cppc_arb_binding(struct amd_cppc_softc *sc, uint8_t *bind)
+{
+	struct amd_cppc_req req;
+
+	sx_assert(&amd_cppc_lock, SA_LOCKED);
+	memcpy(bind, sc->arb_bind, AMD_CPPC_BIND_COUNT);
+	amd_cppc_domain_req(sc, &req);
+	if (req.max_perf != sc->req_max_perf)
+		bind[AMD_CPPC_BIND_MAX] = AMD_CPPC_SRC_DOMAIN;
+	if (req.min_perf != sc->req_min_perf)
+		bind[AMD_CPPC_BIND_MIN] = AMD_CPPC_SRC_DOMAIN;
+	if (req.des_perf != sc->req_des_perf)
+		bind[AMD_CPPC_BIND_DES] = AMD_CPPC_SRC_DOMAIN;
+	if (req.epp != sc->req_epp)
+		bind[AMD_CPPC_BIND_EPP] = AMD_CPPC_SRC_DOMAIN;
+}
+
+/*
+ * Set or, with c NULL, withdraw the contribution of src (thermal or lease)
+ * to the request of a CPU, and write the request if it changed.
+ */
+int
+amd_cppc_arb_set(int cpu, int src, const struct amd_cppc_contrib *c)
+{
+	struct amd_cppc_softc *sc;
+	struct amd_cppc_contrib *slot;
+
+	if (src != AMD_CPPC_SRC_THERMAL && src != AMD_CPPC_SRC_LEASE)
+		return (EINVAL);
+	if (c != NULL && (c->floor > 255 || c->ceil > 255 || c->des > 255 ||
+	    c->epp > 100))
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	if ((sc = amd_cppc_softc_get(cpu)) == NULL) {
+		sx_xunlock(&amd_cppc_lock);
+		return (ENXIO);
+	}
+	slot = &sc->arb_contrib[src - AMD_CPPC_SRC_THERMAL];
+	if (c != NULL)
+		*slot = *c;
+	else
+		amd_cppc_arb_clear(slot);
+	amd_cppc_update_req(sc);
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+
+static int
+amd_cppc_sysctl_binding(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	struct sbuf	*sb;
+	uint8_t		bind[AMD_CPPC_BIND_COUNT];
+	int		error, i;
+
+	sc = arg1;
+	sx_slock(&amd_cppc_lock);
+	amd_cppc_arb_binding(sc, bind);
+	sx_sunlock(&amd_cppc_lock);
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 80, req);
+	if (sb == NULL)
+		return (ENOMEM);
+	for (i = 0; i < AMD_CPPC_BIND_COUNT; i++)
+		sbuf_printf(sb, "%s%s=%s", i != 0 ? " " : "",
+			    amd_cppc_arb_fields[i], amd_cppc_arb_name(bind[i]));
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+	return (error);
+}
+
+static int
+amd_cppc_sysctl_contrib(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_contrib c[AMD_CPPC_ARB_SLOTS];
+	struct amd_cppc_softc *sc;
+	struct sbuf	*sb;
+	int		error, i;
+
+	sc = arg1;
+	sx_slock(&amd_cppc_lock);
+	memcpy(c, sc->arb_contrib, sizeof(c));
+	sx_sunlock(&amd_cppc_lock);
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 128, req);
+	if (sb == NULL)
+		return (ENOMEM);
+	for (i = 0; i < AMD_CPPC_ARB_SLOTS; i++)
+		sbuf_printf(sb, "\n%-8s floor=%d ceil=%d des=%d epp=%d",
+			    amd_cppc_arb_name(AMD_CPPC_SRC_THERMAL + i),
+			    c[i].floor, c[i].ceil, c[i].des, c[i].epp);
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+	return (error);
+}
+
+void
+amd_cppc_arb_attach(struct amd_cppc_softc *sc)
+{
+	struct sysctl_ctx_list *ctx;
+	int		i;
+
+	for (i = 0; i < AMD_CPPC_ARB_SLOTS; i++)
+		amd_cppc_arb_clear(&sc->arb_contrib[i]);
+
+	ctx = device_get_sysctl_ctx(sc->dev);
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+			OID_AUTO, "binding",
+			CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, sc, 0,
+			amd_cppc_sysctl_binding, "A",
+			"Source deciding each field of the request");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+			OID_AUTO, "contributions",
+			CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, sc, 0,
+			amd_cppc_sysctl_contrib, "A",
+			"Registered thermal and lease contributions (-1 = none)");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		       OID_AUTO, "rebinds", CTLFLAG_RD, &sc->arb_rebinds, 0,
+		       "Times the source deciding some field changed");
+}
+
+static int
+amd_cppc_sysctl_limit(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	struct amd_cppc_batch *b;
+	int		*limit;
+	int		cpu, error, val;
+
+	limit = arg1;
+	val = *limit;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val < 0 || val > 255)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	*limit = val;
+	b = amd_cppc_batch_alloc();
+	CPU_FOREACH(cpu)
+		if ((sc = amd_cppc_softc_get(cpu)) != NULL)
+			amd_cppc_batch_add(b, sc);
+	amd_cppc_batch_commit(b);
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, limit_min_perf,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE,
+	    &amd_cppc_arb_limit_min, 0, amd_cppc_sysctl_limit, "I",
+	    "Floor for every CPU, below the ceilings of all sources (0 = none)");
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, limit_max_perf,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE,
+	    &amd_cppc_arb_limit_max, 0, amd_cppc_sysctl_limit, "I",
+	    "Ceiling for every CPU over all sources (0 = none)");
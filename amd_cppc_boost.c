@@ -0,0 +1,374 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Concurrent boost budget.
+ *
+ * Boost headroom is shared: with every core of a CCD or package above
+ * nominal, none of them gets near its single-core peak. With
+ * hw.amd_cppc.boost_budget set to N, at most N cores per group may request
+ * more than nominal_perf at a time. A core is a coordination domain
+ * (amd_cppc_domain.c): SMT siblings share one clock, so a grant covers
+ * every thread of the core. Each pass ranks the CPUs of a group
+ * that want to boost by their administrative priority
+ * (dev.amd_cppc.N.boost_priority), then by 3D V-Cache CCD preference, then
+ * by utilization over the last interval, and caps everyone past the budget
+ * at nominal_perf. A CPU that already holds a grant gets a small
+ * utilization bonus so grants do not flap between CPUs with similar load.
+ */
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/cpuset.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/pcpu.h>
+#include <sys/resource.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+#include <sys/taskqueue.h>
+
+#include "amd_cppc_var.h"
+
+#define AMD_CPPC_BOOST_HYST	10	/* utilization bonus of a holder */
+
+#define AMD_CPPC_BOOST_SCOPE_CCD	0
+#define AMD_CPPC_BOOST_SCOPE_PACKAGE	1
+
+/* Budget state, protected by amd_cppc_lock */
+static int	amd_cppc_boost_budget = 0;	/* 0 = unlimited */
+static int	amd_cppc_boost_scope = AMD_CPPC_BOOST_SCOPE_CCD;
+static int	amd_cppc_boost_interval_ms = 100;
+static uint64_t	amd_cppc_boost_grants;
+static uint64_t	amd_cppc_boost_revokes;
+static bool	amd_cppc_boost_ready;
+static struct timeout_task amd_cppc_boost_task;
+
+/*
+ * Cap a request at nominal_perf while the CPU holds no boost grant.
+ */
+void
+amd_cppc_boost_clamp(struct amd_cppc_softc *sc, struct amd_cppc_req *req)
+{
+
+	if (!sc->boost_capped)
+		return;
+	req->max_perf = MIN(req->max_perf, sc->nominal_perf);
+	req->min_perf = MIN(req->min_perf, req->max_perf);
+	req->des_perf = MIN(req->des_perf, req->max_perf);
+}
+
+static void
+amd_cppc_boost_arm(void)
+{
+	int		ms;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	ms = amd_cppc_boost_interval_ms;
+	if (!amd_cppc_boost_ready || amd_cppc_boost_budget == 0 || ms <= 0)
+		return;
+	taskqueue_enqueue_timeout(taskqueue_thread, &amd_cppc_boost_task,
+				  MAX(1, (int)((int64_t)ms * hz / 1000)));
+}
+
+/*
+ * Whether a CPU's own policy asks for more than nominal_perf.
+ */
+static bool
+amd_cppc_boost_wanted(struct amd_cppc_softc *sc)
+{
+	struct amd_cppc_req req;
+
+	amd_cppc_req_eval(sc, sc->mode, &sc->rule_ovr, &req, NULL);
+	return (MAX(req.max_perf, req.des_perf) > sc->nominal_perf);
+}
+
+/* True if a ranks ahead of b for a grant */
+static bool
+amd_cppc_boost_before(const struct amd_cppc_softc *a,
+		      const struct amd_cppc_softc *b)
+{
+	int		ra, rb, ua, ub;
+
+	if (a->boost_prio != b->boost_prio)
+		return (a->boost_prio > b->boost_prio);
+	ra = amd_cppc_vcache_rank(__DECONST(struct amd_cppc_softc *, a), -1);
+	rb = amd_cppc_vcache_rank(__DECONST(struct amd_cppc_softc *, b), -1);
+	if (ra != rb)
+		return (ra > rb);
+	ua = a->boost_util + (a->boost_capped ? 0 : AMD_CPPC_BOOST_HYST);
+	ub = b->boost_util + (b->boost_capped ? 0 : AMD_CPPC_BOOST_HYST);
+	if (ua != ub)
+		return (ua > ub);
+	return (a->cpu_id < b->cpu_id);
+}
+
+static void
+amd_cppc_boost_set(struct amd_cppc_softc *sc, bool capped)
+{
+
+	if (sc->boost_capped == capped)
+		return;
+	sc->boost_capped = capped;
+	if (capped)
+		amd_cppc_boost_revokes++;
+	else
+		amd_cppc_boost_grants++;
+}
+
+/*
+ * One budget pass over every group. With a budget of 0 all caps are lifted.
+ */
+static void
+amd_cppc_boost_pass(void)
+{
+	struct amd_cppc_softc *sc, **cand;
+	struct amd_cppc_batch *b;
+	cpuset_t	core, done, granted, group;
+	int		budget, cpu, i, j, level, n, ngrants;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	budget = amd_cppc_boost_budget;
+	level = amd_cppc_boost_scope == AMD_CPPC_BOOST_SCOPE_CCD ?
+	    CG_SHARE_L3 : CG_SHARE_NONE;
+	cand = malloc(sizeof(*cand) * (mp_maxid + 1), M_TEMP, M_WAITOK);
+	b = amd_cppc_batch_alloc();
+
+	CPU_FOREACH(cpu) {
+		if ((sc = amd_cppc_softc_get(cpu)) != NULL)
+			sc->boost_util = amd_cppc_cpu_util(cpu,
+			    sc->boost_cp_time);
+	}
+
+	CPU_ZERO(&done);
+	CPU_FOREACH(cpu) {
+		if (CPU_ISSET(cpu, &done))
+			continue;
+		amd_cppc_topo_group(cpu, level, &group);
+
+		/* Rank the CPUs of this group that want to boost. */
+		n = 0;
+		CPU_FOREACH(i) {
+			if (!CPU_ISSET(i, &group))
+				continue;
+			CPU_SET(i, &done);
+			if ((sc = amd_cppc_softc_get(i)) == NULL)
+				continue;
+			if (budget == 0 || !amd_cppc_boost_wanted(sc)) {
+				amd_cppc_boost_set(sc, false);
+				amd_cppc_batch_add(b, sc);
+				continue;
+			}
+			for (j = n; j > 0 &&
+			    amd_cppc_boost_before(sc, cand[j - 1]); j--)
+				cand[j] = cand[j - 1];
+			cand[j] = sc;
+			n++;
+		}
+		/* A thread of a core already granted boosts for free. */
+		CPU_ZERO(&granted);
+		ngrants = 0;
+		for (j = 0; j < n; j++) {
+			sc = cand[j];
+			if (!CPU_ISSET(sc->cpu_id, &granted) &&
+			    ngrants < budget) {
+				amd_cppc_domain_cpus(sc, &core);
+				CPU_OR(&granted, &granted, &core);
+				ngrants++;
+			}
+			amd_cppc_boost_set(sc, !CPU_ISSET(sc->cpu_id,
+			    &granted));
+			amd_cppc_batch_add(b, sc);
+		}
+	}
+	amd_cppc_batch_commit(b);
+	free(cand, M_TEMP);
+}
+
+static void
+amd_cppc_boost_task_fn(void *arg __unused, int pending __unused)
+{
+
+	sx_xlock(&amd_cppc_lock);
+	if (amd_cppc_boost_ready && amd_cppc_boost_budget != 0) {
+		amd_cppc_boost_pass();
+		amd_cppc_boost_arm();
+	}
+	sx_xunlock(&amd_cppc_lock);
+}
+
+static int
+amd_cppc_sysctl_boost_budget(SYSCTL_HANDLER_ARGS)
+{
+	int		error, val;
+
+	val = amd_cppc_boost_budget;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val < 0)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_boost_budget = val;
+	if (amd_cppc_boost_ready) {
+		amd_cppc_boost_pass();
+		amd_cppc_boost_arm();
+	}
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, boost_budget,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_boost_budget, "I",
+	    "Cores per group allowed above nominal_perf at once "
+	    "(0 = unlimited)");
+
+static int
+amd_cppc_sysctl_boost_scope(SYSCTL_HANDLER_ARGS)
+{
+	char		buf[16];
+	int		error, scope;
+
+	scope = amd_cppc_boost_scope;
+	strlcpy(buf, scope == AMD_CPPC_BOOST_SCOPE_CCD ? "ccd" : "package",
+		sizeof(buf));
+	error = sysctl_handle_string(oidp, buf, sizeof(buf), req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (strcmp(buf, "ccd") == 0)
+		scope = AMD_CPPC_BOOST_SCOPE_CCD;
+	else if (strcmp(buf, "package") == 0)
+		scope = AMD_CPPC_BOOST_SCOPE_PACKAGE;
+	else
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_boost_scope = scope;
+	if (amd_cppc_boost_ready && amd_cppc_boost_budget != 0)
+		amd_cppc_boost_pass();
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, boost_scope,
+	    CTLTYPE_STRING | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_boost_scope, "A",
+	    "Group the boost budget applies to (ccd, package)");
+
+static int
+amd_cppc_sysctl_boost_interval(SYSCTL_HANDLER_ARGS)
+{
+	int		error, ms;
+
+	ms = amd_cppc_boost_interval_ms;
+	error = sysctl_handle_int(oidp, &ms, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (ms < 0)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_boost_interval_ms = ms;
+	amd_cppc_boost_arm();
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, boost_interval_ms,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_boost_interval, "I",
+	    "Interval in ms between boost budget passes (0 = paused)");
+
+SYSCTL_U64(_hw_amd_cppc, OID_AUTO, boost_grants, CTLFLAG_RD,
+	   &amd_cppc_boost_grants, 0, "Number of boost grants");
+
+SYSCTL_U64(_hw_amd_cppc, OID_AUTO, boost_revokes, CTLFLAG_RD,
+	   &amd_cppc_boost_revokes, 0, "Number of boost revocations");
+
+static int
+amd_cppc_sysctl_boost_prio(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	int		error, val;
+
+	sc = arg1;
+	val = sc->boost_prio;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	sx_xlock(&amd_cppc_lock);
+	sc->boost_prio = val;
+	if (amd_cppc_boost_ready && amd_cppc_boost_budget != 0)
+		amd_cppc_boost_pass();
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+
+void
+amd_cppc_boost_attach(struct amd_cppc_softc *sc)
+{
+	struct sysctl_ctx_list *ctx;
+	struct sysctl_oid_list *children;
+
+	sc->boost_prio = 0;
+	sc->boost_capped = false;
+
+	ctx = device_get_sysctl_ctx(sc->dev);
+	children = SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev));
+	SYSCTL_ADD_PROC(ctx, children, OID_AUTO, "boost_priority",
+			CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, sc, 0,
+			amd_cppc_sysctl_boost_prio, "I",
+			"Rank for boost grants under a budget (higher first)");
+	SYSCTL_ADD_BOOL(ctx, children, OID_AUTO, "boost_capped", CTLFLAG_RD,
+			&sc->boost_capped, 0,
+			"Held at nominal_perf by the boost budget");
+}
+
+void
+amd_cppc_boost_init(void)
+{
+
+	TIMEOUT_TASK_INIT(taskqueue_thread, &amd_cppc_boost_task, 0,
+			  amd_cppc_boost_task_fn, NULL);
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_boost_ready = true;
+	amd_cppc_boost_arm();
+	sx_xunlock(&amd_cppc_lock);
+}
+
+void
+amd_cppc_boost_fini(void)
+{
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_boost_ready = false;
+	sx_xunlock(&amd_cppc_lock);
+	taskqueue_drain_timeout(taskqueue_thread, &amd_cppc_boost_task);
+}
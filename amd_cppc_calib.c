@@ -0,0 +1,414 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Empirical perf to MHz calibration.
+ *
+ * The linear map base_freq_mhz * perf / nominal_perf is close at and below
+ * nominal but often hundreds of MHz off at highest_perf, where the real
+ * boost clock depends on the part. Calibration pins the CPU, and the
+ * others of its coordination domain (amd_cppc_domain.c) with it, at each
+ * of lowest, lowest_nonlinear, nominal and highest perf (min = max = perf,
+ * EPP 0), keeps it busy and measures the delivered clock as
+ * base_freq_mhz * APERF / MPERF. The points form a piecewise linear map
+ * that replaces the linear one in the cpufreq settings, get() and
+ * everywhere else perf is shown as MHz.
+ *
+ * It runs on demand (dev.amd_cppc.N.calibrate, hw.amd_cppc.calibrate) or
+ * once after attach with hw.amd_cppc.calibrate_at_attach. The result is
+ * dev.amd_cppc.N.calibration, "perf:mhz ..."; setting that in loader.conf
+ * restores it on the next boot without measuring. A stored map whose end
+ * points do not match the CPU's capabilities is refused.
+ */
+
+#include <sys/param.h>
+#ifdef _KERNEL
+#include <sys/bus.h>
+#include <sys/cpuset.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/pcpu.h>
+#include <sys/sbuf.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+#include <sys/taskqueue.h>
+
+#include <machine/atomic.h>
+#include <machine/cpu.h>
+#include <machine/cpufunc.h>
+#include <machine/specialreg.h>
+
+#include "amd_cppc_var.h"
+#else
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+#include "amd_cppc_calib.h"
+
+/*
+ * Parse the text form of a map into perf[] and mhz[], *np points. An
+ * empty text is a map of no points.
+ */
+int
+amd_cppc_calib_parse(char *text, int *perf, int *mhz, int *np)
+{
+	char		*tok;
+	int		n;
+
+	n = 0;
+	while ((tok = strsep(&text, " ")) != NULL) {
+		if (*tok == '\0')
+			continue;
+		if (n == AMD_CPPC_CAL_POINTS)
+			return (EINVAL);
+		perf[n] = strtol(tok, &tok, 10);
+		if (*tok++ != ':')
+			return (EINVAL);
+		mhz[n] = strtol(tok, &tok, 10);
+		if (*tok != '\0')
+			return (EINVAL);
+		n++;
+	}
+	*np = n;
+	return (0);
+}
+
+/*
+ * Check a map of n points against a CPU. Perf and MHz must both rise, and
+ * the ends must be the CPU's lowest and highest perf.
+ */
+int
+amd_cppc_calib_check(const int *perf, const int *mhz, int n, int lowest,
+		     int highest)
+{
+	int		i;
+
+	if (n < 2 || n > AMD_CPPC_CAL_POINTS ||
+	    perf[0] != lowest || perf[n - 1] != highest)
+		return (EINVAL);
+	for (i = 0; i < n; i++)
+		if (mhz[i] <= 0 || (i > 0 && (perf[i] <= perf[i - 1] ||
+		    mhz[i] <= mhz[i - 1])))
+			return (EINVAL);
+	return (0);
+}
+
+/*
+ * Interpolate y at x through the points (xs[i], ys[i]), xs ascending.
+ * Outside the points the nearest segment is extended.
+ */
+int
+amd_cppc_calib_interp(int x, const int *xs, const int *ys, int n)
+{
+	int		i;
+
+	for (i = 1; i < n - 1 && x > xs[i]; i++)
+		;
+	return (ys[i - 1] + (x - xs[i - 1]) * (ys[i] - ys[i - 1]) /
+	    (xs[i] - xs[i - 1]));
+}
+
+#ifdef _KERNEL
+static int	amd_cppc_calib_at_attach = 0;
+static int	amd_cppc_calib_ms = 20;
+static int	amd_cppc_calib_settle_ms = 2;
+
+/*
+ * MHz of a perf level from the calibration, -1 if there is none.
+ */
+int
+amd_cppc_calib_mhz(struct amd_cppc_softc *sc, int perf)
+{
+	int		n;
+
+	n = atomic_load_acq_int(&sc->cal_n);
+	if (n < 2)
+		return (-1);
+	return (amd_cppc_calib_interp(perf, sc->cal_perf, sc->cal_mhz, n));
+}
+
+/*
+ * Perf level delivering mhz from the calibration, -1 if there is none.
+ */
+int
+amd_cppc_calib_perf(struct amd_cppc_softc *sc, int mhz)
+{
+	int		n;
+
+	n = atomic_load_acq_int(&sc->cal_n);
+	if (n < 2)
+		return (-1);
+	return (amd_cppc_calib_interp(mhz, sc->cal_mhz, sc->cal_perf, n));
+}
+
+/*
+ * Check and install a map; no points goes back to the linear map.
+ */
+static int
+amd_cppc_calib_set(struct amd_cppc_softc *sc, const int *perf,
+		   const int *mhz, int n)
+{
+	int		i;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	if (n == 0) {
+		atomic_store_rel_int(&sc->cal_n, 0);
+		amd_cppc_em_remap(sc);
+		return (0);
+	}
+	if (amd_cppc_calib_check(perf, mhz, n, sc->lowest_perf,
+	    sc->highest_perf) != 0)
+		return (EINVAL);
+
+	atomic_store_rel_int(&sc->cal_n, 0);
+	for (i = 0; i < n; i++) {
+		sc->cal_perf[i] = perf[i];
+		sc->cal_mhz[i] = mhz[i];
+	}
+	atomic_store_rel_int(&sc->cal_n, n);
+	amd_cppc_em_remap(sc);
+	return (0);
+}
+
+static void
+amd_cppc_calib_pin(void *arg)
+{
+
+	wrmsr(MSR_AMD_CPPC_REQ, *(uint64_t *)arg);
+}
+
+/*
+ * Delivered MHz with the calling CPU pinned at perf. The caller is bound
+ * to the CPU and keeps it busy while measuring. The other CPUs sharing its
+ * clock are pinned too, so their requests do not move it.
+ */
+static int
+amd_cppc_calib_point(struct amd_cppc_softc *sc, const cpuset_t *members,
+		     int perf)
+{
+	uint64_t	a0, a1, m0, m1, req, t0, window;
+
+	req = AMD_CPPC_REQ_BUILD(perf, perf, 0, 0);
+	smp_rendezvous_cpus(*members, smp_no_rendezvous_barrier,
+			    amd_cppc_calib_pin, smp_no_rendezvous_barrier, &req);
+	window = tsc_freq / 1000 * amd_cppc_calib_settle_ms;
+	t0 = rdtsc();
+	while (rdtsc() - t0 < window)
+		cpu_spinwait();
+
+	window = tsc_freq / 1000 * amd_cppc_calib_ms;
+	a0 = rdmsr(MSR_APERF);
+	m0 = rdmsr(MSR_MPERF);
+	t0 = rdtsc();
+	while (rdtsc() - t0 < window)
+		cpu_spinwait();
+	a1 = rdmsr(MSR_APERF);
+	m1 = rdmsr(MSR_MPERF);
+	if (m1 == m0)
+		return (-1);
+	return ((int)((a1 - a0) * sc->base_freq_mhz / (m1 - m0)));
+}
+
+/*
+ * Measure every point and install the map. The request is restored
+ * afterwards; holding the driver lock keeps the watchdog and other writers
+ * away meanwhile.
+ */
+static int
+amd_cppc_calib_run(struct amd_cppc_softc *sc)
+{
+	struct amd_cppc_softc *m;
+	cpuset_t	members;
+	int		mhz[AMD_CPPC_CAL_POINTS], perf[AMD_CPPC_CAL_POINTS];
+	int		cpu, error, i, n;
+
+	sx_xlock(&amd_cppc_lock);
+	if (!sc->cppc_enabled || sc->detaching) {
+		sx_xunlock(&amd_cppc_lock);
+		return (ENXIO);
+	}
+	n = 0;
+	perf[n++] = sc->lowest_perf;
+	if (sc->lowest_nonlinear_perf > perf[n - 1])
+		perf[n++] = sc->lowest_nonlinear_perf;
+	if (sc->nominal_perf > perf[n - 1])
+		perf[n++] = sc->nominal_perf;
+	if (sc->highest_perf > perf[n - 1])
+		perf[n++] = sc->highest_perf;
+
+	amd_cppc_domain_cpus(sc, &members);
+	amd_cppc_bind_cpu(sc->cpu_id);
+	for (i = 0; i < n; i++)
+		mhz[i] = amd_cppc_calib_point(sc, &members, perf[i]);
+	amd_cppc_unbind_cpu();
+
+	/* Force the rewrite of every pinned request. */
+	CPU_FOREACH(cpu) {
+		if (!CPU_ISSET(cpu, &members))
+			continue;
+		m = cpu == sc->cpu_id ? sc : amd_cppc_softc_get(cpu);
+		if (m == NULL)
+			continue;
+		m->req_shadow = 0;
+		amd_cppc_update_req(m);
+	}
+
+	error = amd_cppc_calib_set(sc, perf, mhz, n);
+	if (error != 0)
+		device_printf(sc->dev, "calibration failed, clock did not "
+			      "rise with perf\n");
+	else
+		CPPC_DEBUG(sc->dev, "calibrated: highest_perf %d MHz, "
+			   "linear %d MHz\n", mhz[n - 1],
+			   (int)((uint64_t)sc->base_freq_mhz *
+			   sc->highest_perf / MAX(sc->nominal_perf, 1)));
+	sx_xunlock(&amd_cppc_lock);
+	return (error);
+}
+
+static void
+amd_cppc_calib_task(void *arg, int pending __unused)
+{
+
+	(void)amd_cppc_calib_run(arg);
+}
+
+static int
+amd_cppc_sysctl_calibrate(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	int		error, val;
+
+	sc = arg1;
+	val = 0;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL || val == 0)
+		return (error);
+	return (amd_cppc_calib_run(sc));
+}
+
+static int
+amd_cppc_sysctl_calibration(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	struct sbuf	sb;
+	char		buf[AMD_CPPC_CAL_POINTS * 12 + 1];
+	int		mhz[AMD_CPPC_CAL_POINTS], perf[AMD_CPPC_CAL_POINTS];
+	int		error, i, n;
+
+	sc = arg1;
+	sbuf_new(&sb, buf, sizeof(buf), SBUF_FIXEDLEN);
+	sx_slock(&amd_cppc_lock);
+	for (i = 0; i < sc->cal_n; i++)
+		sbuf_printf(&sb, "%s%d:%d", i != 0 ? " " : "",
+			    sc->cal_perf[i], sc->cal_mhz[i]);
+	sx_sunlock(&amd_cppc_lock);
+	sbuf_finish(&sb);
+
+	error = sysctl_handle_string(oidp, buf, sizeof(buf), req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	if ((error = amd_cppc_calib_parse(buf, perf, mhz, &n)) != 0)
+		return (error);
+
+	sx_xlock(&amd_cppc_lock);
+	error = amd_cppc_calib_set(sc, perf, mhz, n);
+	sx_xunlock(&amd_cppc_lock);
+	if (error != 0)
+		device_printf(sc->dev, "stored calibration does not match "
+			      "this CPU, ignored\n");
+	return (error);
+}
+
+static int
+amd_cppc_sysctl_calibrate_all(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	int		cpu, error, failed, val;
+
+	val = 0;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL || val == 0)
+		return (error);
+
+	failed = 0;
+	CPU_FOREACH(cpu) {
+		sx_slock(&amd_cppc_lock);
+		sc = amd_cppc_softc_get(cpu);
+		sx_sunlock(&amd_cppc_lock);
+		if (sc != NULL && amd_cppc_calib_run(sc) != 0)
+			failed++;
+	}
+	return (failed != 0 ? EAGAIN : 0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, calibrate,
+	    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_calibrate_all, "I",
+	    "Write 1 to calibrate perf to MHz on every CPU");
+SYSCTL_INT(_hw_amd_cppc, OID_AUTO, calibrate_at_attach, CTLFLAG_RDTUN,
+	   &amd_cppc_calib_at_attach, 0,
+	   "Calibrate CPUs without a stored calibration after attach");
+SYSCTL_INT(_hw_amd_cppc, OID_AUTO, calibrate_ms, CTLFLAG_RWTUN,
+	   &amd_cppc_calib_ms, 0, "Measuring time per perf level in ms");
+
+void
+amd_cppc_calib_attach(struct amd_cppc_softc *sc)
+{
+	struct sysctl_ctx_list *ctx;
+
+	TASK_INIT(&sc->cal_task, 0, amd_cppc_calib_task, sc);
+
+	/* A stored calibration is loaded here, through the tunable. */
+	ctx = device_get_sysctl_ctx(sc->dev);
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+			OID_AUTO, "calibration",
+			CTLTYPE_STRING | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, sc, 0,
+			amd_cppc_sysctl_calibration, "A",
+			"Measured perf:MHz points (empty = linear)");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+			OID_AUTO, "calibrate",
+			CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, sc, 0,
+			amd_cppc_sysctl_calibrate, "I",
+			"Write 1 to calibrate perf to MHz");
+
+	if (amd_cppc_calib_at_attach && sc->cal_n == 0)
+		taskqueue_enqueue(taskqueue_thread, &sc->cal_task);
+}
+
+void
+amd_cppc_calib_detach(struct amd_cppc_softc *sc)
+{
+
+	taskqueue_drain(taskqueue_thread, &sc->cal_task);
+}
+#endif /* _KERNEL */
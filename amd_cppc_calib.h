@@ -0,0 +1,50 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Perf to MHz calibration map.
+ *
+ * A map is up to AMD_CPPC_CAL_POINTS perf:MHz points, perf and MHz both
+ * rising, from the CPU's lowest to its highest perf. Its text form is the
+ * one dev.amd_cppc.N.calibration reads and writes, "20:1400 166:4850".
+ * Parsing, checking and interpolation have no kernel dependencies and
+ * build in userland, so stored calibrations can be checked off the
+ * machine.
+ */
+
+#ifndef _AMD_CPPC_CALIB_H_
+#define _AMD_CPPC_CALIB_H_
+
+/* Points of the perf to MHz calibration */
+#define AMD_CPPC_CAL_POINTS		4
+
+int	amd_cppc_calib_parse(char *text, int *perf, int *mhz, int *np);
+int	amd_cppc_calib_check(const int *perf, const int *mhz, int n,
+			     int lowest, int highest);
+int	amd_cppc_calib_interp(int x, const int *xs, const int *ys, int n);
+
+#endif /* !_AMD_CPPC_CALIB_H_ */
@@ -0,0 +1,423 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * CCD parking.
+ *
+ * On parts with several CCDs one of them is often saturated while the
+ * others only see housekeeping, yet their cores still ramp to boost on
+ * every tick and spend package power the busy CCD could use. With
+ * hw.amd_cppc.ccd_park enabled, a CCD whose average utilization stays
+ * under ccd_park_util for ccd_park_hold_ms is parked: its CPUs are capped
+ * at lowest_nonlinear_perf with the most efficient EPP. A parked CCD is
+ * unparked on the first pass where any of its CPUs exceeds
+ * ccd_unpark_util, so the cost of waking it is at most one sampling
+ * interval. The busiest CCD is never parked.
+ *
+ * Park and unpark latencies are measured from the start of the pass that
+ * made the decision to the completion of the MSR writes.
+ */
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/cpuset.h>
+#include <sys/devctl.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/pcpu.h>
+#include <sys/resource.h>
+#include <sys/sbuf.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+#include <sys/taskqueue.h>
+#include <sys/time.h>
+
+#include "amd_cppc_var.h"
+
+static MALLOC_DEFINE(M_AMD_CPPC_CCD, "amd_cppc_ccd", "AMD CPPC CCD state");
+
+struct amd_cppc_ccd {
+	cpuset_t	cpus;
+	bool		parked;
+	int		util;		/* average percent busy */
+	int		peak;		/* busiest member */
+	sbintime_t	idle_since;	/* below park threshold since, 0 = not */
+	uint64_t	parks;
+	uint64_t	unparks;
+	sbintime_t	park_lat;	/* last, sbintime */
+	sbintime_t	unpark_lat;
+	sbintime_t	unpark_lat_max;
+};
+
+/* CCD state, protected by amd_cppc_lock */
+static struct amd_cppc_ccd *amd_cppc_ccds;
+static int	amd_cppc_nccds;
+static int	amd_cppc_ccd_park = 0;
+static int	amd_cppc_ccd_park_util = 10;
+static int	amd_cppc_ccd_unpark_util = 30;
+static int	amd_cppc_ccd_park_hold_ms = 1000;
+static int	amd_cppc_ccd_interval_ms = 50;
+static bool	amd_cppc_ccd_ready;
+static struct timeout_task amd_cppc_ccd_task;
+
+/*
+ * Hold a parked CPU at lowest_nonlinear_perf with the power EPP.
+ */
+void
+amd_cppc_ccd_clamp(struct amd_cppc_softc *sc, struct amd_cppc_req *req)
+{
+
+	if (!sc->ccd_parked)
+		return;
+	req->max_perf = MIN(req->max_perf, sc->lowest_nonlinear_perf);
+	req->min_perf = MIN(req->min_perf, req->max_perf);
+	req->des_perf = MIN(req->des_perf, req->max_perf);
+	req->epp = amd_cppc_epp_to_hw(100);
+}
+
+static void
+amd_cppc_ccd_arm(void)
+{
+	int		ms;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	ms = amd_cppc_ccd_interval_ms;
+	if (!amd_cppc_ccd_ready || !amd_cppc_ccd_park || ms <= 0)
+		return;
+	taskqueue_enqueue_timeout(taskqueue_thread, &amd_cppc_ccd_task,
+				  MAX(1, (int)((int64_t)ms * hz / 1000)));
+}
+
+/*
+ * Group the CPUs into CCDs by shared L3. The topology does not change while
+ * the system runs, so this is done once, on the first pass.
+ */
+static void
+amd_cppc_ccd_build(void)
+{
+	struct amd_cppc_ccd *ccd;
+	cpuset_t	done, l3;
+	int		cpu, i;
+
+	amd_cppc_ccds = malloc(sizeof(*amd_cppc_ccds) * (mp_maxid + 1),
+			       M_AMD_CPPC_CCD, M_WAITOK | M_ZERO);
+	CPU_ZERO(&done);
+	CPU_FOREACH(cpu) {
+		if (CPU_ISSET(cpu, &done))
+			continue;
+		amd_cppc_topo_group(cpu, CG_SHARE_L3, &l3);
+		ccd = &amd_cppc_ccds[amd_cppc_nccds++];
+		CPU_COPY(&l3, &ccd->cpus);
+		CPU_FOREACH(i)
+			if (CPU_ISSET(i, &l3))
+				CPU_SET(i, &done);
+	}
+}
+
+/*
+ * Park or unpark every CPU of a CCD and record how long it took.
+ */
+static void
+amd_cppc_ccd_set(struct amd_cppc_ccd *ccd, bool park, sbintime_t start)
+{
+	struct amd_cppc_softc *sc;
+	struct amd_cppc_batch *b;
+	sbintime_t	lat;
+	int		cpu;
+
+	ccd->parked = park;
+	ccd->idle_since = 0;
+	b = amd_cppc_batch_alloc();
+	CPU_FOREACH(cpu) {
+		if (!CPU_ISSET(cpu, &ccd->cpus) ||
+		    (sc = amd_cppc_softc_get(cpu)) == NULL)
+			continue;
+		sc->ccd_parked = park;
+		amd_cppc_batch_add(b, sc);
+	}
+	amd_cppc_batch_commit(b);
+
+	lat = sbinuptime() - start;
+	if (park) {
+		ccd->parks++;
+		ccd->park_lat = lat;
+	} else {
+		ccd->unparks++;
+		ccd->unpark_lat = lat;
+		ccd->unpark_lat_max = MAX(ccd->unpark_lat_max, lat);
+	}
+	devctl_notify("AMD_CPPC", "ccd", park ? "park" : "unpark", NULL);
+}
+
+static void
+amd_cppc_ccd_pass(void)
+{
+	struct amd_cppc_softc *sc;
+	struct amd_cppc_ccd *ccd, *busiest;
+	sbintime_t	now;
+	int		cpu, i, n, park_util, sum, util;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	now = sbinuptime();
+	/*
+	 * A CCD parked above the unpark threshold would unpark on the next
+	 * pass. The two are set one at a time, from loader.conf in any
+	 * order, so cap the one here rather than reject it there.
+	 */
+	park_util = MIN(amd_cppc_ccd_park_util, amd_cppc_ccd_unpark_util);
+	if (amd_cppc_ccds == NULL)
+		amd_cppc_ccd_build();
+
+	busiest = NULL;
+	for (i = 0; i < amd_cppc_nccds; i++) {
+		ccd = &amd_cppc_ccds[i];
+		n = sum = 0;
+		ccd->peak = 0;
+		CPU_FOREACH(cpu) {
+			if (!CPU_ISSET(cpu, &ccd->cpus) ||
+			    (sc = amd_cppc_softc_get(cpu)) == NULL)
+				continue;
+			util = amd_cppc_cpu_util(cpu, sc->ccd_cp_time);
+			ccd->peak = MAX(ccd->peak, util);
+			sum += util;
+			n++;
+		}
+		ccd->util = n > 0 ? sum / n : 0;
+		if (busiest == NULL || ccd->util > busiest->util)
+			busiest = ccd;
+	}
+
+	for (i = 0; i < amd_cppc_nccds; i++) {
+		ccd = &amd_cppc_ccds[i];
+		if (ccd->parked) {
+			if (ccd->peak > amd_cppc_ccd_unpark_util ||
+			    ccd == busiest)
+				amd_cppc_ccd_set(ccd, false, now);
+			continue;
+		}
+		if (ccd == busiest || ccd->util >= park_util) {
+			ccd->idle_since = 0;
+			continue;
+		}
+		if (ccd->idle_since == 0)
+			ccd->idle_since = now;
+		else if (now - ccd->idle_since >=
+		    amd_cppc_ccd_park_hold_ms * SBT_1MS)
+			amd_cppc_ccd_set(ccd, true, now);
+	}
+}
+
+static void
+amd_cppc_ccd_unpark_all(void)
+{
+	int		i;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	for (i = 0; i < amd_cppc_nccds; i++) {
+		if (amd_cppc_ccds[i].parked)
+			amd_cppc_ccd_set(&amd_cppc_ccds[i], false,
+					 sbinuptime());
+		amd_cppc_ccds[i].idle_since = 0;
+	}
+}
+
+static void
+amd_cppc_ccd_task_fn(void *arg __unused, int pending __unused)
+{
+
+	sx_xlock(&amd_cppc_lock);
+	if (amd_cppc_ccd_ready && amd_cppc_ccd_park) {
+		amd_cppc_ccd_pass();
+		amd_cppc_ccd_arm();
+	}
+	sx_xunlock(&amd_cppc_lock);
+}
+
+static int
+amd_cppc_sysctl_ccd_park(SYSCTL_HANDLER_ARGS)
+{
+	int		error, val;
+
+	val = amd_cppc_ccd_park;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	sx_xlock(&amd_cppc_lock);
+	if ((val != 0) != (amd_cppc_ccd_park != 0)) {
+		amd_cppc_ccd_park = val != 0;
+		if (amd_cppc_ccd_park)
+			amd_cppc_ccd_arm();
+		else
+			amd_cppc_ccd_unpark_all();
+	}
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, ccd_park,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_ccd_park, "I",
+	    "Park lightly loaded CCDs at lowest_nonlinear_perf");
+
+/*
+ * ccd_park_util and ccd_unpark_util; arg1 points at the one being set.
+ */
+static int
+amd_cppc_sysctl_ccd_util(SYSCTL_HANDLER_ARGS)
+{
+	int		error, val;
+
+	val = *(int *)arg1;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val < 0 || val > 100)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	*(int *)arg1 = val;
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, ccd_park_util,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE,
+	    &amd_cppc_ccd_park_util, 0, amd_cppc_sysctl_ccd_util, "I",
+	    "Average utilization (%) below which a CCD may be parked");
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, ccd_unpark_util,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE,
+	    &amd_cppc_ccd_unpark_util, 0, amd_cppc_sysctl_ccd_util, "I",
+	    "Utilization (%) of any CPU that unparks its CCD");
+
+static int
+amd_cppc_sysctl_ccd_hold(SYSCTL_HANDLER_ARGS)
+{
+	int		error, ms;
+
+	ms = amd_cppc_ccd_park_hold_ms;
+	error = sysctl_handle_int(oidp, &ms, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (ms < 0)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_ccd_park_hold_ms = ms;
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, ccd_park_hold_ms,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_ccd_hold, "I",
+	    "Time in ms a CCD must stay lightly loaded before it is parked");
+
+static int
+amd_cppc_sysctl_ccd_interval(SYSCTL_HANDLER_ARGS)
+{
+	int		error, ms;
+
+	ms = amd_cppc_ccd_interval_ms;
+	error = sysctl_handle_int(oidp, &ms, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (ms < 0)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_ccd_interval_ms = ms;
+	amd_cppc_ccd_arm();
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, ccd_interval_ms,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_ccd_interval, "I",
+	    "Interval in ms between CCD load checks (0 = paused)");
+
+static int
+amd_cppc_sysctl_ccds(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_ccd *ccd;
+	struct sbuf	sb;
+	int		cpu, error, i, first;
+
+	sbuf_new_for_sysctl(&sb, NULL, 256, req);
+	sx_slock(&amd_cppc_lock);
+	for (i = 0; i < amd_cppc_nccds; i++) {
+		ccd = &amd_cppc_ccds[i];
+		sbuf_printf(&sb, "%s%d: cpus ", i == 0 ? "" : "\n", i);
+		first = 1;
+		CPU_FOREACH(cpu) {
+			if (CPU_ISSET(cpu, &ccd->cpus)) {
+				sbuf_printf(&sb, "%s%d", first ? "" : ",", cpu);
+				first = 0;
+			}
+		}
+		sbuf_printf(&sb, " %s util %d parks %ju unparks %ju "
+			    "park_us %jd unpark_us %jd unpark_max_us %jd",
+			    ccd->parked ? "parked" : "active", ccd->util,
+			    (uintmax_t)ccd->parks, (uintmax_t)ccd->unparks,
+			    (intmax_t)(ccd->park_lat / SBT_1US),
+			    (intmax_t)(ccd->unpark_lat / SBT_1US),
+			    (intmax_t)(ccd->unpark_lat_max / SBT_1US));
+	}
+	sx_sunlock(&amd_cppc_lock);
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, ccds,
+	    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_ccds, "A",
+	    "Per-CCD park state, load and park/unpark latency");
+
+void
+amd_cppc_ccd_init(void)
+{
+
+	TIMEOUT_TASK_INIT(taskqueue_thread, &amd_cppc_ccd_task, 0,
+			  amd_cppc_ccd_task_fn, NULL);
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_ccd_ready = true;
+	amd_cppc_ccd_arm();
+	sx_xunlock(&amd_cppc_lock);
+}
+
+void
+amd_cppc_ccd_fini(void)
+{
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_ccd_ready = false;
+	sx_xunlock(&amd_cppc_lock);
+	taskqueue_drain_timeout(taskqueue_thread, &amd_cppc_ccd_task);
+	free(amd_cppc_ccds, M_AMD_CPPC_CCD);
+	amd_cppc_ccds = NULL;
+	amd_cppc_nccds = 0;
+}
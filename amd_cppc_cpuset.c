@@ -0,0 +1,484 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * cpuset and jail scoped policies.
+ *
+ * A policy is bound to a cpuset, either by cpuset id or through the cpuset
+ * of a jail, and carries a mode, EPP, floor, ceiling and 3D V-Cache CCD
+ * preference. It applies to every
+ * CPU in the set. The host manages the whole table through
+ * hw.amd_cppc.cpuset_policy:
+ *
+ *	cpuset=4 mode=cap epp=20 min=40; jail=3 epp=80 max=120
+ *
+ * Later entries win where sets overlap. With hw.amd_cppc.jail_writable set,
+ * root inside a jail can read and write the entry of its own jail through
+ * hw.amd_cppc.jail_policy ("epp=30 mode=guided").
+ *
+ * The kernel has no notification for cpuset changes, so membership is
+ * re-resolved periodically and the policies re-applied when it changed.
+ * A CPU picks up its policy when it attaches.
+ */
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/cpuset.h>
+#include <sys/jail.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/proc.h>
+#include <sys/sbuf.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+#include <sys/taskqueue.h>
+#include <sys/ucred.h>
+
+#include "amd_cppc_var.h"
+
+#define AMD_CPPC_SETPOL_MAX	32
+#define AMD_CPPC_SETPOL_TEXTLEN	1024
+
+struct amd_cppc_setpol {
+	int		setid;		/* cpuset id, or -1 */
+	int		jid;		/* jail id, or -1 */
+	struct amd_cppc_override ovr;	/* boost is never set */
+	cpuset_t	cpus;		/* last resolved membership */
+};
+
+/* Policy table, protected by amd_cppc_lock */
+static struct amd_cppc_setpol amd_cppc_setpols[AMD_CPPC_SETPOL_MAX];
+static int	amd_cppc_nsetpols;
+
+static int	amd_cppc_cpuset_interval_ms = 1000;
+static int	amd_cppc_jail_writable = 0;
+static uint64_t	amd_cppc_cpuset_applies;
+static bool	amd_cppc_cpuset_ready;
+static struct timeout_task amd_cppc_cpuset_task;
+
+static void
+amd_cppc_cpuset_arm(void)
+{
+	int		ms;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	ms = amd_cppc_cpuset_interval_ms;
+	if (!amd_cppc_cpuset_ready || amd_cppc_nsetpols == 0 || ms <= 0)
+		return;
+	taskqueue_enqueue_timeout(taskqueue_thread, &amd_cppc_cpuset_task,
+				  MAX(1, (int)((int64_t)ms * hz / 1000)));
+}
+
+/*
+ * Current members of the set a policy is bound to. A vanished set or jail
+ * has no members.
+ */
+static void
+amd_cppc_setpol_resolve(const struct amd_cppc_setpol *p, cpuset_t *mask)
+{
+	struct cpuset	*set;
+
+	CPU_ZERO(mask);
+	set = NULL;
+	if (p->jid >= 0) {
+		if (cpuset_which(CPU_WHICH_JAIL, p->jid, NULL, NULL, &set) != 0)
+			set = NULL;
+	} else
+		set = cpuset_lookup(p->setid, curthread);
+	if (set == NULL)
+		return;
+	CPU_COPY(&set->cs_mask, mask);
+	cpuset_rel(set);
+}
+
+/*
+ * Re-resolve membership and push the policies to the CPUs. Unless forced,
+ * nothing is written when no membership changed.
+ */
+static void
+amd_cppc_cpuset_apply(bool force)
+{
+	struct amd_cppc_setpol *p;
+	struct amd_cppc_softc *sc;
+	struct amd_cppc_batch *b;
+	cpuset_t	mask;
+	int		cpu, i, idx;
+	bool		changed;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+
+	changed = force;
+	for (i = 0; i < amd_cppc_nsetpols; i++) {
+		p = &amd_cppc_setpols[i];
+		amd_cppc_setpol_resolve(p, &mask);
+		if (CPU_CMP(&mask, &p->cpus) != 0) {
+			CPU_COPY(&mask, &p->cpus);
+			changed = true;
+		}
+	}
+	if (!changed)
+		return;
+
+	b = amd_cppc_batch_alloc();
+	CPU_FOREACH(cpu) {
+		if ((sc = amd_cppc_softc_get(cpu)) == NULL)
+			continue;
+		idx = -1;
+		for (i = amd_cppc_nsetpols - 1; i >= 0; i--) {
+			if (CPU_ISSET(cpu, &amd_cppc_setpols[i].cpus)) {
+				idx = i;
+				break;
+			}
+		}
+		sc->set_policy = idx;
+		if (idx >= 0)
+			sc->set_ovr = amd_cppc_setpols[idx].ovr;
+		else
+			amd_cppc_override_clear(&sc->set_ovr);
+		amd_cppc_batch_add(b, sc);
+	}
+	amd_cppc_batch_commit(b);
+	amd_cppc_cpuset_applies++;
+}
+
+/*
+ * Give a CPU being attached the policy covering it. Passes skip CPUs that
+ * are not attached yet and only push on membership changes, so without
+ * this a CPU would miss policies pushed before it came up.
+ */
+void
+amd_cppc_cpuset_attach(struct amd_cppc_softc *sc)
+{
+	cpuset_t	mask;
+	int		i;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	sc->set_policy = -1;
+	amd_cppc_override_clear(&sc->set_ovr);
+	for (i = amd_cppc_nsetpols - 1; i >= 0; i--) {
+		amd_cppc_setpol_resolve(&amd_cppc_setpols[i], &mask);
+		if (CPU_ISSET(sc->cpu_id, &mask)) {
+			sc->set_policy = i;
+			sc->set_ovr = amd_cppc_setpols[i].ovr;
+			break;
+		}
+	}
+}
+
+static void
+amd_cppc_cpuset_task_fn(void *arg __unused, int pending __unused)
+{
+
+	sx_xlock(&amd_cppc_lock);
+	if (amd_cppc_cpuset_ready) {
+		amd_cppc_cpuset_apply(false);
+		amd_cppc_cpuset_arm();
+	}
+	sx_xunlock(&amd_cppc_lock);
+}
+
+static int
+amd_cppc_setpol_int(const char *val, int max, int *out)
+{
+	char		*end;
+	long		v;
+
+	v = strtol(val, &end, 10);
+	if (end == val || *end != '\0' || v < 0 || v > max)
+		return (EINVAL);
+	*out = (int)v;
+	return (0);
+}
+
+/*
+ * Parse one policy entry. With jail_only, binding keys are rejected and the
+ * caller supplies the binding.
+ */
+static int
+amd_cppc_setpol_parse(char *line, struct amd_cppc_setpol *p, bool jail_only)
+{
+	char		*key, *val;
+	int		error, mode;
+
+	memset(p, 0, sizeof(*p));
+	p->setid = p->jid = -1;
+	amd_cppc_override_clear(&p->ovr);
+
+	while ((key = strsep(&line, " \t")) != NULL) {
+		if (*key == '\0')
+			continue;
+		if ((val = strchr(key, '=')) == NULL)
+			return (EINVAL);
+		*val++ = '\0';
+		if (!jail_only && strcmp(key, "cpuset") == 0)
+			error = amd_cppc_setpol_int(val, INT_MAX, &p->setid);
+		else if (!jail_only && strcmp(key, "jail") == 0)
+			error = amd_cppc_setpol_int(val, INT_MAX, &p->jid);
+		else if (strcmp(key, "epp") == 0)
+			error = amd_cppc_setpol_int(val, 100, &p->ovr.epp);
+		else if (strcmp(key, "min") == 0)
+			error = amd_cppc_setpol_int(val, 255, &p->ovr.min_perf);
+		else if (strcmp(key, "max") == 0)
+			error = amd_cppc_setpol_int(val, 255, &p->ovr.max_perf);
+		else if (strcmp(key, "mode") == 0) {
+			mode = amd_cppc_mode_parse(val);
+			error = mode < 0 ? EINVAL : 0;
+			p->ovr.mode = mode;
+		} else if (strcmp(key, "vcache") == 0) {
+			mode = amd_cppc_vcache_parse(val);
+			error = mode < 0 ? EINVAL : 0;
+			p->ovr.vcache = mode;
+		} else
+			error = EINVAL;
+		if (error != 0)
+			return (error);
+	}
+	if (!jail_only && (p->setid < 0) == (p->jid < 0))
+		return (EINVAL);	/* need exactly one binding */
+	return (0);
+}
+
+static void
+amd_cppc_setpol_format(struct sbuf *sb, const struct amd_cppc_setpol *p,
+		       bool binding)
+{
+	const char	*sep;
+
+	sep = "";
+	if (binding) {
+		if (p->jid >= 0)
+			sbuf_printf(sb, "jail=%d", p->jid);
+		else
+			sbuf_printf(sb, "cpuset=%d", p->setid);
+		sep = " ";
+	}
+	if (p->ovr.mode >= 0) {
+		sbuf_printf(sb, "%smode=%s", sep,
+			    amd_cppc_mode_name(p->ovr.mode));
+		sep = " ";
+	}
+	if (p->ovr.epp >= 0) {
+		sbuf_printf(sb, "%sepp=%d", sep, p->ovr.epp);
+		sep = " ";
+	}
+	if (p->ovr.min_perf >= 0) {
+		sbuf_printf(sb, "%smin=%d", sep, p->ovr.min_perf);
+		sep = " ";
+	}
+	if (p->ovr.max_perf >= 0) {
+		sbuf_printf(sb, "%smax=%d", sep, p->ovr.max_perf);
+		sep = " ";
+	}
+	if (p->ovr.vcache >= 0)
+		sbuf_printf(sb, "%svcache=%s", sep,
+			    amd_cppc_vcache_name(p->ovr.vcache));
+}
+
+static int
+amd_cppc_sysctl_cpuset_policy(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_setpol *pols;
+	struct sbuf	sb;
+	char		*line, *next, *p, *text;
+	int		error, i, n;
+
+	text = malloc(AMD_CPPC_SETPOL_TEXTLEN, M_TEMP, M_WAITOK | M_ZERO);
+	sbuf_new(&sb, text, AMD_CPPC_SETPOL_TEXTLEN, SBUF_FIXEDLEN);
+	sx_slock(&amd_cppc_lock);
+	for (i = 0; i < amd_cppc_nsetpols; i++) {
+		if (i != 0)
+			sbuf_cat(&sb, "; ");
+		amd_cppc_setpol_format(&sb, &amd_cppc_setpols[i], true);
+	}
+	sx_sunlock(&amd_cppc_lock);
+	sbuf_finish(&sb);
+	sbuf_delete(&sb);
+
+	error = sysctl_handle_string(oidp, text, AMD_CPPC_SETPOL_TEXTLEN, req);
+	if (error || req->newptr == NULL)
+		goto out;
+
+	pols = malloc(sizeof(*pols) * AMD_CPPC_SETPOL_MAX, M_TEMP, M_WAITOK);
+	n = 0;
+	next = text;
+	while ((line = strsep(&next, ";\n")) != NULL) {
+		for (p = line; *p == ' ' || *p == '\t'; p++)
+			;
+		if (*p == '\0')
+			continue;
+		if (n == AMD_CPPC_SETPOL_MAX) {
+			error = E2BIG;
+			break;
+		}
+		error = amd_cppc_setpol_parse(p, &pols[n], false);
+		if (error != 0)
+			break;
+		n++;
+	}
+	if (error == 0) {
+		sx_xlock(&amd_cppc_lock);
+		memcpy(amd_cppc_setpols, pols, sizeof(*pols) * n);
+		amd_cppc_nsetpols = n;
+		amd_cppc_cpuset_apply(true);
+		amd_cppc_cpuset_arm();
+		sx_xunlock(&amd_cppc_lock);
+	}
+	free(pols, M_TEMP);
+out:
+	free(text, M_TEMP);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, cpuset_policy,
+	    CTLTYPE_STRING | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_cpuset_policy, "A",
+	    "Policies bound to cpusets or jails (cpuset=ID|jail=JID "
+	    "mode= epp= min= max= vcache=; ...)");
+
+static int
+amd_cppc_setpol_find_jail(int jid)
+{
+	int		i;
+
+	for (i = 0; i < amd_cppc_nsetpols; i++)
+		if (amd_cppc_setpols[i].jid == jid)
+			return (i);
+	return (-1);
+}
+
+/*
+ * The calling jail's own policy. Readable by anyone in the jail, writable
+ * by jail root when the host allows it.
+ */
+static int
+amd_cppc_sysctl_jail_policy(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_setpol pol;
+	struct sbuf	sb;
+	char		buf[128];
+	int		error, i, jid;
+
+	jid = req->td->td_ucred->cr_prison->pr_id;
+
+	memset(buf, 0, sizeof(buf));
+	sbuf_new(&sb, buf, sizeof(buf), SBUF_FIXEDLEN);
+	sx_slock(&amd_cppc_lock);
+	if ((i = amd_cppc_setpol_find_jail(jid)) >= 0)
+		amd_cppc_setpol_format(&sb, &amd_cppc_setpols[i], false);
+	sx_sunlock(&amd_cppc_lock);
+	sbuf_finish(&sb);
+	sbuf_delete(&sb);
+
+	error = sysctl_handle_string(oidp, buf, sizeof(buf), req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	/* The host manages its policies through cpuset_policy. */
+	if (jid == 0)
+		return (EINVAL);
+	if (!amd_cppc_jail_writable)
+		return (EPERM);
+
+	error = amd_cppc_setpol_parse(buf, &pol, true);
+	if (error != 0)
+		return (error);
+	pol.jid = jid;
+
+	sx_xlock(&amd_cppc_lock);
+	i = amd_cppc_setpol_find_jail(jid);
+	if (i < 0) {
+		if (amd_cppc_nsetpols == AMD_CPPC_SETPOL_MAX) {
+			sx_xunlock(&amd_cppc_lock);
+			return (ENOSPC);
+		}
+		i = amd_cppc_nsetpols++;
+	}
+	amd_cppc_setpols[i] = pol;
+	amd_cppc_cpuset_apply(true);
+	amd_cppc_cpuset_arm();
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, jail_policy,
+	    CTLTYPE_STRING | CTLFLAG_RW | CTLFLAG_PRISON | CTLFLAG_MPSAFE,
+	    NULL, 0, amd_cppc_sysctl_jail_policy, "A",
+	    "Policy of the calling jail (mode= epp= min= max= vcache=)");
+
+SYSCTL_INT(_hw_amd_cppc, OID_AUTO, jail_writable, CTLFLAG_RWTUN,
+	   &amd_cppc_jail_writable, 0,
+	   "Allow jail root to set the policy of its own jail");
+
+static int
+amd_cppc_sysctl_cpuset_interval(SYSCTL_HANDLER_ARGS)
+{
+	int		error, ms;
+
+	ms = amd_cppc_cpuset_interval_ms;
+	error = sysctl_handle_int(oidp, &ms, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (ms < 0)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_cpuset_interval_ms = ms;
+	amd_cppc_cpuset_arm();
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, cpuset_interval_ms,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_cpuset_interval, "I",
+	    "Interval in ms between cpuset membership checks (0 = paused)");
+
+SYSCTL_U64(_hw_amd_cppc, OID_AUTO, cpuset_applies, CTLFLAG_RD,
+	   &amd_cppc_cpuset_applies, 0,
+	   "Number of times cpuset policies were pushed to the CPUs");
+
+void
+amd_cppc_cpuset_init(void)
+{
+
+	TIMEOUT_TASK_INIT(taskqueue_thread, &amd_cppc_cpuset_task, 0,
+			  amd_cppc_cpuset_task_fn, NULL);
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_cpuset_ready = true;
+	amd_cppc_cpuset_apply(true);
+	amd_cppc_cpuset_arm();
+	sx_xunlock(&amd_cppc_lock);
+}
+
+void
+amd_cppc_cpuset_fini(void)
+{
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_cpuset_ready = false;
+	sx_xunlock(&amd_cppc_lock);
+	taskqueue_drain_timeout(taskqueue_thread, &amd_cppc_cpuset_task);
+}
@@ -0,0 +1,419 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Request coordination across frequency domains.
+ *
+ * SMT siblings share one core clock, and firmware may describe larger
+ * dependency domains with _PSD. Requests written independently to each
+ * member are then resolved by hardware in ways the driver cannot see, so
+ * get() can report a frequency the core never runs at. When a merge rule
+ * is selected the driver resolves the domain itself: every member is
+ * programmed with the same merged request and the merged value is what
+ * the driver reports.
+ *
+ * Domains come from _PSD when firmware provides one and from the SMT
+ * topology otherwise. Merge rules:
+ *	none	every CPU keeps its own request (default)
+ *	max	highest floor, ceiling and desired level, lowest EPP
+ *	min	lowest floor, ceiling and desired level, highest EPP
+ *	leader	the request of the lowest numbered member
+ */
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/cpuset.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/sbuf.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+
+#include <contrib/dev/acpica/include/acpi.h>
+#include <dev/acpica/acpivar.h>
+
+#include "amd_cppc_var.h"
+
+#define AMD_CPPC_MERGE_NONE	0
+#define AMD_CPPC_MERGE_MAX	1
+#define AMD_CPPC_MERGE_MIN	2
+#define AMD_CPPC_MERGE_LEADER	3
+#define AMD_CPPC_MERGE_COUNT	4
+
+/* _PSD coordination types (ACPI 6.5, 8.4.5.5) */
+#define ACPI_PSD_SW_ALL		0xFC
+#define ACPI_PSD_SW_ANY		0xFD
+#define ACPI_PSD_HW_ALL		0xFE
+
+static const char *const amd_cppc_merge_names[AMD_CPPC_MERGE_COUNT] = {
+	"none", "max", "min", "leader",
+};
+
+struct amd_cppc_domain {
+	int		psd;		/* _PSD domain number, -1 = SMT group */
+	int		coord;		/* _PSD coordination type */
+	cpuset_t	cpus;
+};
+
+/* Domain table, protected by amd_cppc_lock */
+static struct amd_cppc_domain amd_cppc_domains[MAXCPU];
+static int	amd_cppc_ndomains;
+static int	amd_cppc_domain_merge = AMD_CPPC_MERGE_NONE;
+
+/*
+ * Read the first _PSD dependency package of the processor object.
+ */
+static void
+amd_cppc_domain_read_psd(struct amd_cppc_softc *sc)
+{
+	ACPI_BUFFER	buf;
+	ACPI_HANDLE	handle;
+	ACPI_OBJECT	*obj, *pkg;
+	uint32_t	domain, coord;
+
+	sc->psd_domain = -1;
+	sc->psd_coord = 0;
+
+	handle = acpi_get_handle(device_get_parent(sc->dev));
+	if (handle == NULL)
+		return;
+	buf.Pointer = NULL;
+	buf.Length = ACPI_ALLOCATE_BUFFER;
+	if (ACPI_FAILURE(AcpiEvaluateObject(handle, "_PSD", NULL, &buf)))
+		return;
+
+	obj = buf.Pointer;
+	if (obj->Type == ACPI_TYPE_PACKAGE && obj->Package.Count >= 1) {
+		pkg = &obj->Package.Elements[0];
+		if (pkg->Type == ACPI_TYPE_PACKAGE &&
+		    acpi_PkgInt32(pkg, 2, &domain) == 0 &&
+		    acpi_PkgInt32(pkg, 3, &coord) == 0) {
+			sc->psd_domain = domain;
+			sc->psd_coord = coord;
+		}
+	}
+	AcpiOsFree(buf.Pointer);
+}
+
+/*
+ * The CPUs sharing a core with cpu, or just cpu without SMT.
+ */
+static void
+amd_cppc_domain_smt(int cpu, cpuset_t *mask)
+{
+	struct cpu_group *cg;
+	int		i;
+
+	CPU_ZERO(mask);
+	CPU_SET(cpu, mask);
+
+	cg = cpu_top;
+	while (cg != NULL && cg->cg_children > 0) {
+		for (i = 0; i < cg->cg_children; i++)
+			if (CPU_ISSET(cpu, &cg->cg_child[i].cg_mask))
+				break;
+		if (i == cg->cg_children)
+			break;
+		cg = &cg->cg_child[i];
+	}
+	if (cg != NULL && (cg->cg_flags & CG_FLAG_SMT) != 0)
+		CPU_COPY(&cg->cg_mask, mask);
+}
+
+/*
+ * The innermost scheduler topology group containing cpu at the given sharing
+ * level: CG_SHARE_L3 for a CCX, CG_SHARE_NONE for a package. Without such a
+ * group the mask is just cpu and false is returned.
+ */
+bool
+amd_cppc_topo_group(int cpu, int level, cpuset_t *mask)
+{
+	struct cpu_group *cg, *found;
+	int		i;
+
+	found = NULL;
+	cg = cpu_top;
+	while (cg != NULL) {
+		if (cg->cg_level == level)
+			found = cg;
+		for (i = 0; i < cg->cg_children; i++)
+			if (CPU_ISSET(cpu, &cg->cg_child[i].cg_mask))
+				break;
+		cg = i < cg->cg_children ? &cg->cg_child[i] : NULL;
+	}
+	if (found == NULL) {
+		CPU_ZERO(mask);
+		CPU_SET(cpu, mask);
+		return (false);
+	}
+	CPU_COPY(&found->cg_mask, mask);
+	return (true);
+}
+
+/*
+ * Place a newly attached CPU in its domain, creating the domain on first
+ * sight. Called with amd_cppc_lock held.
+ */
+static void
+amd_cppc_domain_join(struct amd_cppc_softc *sc)
+{
+	struct amd_cppc_domain *d;
+	cpuset_t	smt;
+	int		i;
+
+	amd_cppc_domain_smt(sc->cpu_id, &smt);
+	for (i = 0; i < amd_cppc_ndomains; i++) {
+		d = &amd_cppc_domains[i];
+		if (sc->psd_domain >= 0 ? d->psd == sc->psd_domain :
+		    d->psd < 0 && CPU_OVERLAP(&d->cpus, &smt))
+			break;
+	}
+	if (i == amd_cppc_ndomains) {
+		if (amd_cppc_ndomains == MAXCPU)
+			return;
+		d = &amd_cppc_domains[amd_cppc_ndomains++];
+		d->psd = sc->psd_domain;
+		d->coord = sc->psd_coord;
+		CPU_ZERO(&d->cpus);
+	}
+	CPU_SET(sc->cpu_id, &d->cpus);
+	sc->domain = i;
+}
+
+void
+amd_cppc_domain_members(struct amd_cppc_softc *sc, cpuset_t *mask)
+{
+
+	sx_assert(&amd_cppc_lock, SA_LOCKED);
+	if (sc->domain < 0 || amd_cppc_domain_merge == AMD_CPPC_MERGE_NONE) {
+		CPU_ZERO(mask);
+		CPU_SET(sc->cpu_id, mask);
+	} else
+		CPU_COPY(&amd_cppc_domains[sc->domain].cpus, mask);
+}
+
+/*
+ * The CPUs sharing sc's clock as hardware groups them, whatever the merge
+ * rule. Only CPUs still attached are included.
+ */
+void
+amd_cppc_domain_cpus(struct amd_cppc_softc *sc, cpuset_t *mask)
+{
+	int		cpu;
+
+	sx_assert(&amd_cppc_lock, SA_LOCKED);
+	CPU_ZERO(mask);
+	CPU_SET(sc->cpu_id, mask);
+	if (sc->domain < 0)
+		return;
+	CPU_FOREACH(cpu)
+		if (CPU_ISSET(cpu, &amd_cppc_domains[sc->domain].cpus) &&
+		    amd_cppc_softc_get(cpu) != NULL)
+			CPU_SET(cpu, mask);
+}
+
+/*
+ * The request to program on sc: its own request, or the merge of every
+ * active member of its domain.
+ */
+void
+amd_cppc_domain_req(struct amd_cppc_softc *sc, struct amd_cppc_req *req)
+{
+	struct amd_cppc_softc *m;
+	cpuset_t	members;
+	bool		first;
+	int		cpu;
+
+	sx_assert(&amd_cppc_lock, SA_LOCKED);
+	req->max_perf = sc->req_max_perf;
+	req->min_perf = sc->req_min_perf;
+	req->des_perf = sc->req_des_perf;
+	req->epp = sc->req_epp;
+
+	amd_cppc_domain_members(sc, &members);
+	first = true;
+	CPU_FOREACH(cpu) {
+		if (!CPU_ISSET(cpu, &members))
+			continue;
+		m = cpu == sc->cpu_id ? sc : amd_cppc_softc_get(cpu);
+		if (m == NULL)
+			continue;
+		if (first) {
+			req->max_perf = m->req_max_perf;
+			req->min_perf = m->req_min_perf;
+			req->des_perf = m->req_des_perf;
+			req->epp = m->req_epp;
+			first = false;
+			if (amd_cppc_domain_merge == AMD_CPPC_MERGE_LEADER)
+				break;
+			continue;
+		}
+		if (amd_cppc_domain_merge == AMD_CPPC_MERGE_MAX) {
+			req->max_perf = MAX(req->max_perf, m->req_max_perf);
+			req->min_perf = MAX(req->min_perf, m->req_min_perf);
+			req->des_perf = MAX(req->des_perf, m->req_des_perf);
+			req->epp = MIN(req->epp, m->req_epp);
+		} else {
+			req->max_perf = MIN(req->max_perf, m->req_max_perf);
+			req->min_perf = MIN(req->min_perf, m->req_min_perf);
+			req->des_perf = MIN(req->des_perf, m->req_des_perf);
+			req->epp = MAX(req->epp, m->req_epp);
+		}
+	}
+}
+
+static void
+amd_cppc_domain_print_cpus(struct sbuf *sb, const cpuset_t *cpus)
+{
+	const char	*sep;
+	int		cpu;
+
+	sep = "";
+	CPU_FOREACH(cpu) {
+		if (CPU_ISSET(cpu, cpus)) {
+			sbuf_printf(sb, "%s%d", sep, cpu);
+			sep = ",";
+		}
+	}
+}
+
+static const char *
+amd_cppc_domain_coord_name(const struct amd_cppc_domain *d)
+{
+
+	if (d->psd < 0)
+		return ("smt");
+	switch (d->coord) {
+	case ACPI_PSD_SW_ALL:
+		return ("sw_all");
+	case ACPI_PSD_SW_ANY:
+		return ("sw_any");
+	case ACPI_PSD_HW_ALL:
+		return ("hw_all");
+	default:
+		return ("unknown");
+	}
+}
+
+static int
+amd_cppc_sysctl_domain_merge(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	struct amd_cppc_batch *b;
+	char		buf[16];
+	int		cpu, error, i;
+
+	strlcpy(buf, amd_cppc_merge_names[amd_cppc_domain_merge], sizeof(buf));
+	error = sysctl_handle_string(oidp, buf, sizeof(buf), req);
+	if (error || req->newptr == NULL)
+		return (error);
+	for (i = 0; i < AMD_CPPC_MERGE_COUNT; i++)
+		if (strcmp(buf, amd_cppc_merge_names[i]) == 0)
+			break;
+	if (i == AMD_CPPC_MERGE_COUNT)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	if (i != amd_cppc_domain_merge) {
+		amd_cppc_domain_merge = i;
+		b = amd_cppc_batch_alloc();
+		CPU_FOREACH(cpu)
+			if ((sc = amd_cppc_softc_get(cpu)) != NULL)
+				amd_cppc_batch_add(b, sc);
+		amd_cppc_batch_commit(b);
+	}
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, domain_merge,
+	    CTLTYPE_STRING | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_domain_merge, "A",
+	    "How requests in a frequency domain are merged "
+	    "(none, max, min, leader)");
+
+/*
+ * One line per domain: members, source, and the request programmed on the
+ * lowest numbered active member.
+ */
+static int
+amd_cppc_sysctl_domains(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_domain *d;
+	struct amd_cppc_softc *sc;
+	struct sbuf	sb;
+	uint64_t	val;
+	int		cpu, error, i;
+
+	sbuf_new_for_sysctl(&sb, NULL, 256, req);
+	sx_slock(&amd_cppc_lock);
+	for (i = 0; i < amd_cppc_ndomains; i++) {
+		d = &amd_cppc_domains[i];
+		sbuf_printf(&sb, "%s%d: cpus ", i == 0 ? "" : "\n", i);
+		amd_cppc_domain_print_cpus(&sb, &d->cpus);
+		sbuf_printf(&sb, " source %s", amd_cppc_domain_coord_name(d));
+		if (d->psd >= 0)
+			sbuf_printf(&sb, " psd %d", d->psd);
+		sc = NULL;
+		CPU_FOREACH(cpu)
+			if (CPU_ISSET(cpu, &d->cpus) &&
+			    (sc = amd_cppc_softc_get(cpu)) != NULL)
+				break;
+		if (sc == NULL)
+			continue;
+		val = sc->req_shadow;
+		sbuf_printf(&sb, " max %ju min %ju des %ju epp %ju",
+			    (uintmax_t)((val >> AMD_CPPC_MAX_PERF_SHIFT) & 0xFF),
+			    (uintmax_t)((val >> AMD_CPPC_MIN_PERF_SHIFT) & 0xFF),
+			    (uintmax_t)((val >> AMD_CPPC_DES_PERF_SHIFT) & 0xFF),
+			    (uintmax_t)((val >> AMD_CPPC_EPP_PERF_SHIFT) & 0xFF));
+	}
+	sx_sunlock(&amd_cppc_lock);
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, domains,
+	    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_domains, "A",
+	    "Frequency domains and their programmed request");
+
+void
+amd_cppc_domain_attach(struct amd_cppc_softc *sc)
+{
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	amd_cppc_domain_read_psd(sc);
+	amd_cppc_domain_join(sc);
+
+	SYSCTL_ADD_INT(device_get_sysctl_ctx(sc->dev),
+		       SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+		       OID_AUTO, "domain", CTLFLAG_RD, &sc->domain, 0,
+		       "Frequency domain index (see hw.amd_cppc.domains)");
+}
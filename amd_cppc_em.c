@@ -0,0 +1,673 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Energy model and energy-aware wakeup placement.
+ *
+ * With hw.amd_cppc.em.enable set, a task samples every CPU each
+ * em.interval_ms in one rendezvous: APERF, MPERF, TSC and the RAPL core
+ * energy counter. From the deltas each CPU gets its C0 residency, the
+ * clock it delivered while busy, and, on intervals busy enough to tell,
+ * the active power at that clock. The power is kept per perf level, eight
+ * levels spread from lowest_perf to highest_perf, as a running average.
+ * Levels never measured are filled in from amd_cppc_model_energy() scaled
+ * to the nearest measured level (or to em.model_mw at highest_perf when
+ * there is no RAPL), so every level has a cost. The core energy counter is
+ * shared by SMT siblings, so each thread is charged the core's power.
+ *
+ * amd_cppc_em_get() hands the levels and the current operating point of a
+ * CPU to other kernel code, and dev.amd_cppc.N.energy_model shows them.
+ *
+ * Placement: the incremental power of running a thread that uses util
+ * percent of a CPU at base clock is the thread's share of time at the
+ * clock it would run at, times that clock's power. A CPU already running
+ * is charged at its current clock; an idle CPU at the clock its request
+ * lets it ramp to, plus em.wake_mw for leaving idle. CPUs above
+ * em.busy_max are not candidates. amd_cppc_em_pick() returns the
+ * cheapest CPU of a mask within the L3 group of the scheduler's choice,
+ * and keeps the scheduler's choice unless the other saves em.margin_pct.
+ *
+ * Stock ULE offers no placement hook. kernel/sched_ule_em_hook.diff adds
+ * sched_pickcpu_hook, which sched_pickcpu() calls with the thread locked
+ * and the CPU it chose, using the CPU returned instead. The pointer is
+ * looked up by name when hw.amd_cppc.em.sched is set, so the module still
+ * loads on kernels without it and the sysctl fails with ENODEV. The hook
+ * places threads below em.small_pct with amd_cppc_em_pick(), and
+ * hw.amd_cppc.em.stats reports the modelled power saved by the diverted
+ * wakeups against what placement cost: time spent choosing, and how many
+ * threads were put on a CPU that was running something.
+ *
+ * The levels' clocks follow the perf to MHz map, so they are mapped again
+ * when a CPU is calibrated (amd_cppc_calib.c).
+ */
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/cpuset.h>
+#include <sys/kernel.h>
+#include <sys/linker.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/pcpu.h>
+#include <sys/proc.h>
+#include <sys/sbuf.h>
+#include <sys/sched.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+#include <sys/taskqueue.h>
+
+#include <machine/atomic.h>
+#include <machine/cpufunc.h>
+
+#include "amd_cppc_var.h"
+
+static MALLOC_DEFINE(M_AMD_CPPC_EM, "amd_cppc_em", "AMD CPPC energy model");
+
+struct amd_cppc_em_cpu {
+	volatile int	valid;
+	cpuset_t	llc;		/* CPUs sharing the L3 */
+	int		base_mhz;
+	int		nominal_perf;
+	int		nlevels;
+	int		lvl_perf[AMD_CPPC_EM_LEVELS];
+	int		lvl_mhz[AMD_CPPC_EM_LEVELS];
+	int		lvl_model[AMD_CPPC_EM_LEVELS];	/* relative V^2 f */
+	uint32_t	lvl_meas[AMD_CPPC_EM_LEVELS];	/* mW, 0 = none */
+	uint32_t	lvl_samples[AMD_CPPC_EM_LEVELS];
+	struct amd_cppc_ctr last;
+	bool		primed;
+
+	/* Published each interval, read unlocked by the wakeup hook */
+	uint32_t	lvl_mw[AMD_CPPC_EM_LEVELS];
+	int		busy;		/* C0 percent */
+	int		cur_mhz;	/* delivered while in C0 */
+	int		wake_mhz;	/* clock an idle wakeup ramps to */
+};
+
+static struct amd_cppc_em_cpu amd_cppc_em_cpus[MAXCPU];
+static int	amd_cppc_em = 0;
+static int	amd_cppc_em_interval_ms = 250;
+static int	amd_cppc_em_min_busy = 50;
+static int	amd_cppc_em_model_mw = 5000;
+static int	amd_cppc_em_wake_mw = 150;
+static int	amd_cppc_em_busy_max = 80;
+static int	amd_cppc_em_small_pct = 10;
+static int	amd_cppc_em_margin_pct = 10;
+static bool	amd_cppc_em_ready;
+static struct timeout_task amd_cppc_em_task;
+
+/* sched_pickcpu_hook of kernel/sched_ule_em_hook.diff */
+typedef int	amd_cppc_em_hook_t(struct thread *td, int cpu);
+static amd_cppc_em_hook_t * volatile *amd_cppc_em_hookp;
+
+/* Placement statistics */
+static uint64_t	amd_cppc_em_decisions;
+static uint64_t	amd_cppc_em_diverted;
+static uint64_t	amd_cppc_em_onto_busy;
+static uint64_t	amd_cppc_em_saved_mw;
+static uint64_t	amd_cppc_em_pick_cycles;
+static uint64_t	amd_cppc_em_pick_max;
+
+static SYSCTL_NODE(_hw_amd_cppc, OID_AUTO, em, CTLFLAG_RD | CTLFLAG_MPSAFE,
+		   NULL, "Energy model and energy-aware wakeup placement");
+
+/*
+ * Power of a CPU at mhz, interpolated between its levels.
+ */
+static int
+amd_cppc_em_power(const struct amd_cppc_em_cpu *ec, int mhz)
+{
+	int		i, n;
+
+	n = ec->nlevels;
+	if (mhz <= ec->lvl_mhz[0])
+		return (ec->lvl_mw[0]);
+	for (i = 1; i < n - 1 && mhz > ec->lvl_mhz[i]; i++)
+		;
+	if (mhz >= ec->lvl_mhz[i])
+		return (ec->lvl_mw[i]);
+	return (ec->lvl_mw[i - 1] + (int64_t)(mhz - ec->lvl_mhz[i - 1]) *
+	    ((int)ec->lvl_mw[i] - (int)ec->lvl_mw[i - 1]) /
+	    MAX(1, ec->lvl_mhz[i] - ec->lvl_mhz[i - 1]));
+}
+
+/*
+ * Fill the published per-level power: measured where measured, else the
+ * model scaled to the nearest measured level.
+ */
+static void
+amd_cppc_em_publish(struct amd_cppc_em_cpu *ec)
+{
+	int		i, j, ref;
+
+	for (i = 0; i < ec->nlevels; i++) {
+		if (ec->lvl_meas[i] != 0) {
+			ec->lvl_mw[i] = ec->lvl_meas[i];
+			continue;
+		}
+		ref = -1;
+		for (j = 0; j < ec->nlevels; j++)
+			if (ec->lvl_meas[j] != 0 &&
+			    (ref < 0 || abs(j - i) < abs(ref - i)))
+				ref = j;
+		if (ref < 0)
+			ec->lvl_mw[i] = (uint64_t)amd_cppc_em_model_mw *
+			    ec->lvl_model[i] / ec->lvl_model[ec->nlevels - 1];
+		else
+			ec->lvl_mw[i] = (uint64_t)ec->lvl_meas[ref] *
+			    ec->lvl_model[i] / ec->lvl_model[ref];
+	}
+}
+
+/*
+ * Take one interval's counter deltas of a CPU into its model.
+ */
+static void
+amd_cppc_em_sample(struct amd_cppc_softc *sc, struct amd_cppc_em_cpu *ec,
+		   const struct amd_cppc_ctr *c)
+{
+	struct amd_cppc_req req;
+	uint64_t	da, dm, dt, uj, us;
+	uint32_t	mw;
+	int		best, i;
+
+	req.max_perf = (sc->req_shadow >> AMD_CPPC_MAX_PERF_SHIFT) & 0xFF;
+	req.min_perf = (sc->req_shadow >> AMD_CPPC_MIN_PERF_SHIFT) & 0xFF;
+	req.des_perf = (sc->req_shadow >> AMD_CPPC_DES_PERF_SHIFT) & 0xFF;
+	req.epp = (sc->req_shadow >> AMD_CPPC_EPP_PERF_SHIFT) & 0xFF;
+	ec->wake_mhz = amd_cppc_perf_to_mhz(sc, amd_cppc_req_opp(&req));
+
+	da = c->aperf - ec->last.aperf;
+	dm = c->mperf - ec->last.mperf;
+	dt = c->tsc - ec->last.tsc;
+	if (ec->primed && dt != 0 && dm != 0) {
+		ec->busy = (int)MIN(100, dm * 100 / dt);
+		ec->cur_mhz = (int)(da * ec->base_mhz / dm);
+		if (c->esu >= 0 && ec->last.esu >= 0 &&
+		    ec->busy >= amd_cppc_em_min_busy) {
+			uj = ((uint64_t)(c->energy - ec->last.energy) *
+			    1000000) >> c->esu;
+			us = dt * 1000000 / tsc_freq;
+			mw = (uint32_t)(uj * 1000 / MAX(us, 1) * 100 /
+			    ec->busy);
+			best = 0;
+			for (i = 1; i < ec->nlevels; i++)
+				if (abs(ec->lvl_mhz[i] - ec->cur_mhz) <
+				    abs(ec->lvl_mhz[best] - ec->cur_mhz))
+					best = i;
+			ec->lvl_meas[best] = ec->lvl_meas[best] == 0 ? mw :
+			    (ec->lvl_meas[best] * 3 + mw) / 4;
+			ec->lvl_samples[best]++;
+		}
+	}
+	ec->last = *c;
+	ec->primed = true;
+	amd_cppc_em_publish(ec);
+}
+
+static void
+amd_cppc_em_arm(void)
+{
+	int		ms;
+
+	sx_assert(&amd_cppc_lock, SA_LOCKED);
+	ms = amd_cppc_em_interval_ms;
+	if (!amd_cppc_em_ready || !amd_cppc_em || ms <= 0)
+		return;
+	taskqueue_enqueue_timeout(taskqueue_thread, &amd_cppc_em_task,
+				  MAX(1, (int)((int64_t)ms * hz / 1000)));
+}
+
+static void
+amd_cppc_em_task_fn(void *arg __unused, int pending __unused)
+{
+	struct amd_cppc_ctr *ctr;
+	struct amd_cppc_softc *sc;
+	int		cpu;
+
+	ctr = malloc(sizeof(*ctr) * (mp_maxid + 1), M_AMD_CPPC_EM,
+		     M_WAITOK | M_ZERO);
+	sx_slock(&amd_cppc_lock);
+	if (amd_cppc_em_ready && amd_cppc_em) {
+		smp_rendezvous(NULL, amd_cppc_ctr_read, NULL, ctr);
+		CPU_FOREACH(cpu) {
+			sc = amd_cppc_softc_get(cpu);
+			if (sc != NULL && amd_cppc_em_cpus[cpu].valid)
+				amd_cppc_em_sample(sc, &amd_cppc_em_cpus[cpu],
+						   &ctr[cpu]);
+		}
+		amd_cppc_em_arm();
+	}
+	sx_sunlock(&amd_cppc_lock);
+	free(ctr, M_AMD_CPPC_EM);
+}
+
+/*
+ * Energy model of a CPU: its perf levels with their power and its current
+ * operating point.
+ */
+int
+amd_cppc_em_get(int cpu, struct amd_cppc_em_state *st)
+{
+	struct amd_cppc_em_cpu *ec;
+	int		i;
+
+	if (cpu < 0 || cpu > mp_maxid)
+		return (EINVAL);
+	ec = &amd_cppc_em_cpus[cpu];
+	sx_slock(&amd_cppc_lock);
+	if (!ec->valid) {
+		sx_sunlock(&amd_cppc_lock);
+		return (ENXIO);
+	}
+	bzero(st, sizeof(*st));
+	st->cpu = cpu;
+	st->nlevels = ec->nlevels;
+	for (i = 0; i < ec->nlevels; i++) {
+		st->level[i].perf = ec->lvl_perf[i];
+		st->level[i].mhz = ec->lvl_mhz[i];
+		st->level[i].power_mw = ec->lvl_mw[i];
+		st->level[i].measured = ec->lvl_meas[i] != 0;
+	}
+	st->busy = ec->busy;
+	st->cur_mhz = ec->cur_mhz;
+	st->wake_mhz = ec->wake_mhz;
+	st->sampling = amd_cppc_em && ec->primed;
+	sx_sunlock(&amd_cppc_lock);
+	return (0);
+}
+
+/*
+ * Modelled power, in mW, that a thread using util percent of a CPU at base
+ * clock adds to cpu. -1 if the CPU is busier than busy_max.
+ */
+static int
+amd_cppc_em_delta(int cpu, int util, int busy_max, bool *running)
+{
+	struct amd_cppc_em_cpu *ec;
+	struct pcpu	*pc;
+	int		mhz, t;
+
+	ec = &amd_cppc_em_cpus[cpu];
+	if (!ec->valid || ec->nlevels == 0)
+		return (-1);
+	pc = pcpu_find(cpu);
+	*running = pc->pc_curthread != pc->pc_idlethread;
+	mhz = *running ? MAX(ec->cur_mhz, ec->lvl_mhz[0]) : ec->wake_mhz;
+	if (mhz <= 0)
+		return (-1);
+	t = util * ec->base_mhz / mhz;
+	if (*running && ec->busy + t > busy_max)
+		return (-1);
+	return (amd_cppc_em_power(ec, mhz) * t / 100 +
+	    (*running ? 0 : amd_cppc_em_wake_mw));
+}
+
+/*
+ * The CPU of mask, within the L3 group of cpu, where a thread of util
+ * percent adds the least power. Returns cpu unless another one saves at
+ * least em.margin_pct; *saved is the modelled saving in mW.
+ */
+int
+amd_cppc_em_pick(const cpuset_t *mask, int cpu, int util, int *saved)
+{
+	const struct amd_cppc_em_cpu *ec;
+	bool		running;
+	int		best, c, def, i, min;
+
+	*saved = 0;
+	ec = &amd_cppc_em_cpus[cpu];
+	if (!ec->valid ||
+	    (def = amd_cppc_em_delta(cpu, util, INT_MAX, &running)) < 0)
+		return (cpu);
+	best = cpu;
+	min = def;
+	CPU_FOREACH(i) {
+		if (i == cpu || !CPU_ISSET(i, mask) || !CPU_ISSET(i, &ec->llc))
+			continue;
+		c = amd_cppc_em_delta(i, util, amd_cppc_em_busy_max, &running);
+		if (c >= 0 && c < min) {
+			best = i;
+			min = c;
+		}
+	}
+	if (best == cpu ||
+	    (int64_t)min * 100 > (int64_t)def * (100 - amd_cppc_em_margin_pct))
+		return (cpu);
+	*saved = def - min;
+	return (best);
+}
+
+/*
+ * sched_pickcpu_hook: place a small waking thread by energy. Runs with the
+ * thread lock held, so it only reads the published model.
+ */
+static int
+amd_cppc_em_pickcpu(struct thread *td, int cpu)
+{
+	struct pcpu	*pc;
+	uint64_t	dt, max, t0;
+	int		best, saved, util;
+
+	util = sched_pctcpu(td) * 100 / FSCALE;
+	if (util >= amd_cppc_em_small_pct)
+		return (cpu);
+	t0 = rdtsc();
+	best = amd_cppc_em_pick(&td->td_cpuset->cs_mask, cpu, MAX(util, 1),
+				&saved);
+	if (best != cpu) {
+		pc = pcpu_find(best);
+		atomic_add_64(&amd_cppc_em_diverted, 1);
+		atomic_add_64(&amd_cppc_em_saved_mw, saved);
+		if (pc->pc_curthread != pc->pc_idlethread)
+			atomic_add_64(&amd_cppc_em_onto_busy, 1);
+	}
+	dt = rdtsc() - t0;
+	atomic_add_64(&amd_cppc_em_decisions, 1);
+	atomic_add_64(&amd_cppc_em_pick_cycles, dt);
+	do {
+		max = atomic_load_64(&amd_cppc_em_pick_max);
+	} while (dt > max &&
+	    !atomic_cmpset_64(&amd_cppc_em_pick_max, max, dt));
+	return (best);
+}
+
+/*
+ * Install or remove the wakeup hook. Once removed, no CPU is inside it any
+ * more.
+ */
+static int
+amd_cppc_em_hook_set(bool on)
+{
+	amd_cppc_em_hook_t * volatile *hookp;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	hookp = amd_cppc_em_hookp;
+	if (on) {
+		if (hookp == NULL)
+			hookp = (void *)linker_file_lookup_symbol(
+			    linker_kernel_file, "sched_pickcpu_hook", 0);
+		if (hookp == NULL)
+			return (ENODEV);	/* kernel without the patch */
+		amd_cppc_em_hookp = hookp;
+		if (*hookp == amd_cppc_em_pickcpu)
+			return (0);
+		if (!atomic_cmpset_ptr((volatile uintptr_t *)hookp,
+		    (uintptr_t)NULL, (uintptr_t)amd_cppc_em_pickcpu))
+			return (EBUSY);
+	} else {
+		if (hookp == NULL || *hookp != amd_cppc_em_pickcpu)
+			return (0);
+		atomic_store_rel_ptr((volatile uintptr_t *)hookp,
+				     (uintptr_t)NULL);
+		quiesce_all_cpus("cppcem", 0);
+	}
+	return (0);
+}
+
+static int
+amd_cppc_sysctl_em_enable(SYSCTL_HANDLER_ARGS)
+{
+	int		cpu, error, val;
+
+	val = amd_cppc_em;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	sx_xlock(&amd_cppc_lock);
+	if (val == 0)
+		(void)amd_cppc_em_hook_set(false);
+	else if (!amd_cppc_em)
+		for (cpu = 0; cpu <= mp_maxid; cpu++)
+			amd_cppc_em_cpus[cpu].primed = false;
+	amd_cppc_em = val != 0;
+	amd_cppc_em_arm();
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc_em, OID_AUTO, enable,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_em_enable, "I",
+	    "Sample power and operating points for the energy model");
+
+static int
+amd_cppc_sysctl_em_sched(SYSCTL_HANDLER_ARGS)
+{
+	int		error, val;
+
+	val = amd_cppc_em_hookp != NULL &&
+	    *amd_cppc_em_hookp == amd_cppc_em_pickcpu;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	sx_xlock(&amd_cppc_lock);
+	if (val != 0 && !amd_cppc_em)
+		error = ENXIO;		/* no model to decide with */
+	else
+		error = amd_cppc_em_hook_set(val != 0);
+	sx_xunlock(&amd_cppc_lock);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc_em, OID_AUTO, sched,
+	    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_em_sched, "I",
+	    "Place small waking threads on the cheapest CPU "
+	    "(needs a kernel with sched_pickcpu_hook)");
+
+static int
+amd_cppc_sysctl_em_stats(SYSCTL_HANDLER_ARGS)
+{
+	struct sbuf	sb;
+	uint64_t	dec, div;
+	int		error;
+
+	sbuf_new_for_sysctl(&sb, NULL, 160, req);
+	dec = amd_cppc_em_decisions;
+	div = amd_cppc_em_diverted;
+	sbuf_printf(&sb, "decisions %ju diverted %ju (%ju%%) "
+		    "saved_mw_avg %ju onto_running %ju pick_ns_avg %ju "
+		    "pick_ns_max %ju",
+		    (uintmax_t)dec, (uintmax_t)div,
+		    (uintmax_t)(dec != 0 ? div * 100 / dec : 0),
+		    (uintmax_t)(div != 0 ? amd_cppc_em_saved_mw / div : 0),
+		    (uintmax_t)amd_cppc_em_onto_busy,
+		    (uintmax_t)(dec != 0 ? amd_cppc_em_pick_cycles *
+		    1000000000 / tsc_freq / dec : 0),
+		    (uintmax_t)(amd_cppc_em_pick_max * 1000000000 / tsc_freq));
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc_em, OID_AUTO, stats,
+	    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_em_stats, "A",
+	    "Wakeup placement: diverted wakeups, modelled power saved per "
+	    "diverted wakeup, placements on running CPUs, time to choose");
+
+static int
+amd_cppc_sysctl_em_interval(SYSCTL_HANDLER_ARGS)
+{
+	int		error, ms;
+
+	ms = amd_cppc_em_interval_ms;
+	error = sysctl_handle_int(oidp, &ms, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (ms < 0)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_em_interval_ms = ms;
+	amd_cppc_em_arm();
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc_em, OID_AUTO, interval_ms,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_em_interval, "I",
+	    "Sampling interval in ms (0 = paused)");
+SYSCTL_INT(_hw_amd_cppc_em, OID_AUTO, min_busy, CTLFLAG_RWTUN,
+	   &amd_cppc_em_min_busy, 0,
+	   "C0 percent an interval needs to measure power");
+SYSCTL_INT(_hw_amd_cppc_em, OID_AUTO, model_mw, CTLFLAG_RWTUN,
+	   &amd_cppc_em_model_mw, 0,
+	   "Assumed core power at highest_perf without RAPL, mW");
+SYSCTL_INT(_hw_amd_cppc_em, OID_AUTO, wake_mw, CTLFLAG_RWTUN,
+	   &amd_cppc_em_wake_mw, 0, "Cost of waking an idle CPU, mW");
+SYSCTL_INT(_hw_amd_cppc_em, OID_AUTO, busy_max, CTLFLAG_RWTUN,
+	   &amd_cppc_em_busy_max, 0,
+	   "C0 percent above which a running CPU takes no more threads");
+SYSCTL_INT(_hw_amd_cppc_em, OID_AUTO, small_pct, CTLFLAG_RWTUN,
+	   &amd_cppc_em_small_pct, 0,
+	   "Threads below this %CPU are placed by energy");
+SYSCTL_INT(_hw_amd_cppc_em, OID_AUTO, margin_pct, CTLFLAG_RWTUN,
+	   &amd_cppc_em_margin_pct, 0,
+	   "Saving in percent needed to override the scheduler");
+
+static int
+amd_cppc_sysctl_energy_model(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_em_state st;
+	struct amd_cppc_softc *sc;
+	struct sbuf	sb;
+	int		error, i;
+
+	sc = arg1;
+	if ((error = amd_cppc_em_get(sc->cpu_id, &st)) != 0)
+		return (error);
+	sbuf_new_for_sysctl(&sb, NULL, 256, req);
+	for (i = 0; i < st.nlevels; i++)
+		sbuf_printf(&sb, "%d:%dMHz:%dmW%s ", st.level[i].perf,
+			    st.level[i].mhz, st.level[i].power_mw,
+			    st.level[i].measured ? "*" : "");
+	if (st.sampling)
+		sbuf_printf(&sb, "op %dMHz busy %d%% wake %dMHz",
+			    st.cur_mhz, st.busy, st.wake_mhz);
+	else
+		sbuf_printf(&sb, "op unknown (hw.amd_cppc.em.enable=0)");
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	return (error);
+}
+
+/*
+ * Clock and modelled cost of each level, from the current perf to MHz map.
+ */
+static void
+amd_cppc_em_map(struct amd_cppc_softc *sc, struct amd_cppc_em_cpu *ec)
+{
+	int		i;
+
+	for (i = 0; i < ec->nlevels; i++) {
+		ec->lvl_mhz[i] = amd_cppc_perf_to_mhz(sc, ec->lvl_perf[i]);
+		ec->lvl_model[i] = (int)MAX(1,
+		    amd_cppc_model_energy(sc, ec->lvl_perf[i]) *
+		    ec->lvl_mhz[i] / 1000);
+	}
+	amd_cppc_em_publish(ec);
+}
+
+/*
+ * The perf to MHz map of a CPU changed; measurements stay with their perf
+ * level.
+ */
+void
+amd_cppc_em_remap(struct amd_cppc_softc *sc)
+{
+	struct amd_cppc_em_cpu *ec;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	ec = &amd_cppc_em_cpus[sc->cpu_id];
+	if (ec->valid)
+		amd_cppc_em_map(sc, ec);
+}
+
+void
+amd_cppc_em_attach(struct amd_cppc_softc *sc)
+{
+	struct amd_cppc_em_cpu *ec;
+	int		i, n;
+
+	ec = &amd_cppc_em_cpus[sc->cpu_id];
+	sx_xlock(&amd_cppc_lock);
+	bzero(ec, sizeof(*ec));
+	amd_cppc_topo_group(sc->cpu_id, CG_SHARE_L3, &ec->llc);
+	ec->base_mhz = sc->base_freq_mhz;
+	ec->nominal_perf = sc->nominal_perf;
+	n = MIN(AMD_CPPC_EM_LEVELS, sc->highest_perf - sc->lowest_perf + 1);
+	for (i = 0; i < n; i++)
+		ec->lvl_perf[i] = n == 1 ? sc->highest_perf : sc->lowest_perf +
+		    (sc->highest_perf - sc->lowest_perf) * i / (n - 1);
+	ec->nlevels = n;
+	amd_cppc_em_map(sc, ec);
+	ec->wake_mhz = ec->lvl_mhz[n - 1];
+	ec->valid = 1;
+	sx_xunlock(&amd_cppc_lock);
+
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(sc->dev),
+			SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+			OID_AUTO, "energy_model",
+			CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, sc, 0,
+			amd_cppc_sysctl_energy_model, "A",
+			"perf:MHz:mW of each level (* = measured), "
+			"operating point");
+}
+
+void
+amd_cppc_em_detach(struct amd_cppc_softc *sc)
+{
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	amd_cppc_em_cpus[sc->cpu_id].valid = 0;
+}
+
+void
+amd_cppc_em_init(void)
+{
+
+	TIMEOUT_TASK_INIT(taskqueue_thread, &amd_cppc_em_task, 0,
+			  amd_cppc_em_task_fn, NULL);
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_em_ready = true;
+	amd_cppc_em_arm();
+	sx_xunlock(&amd_cppc_lock);
+}
+
+void
+amd_cppc_em_fini(void)
+{
+
+	sx_xlock(&amd_cppc_lock);
+	(void)amd_cppc_em_hook_set(false);
+	amd_cppc_em_ready = false;
+	sx_xunlock(&amd_cppc_lock);
+	taskqueue_drain_timeout(taskqueue_thread, &amd_cppc_em_task);
+}
@@ -0,0 +1,573 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Per-process and per-jail energy accounting.
+ *
+ * CPU time alone does not say what a workload cost when clocks and power
+ * differ from core to core. With hw.amd_cppc.energy enabled, every CPU
+ * samples the RAPL core energy counter and APERF/MPERF each energy.ticks
+ * ticks (10 by default, so idle cores are not woken on every tick) from a
+ * direct callout, and charges the deltas since the previous
+ * sample to the thread the tick interrupted: to its process and to its
+ * jail. Sampling on the tick is statistical, like CPU time accounting;
+ * a module has no hook in the context switch path.
+ *
+ * The core energy counter is shared by SMT siblings. Each sibling swaps
+ * its reading into a per-core slot and is charged only the energy since
+ * the last reading of either, so the core's energy is not counted twice.
+ *
+ * Each CPU keeps its own tables under a spin lock that only its callout
+ * and the readers take. The table of CPUs has a lock of its own, so fork
+ * and exit never wait for the driver lock. A full table charges into an
+ * "other" entry. Process entries are dropped at exit and at fork of a new
+ * pid, so a reused pid starts from zero; jail entries are kept.
+ *
+ *	hw.amd_cppc.energy.procs	pid, jid, joules, average MHz while
+ *					running, samples
+ *	hw.amd_cppc.energy.jails	jid, joules, average MHz, samples
+ *	hw.amd_cppc.energy.overhead	time spent sampling
+ *
+ * Jailed readers only see their own jail.
+ */
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/callout.h>
+#include <sys/eventhandler.h>
+#include <sys/jail.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/mutex.h>
+#include <sys/pcpu.h>
+#include <sys/proc.h>
+#include <sys/sbuf.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+#include <sys/ucred.h>
+
+#include <machine/atomic.h>
+#include <machine/cpufunc.h>
+#include <machine/md_var.h>
+#include <machine/specialreg.h>
+
+#include "amd_cppc_var.h"
+
+#define MSR_AMD_RAPL_PWR_UNIT		0xC0010299
+#define MSR_AMD_CORE_ENERGY		0xC001029A
+#define AMD_RAPL_ESU(x)			(((x) >> 8) & 0x1F)
+
+#define AMD_CPPC_ENERGY_PROCS		512	/* power of 2 */
+#define AMD_CPPC_ENERGY_JAILS		32	/* power of 2 */
+#define AMD_CPPC_ENERGY_MERGED		4096	/* power of 2 */
+
+#define AMD_CPPC_ENERGY_EMPTY		(-1)
+#define AMD_CPPC_ENERGY_DEAD		(-2)
+#define AMD_CPPC_ENERGY_OTHER		(-3)
+
+static MALLOC_DEFINE(M_AMD_CPPC_ENERGY, "amd_cppc_energy",
+		     "AMD CPPC energy accounting");
+
+struct amd_cppc_energy_ent {
+	int		id;		/* pid or jid */
+	int		jid;
+	uint64_t	energy;		/* RAPL energy units */
+	uint64_t	aperf;
+	uint64_t	mperf;
+	uint64_t	samples;
+};
+
+struct amd_cppc_energy_cpu {
+	struct mtx	mtx;
+	struct callout	callout;
+	int		cpu;
+	int		core;
+	bool		primed;
+	uint64_t	aperf;		/* last readings */
+	uint64_t	mperf;
+	uint64_t	samples;
+	uint64_t	cycles;		/* TSC cycles spent sampling */
+	uint64_t	tsc0;		/* when sampling started */
+	struct amd_cppc_energy_ent procs[AMD_CPPC_ENERGY_PROCS];
+	struct amd_cppc_energy_ent jails[AMD_CPPC_ENERGY_JAILS];
+	struct amd_cppc_energy_ent other_proc;
+	struct amd_cppc_energy_ent other_jail;
+};
+
+static int	amd_cppc_energy = 0;
+static int	amd_cppc_energy_ticks = 10;
+static int	amd_cppc_energy_esu = -1;	/* -1 = no RAPL */
+static int	amd_cppc_energy_mhz;		/* MPERF rate */
+static struct amd_cppc_energy_cpu *amd_cppc_energy_cpus[MAXCPU];
+static volatile u_int amd_cppc_energy_core[MAXCPU];
+static eventhandler_tag amd_cppc_energy_exit_tag;
+static eventhandler_tag amd_cppc_energy_fork_tag;
+
+/*
+ * Protects amd_cppc_energy_cpus[]; changed with amd_cppc_lock also held,
+ * so the driver may walk it under either.
+ */
+static struct sx amd_cppc_energy_lock;
+SX_SYSINIT(amd_cppc_energy_lock, &amd_cppc_energy_lock, "amd_cppc_energy");
+
+static SYSCTL_NODE(_hw_amd_cppc, OID_AUTO, energy,
+		   CTLFLAG_RD | CTLFLAG_MPSAFE, NULL,
+		   "Per-process and per-jail energy accounting");
+
+static void
+amd_cppc_energy_reset(struct amd_cppc_energy_ent *tab, int n)
+{
+	int		i;
+
+	for (i = 0; i < n; i++) {
+		bzero(&tab[i], sizeof(tab[i]));
+		tab[i].id = AMD_CPPC_ENERGY_EMPTY;
+	}
+}
+
+/*
+ * Find the entry for id in an open addressed table of n entries, creating
+ * it if asked to. Returns NULL if it is not there or the table is full.
+ */
+static struct amd_cppc_energy_ent *
+amd_cppc_energy_slot(struct amd_cppc_energy_ent *tab, int n, int id,
+		     bool create)
+{
+	struct amd_cppc_energy_ent *e, *dead;
+	u_int		h;
+	int		i;
+
+	dead = NULL;
+	h = (u_int)id * 2654435761u;
+	for (i = 0; i < n; i++) {
+		e = &tab[(h + i) & (n - 1)];
+		if (e->id == id)
+			return (e);
+		if (e->id == AMD_CPPC_ENERGY_EMPTY)
+			break;
+		if (e->id == AMD_CPPC_ENERGY_DEAD && dead == NULL)
+			dead = e;
+	}
+	if (!create)
+		return (NULL);
+	if (dead == NULL) {
+		if (i == n)
+			return (NULL);
+		dead = e;
+	}
+	bzero(dead, sizeof(*dead));
+	dead->id = id;
+	return (dead);
+}
+
+static void
+amd_cppc_energy_charge(struct amd_cppc_energy_ent *e, int jid,
+		       uint64_t energy, uint64_t aperf, uint64_t mperf)
+{
+
+	e->jid = jid;
+	e->energy += energy;
+	e->aperf += aperf;
+	e->mperf += mperf;
+	e->samples++;
+}
+
+static void
+amd_cppc_energy_tick(void *arg)
+{
+	struct amd_cppc_energy_cpu *ec;
+	struct amd_cppc_energy_ent *e;
+	struct thread	*td;
+	volatile u_int	*slot;
+	uint64_t	a, m, da, dm, t0;
+	uint32_t	de, last, now;
+	int		jid, pid;
+
+	ec = arg;
+	t0 = rdtsc();
+	td = curthread;
+	a = rdmsr(MSR_APERF);
+	m = rdmsr(MSR_MPERF);
+	de = 0;
+	if (amd_cppc_energy_esu >= 0) {
+		now = (uint32_t)rdmsr(MSR_AMD_CORE_ENERGY);
+		slot = &amd_cppc_energy_core[ec->core];
+		do {
+			last = *slot;
+			if (last == 0 || (int32_t)(now - last) <= 0) {
+				/* First reading, or a sibling read later. */
+				if (last == 0)
+					atomic_cmpset_int(slot, 0, now);
+				de = 0;
+				break;
+			}
+			de = now - last;
+		} while (!atomic_cmpset_int(slot, last, now));
+	}
+	da = a - ec->aperf;
+	dm = m - ec->mperf;
+	ec->aperf = a;
+	ec->mperf = m;
+
+	if (ec->primed) {
+		pid = td->td_proc->p_pid;
+		jid = td->td_ucred->cr_prison->pr_id;
+		mtx_lock_spin(&ec->mtx);
+		e = amd_cppc_energy_slot(ec->procs, AMD_CPPC_ENERGY_PROCS,
+					 pid, true);
+		amd_cppc_energy_charge(e != NULL ? e : &ec->other_proc, jid,
+				       de, da, dm);
+		e = amd_cppc_energy_slot(ec->jails, AMD_CPPC_ENERGY_JAILS,
+					 jid, true);
+		amd_cppc_energy_charge(e != NULL ? e : &ec->other_jail, jid,
+				       de, da, dm);
+		ec->samples++;
+		ec->cycles += rdtsc() - t0;
+		mtx_unlock_spin(&ec->mtx);
+	}
+	ec->primed = true;
+
+	if (amd_cppc_energy)
+		callout_reset_sbt_on(&ec->callout,
+		    tick_sbt * MAX(1, amd_cppc_energy_ticks), 0,
+		    amd_cppc_energy_tick, ec, ec->cpu, C_DIRECT_EXEC);
+}
+
+static void
+amd_cppc_energy_start(struct amd_cppc_energy_cpu *ec)
+{
+
+	ec->primed = false;
+	ec->tsc0 = rdtsc();
+	ec->samples = ec->cycles = 0;
+	callout_reset_sbt_on(&ec->callout, tick_sbt, 0, amd_cppc_energy_tick,
+			     ec, ec->cpu, C_DIRECT_EXEC);
+}
+
+/*
+ * Drop a pid from every CPU's table.
+ */
+static void
+amd_cppc_energy_forget(pid_t pid)
+{
+	struct amd_cppc_energy_cpu *ec;
+	struct amd_cppc_energy_ent *e;
+	int		cpu;
+
+	if (!amd_cppc_energy)
+		return;
+	sx_slock(&amd_cppc_energy_lock);
+	CPU_FOREACH(cpu) {
+		if ((ec = amd_cppc_energy_cpus[cpu]) == NULL)
+			continue;
+		mtx_lock_spin(&ec->mtx);
+		e = amd_cppc_energy_slot(ec->procs, AMD_CPPC_ENERGY_PROCS,
+					 pid, false);
+		if (e != NULL)
+			e->id = AMD_CPPC_ENERGY_DEAD;
+		mtx_unlock_spin(&ec->mtx);
+	}
+	sx_sunlock(&amd_cppc_energy_lock);
+}
+
+static void
+amd_cppc_energy_exit(void *arg __unused, struct proc *p)
+{
+
+	amd_cppc_energy_forget(p->p_pid);
+}
+
+static void
+amd_cppc_energy_fork(void *arg __unused, struct proc *p1 __unused,
+		     struct proc *p2, int flags __unused)
+{
+
+	amd_cppc_energy_forget(p2->p_pid);
+}
+
+static int
+amd_cppc_sysctl_energy(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_energy_cpu *ec;
+	int		cpu, error, val;
+
+	val = amd_cppc_energy;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	val = val != 0;
+	sx_xlock(&amd_cppc_lock);
+	if (val != amd_cppc_energy) {
+		amd_cppc_energy = val;
+		CPU_FOREACH(cpu) {
+			if ((ec = amd_cppc_energy_cpus[cpu]) == NULL)
+				continue;
+			if (val)
+				amd_cppc_energy_start(ec);
+			else
+				callout_drain(&ec->callout);
+		}
+	}
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc_energy, OID_AUTO, enable,
+	    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_energy, "I",
+	    "Sample energy and clocks on the tick, charged to processes");
+
+SYSCTL_INT(_hw_amd_cppc_energy, OID_AUTO, ticks, CTLFLAG_RWTUN,
+	   &amd_cppc_energy_ticks, 0, "Ticks between samples");
+
+/*
+ * Sum the per-CPU tables into one. Entries of other jails are left out
+ * for jailed readers.
+ */
+static void
+amd_cppc_energy_merge(bool jails, struct prison *pr,
+		      struct amd_cppc_energy_ent *out, int nout,
+		      struct amd_cppc_energy_ent *other)
+{
+	struct amd_cppc_energy_cpu *ec;
+	struct amd_cppc_energy_ent *src, *e;
+	int		cpu, i, n;
+
+	n = jails ? AMD_CPPC_ENERGY_JAILS : AMD_CPPC_ENERGY_PROCS;
+	src = malloc((n + 1) * sizeof(*src), M_AMD_CPPC_ENERGY, M_WAITOK);
+	amd_cppc_energy_reset(out, nout);
+	bzero(other, sizeof(*other));
+	other->id = AMD_CPPC_ENERGY_OTHER;
+
+	sx_slock(&amd_cppc_energy_lock);
+	CPU_FOREACH(cpu) {
+		if ((ec = amd_cppc_energy_cpus[cpu]) == NULL)
+			continue;
+		mtx_lock_spin(&ec->mtx);
+		memcpy(src, jails ? ec->jails : ec->procs, n * sizeof(*src));
+		src[n] = jails ? ec->other_jail : ec->other_proc;
+		mtx_unlock_spin(&ec->mtx);
+
+		for (i = 0; i <= n; i++) {
+			if (src[i].samples == 0 || (i < n && src[i].id < 0))
+				continue;
+			if (pr != NULL && (i == n || src[i].jid != pr->pr_id))
+				continue;
+			e = i < n ? amd_cppc_energy_slot(out, nout, src[i].id,
+			    true) : NULL;
+			if (e == NULL)
+				e = other;
+			e->jid = src[i].jid;
+			e->energy += src[i].energy;
+			e->aperf += src[i].aperf;
+			e->mperf += src[i].mperf;
+			e->samples += src[i].samples;
+		}
+	}
+	sx_sunlock(&amd_cppc_energy_lock);
+	free(src, M_AMD_CPPC_ENERGY);
+}
+
+static void
+amd_cppc_energy_print(struct sbuf *sb, const struct amd_cppc_energy_ent *e,
+		      bool jails)
+{
+	uint64_t	a, m, j, uj, mhz;
+	int		esu;
+
+	esu = MAX(amd_cppc_energy_esu, 0);
+	j = e->energy >> esu;
+	uj = ((e->energy & ((1ULL << esu) - 1)) * 1000000) >> esu;
+
+	/* Delivered clock is the MPERF rate scaled by APERF/MPERF. */
+	a = e->aperf;
+	m = e->mperf;
+	while (a > UINT64_MAX / (uint64_t)amd_cppc_energy_mhz) {
+		a >>= 1;
+		m >>= 1;
+	}
+	mhz = m != 0 ? a * amd_cppc_energy_mhz / m : 0;
+	if (e->id == AMD_CPPC_ENERGY_OTHER)
+		sbuf_printf(sb, "other");
+	else if (jails)
+		sbuf_printf(sb, "jid %d", e->id);
+	else
+		sbuf_printf(sb, "pid %d jid %d", e->id, e->jid);
+	sbuf_printf(sb, " joules %ju.%06ju mhz %ju samples %ju\n",
+		    (uintmax_t)j, (uintmax_t)uj, (uintmax_t)mhz,
+		    (uintmax_t)e->samples);
+}
+
+static int
+amd_cppc_sysctl_energy_table(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_energy_ent *tab, other;
+	struct prison	*pr;
+	struct sbuf	sb;
+	bool		jails;
+	int		error, i, n;
+
+	jails = arg2 != 0;
+	n = jails ? AMD_CPPC_ENERGY_JAILS : AMD_CPPC_ENERGY_MERGED;
+	pr = jailed(req->td->td_ucred) ? req->td->td_ucred->cr_prison : NULL;
+	tab = malloc(n * sizeof(*tab), M_AMD_CPPC_ENERGY, M_WAITOK);
+	amd_cppc_energy_merge(jails, pr, tab, n, &other);
+
+	sbuf_new_for_sysctl(&sb, NULL, 4096, req);
+	for (i = 0; i < n; i++)
+		if (tab[i].id >= 0)
+			amd_cppc_energy_print(&sb, &tab[i], jails);
+	if (other.samples != 0)
+		amd_cppc_energy_print(&sb, &other, jails);
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	free(tab, M_AMD_CPPC_ENERGY);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc_energy, OID_AUTO, procs,
+	    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE | CTLFLAG_PRISON,
+	    NULL, 0, amd_cppc_sysctl_energy_table, "A",
+	    "Energy and average clock per process");
+SYSCTL_PROC(_hw_amd_cppc_energy, OID_AUTO, jails,
+	    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE | CTLFLAG_PRISON,
+	    NULL, 1, amd_cppc_sysctl_energy_table, "A",
+	    "Energy and average clock per jail");
+
+/*
+ * Sampling cost: samples taken, average time per sample and the share of
+ * CPU time spent sampling in parts per million.
+ */
+static int
+amd_cppc_sysctl_energy_overhead(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_energy_cpu *ec;
+	struct sbuf	sb;
+	uint64_t	cycles, elapsed, now, samples;
+	int		cpu, error;
+
+	cycles = elapsed = samples = 0;
+	now = rdtsc();
+	sx_slock(&amd_cppc_energy_lock);
+	CPU_FOREACH(cpu) {
+		if ((ec = amd_cppc_energy_cpus[cpu]) == NULL)
+			continue;
+		mtx_lock_spin(&ec->mtx);
+		cycles += ec->cycles;
+		samples += ec->samples;
+		if (amd_cppc_energy)
+			elapsed += now - ec->tsc0;
+		mtx_unlock_spin(&ec->mtx);
+	}
+	sx_sunlock(&amd_cppc_energy_lock);
+
+	sbuf_new_for_sysctl(&sb, NULL, 128, req);
+	sbuf_printf(&sb, "samples %ju sample_ns %ju overhead_ppm %ju",
+		    (uintmax_t)samples,
+		    (uintmax_t)(samples != 0 ?
+		    cycles * 1000 / (tsc_freq / 1000000) / samples : 0),
+		    (uintmax_t)(elapsed != 0 ?
+		    cycles / (elapsed / 1000000 + 1) : 0));
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc_energy, OID_AUTO, overhead,
+	    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_energy_overhead, "A",
+	    "Time spent sampling");
+
+void
+amd_cppc_energy_attach(struct amd_cppc_softc *sc)
+{
+	struct amd_cppc_energy_cpu *ec;
+	uint64_t	unit;
+
+	ec = malloc(sizeof(*ec), M_AMD_CPPC_ENERGY, M_WAITOK | M_ZERO);
+	mtx_init(&ec->mtx, "amd_cppc_energy", NULL, MTX_SPIN);
+	callout_init(&ec->callout, 1);
+	ec->cpu = sc->cpu_id;
+	ec->core = sc->cpu_id / MAX(1, smp_threads_per_core);
+	amd_cppc_energy_reset(ec->procs, AMD_CPPC_ENERGY_PROCS);
+	amd_cppc_energy_reset(ec->jails, AMD_CPPC_ENERGY_JAILS);
+	ec->other_proc.id = ec->other_jail.id = AMD_CPPC_ENERGY_OTHER;
+
+	sx_xlock(&amd_cppc_lock);
+	if (amd_cppc_energy_mhz == 0)
+		amd_cppc_energy_mhz = MAX(1, sc->base_freq_mhz);
+	if (amd_cppc_energy_esu < 0) {
+		amd_cppc_bind_cpu(sc->cpu_id);
+		if (rdmsr_safe(MSR_AMD_RAPL_PWR_UNIT, &unit) == 0 &&
+		    rdmsr_safe(MSR_AMD_CORE_ENERGY, &unit) == 0) {
+			unit = rdmsr(MSR_AMD_RAPL_PWR_UNIT);
+			amd_cppc_energy_esu = AMD_RAPL_ESU(unit);
+		}
+		amd_cppc_unbind_cpu();
+	}
+	sx_xlock(&amd_cppc_energy_lock);
+	amd_cppc_energy_cpus[sc->cpu_id] = ec;
+	sx_xunlock(&amd_cppc_energy_lock);
+	if (amd_cppc_energy)
+		amd_cppc_energy_start(ec);
+	sx_xunlock(&amd_cppc_lock);
+}
+
+void
+amd_cppc_energy_detach(struct amd_cppc_softc *sc)
+{
+	struct amd_cppc_energy_cpu *ec;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	if ((ec = amd_cppc_energy_cpus[sc->cpu_id]) == NULL)
+		return;
+	callout_drain(&ec->callout);
+	sx_xlock(&amd_cppc_energy_lock);
+	amd_cppc_energy_cpus[sc->cpu_id] = NULL;
+	sx_xunlock(&amd_cppc_energy_lock);
+	mtx_destroy(&ec->mtx);
+	free(ec, M_AMD_CPPC_ENERGY);
+}
+
+void
+amd_cppc_energy_init(void)
+{
+
+	amd_cppc_energy_exit_tag = EVENTHANDLER_REGISTER(process_exit,
+	    amd_cppc_energy_exit, NULL, EVENTHANDLER_PRI_ANY);
+	amd_cppc_energy_fork_tag = EVENTHANDLER_REGISTER(process_fork,
+	    amd_cppc_energy_fork, NULL, EVENTHANDLER_PRI_ANY);
+}
+
+void
+amd_cppc_energy_fini(void)
+{
+
+	EVENTHANDLER_DEREGISTER(process_exit, amd_cppc_energy_exit_tag);
+	EVENTHANDLER_DEREGISTER(process_fork, amd_cppc_energy_fork_tag);
+}
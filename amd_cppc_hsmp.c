@@ -0,0 +1,490 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * HSMP mailbox client.
+ *
+ * The message code at the top of this file is portable, see
+ * amd_cppc_hsmp.h. The kernel part reaches the mailbox of each socket
+ * through amdsmn(4) and exposes the socket power cap, power telemetry and
+ * data fabric P-state under hw.amd_cppc.hsmp.N and a per-core boost limit
+ * under dev.amd_cppc.N.hsmp_boost_limit.
+ */
+
+#include <sys/param.h>
+#ifdef _KERNEL
+#include <sys/bus.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/module.h>
+#include <sys/pcpu.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+
+#include <machine/cpufunc.h>
+#include <machine/md_var.h>
+#include <machine/specialreg.h>
+
+#include <dev/amdsmn/amdsmn.h>
+#include <dev/pci/pcivar.h>
+
+#include "amd_cppc_var.h"
+#include "amd_cppc_quirk.h"
+#else
+#include <errno.h>
+#include <stdint.h>
+#endif
+
+#include "amd_cppc_hsmp.h"
+
+#ifndef nitems
+#define nitems(x)	(sizeof(x) / sizeof((x)[0]))
+#endif
+
+/* Argument and response register counts of each message */
+static const struct {
+	uint32_t	msg;
+	uint8_t		nargs;
+	uint8_t		nresp;
+} amd_cppc_hsmp_msgs[] = {
+	{ AMD_CPPC_HSMP_TEST,				1, 1 },
+	{ AMD_CPPC_HSMP_GET_SMU_VER,			0, 1 },
+	{ AMD_CPPC_HSMP_GET_PROTO_VER,			0, 1 },
+	{ AMD_CPPC_HSMP_GET_SOCKET_POWER,		0, 1 },
+	{ AMD_CPPC_HSMP_SET_SOCKET_POWER_LIMIT,		1, 0 },
+	{ AMD_CPPC_HSMP_GET_SOCKET_POWER_LIMIT,		0, 1 },
+	{ AMD_CPPC_HSMP_GET_SOCKET_POWER_LIMIT_MAX,	0, 1 },
+	{ AMD_CPPC_HSMP_SET_BOOST_LIMIT,		1, 0 },
+	{ AMD_CPPC_HSMP_SET_BOOST_LIMIT_SOCKET,		1, 0 },
+	{ AMD_CPPC_HSMP_GET_BOOST_LIMIT,		1, 1 },
+	{ AMD_CPPC_HSMP_SET_DF_PSTATE,			1, 0 },
+	{ AMD_CPPC_HSMP_SET_AUTO_DF_PSTATE,		0, 0 },
+};
+
+/*
+ * Send one message. args holds the message arguments on entry and the
+ * response values on return. Returns 0, ETIMEDOUT if the SMU never
+ * answered, or an errno matching the SMU's status.
+ */
+int
+amd_cppc_hsmp_send(struct amd_cppc_hsmp *h, uint32_t msg, uint32_t *args)
+{
+	const struct amd_cppc_hsmp_ops *ops;
+	uint32_t	resp;
+	u_int		i, nargs, nresp, step, waited;
+	int		error;
+
+	for (i = 0; i < nitems(amd_cppc_hsmp_msgs); i++)
+		if (amd_cppc_hsmp_msgs[i].msg == msg)
+			break;
+	if (i == nitems(amd_cppc_hsmp_msgs))
+		return (EINVAL);
+	nargs = amd_cppc_hsmp_msgs[i].nargs;
+	nresp = amd_cppc_hsmp_msgs[i].nresp;
+	ops = h->ops;
+
+	error = ops->smn_write(h->ctx, AMD_CPPC_HSMP_SMN_MSG_RESP,
+			       AMD_CPPC_HSMP_RESP_NONE);
+	for (i = 0; error == 0 && i < nargs; i++)
+		error = ops->smn_write(h->ctx,
+				       AMD_CPPC_HSMP_SMN_MSG_ARG + i * 4, args[i]);
+	if (error == 0)
+		error = ops->smn_write(h->ctx, AMD_CPPC_HSMP_SMN_MSG_ID, msg);
+	if (error != 0)
+		return (error);
+
+	/* Most messages complete in microseconds; back off up to 1 ms. */
+	resp = AMD_CPPC_HSMP_RESP_NONE;
+	for (step = 10, waited = 0; waited < h->timeout_us; waited += step,
+	    step = step < 1000 ? step * 2 : 1000) {
+		ops->delay(h->ctx, step);
+		error = ops->smn_read(h->ctx, AMD_CPPC_HSMP_SMN_MSG_RESP, &resp);
+		if (error != 0)
+			return (error);
+		if (resp != AMD_CPPC_HSMP_RESP_NONE)
+			break;
+	}
+
+	switch (resp) {
+	case AMD_CPPC_HSMP_RESP_OK:
+		break;
+	case AMD_CPPC_HSMP_RESP_NONE:
+		return (ETIMEDOUT);
+	case AMD_CPPC_HSMP_RESP_BUSY:
+		return (EBUSY);
+	case AMD_CPPC_HSMP_RESP_PREREQ:
+	case AMD_CPPC_HSMP_RESP_INVALID_ARGS:
+		return (EINVAL);
+	case AMD_CPPC_HSMP_RESP_INVALID_MSG:
+		return (EOPNOTSUPP);
+	default:
+		return (EIO);
+	}
+
+	for (i = 0; i < nresp; i++) {
+		error = ops->smn_read(h->ctx,
+				      AMD_CPPC_HSMP_SMN_MSG_ARG + i * 4, &args[i]);
+		if (error != 0)
+			return (error);
+	}
+	return (0);
+}
+
+#ifdef _KERNEL
+
+#define AMD_CPPC_HSMP_SOCKETS	8
+#define AMD_CPPC_HSMP_TIMEOUT_US 500000
+#define AMD_CPPC_HSMP_PROBE_US	20000	/* keep attach quick without HSMP */
+
+#define CPUID_AMD_NODE_ID	0x8000001E
+
+/* Data fabric function 0 of node N is at PCI 0:(0x18 + N):0. */
+#define AMD_CPPC_HSMP_DF_SLOT		0x18
+#define AMD_CPPC_HSMP_DF_CFGADDRCNTL	0x84	/* family 19h */
+#define AMD_CPPC_HSMP_DF_CFGADDRCNTL_1A	0xC00
+
+/* Socket selectors for amd_cppc_sysctl_hsmp_socket() */
+#define AMD_CPPC_HSMP_POWER		0
+#define AMD_CPPC_HSMP_POWER_LIMIT	1
+#define AMD_CPPC_HSMP_POWER_LIMIT_MAX	2
+#define AMD_CPPC_HSMP_SMU_VER		3
+#define AMD_CPPC_HSMP_PROTO_VER		4
+
+struct amd_cppc_hsmp_sock {
+	bool		probed;
+	bool		present;
+	device_t	smn;
+	struct amd_cppc_hsmp mb;
+	int		df_pstate;	/* -1 = automatic */
+};
+
+/*
+ * Mailbox traffic is serialized by its own lock: a message can take
+ * milliseconds and must not hold up request updates.
+ */
+static struct sx amd_cppc_hsmp_lock;
+SX_SYSINIT(amd_cppc_hsmp_lock, &amd_cppc_hsmp_lock, "amd_cppc_hsmp");
+
+static struct amd_cppc_hsmp_sock amd_cppc_hsmp_socks[AMD_CPPC_HSMP_SOCKETS];
+static struct sysctl_ctx_list amd_cppc_hsmp_ctx;
+static bool	amd_cppc_hsmp_ctx_init;
+
+static SYSCTL_NODE(_hw_amd_cppc, OID_AUTO, hsmp, CTLFLAG_RD | CTLFLAG_MPSAFE,
+		   NULL, "EPYC Host System Management Port");
+
+static int	amd_cppc_hsmp_enable = 1;
+SYSCTL_INT(_hw_amd_cppc_hsmp, OID_AUTO, enable, CTLFLAG_RDTUN,
+	   &amd_cppc_hsmp_enable, 0, "Use the HSMP mailbox when present");
+
+static int
+amd_cppc_hsmp_smn_read(void *ctx, uint32_t addr, uint32_t *val)
+{
+
+	return (amdsmn_read(ctx, addr, val));
+}
+
+static int
+amd_cppc_hsmp_smn_write(void *ctx, uint32_t addr, uint32_t val)
+{
+
+	return (amdsmn_write(ctx, addr, val));
+}
+
+static void
+amd_cppc_hsmp_delay(void *ctx __unused, u_int us)
+{
+
+	if (us < 100)
+		DELAY(us);
+	else
+		pause_sbt("hsmp", us * SBT_1US, 0, C_PREL(2));
+}
+
+static const struct amd_cppc_hsmp_ops amd_cppc_hsmp_kops = {
+	.smn_read = amd_cppc_hsmp_smn_read,
+	.smn_write = amd_cppc_hsmp_smn_write,
+	.delay = amd_cppc_hsmp_delay,
+};
+
+static int
+amd_cppc_hsmp_call(int socket, uint32_t msg, uint32_t *args)
+{
+	int		error;
+
+	sx_xlock(&amd_cppc_hsmp_lock);
+	error = amd_cppc_hsmp_send(&amd_cppc_hsmp_socks[socket].mb, msg, args);
+	sx_xunlock(&amd_cppc_hsmp_lock);
+	return (error);
+}
+
+static int
+amd_cppc_sysctl_hsmp_socket(SYSCTL_HANDLER_ARGS)
+{
+	static const uint32_t get[] = {
+		[AMD_CPPC_HSMP_POWER] = AMD_CPPC_HSMP_GET_SOCKET_POWER,
+		[AMD_CPPC_HSMP_POWER_LIMIT] =
+		    AMD_CPPC_HSMP_GET_SOCKET_POWER_LIMIT,
+		[AMD_CPPC_HSMP_POWER_LIMIT_MAX] =
+		    AMD_CPPC_HSMP_GET_SOCKET_POWER_LIMIT_MAX,
+		[AMD_CPPC_HSMP_SMU_VER] = AMD_CPPC_HSMP_GET_SMU_VER,
+		[AMD_CPPC_HSMP_PROTO_VER] = AMD_CPPC_HSMP_GET_PROTO_VER,
+	};
+	uint32_t	args[AMD_CPPC_HSMP_MAX_ARGS];
+	u_int		val;
+	int		error, socket, what;
+
+	socket = (intptr_t)arg1;
+	what = arg2;
+	args[0] = 0;
+	error = amd_cppc_hsmp_call(socket, get[what], args);
+	if (error != 0)
+		return (error);
+	val = args[0];
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (what != AMD_CPPC_HSMP_POWER_LIMIT)
+		return (EPERM);
+
+	args[0] = val;
+	return (amd_cppc_hsmp_call(socket,
+	    AMD_CPPC_HSMP_SET_SOCKET_POWER_LIMIT, args));
+}
+
+/*
+ * The SMU cannot report the fabric P-state, so the last one set is shown.
+ */
+static int
+amd_cppc_sysctl_hsmp_df_pstate(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_hsmp_sock *s;
+	uint32_t	args[AMD_CPPC_HSMP_MAX_ARGS];
+	int		error, val;
+
+	s = &amd_cppc_hsmp_socks[(intptr_t)arg1];
+	val = s->df_pstate;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val < -1 || val >= AMD_CPPC_HSMP_DF_PSTATES)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_hsmp_lock);
+	args[0] = val;
+	error = amd_cppc_hsmp_send(&s->mb, val < 0 ?
+	    AMD_CPPC_HSMP_SET_AUTO_DF_PSTATE : AMD_CPPC_HSMP_SET_DF_PSTATE,
+	    args);
+	if (error == 0)
+		s->df_pstate = val;
+	sx_xunlock(&amd_cppc_hsmp_lock);
+	return (error);
+}
+
+static int
+amd_cppc_sysctl_hsmp_boost_limit(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	uint32_t	apic, args[AMD_CPPC_HSMP_MAX_ARGS];
+	u_int		val;
+	int		error;
+
+	sc = arg1;
+	apic = pcpu_find(sc->cpu_id)->pc_apic_id;
+	args[0] = apic;
+	error = amd_cppc_hsmp_call(sc->hsmp_socket,
+	    AMD_CPPC_HSMP_GET_BOOST_LIMIT, args);
+	if (error != 0)
+		return (error);
+	val = args[0];
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val > 0xFFFF)
+		return (EINVAL);
+
+	args[0] = apic << 16 | val;
+	return (amd_cppc_hsmp_call(sc->hsmp_socket,
+	    AMD_CPPC_HSMP_SET_BOOST_LIMIT, args));
+}
+
+/*
+ * amdsmn(4) attaches to every root complex in PCI order, so its unit
+ * numbers are not sockets and a socket may have several. The data fabric
+ * of each node names its root bus in CfgAddressCntl; use the amdsmn
+ * instance on that bus.
+ */
+static device_t
+amd_cppc_hsmp_smn_find(int node)
+{
+	devclass_t	dc;
+	device_t	df, smn;
+	int		bus, i, reg;
+
+	if ((dc = devclass_find("amdsmn")) == NULL ||
+	    (df = pci_find_bsf(0, AMD_CPPC_HSMP_DF_SLOT + node, 0)) == NULL)
+		return (NULL);
+	reg = CPUID_TO_FAMILY(cpu_id) >= 0x1A ?
+	    AMD_CPPC_HSMP_DF_CFGADDRCNTL_1A : AMD_CPPC_HSMP_DF_CFGADDRCNTL;
+	bus = pci_read_config(df, reg, 1);
+	for (i = 0; i < devclass_get_maxunit(dc); i++) {
+		smn = devclass_get_device(dc, i);
+		if (smn != NULL && device_is_attached(smn) &&
+		    pci_get_domain(device_get_parent(smn)) == 0 &&
+		    pci_get_bus(device_get_parent(smn)) == bus)
+			return (smn);
+	}
+	return (NULL);
+}
+
+/*
+ * Find the SMN device of a socket and check that its mailbox answers.
+ */
+static void
+amd_cppc_hsmp_probe(int socket)
+{
+	struct amd_cppc_hsmp_sock *s;
+	struct sysctl_oid *node;
+	uint32_t	args[AMD_CPPC_HSMP_MAX_ARGS];
+	char		name[8];
+
+	sx_assert(&amd_cppc_hsmp_lock, SA_XLOCKED);
+	s = &amd_cppc_hsmp_socks[socket];
+	s->probed = true;
+	if ((s->smn = amd_cppc_hsmp_smn_find(socket)) == NULL)
+		return;
+
+	s->mb.ops = &amd_cppc_hsmp_kops;
+	s->mb.ctx = s->smn;
+	s->mb.timeout_us = AMD_CPPC_HSMP_PROBE_US;
+	s->df_pstate = -1;
+	args[0] = 0xA5;
+	if (amd_cppc_hsmp_send(&s->mb, AMD_CPPC_HSMP_TEST, args) != 0 ||
+	    args[0] != 0xA6)
+		return;
+	s->mb.timeout_us = AMD_CPPC_HSMP_TIMEOUT_US;
+	s->present = true;
+
+	if (!amd_cppc_hsmp_ctx_init) {
+		sysctl_ctx_init(&amd_cppc_hsmp_ctx);
+		amd_cppc_hsmp_ctx_init = true;
+	}
+	snprintf(name, sizeof(name), "%d", socket);
+	node = SYSCTL_ADD_NODE(&amd_cppc_hsmp_ctx,
+	    SYSCTL_STATIC_CHILDREN(_hw_amd_cppc_hsmp), OID_AUTO, name,
+	    CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, "Socket");
+	SYSCTL_ADD_PROC(&amd_cppc_hsmp_ctx, SYSCTL_CHILDREN(node), OID_AUTO,
+			"power", CTLTYPE_UINT | CTLFLAG_RD | CTLFLAG_MPSAFE,
+			(void *)(intptr_t)socket, AMD_CPPC_HSMP_POWER,
+			amd_cppc_sysctl_hsmp_socket, "IU",
+			"Socket power in mW");
+	SYSCTL_ADD_PROC(&amd_cppc_hsmp_ctx, SYSCTL_CHILDREN(node), OID_AUTO,
+			"power_limit", CTLTYPE_UINT | CTLFLAG_RW | CTLFLAG_MPSAFE,
+			(void *)(intptr_t)socket, AMD_CPPC_HSMP_POWER_LIMIT,
+			amd_cppc_sysctl_hsmp_socket, "IU",
+			"Socket power cap in mW");
+	SYSCTL_ADD_PROC(&amd_cppc_hsmp_ctx, SYSCTL_CHILDREN(node), OID_AUTO,
+			"power_limit_max", CTLTYPE_UINT | CTLFLAG_RD |
+			CTLFLAG_MPSAFE, (void *)(intptr_t)socket,
+			AMD_CPPC_HSMP_POWER_LIMIT_MAX,
+			amd_cppc_sysctl_hsmp_socket, "IU",
+			"Highest settable socket power cap in mW");
+	SYSCTL_ADD_PROC(&amd_cppc_hsmp_ctx, SYSCTL_CHILDREN(node), OID_AUTO,
+			"smu_version", CTLTYPE_UINT | CTLFLAG_RD | CTLFLAG_MPSAFE,
+			(void *)(intptr_t)socket, AMD_CPPC_HSMP_SMU_VER,
+			amd_cppc_sysctl_hsmp_socket, "IU",
+			"SMU firmware version");
+	SYSCTL_ADD_PROC(&amd_cppc_hsmp_ctx, SYSCTL_CHILDREN(node), OID_AUTO,
+			"proto_version", CTLTYPE_UINT | CTLFLAG_RD |
+			CTLFLAG_MPSAFE, (void *)(intptr_t)socket,
+			AMD_CPPC_HSMP_PROTO_VER,
+			amd_cppc_sysctl_hsmp_socket, "IU",
+			"HSMP protocol version");
+	SYSCTL_ADD_PROC(&amd_cppc_hsmp_ctx, SYSCTL_CHILDREN(node), OID_AUTO,
+			"df_pstate", CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE,
+			(void *)(intptr_t)socket, 0,
+			amd_cppc_sysctl_hsmp_df_pstate, "I",
+			"Data fabric P-state (-1 = automatic, 0 = fastest)");
+}
+
+/*
+ * HSMP exists on server parts only, and the mailbox SMN addresses mean
+ * something else on client parts, so never touch them there.
+ */
+static bool
+amd_cppc_hsmp_supported(void)
+{
+
+	return (AMD_CPPC_QUIRK(AMD_CPPC_QUIRK_HSMP));
+}
+
+void
+amd_cppc_hsmp_attach(struct amd_cppc_softc *sc)
+{
+	u_int		regs[4];
+	int		socket;
+
+	sc->hsmp_socket = -1;
+	if (!amd_cppc_hsmp_enable || !amd_cppc_hsmp_supported())
+		return;
+
+	/* These parts have one node per socket, numbered like the sockets. */
+	amd_cppc_bind_cpu(sc->cpu_id);
+	do_cpuid(CPUID_AMD_NODE_ID, regs);
+	amd_cppc_unbind_cpu();
+	socket = regs[2] & 0xFF;
+	if (socket >= AMD_CPPC_HSMP_SOCKETS)
+		return;
+
+	sx_xlock(&amd_cppc_hsmp_lock);
+	if (!amd_cppc_hsmp_socks[socket].probed)
+		amd_cppc_hsmp_probe(socket);
+	if (amd_cppc_hsmp_socks[socket].present)
+		sc->hsmp_socket = socket;
+	sx_xunlock(&amd_cppc_hsmp_lock);
+	if (sc->hsmp_socket < 0)
+		return;
+
+	SYSCTL_ADD_PROC(device_get_sysctl_ctx(sc->dev),
+			SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+			OID_AUTO, "hsmp_boost_limit",
+			CTLTYPE_UINT | CTLFLAG_RW | CTLFLAG_MPSAFE, sc, 0,
+			amd_cppc_sysctl_hsmp_boost_limit, "IU",
+			"HSMP boost frequency limit of this core in MHz");
+}
+
+void
+amd_cppc_hsmp_fini(void)
+{
+
+	if (amd_cppc_hsmp_ctx_init)
+		sysctl_ctx_free(&amd_cppc_hsmp_ctx);
+}
+
+MODULE_DEPEND(amd_cppc, amdsmn, 1, 1, 1);
+
+#endif /* _KERNEL */
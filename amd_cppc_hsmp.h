@@ -0,0 +1,93 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Host System Management Port (HSMP) mailbox client, EPYC family 19h.
+ *
+ * HSMP is a mailbox in the SMU reached through SMN, the System Management
+ * Network, which the host bridge exposes as an index/data register pair in
+ * PCI config space. A message is sent by clearing the response register,
+ * writing the arguments, writing the message ID, and polling the response
+ * register until the SMU posts a status. Results come back in the argument
+ * registers.
+ *
+ * The protocol code has no kernel dependencies: SMN access and delays are
+ * supplied through struct amd_cppc_hsmp_ops, so it runs unchanged in
+ * userland against the emulated mailbox in tests/hsmp_test.c.
+ */
+
+#ifndef _AMD_CPPC_HSMP_H_
+#define _AMD_CPPC_HSMP_H_
+
+/* Mailbox registers in SMN space */
+#define AMD_CPPC_HSMP_SMN_MSG_ID	0x3B10534
+#define AMD_CPPC_HSMP_SMN_MSG_RESP	0x3B10980
+#define AMD_CPPC_HSMP_SMN_MSG_ARG	0x3B109E0
+
+#define AMD_CPPC_HSMP_MAX_ARGS		8
+
+/* Messages */
+#define AMD_CPPC_HSMP_TEST			0x01
+#define AMD_CPPC_HSMP_GET_SMU_VER		0x02
+#define AMD_CPPC_HSMP_GET_PROTO_VER		0x03
+#define AMD_CPPC_HSMP_GET_SOCKET_POWER		0x04
+#define AMD_CPPC_HSMP_SET_SOCKET_POWER_LIMIT	0x05
+#define AMD_CPPC_HSMP_GET_SOCKET_POWER_LIMIT	0x06
+#define AMD_CPPC_HSMP_GET_SOCKET_POWER_LIMIT_MAX 0x07
+#define AMD_CPPC_HSMP_SET_BOOST_LIMIT		0x08
+#define AMD_CPPC_HSMP_SET_BOOST_LIMIT_SOCKET	0x09
+#define AMD_CPPC_HSMP_GET_BOOST_LIMIT		0x0A
+#define AMD_CPPC_HSMP_SET_DF_PSTATE		0x0D
+#define AMD_CPPC_HSMP_SET_AUTO_DF_PSTATE	0x0E
+
+/* Response register values */
+#define AMD_CPPC_HSMP_RESP_NONE		0x00	/* still running */
+#define AMD_CPPC_HSMP_RESP_OK		0x01
+#define AMD_CPPC_HSMP_RESP_BUSY		0xFC
+#define AMD_CPPC_HSMP_RESP_PREREQ	0xFD
+#define AMD_CPPC_HSMP_RESP_INVALID_MSG	0xFE
+#define AMD_CPPC_HSMP_RESP_INVALID_ARGS	0xFF
+
+/* Number of data fabric P-states accepted by SET_DF_PSTATE */
+#define AMD_CPPC_HSMP_DF_PSTATES	4
+
+struct amd_cppc_hsmp_ops {
+	int	(*smn_read)(void *ctx, uint32_t addr, uint32_t *val);
+	int	(*smn_write)(void *ctx, uint32_t addr, uint32_t val);
+	void	(*delay)(void *ctx, u_int us);
+};
+
+struct amd_cppc_hsmp {
+	const struct amd_cppc_hsmp_ops *ops;
+	void		*ctx;
+	u_int		timeout_us;	/* give up on a message after this */
+};
+
+int	amd_cppc_hsmp_send(struct amd_cppc_hsmp *h, uint32_t msg,
+			   uint32_t *args);
+
+#endif /* !_AMD_CPPC_HSMP_H_ */
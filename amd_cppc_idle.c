@@ -0,0 +1,443 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Idle state depth.
+ *
+ * A profile that asks for low latency with EPP 0 gains little if the core
+ * then drops into a deep C-state between requests and pays the exit
+ * latency on every wakeup. Profiles therefore also carry a deepest allowed
+ * idle state, applied through acpi_cpu(4)'s dev.cpu.N.cx_lowest. The
+ * setting found at the first change is restored when profiles are turned
+ * off or the driver detaches.
+ *
+ * To check the effect, dev.amd_cppc.N.cx_residency reports how the idle
+ * entries of the CPU split across C-states since the last depth change,
+ * from acpi_cpu's usage counters.
+ */
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/pcpu.h>
+#include <sys/proc.h>
+#include <sys/sbuf.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+
+#include <machine/atomic.h>
+#include <machine/cpufunc.h>
+#include <machine/md_var.h>
+
+#include "amd_cppc_var.h"
+
+/*
+ * Read acpi_cpu's idle state entry counters of a CPU. Returns the number
+ * of states, 0 if acpi_cpu does not export them.
+ */
+static int
+amd_cppc_idle_counters(int cpu, uint64_t *cnt)
+{
+	char		name[40], buf[256], *p, *end;
+	size_t		len;
+	int		n;
+
+	snprintf(name, sizeof(name), "dev.cpu.%d.cx_usage_counters", cpu);
+	len = sizeof(buf) - 1;
+	if (kernel_sysctlbyname(curthread, name, buf, &len, NULL, 0, NULL,
+				0) != 0)
+		return (0);
+	buf[MIN(len, sizeof(buf) - 1)] = '\0';
+
+	for (n = 0, p = buf; n < AMD_CPPC_IDLE_STATES; n++, p = end) {
+		cnt[n] = strtouq(p, &end, 10);
+		if (end == p)
+			break;
+	}
+	return (n);
+}
+
+static int
+amd_cppc_idle_cx_lowest(int cpu, char *buf, size_t buflen, const char *set)
+{
+	char		name[40];
+	size_t		len;
+
+	snprintf(name, sizeof(name), "dev.cpu.%d.cx_lowest", cpu);
+	len = buflen;
+	return (kernel_sysctlbyname(curthread, name, buf, buf != NULL ? &len :
+	    NULL, __DECONST(char *, set), set != NULL ? strlen(set) + 1 : 0,
+	    NULL, 0));
+}
+
+/*
+ * Limit one CPU to idle states no deeper than C<depth>, or restore the
+ * setting it had before the driver changed it when depth is 0.
+ */
+static void
+amd_cppc_idle_set(struct amd_cppc_softc *sc, int depth)
+{
+	char		buf[8];
+	int		error;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	if (depth == sc->idle_depth)
+		return;
+	if (sc->idle_depth == 0 && amd_cppc_idle_cx_lowest(sc->cpu_id,
+	    sc->idle_saved, sizeof(sc->idle_saved), NULL) != 0)
+		return;		/* no acpi_cpu idle control */
+
+	if (depth == 0)
+		strlcpy(buf, sc->idle_saved, sizeof(buf));
+	else
+		snprintf(buf, sizeof(buf), "C%d", depth);
+	error = amd_cppc_idle_cx_lowest(sc->cpu_id, NULL, 0, buf);
+	if (error != 0) {
+		device_printf(sc->dev, "cannot set cx_lowest to %s: %d\n",
+			      buf, error);
+		return;
+	}
+	sc->idle_depth = depth;
+	sc->idle_nbase = amd_cppc_idle_counters(sc->cpu_id, sc->idle_base);
+}
+
+/*
+ * Apply an idle depth to every CPU; 0 restores the original settings.
+ */
+void
+amd_cppc_idle_apply(int depth)
+{
+	struct amd_cppc_softc *sc;
+	int		cpu;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	CPU_FOREACH(cpu)
+		if ((sc = amd_cppc_softc_get(cpu)) != NULL)
+			amd_cppc_idle_set(sc, depth);
+}
+
+static int
+amd_cppc_sysctl_cx_residency(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	struct sbuf	sb;
+	uint64_t	cnt[AMD_CPPC_IDLE_STATES], d[AMD_CPPC_IDLE_STATES];
+	uint64_t	total;
+	int		error, i, n;
+
+	sc = arg1;
+	n = amd_cppc_idle_counters(sc->cpu_id, cnt);
+	sx_slock(&amd_cppc_lock);
+	total = 0;
+	for (i = 0; i < n; i++) {
+		d[i] = cnt[i] - (i < sc->idle_nbase ? sc->idle_base[i] : 0);
+		total += d[i];
+	}
+	sx_sunlock(&amd_cppc_lock);
+
+	sbuf_new_for_sysctl(&sb, NULL, 128, req);
+	for (i = 0; i < n; i++)
+		sbuf_printf(&sb, "%sC%d %ju (%ju%%)", i == 0 ? "" : " ", i + 1,
+			    (uintmax_t)d[i],
+			    (uintmax_t)(total > 0 ? d[i] * 100 / total : 0));
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	return (error);
+}
+
+
+/*
+ * Idle-entry EPP.
+ *
+ * A CPU left at a performance EPP burns power in shallow idle states and
+ * wakes from long idle with whatever EPP it had. With hw.amd_cppc.idle_epp
+ * enabled the driver wraps acpi_cpu's idle hook: before a long idle period
+ * it writes the request with idle_epp_value as EPP, and on wakeup writes
+ * the active request back. The write is skipped when the active EPP is
+ * already the idle one.
+ *
+ * The idle hook is told how long until the next timer, which is only an
+ * upper bound, so a period counts as long only if the prediction and the
+ * running average of measured idle periods both reach idle_epp_min_us.
+ * Per-CPU counters give the cost of the writes against the time spent at
+ * the efficient EPP.
+ *
+ * The hook runs on the idle thread with interrupts disabled and accesses
+ * the local MSR directly. It also hands every wakeup to the pre-ramp
+ * predictor, which can keep it installed without idle EPP.
+ */
+
+static void	(*amd_cppc_idle_orig)(sbintime_t);
+static struct amd_cppc_softc *amd_cppc_idle_sc[MAXCPU];
+static volatile u_int amd_cppc_idle_busy;	/* CPUs inside the hook */
+static int	amd_cppc_idle_users;		/* AMD_CPPC_IDLE_USER_* */
+static int	amd_cppc_idle_epp = 0;
+static int	amd_cppc_idle_epp_value = 100;
+static int	amd_cppc_idle_epp_min_us = 2000;
+
+static void
+amd_cppc_idle_hook(sbintime_t sbt)
+{
+	struct amd_cppc_softc *sc;
+	register_t	saveintr;
+	uint64_t	req, idle_req, t0, t1, t2;
+	uint32_t	us;
+	bool		changed;
+
+	atomic_add_int(&amd_cppc_idle_busy, 1);
+	sc = amd_cppc_idle_sc[PCPU_GET(cpuid)];
+	changed = false;
+	t0 = rdtsc();
+	if (sc != NULL && sc->cppc_enabled && amd_cppc_idle_epp &&
+	    sc->pr_req == 0 && sbt >= amd_cppc_idle_epp_min_us * SBT_1US &&
+	    sc->ie_avg_us >= (uint32_t)amd_cppc_idle_epp_min_us) {
+		req = sc->req_shadow;
+		idle_req = (req & ~((uint64_t)0xFF << AMD_CPPC_EPP_PERF_SHIFT)) |
+		    (uint64_t)amd_cppc_epp_to_hw(amd_cppc_idle_epp_value) <<
+		    AMD_CPPC_EPP_PERF_SHIFT;
+		if (idle_req == req)
+			sc->ie_elided++;
+		else {
+			wrmsr(MSR_AMD_CPPC_REQ, idle_req);
+			changed = true;
+			sc->ie_entries++;
+		}
+	} else if (sc != NULL && amd_cppc_idle_epp && sc->pr_req == 0 &&
+	    sbt >= amd_cppc_idle_epp_min_us * SBT_1US)
+		sc->ie_gated++;
+	t1 = rdtsc();
+
+	amd_cppc_idle_orig(sbt);
+
+	t2 = rdtsc();
+	if (sc != NULL) {
+		/*
+		 * Restore whatever is programmed by now, boosts included. A
+		 * request commit is a rendezvous, so with interrupts off none
+		 * can land between reading the request and writing it back.
+		 */
+		saveintr = intr_disable();
+		if (changed)
+			wrmsr(MSR_AMD_CPPC_REQ, sc->pr_req != 0 ? sc->pr_req :
+			    sc->ob_req != 0 ? sc->ob_req : sc->req_shadow);
+		us = (uint32_t)MIN((t2 - t1) * 1000000 / tsc_freq, UINT32_MAX);
+		sc->ie_avg_us = sc->ie_avg_us - sc->ie_avg_us / 8 + us / 8;
+		if (changed) {
+			sc->ie_cost_cycles += (t1 - t0) + (rdtsc() - t2);
+			sc->ie_efficient_us += us;
+		}
+		if (sc->cppc_enabled)
+			amd_cppc_ramp_wake(sc, us);
+		intr_restore(saveintr);
+	}
+	atomic_subtract_int(&amd_cppc_idle_busy, 1);
+}
+
+/*
+ * Wait until no CPU is inside the hook. Idle CPUs are kicked with an empty
+ * rendezvous so they leave the hook instead of sleeping on in it.
+ */
+static void
+amd_cppc_idle_drain(void)
+{
+
+	while (atomic_load_int(&amd_cppc_idle_busy) != 0) {
+		smp_rendezvous(NULL, NULL, NULL, NULL);
+		pause("cppcidl", 1);
+	}
+}
+
+static int
+amd_cppc_idle_hook_set(bool on)
+{
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	if (on) {
+		if (cpu_idle_hook == amd_cppc_idle_hook)
+			return (0);
+		if (cpu_idle_hook == NULL)
+			return (ENODEV);	/* no acpi_cpu idle */
+		amd_cppc_idle_orig = cpu_idle_hook;
+		atomic_store_rel_ptr((volatile uintptr_t *)&cpu_idle_hook,
+				     (uintptr_t)amd_cppc_idle_hook);
+	} else {
+		if (cpu_idle_hook != amd_cppc_idle_hook)
+			return (0);
+		atomic_store_rel_ptr((volatile uintptr_t *)&cpu_idle_hook,
+				     (uintptr_t)amd_cppc_idle_orig);
+		amd_cppc_idle_drain();
+	}
+	return (0);
+}
+
+/*
+ * The hook is shared by idle EPP and the pre-ramp (amd_cppc_ramp.c); it
+ * stays installed while either uses it. Once a user is dropped no CPU is
+ * still inside the hook on its behalf.
+ */
+int
+amd_cppc_idle_hook_use(int user, bool on)
+{
+	int		error, users;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	users = on ? amd_cppc_idle_users | user : amd_cppc_idle_users & ~user;
+	error = amd_cppc_idle_hook_set(users != 0);
+	if (error != 0)
+		return (error);
+	amd_cppc_idle_users = users;
+	if (!on)
+		amd_cppc_idle_drain();
+	return (0);
+}
+
+static int
+amd_cppc_sysctl_idle_epp(SYSCTL_HANDLER_ARGS)
+{
+	int		error, val;
+
+	val = amd_cppc_idle_epp;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	sx_xlock(&amd_cppc_lock);
+	if (val != 0) {
+		error = amd_cppc_idle_hook_use(AMD_CPPC_IDLE_USER_EPP, true);
+		if (error == 0)
+			amd_cppc_idle_epp = 1;
+	} else {
+		amd_cppc_idle_epp = 0;
+		(void)amd_cppc_idle_hook_use(AMD_CPPC_IDLE_USER_EPP, false);
+	}
+	sx_xunlock(&amd_cppc_lock);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, idle_epp,
+	    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_idle_epp, "I",
+	    "Switch to idle_epp_value on long idle periods");
+
+static int
+amd_cppc_sysctl_idle_epp_value(SYSCTL_HANDLER_ARGS)
+{
+	int		error, val;
+
+	val = amd_cppc_idle_epp_value;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val < 0 || val > 100)
+		return (EINVAL);
+	amd_cppc_idle_epp_value = val;
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, idle_epp_value,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_idle_epp_value, "I",
+	    "EPP (0-100) used while idle");
+
+SYSCTL_INT(_hw_amd_cppc, OID_AUTO, idle_epp_min_us, CTLFLAG_RWTUN,
+	   &amd_cppc_idle_epp_min_us, 0,
+	   "Shortest predicted and average idle period in us for idle EPP");
+
+static int
+amd_cppc_sysctl_idle_epp_cost(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	uint64_t	ns;
+
+	sc = arg1;
+	ns = sc->ie_cost_cycles * 1000 / (tsc_freq / 1000000);
+	return (sysctl_handle_64(oidp, &ns, 0, req));
+}
+
+void
+amd_cppc_idle_attach(struct amd_cppc_softc *sc)
+{
+	struct sysctl_ctx_list *ctx;
+	struct sysctl_oid *node;
+
+	sc->idle_depth = 0;
+	sc->idle_nbase = amd_cppc_idle_counters(sc->cpu_id, sc->idle_base);
+
+	ctx = device_get_sysctl_ctx(sc->dev);
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+			OID_AUTO, "cx_residency",
+			CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, sc, 0,
+			amd_cppc_sysctl_cx_residency, "A",
+			"Idle entries per C-state since the last depth change");
+
+	node = SYSCTL_ADD_NODE(ctx,
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)), OID_AUTO,
+	    "idle_epp", CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, "Idle-entry EPP");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "entries",
+		       CTLFLAG_RD, &sc->ie_entries, 0,
+		       "Idle periods entered at the idle EPP");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "elided",
+		       CTLFLAG_RD, &sc->ie_elided, 0,
+		       "Writes skipped because the EPP was already idle EPP");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "gated",
+		       CTLFLAG_RD, &sc->ie_gated, 0,
+		       "Long predictions rejected by measured idle periods");
+	SYSCTL_ADD_U32(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "avg_us",
+		       CTLFLAG_RD, &sc->ie_avg_us, 0,
+		       "Running average of idle periods in us");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "write_ns",
+			CTLTYPE_U64 | CTLFLAG_RD | CTLFLAG_MPSAFE, sc, 0,
+			amd_cppc_sysctl_idle_epp_cost, "QU",
+			"Total time spent writing the request in the idle path");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "efficient_us",
+		       CTLFLAG_RD, &sc->ie_efficient_us, 0,
+		       "Total idle time spent at the idle EPP");
+
+	amd_cppc_idle_sc[sc->cpu_id] = sc;
+}
+
+void
+amd_cppc_idle_detach(struct amd_cppc_softc *sc)
+{
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	amd_cppc_idle_sc[sc->cpu_id] = NULL;
+	amd_cppc_idle_drain();
+	amd_cppc_idle_set(sc, 0);
+}
+
+void
+amd_cppc_idle_fini(void)
+{
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_idle_epp = 0;
+	amd_cppc_idle_users = 0;
+	amd_cppc_idle_hook_set(false);
+	sx_xunlock(&amd_cppc_lock);
+}
@@ -0,0 +1,388 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock owner boost.
+ *
+ * A thread that holds a contended lock on a CPU capped low by powerd makes
+ * every waiter wait longer. While waiters are blocked on a lock, the CPU
+ * the owner runs on gets its min_perf raised to owner_boost_perf, much
+ * like priority propagation raises the owner's scheduling priority.
+ *
+ * The contention events come from turnstile_wait(), which needs the
+ * turnstile_owner_hooks pointer added by kernel/turnstile_owner_hook.diff.
+ * The pointer is looked up by name when owner_boost is set, so the module
+ * still loads on kernels without it and the sysctl fails with ENODEV.
+ * amd_cppc_owner_block() is called with the owner before the thread
+ * sleeps and amd_cppc_owner_unblock() with the returned cookie once it is
+ * woken. Both run with a spin lock held or in a critical section and only
+ * touch atomic counters and the callout.
+ *
+ * The request is changed by a per-CPU callout that writes the local MSR,
+ * keeping the driver lock out of the contention path. The first waiter on
+ * a CPU starts it, and it runs every tick until the waiters have gone and
+ * the request is back. The boost is bounded: at most owner_boost_max_cpus
+ * CPUs are boosted at a time and a CPU drops the boost after
+ * owner_boost_max_ms even if waiters remain, until they all have gone.
+ */
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/callout.h>
+#include <sys/kernel.h>
+#include <sys/linker.h>
+#include <sys/lock.h>
+#include <sys/pcpu.h>
+#include <sys/proc.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+
+#include <machine/atomic.h>
+#include <machine/cpufunc.h>
+
+#include "amd_cppc_var.h"
+
+/* Layout of struct turnstile_owner_hooks in the kernel patch */
+struct amd_cppc_owner_hooks {
+	int		(*block)(struct thread *owner);
+	void		(*unblock)(int cookie);
+};
+
+static void	amd_cppc_owner_tick(void *arg);
+
+static struct amd_cppc_owner_hooks amd_cppc_owner_hooks = {
+	.block = amd_cppc_owner_block,
+	.unblock = amd_cppc_owner_unblock,
+};
+static struct amd_cppc_owner_hooks * volatile *amd_cppc_owner_hookp;
+
+static int	amd_cppc_owner_boost = 0;
+static int	amd_cppc_owner_perf = 0;	/* 0 = nominal_perf */
+static int	amd_cppc_owner_max_ms = 10;
+static int	amd_cppc_owner_max_cpus = 4;
+
+static volatile u_int amd_cppc_owner_waiters[MAXCPU];
+static volatile u_int amd_cppc_owner_active;	/* CPUs with waiters */
+static struct amd_cppc_softc *amd_cppc_owner_sc[MAXCPU];
+
+static uint64_t	amd_cppc_owner_boosts;
+static uint64_t	amd_cppc_owner_denied;
+static uint64_t	amd_cppc_owner_expired;
+
+/*
+ * A thread is about to block on a lock held by owner. Returns a cookie for
+ * amd_cppc_owner_unblock(), -1 if no boost was taken.
+ */
+int
+amd_cppc_owner_block(struct thread *owner)
+{
+	struct amd_cppc_softc *sc;
+	u_int		w;
+	int		cpu;
+
+	if (!amd_cppc_owner_boost || owner == NULL)
+		return (-1);
+	cpu = owner->td_oncpu;
+	if (cpu == NOCPU)
+		cpu = owner->td_lastcpu;
+	if (cpu < 0 || cpu >= MAXCPU ||
+	    (sc = amd_cppc_owner_sc[cpu]) == NULL)
+		return (-1);
+
+	do {
+		w = atomic_load_int(&amd_cppc_owner_waiters[cpu]);
+		if (w == 0 && atomic_load_int(&amd_cppc_owner_active) >=
+		    (u_int)amd_cppc_owner_max_cpus) {
+			atomic_add_64(&amd_cppc_owner_denied, 1);
+			return (-1);
+		}
+	} while (!atomic_cmpset_int(&amd_cppc_owner_waiters[cpu], w, w + 1));
+	if (w == 0) {
+		atomic_add_int(&amd_cppc_owner_active, 1);
+		atomic_add_64(&amd_cppc_owner_boosts, 1);
+		callout_reset_sbt_on(&sc->ob_callout, 0, 0,
+				     amd_cppc_owner_tick, sc, cpu,
+				     C_DIRECT_EXEC);
+	}
+	return (cpu);
+}
+
+void
+amd_cppc_owner_unblock(int cookie)
+{
+	u_int		w;
+
+	if (cookie < 0 || cookie >= MAXCPU)
+		return;
+	/* Waiters counted before owner_boost was last set are not here. */
+	do {
+		w = atomic_load_int(&amd_cppc_owner_waiters[cookie]);
+		if (w == 0)
+			return;
+	} while (!atomic_cmpset_int(&amd_cppc_owner_waiters[cookie], w,
+	    w - 1));
+	if (w == 1)
+		atomic_subtract_int(&amd_cppc_owner_active, 1);
+}
+
+static void
+amd_cppc_owner_tick(void *arg)
+{
+	struct amd_cppc_softc *sc;
+	uint64_t	req;
+	int		floor, min, max;
+	bool		want;
+
+	sc = arg;
+	want = amd_cppc_owner_boost && sc->cppc_enabled &&
+	    atomic_load_int(&amd_cppc_owner_waiters[sc->cpu_id]) != 0;
+	if (!want)
+		sc->ob_expired = false;
+	else if (sc->ob_req != 0 &&
+	    (u_int)(ticks - sc->ob_ticks) >
+	    (u_int)amd_cppc_owner_max_ms * hz / 1000) {
+		sc->ob_expired = true;
+		sc->ob_expirations++;
+		atomic_add_64(&amd_cppc_owner_expired, 1);
+	}
+	if (sc->ob_expired)
+		want = false;
+
+	if (want) {
+		/* Raise min_perf, but never above the ceiling in force. */
+		req = sc->req_shadow;
+		floor = amd_cppc_owner_perf != 0 ? amd_cppc_owner_perf :
+		    sc->nominal_perf;
+		min = (req >> AMD_CPPC_MIN_PERF_SHIFT) & 0xFF;
+		max = (req >> AMD_CPPC_MAX_PERF_SHIFT) & 0xFF;
+		min = MAX(min, MIN(floor, max));
+		req = (req & ~((uint64_t)0xFF << AMD_CPPC_MIN_PERF_SHIFT)) |
+		    (uint64_t)min << AMD_CPPC_MIN_PERF_SHIFT;
+		if (sc->ob_req == 0) {
+			sc->ob_ticks = ticks;
+			sc->ob_boosts++;
+		}
+		if (req != sc->ob_req || sc->ob_base != sc->req_shadow) {
+			sc->ob_req = req;
+			sc->ob_base = sc->req_shadow;
+			wrmsr(MSR_AMD_CPPC_REQ, req);
+		}
+	} else if (sc->ob_req != 0) {
+		if (sc->cppc_enabled)
+			wrmsr(MSR_AMD_CPPC_REQ, sc->pr_req != 0 ? sc->pr_req :
+			    sc->req_shadow);
+		sc->ob_req = 0;
+		sc->ob_ms += (u_int)(ticks - sc->ob_ticks) * 1000 / hz;
+	}
+
+	/* The next first waiter starts the callout again. */
+	if (amd_cppc_owner_boost && !sc->detaching &&
+	    atomic_load_int(&amd_cppc_owner_waiters[sc->cpu_id]) != 0)
+		callout_reset_sbt_on(&sc->ob_callout, tick_sbt, 0,
+				     amd_cppc_owner_tick, sc, sc->cpu_id,
+				     C_DIRECT_EXEC);
+}
+
+/*
+ * Stop the callout of a CPU and put back the request if it was left
+ * boosted.
+ */
+static void
+amd_cppc_owner_stop(struct amd_cppc_softc *sc)
+{
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	callout_drain(&sc->ob_callout);
+	if (sc->ob_req != 0) {
+		if (sc->cppc_enabled) {
+			amd_cppc_bind_cpu(sc->cpu_id);
+			wrmsr(MSR_AMD_CPPC_REQ, sc->req_shadow);
+			amd_cppc_unbind_cpu();
+		}
+		sc->ob_req = 0;
+	}
+	sc->ob_expired = false;
+}
+
+/*
+ * Install or remove the turnstile hooks. Once removed, no CPU is inside
+ * them any more.
+ */
+static int
+amd_cppc_owner_hook_set(bool on)
+{
+	struct amd_cppc_owner_hooks * volatile *hookp;
+	int		cpu;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	hookp = amd_cppc_owner_hookp;
+	if (on) {
+		if (hookp == NULL)
+			hookp = (void *)linker_file_lookup_symbol(
+			    linker_kernel_file, "turnstile_owner_hooks", 0);
+		if (hookp == NULL)
+			return (ENODEV);	/* kernel without the patch */
+		amd_cppc_owner_hookp = hookp;
+		CPU_FOREACH(cpu)
+			amd_cppc_owner_waiters[cpu] = 0;
+		amd_cppc_owner_active = 0;
+		if (!atomic_cmpset_ptr((volatile uintptr_t *)hookp,
+		    (uintptr_t)NULL, (uintptr_t)&amd_cppc_owner_hooks))
+			return (EBUSY);
+	} else {
+		if (hookp == NULL || *hookp != &amd_cppc_owner_hooks)
+			return (0);
+		atomic_store_rel_ptr((volatile uintptr_t *)hookp,
+				     (uintptr_t)NULL);
+		quiesce_all_cpus("cppcown", 0);
+	}
+	return (0);
+}
+
+static int
+amd_cppc_sysctl_owner_boost(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	int		cpu, error, val;
+
+	val = amd_cppc_owner_boost;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	val = val != 0;
+	sx_xlock(&amd_cppc_lock);
+	if (val && !amd_cppc_owner_boost) {
+		error = amd_cppc_owner_hook_set(true);
+		if (error == 0)
+			amd_cppc_owner_boost = 1;
+	} else if (!val && amd_cppc_owner_boost) {
+		amd_cppc_owner_boost = 0;
+		(void)amd_cppc_owner_hook_set(false);
+		CPU_FOREACH(cpu) {
+			if ((sc = amd_cppc_owner_sc[cpu]) != NULL)
+				amd_cppc_owner_stop(sc);
+		}
+	}
+	sx_xunlock(&amd_cppc_lock);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, owner_boost,
+	    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_owner_boost, "I",
+	    "Raise min_perf on CPUs running the owner of a contended lock "
+	    "(needs a kernel with turnstile_owner_hooks)");
+
+static int
+amd_cppc_sysctl_owner_perf(SYSCTL_HANDLER_ARGS)
+{
+	int		error, val;
+
+	val = amd_cppc_owner_perf;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val < 0 || val > 255)
+		return (EINVAL);
+	amd_cppc_owner_perf = val;
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, owner_boost_perf,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_owner_perf, "I",
+	    "min_perf given to a lock owner's CPU (0 = nominal_perf)");
+
+SYSCTL_INT(_hw_amd_cppc, OID_AUTO, owner_boost_max_ms, CTLFLAG_RWTUN,
+	   &amd_cppc_owner_max_ms, 0,
+	   "Longest time in ms a CPU stays boosted for one contention");
+SYSCTL_INT(_hw_amd_cppc, OID_AUTO, owner_boost_max_cpus, CTLFLAG_RWTUN,
+	   &amd_cppc_owner_max_cpus, 0,
+	   "Most CPUs boosted for lock owners at a time");
+SYSCTL_UINT(_hw_amd_cppc, OID_AUTO, owner_boost_active, CTLFLAG_RD,
+	    __DEVOLATILE(u_int *, &amd_cppc_owner_active), 0,
+	    "CPUs with waiters blocked on a lock owner");
+SYSCTL_U64(_hw_amd_cppc, OID_AUTO, owner_boosts, CTLFLAG_RD,
+	   &amd_cppc_owner_boosts, 0,
+	   "Contentions that boosted the owner's CPU");
+SYSCTL_U64(_hw_amd_cppc, OID_AUTO, owner_boost_denied, CTLFLAG_RD,
+	   &amd_cppc_owner_denied, 0,
+	   "Contentions not boosted because of owner_boost_max_cpus");
+SYSCTL_U64(_hw_amd_cppc, OID_AUTO, owner_boost_expired, CTLFLAG_RD,
+	   &amd_cppc_owner_expired, 0,
+	   "Boosts dropped after owner_boost_max_ms");
+
+void
+amd_cppc_owner_attach(struct amd_cppc_softc *sc)
+{
+	struct sysctl_ctx_list *ctx;
+	struct sysctl_oid *node;
+
+	callout_init(&sc->ob_callout, 1);
+
+	ctx = device_get_sysctl_ctx(sc->dev);
+	node = SYSCTL_ADD_NODE(ctx,
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)), OID_AUTO,
+	    "owner_boost", CTLFLAG_RD | CTLFLAG_MPSAFE, NULL,
+	    "Lock owner boost");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "boosts",
+		       CTLFLAG_RD, &sc->ob_boosts, 0,
+		       "Times the request was raised for a lock owner");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "expirations",
+		       CTLFLAG_RD, &sc->ob_expirations, 0,
+		       "Boosts dropped after owner_boost_max_ms");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "boosted_ms",
+		       CTLFLAG_RD, &sc->ob_ms, 0,
+		       "Total time spent boosted");
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_owner_sc[sc->cpu_id] = sc;
+	sx_xunlock(&amd_cppc_lock);
+}
+
+void
+amd_cppc_owner_detach(struct amd_cppc_softc *sc)
+{
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	amd_cppc_owner_sc[sc->cpu_id] = NULL;
+	/* A waiter blocking right now may still start the callout. */
+	if (amd_cppc_owner_boost)
+		quiesce_all_cpus("cppcown", 0);
+	amd_cppc_owner_stop(sc);
+}
+
+void
+amd_cppc_owner_fini(void)
+{
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_owner_boost = 0;
+	(void)amd_cppc_owner_hook_set(false);
+	sx_xunlock(&amd_cppc_lock);
+}
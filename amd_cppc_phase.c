@@ -0,0 +1,304 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Boost windows.
+ *
+ * Boot, resume and writing a kernel dump are latency critical and short,
+ * but run at whatever policy the driver starts with. A window forces the
+ * request to full performance (min_perf and max_perf at highest_perf,
+ * EPP 0) while it is open and hands back to the configured policy when it
+ * closes:
+ *
+ *	boot		from load until hw.amd_cppc.boot_done is set, e.g. by
+ *			rc.local, or phase_boot_max_ms passes
+ *	resume		for phase_resume_ms after a resume
+ *	shutdown	from shutdown_pre_sync on, which covers syncing the
+ *			disks and a panic dump
+ *
+ * On a panic the other CPUs are stopped and the driver lock may be held,
+ * so only the local request is written, directly: min = max at the
+ * max_perf last written, which already holds the thermal and
+ * limit_max_perf ceilings.
+ */
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/eventhandler.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/pcpu.h>
+#include <sys/proc.h>
+#include <sys/sbuf.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+#include <sys/taskqueue.h>
+
+#include <machine/cpufunc.h>
+
+#include "amd_cppc_var.h"
+
+#define AMD_CPPC_PHASE_BOOT	0x01
+#define AMD_CPPC_PHASE_RESUME	0x02
+#define AMD_CPPC_PHASE_SHUTDOWN	0x04
+
+static const char *amd_cppc_phase_names[] = { "boot", "resume", "shutdown" };
+
+static int	amd_cppc_phase_boot = 0;
+static int	amd_cppc_phase_boot_max_ms = 120000;
+static int	amd_cppc_phase_resume_ms = 0;
+static int	amd_cppc_phase_shutdown = 0;
+
+static int	amd_cppc_phase;			/* open windows */
+static bool	amd_cppc_phase_ready;
+static struct timeout_task amd_cppc_phase_boot_task;
+static struct timeout_task amd_cppc_phase_resume_task;
+static eventhandler_tag amd_cppc_phase_tag;
+
+bool
+amd_cppc_phase_open(void)
+{
+
+	return (amd_cppc_phase != 0);
+}
+
+/*
+ * Apply the open windows on top of the computed request.
+ */
+void
+amd_cppc_phase_clamp(struct amd_cppc_softc *sc, struct amd_cppc_req *req)
+{
+
+	if (amd_cppc_phase == 0)
+		return;
+	req->max_perf = sc->highest_perf;
+	req->min_perf = sc->highest_perf;
+	req->des_perf = 0;
+	req->epp = 0;
+}
+
+/*
+ * Open or close windows and rewrite every CPU.
+ */
+static void
+amd_cppc_phase_set(int set, int clear)
+{
+	struct amd_cppc_batch *b;
+	struct amd_cppc_softc *sc;
+	int		cpu, i, old;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	old = amd_cppc_phase;
+	amd_cppc_phase = (old | set) & ~clear;
+	if (amd_cppc_phase == old)
+		return;
+
+	b = amd_cppc_batch_alloc();
+	CPU_FOREACH(cpu) {
+		sc = amd_cppc_softc_get(cpu);
+		if (sc != NULL && sc->cppc_enabled && !sc->detaching)
+			amd_cppc_batch_add(b, sc);
+	}
+	amd_cppc_batch_commit(b);
+
+	for (i = 0; i < (int)nitems(amd_cppc_phase_names); i++) {
+		if (((old ^ amd_cppc_phase) & (1 << i)) == 0)
+			continue;
+		devctl_notify("AMD_CPPC", "phase", amd_cppc_phase_names[i],
+			      (amd_cppc_phase & (1 << i)) ? "state=open" :
+			      "state=closed");
+	}
+}
+
+static void
+amd_cppc_phase_arm(struct timeout_task *t, int ms)
+{
+
+	taskqueue_enqueue_timeout(taskqueue_thread, t,
+				  MAX(1, (int)((int64_t)ms * hz / 1000)));
+}
+
+static void
+amd_cppc_phase_task_fn(void *arg, int pending __unused)
+{
+
+	sx_xlock(&amd_cppc_lock);
+	if (amd_cppc_phase_ready)
+		amd_cppc_phase_set(0, (int)(uintptr_t)arg);
+	sx_xunlock(&amd_cppc_lock);
+}
+
+/*
+ * Called from the resume method of each CPU before its request is
+ * rewritten. The first one opens the window; later CPUs join it.
+ */
+void
+amd_cppc_phase_resume(void)
+{
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	if (!amd_cppc_phase_ready || amd_cppc_phase_resume_ms <= 0 ||
+	    (amd_cppc_phase & AMD_CPPC_PHASE_RESUME) != 0)
+		return;
+	/* The resuming CPUs are rewritten by their own resume method. */
+	amd_cppc_phase |= AMD_CPPC_PHASE_RESUME;
+	devctl_notify("AMD_CPPC", "phase", "resume", "state=open");
+	amd_cppc_phase_arm(&amd_cppc_phase_resume_task,
+			   amd_cppc_phase_resume_ms);
+}
+
+static void
+amd_cppc_phase_shutdown_fn(void *arg __unused, int howto __unused)
+{
+	struct amd_cppc_softc *sc;
+	int		max;
+
+	if (!amd_cppc_phase_shutdown)
+		return;
+	if (KERNEL_PANICKED()) {
+		sc = amd_cppc_softc_get(curcpu);
+		if (sc == NULL || !sc->cppc_enabled)
+			return;
+		max = (sc->req_shadow >> AMD_CPPC_MAX_PERF_SHIFT) & 0xFF;
+		max = MIN(max, sc->highest_perf);
+		if (max != 0)
+			wrmsr(MSR_AMD_CPPC_REQ,
+			      AMD_CPPC_REQ_BUILD(max, max, 0, 0));
+		return;
+	}
+	sx_xlock(&amd_cppc_lock);
+	if (amd_cppc_phase_ready)
+		amd_cppc_phase_set(AMD_CPPC_PHASE_SHUTDOWN, 0);
+	sx_xunlock(&amd_cppc_lock);
+}
+
+static int
+amd_cppc_sysctl_boot_done(SYSCTL_HANDLER_ARGS)
+{
+	int		error, val;
+
+	val = (amd_cppc_phase & AMD_CPPC_PHASE_BOOT) == 0;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val == 0)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_phase_set(0, AMD_CPPC_PHASE_BOOT);
+	sx_xunlock(&amd_cppc_lock);
+	taskqueue_cancel_timeout(taskqueue_thread, &amd_cppc_phase_boot_task,
+				 NULL);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, boot_done,
+	    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_boot_done, "I",
+	    "Set to 1 to close the boot window");
+
+static int
+amd_cppc_sysctl_phase(SYSCTL_HANDLER_ARGS)
+{
+	struct sbuf	sb;
+	int		error, i, n;
+
+	sbuf_new_for_sysctl(&sb, NULL, 32, req);
+	n = 0;
+	sx_slock(&amd_cppc_lock);
+	for (i = 0; i < (int)nitems(amd_cppc_phase_names); i++) {
+		if ((amd_cppc_phase & (1 << i)) != 0)
+			sbuf_printf(&sb, "%s%s", n++ ? " " : "",
+				    amd_cppc_phase_names[i]);
+	}
+	sx_sunlock(&amd_cppc_lock);
+	if (n == 0)
+		sbuf_cat(&sb, "none");
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, phase,
+	    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_phase, "A",
+	    "Open boost windows");
+
+SYSCTL_INT(_hw_amd_cppc, OID_AUTO, phase_boot, CTLFLAG_RDTUN,
+	   &amd_cppc_phase_boot, 0,
+	   "Run at full performance from load until boot_done");
+SYSCTL_INT(_hw_amd_cppc, OID_AUTO, phase_boot_max_ms, CTLFLAG_RDTUN,
+	   &amd_cppc_phase_boot_max_ms, 0,
+	   "Close the boot window after this many ms without boot_done");
+SYSCTL_INT(_hw_amd_cppc, OID_AUTO, phase_resume_ms, CTLFLAG_RWTUN,
+	   &amd_cppc_phase_resume_ms, 0,
+	   "Run at full performance for this many ms after resume (0 = off)");
+SYSCTL_INT(_hw_amd_cppc, OID_AUTO, phase_shutdown, CTLFLAG_RWTUN,
+	   &amd_cppc_phase_shutdown, 0,
+	   "Run at full performance during shutdown and panic dumps");
+
+/*
+ * Called at module load, before any CPU attaches, so the boot window is
+ * already open when the first request is computed.
+ */
+void
+amd_cppc_phase_init(void)
+{
+
+	TIMEOUT_TASK_INIT(taskqueue_thread, &amd_cppc_phase_boot_task, 0,
+			  amd_cppc_phase_task_fn,
+			  (void *)(uintptr_t)AMD_CPPC_PHASE_BOOT);
+	TIMEOUT_TASK_INIT(taskqueue_thread, &amd_cppc_phase_resume_task, 0,
+			  amd_cppc_phase_task_fn,
+			  (void *)(uintptr_t)AMD_CPPC_PHASE_RESUME);
+	amd_cppc_phase_tag = EVENTHANDLER_REGISTER(shutdown_pre_sync,
+	    amd_cppc_phase_shutdown_fn, NULL, SHUTDOWN_PRI_FIRST);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_phase_ready = true;
+	if (amd_cppc_phase_boot) {
+		amd_cppc_phase = AMD_CPPC_PHASE_BOOT;
+		if (amd_cppc_phase_boot_max_ms > 0)
+			amd_cppc_phase_arm(&amd_cppc_phase_boot_task,
+					   amd_cppc_phase_boot_max_ms);
+	}
+	sx_xunlock(&amd_cppc_lock);
+}
+
+void
+amd_cppc_phase_fini(void)
+{
+
+	EVENTHANDLER_DEREGISTER(shutdown_pre_sync, amd_cppc_phase_tag);
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_phase_ready = false;
+	amd_cppc_phase = 0;
+	sx_xunlock(&amd_cppc_lock);
+	taskqueue_drain_timeout(taskqueue_thread, &amd_cppc_phase_boot_task);
+	taskqueue_drain_timeout(taskqueue_thread, &amd_cppc_phase_resume_task);
+}
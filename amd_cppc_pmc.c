@@ -0,0 +1,238 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * hwpmc(4) software events by delivered clock.
+ *
+ * A profile cannot tell a path that is slow from one that ran on a core
+ * capped at a low clock. With hw.amd_cppc.pmc.enable set, every CPU works
+ * out its delivered clock over each tick from APERF/MPERF and fires one
+ * of eight software events, CPPC.FREQ0 to CPPC.FREQ7, each covering
+ * pmc.bucket_mhz MHz (FREQ7 is open ended). CPPC.CAPPED fires on ticks
+ * where the request's max_perf is below highest_perf. The events are
+ * fired with the frame the tick interrupted, so sampling on them gives
+ * ordinary callchains that can be split by clock. An event fires at most
+ * once per tick, so the sampling rate must be set: at pmcstat's default
+ * of one sample per 65536 events a CPU yields one a minute.
+ *
+ *	pmcstat -n 1 -S CPPC.FREQ1 -S CPPC.FREQ6 -O out.pmc
+ *
+ * Events only cost a compare while no PMC is using them.
+ */
+
+#include "opt_hwpmc_hooks.h"
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/callout.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/pcpu.h>
+#include <sys/pmckern.h>
+#include <sys/proc.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+
+#include <machine/cpufunc.h>
+#include <machine/specialreg.h>
+
+#include "amd_cppc_var.h"
+
+#ifdef HWPMC_HOOKS
+
+#define AMD_CPPC_PMC_BUCKETS	8
+
+PMC_SOFT_DEFINE( , , cppc, freq0);
+PMC_SOFT_DEFINE( , , cppc, freq1);
+PMC_SOFT_DEFINE( , , cppc, freq2);
+PMC_SOFT_DEFINE( , , cppc, freq3);
+PMC_SOFT_DEFINE( , , cppc, freq4);
+PMC_SOFT_DEFINE( , , cppc, freq5);
+PMC_SOFT_DEFINE( , , cppc, freq6);
+PMC_SOFT_DEFINE( , , cppc, freq7);
+PMC_SOFT_DEFINE( , , cppc, capped);
+
+static struct pmc_soft *amd_cppc_pmc_freq[AMD_CPPC_PMC_BUCKETS] = {
+	&pmc___cppc_freq0, &pmc___cppc_freq1, &pmc___cppc_freq2,
+	&pmc___cppc_freq3, &pmc___cppc_freq4, &pmc___cppc_freq5,
+	&pmc___cppc_freq6, &pmc___cppc_freq7,
+};
+
+struct amd_cppc_pmc_cpu {
+	struct callout	callout;
+	struct amd_cppc_softc *sc;
+	uint64_t	aperf;
+	uint64_t	mperf;
+};
+
+static int	amd_cppc_pmc = 0;
+static int	amd_cppc_pmc_bucket_mhz = 625;
+static struct amd_cppc_pmc_cpu amd_cppc_pmc_cpus[MAXCPU];
+
+static SYSCTL_NODE(_hw_amd_cppc, OID_AUTO, pmc, CTLFLAG_RD | CTLFLAG_MPSAFE,
+		   NULL, "hwpmc software events by delivered clock");
+
+static void
+amd_cppc_pmc_fire(struct pmc_soft *ps, struct trapframe *tf)
+{
+	struct pmckern_soft ks;
+
+	if (__predict_true(!ps->ps_running))
+		return;
+	ks.pm_ev = ps->ps_ev.pm_ev_code;
+	ks.pm_cpu = PCPU_GET(cpuid);
+	ks.pm_tf = tf;
+	PMC_CALL_HOOK_UNLOCKED(curthread, PMC_FN_SOFT_SAMPLING, (void *)&ks);
+}
+
+static void
+amd_cppc_pmc_tick(void *arg)
+{
+	struct amd_cppc_pmc_cpu *pc;
+	struct amd_cppc_softc *sc;
+	struct trapframe *tf;
+	uint64_t	a, m, da, dm, mhz;
+	int		b;
+	bool		baseline;
+
+	pc = arg;
+	sc = pc->sc;
+	baseline = pc->mperf == 0;
+	a = rdmsr(MSR_APERF);
+	m = rdmsr(MSR_MPERF);
+	da = a - pc->aperf;
+	dm = m - pc->mperf;
+	pc->aperf = a;
+	pc->mperf = m;
+
+	/* The tick's interrupt frame; the callout runs inside it. */
+	tf = curthread->td_intr_frame;
+	if (!baseline && tf != NULL && dm != 0 && da < dm * 16) {
+		mhz = da * sc->base_freq_mhz / dm;
+		b = (int)MIN(mhz / MAX(1, amd_cppc_pmc_bucket_mhz),
+			     AMD_CPPC_PMC_BUCKETS - 1);
+		amd_cppc_pmc_fire(amd_cppc_pmc_freq[b], tf);
+		if (((sc->req_shadow >> AMD_CPPC_MAX_PERF_SHIFT) & 0xFF) <
+		    sc->highest_perf)
+			amd_cppc_pmc_fire(&pmc___cppc_capped, tf);
+	}
+
+	if (amd_cppc_pmc && !sc->detaching)
+		callout_reset_sbt_on(&pc->callout, tick_sbt, 0,
+				     amd_cppc_pmc_tick, pc, sc->cpu_id,
+				     C_DIRECT_EXEC);
+}
+
+static void
+amd_cppc_pmc_start(struct amd_cppc_pmc_cpu *pc)
+{
+
+	/* The first tick only takes the baseline. */
+	pc->aperf = pc->mperf = 0;
+	callout_reset_sbt_on(&pc->callout, tick_sbt, 0, amd_cppc_pmc_tick,
+			     pc, pc->sc->cpu_id, C_DIRECT_EXEC);
+}
+
+static int
+amd_cppc_sysctl_pmc(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_pmc_cpu *pc;
+	int		cpu, error, val;
+
+	val = amd_cppc_pmc;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	val = val != 0;
+	sx_xlock(&amd_cppc_lock);
+	if (val != amd_cppc_pmc) {
+		amd_cppc_pmc = val;
+		CPU_FOREACH(cpu) {
+			pc = &amd_cppc_pmc_cpus[cpu];
+			if (pc->sc == NULL)
+				continue;
+			if (val)
+				amd_cppc_pmc_start(pc);
+			else
+				callout_drain(&pc->callout);
+		}
+	}
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc_pmc, OID_AUTO, enable,
+	    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_pmc, "I",
+	    "Fire CPPC.FREQn and CPPC.CAPPED software events on the tick");
+
+SYSCTL_INT(_hw_amd_cppc_pmc, OID_AUTO, bucket_mhz, CTLFLAG_RWTUN,
+	   &amd_cppc_pmc_bucket_mhz, 0,
+	   "Width of a CPPC.FREQn bucket in MHz");
+
+void
+amd_cppc_pmc_attach(struct amd_cppc_softc *sc)
+{
+	struct amd_cppc_pmc_cpu *pc;
+
+	pc = &amd_cppc_pmc_cpus[sc->cpu_id];
+	callout_init(&pc->callout, 1);
+	sx_xlock(&amd_cppc_lock);
+	pc->sc = sc;
+	if (amd_cppc_pmc)
+		amd_cppc_pmc_start(pc);
+	sx_xunlock(&amd_cppc_lock);
+}
+
+void
+amd_cppc_pmc_detach(struct amd_cppc_softc *sc)
+{
+	struct amd_cppc_pmc_cpu *pc;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	pc = &amd_cppc_pmc_cpus[sc->cpu_id];
+	if (pc->sc == NULL)
+		return;
+	callout_drain(&pc->callout);
+	pc->sc = NULL;
+}
+
+#else /* !HWPMC_HOOKS */
+
+void
+amd_cppc_pmc_attach(struct amd_cppc_softc *sc __unused)
+{
+}
+
+void
+amd_cppc_pmc_detach(struct amd_cppc_softc *sc __unused)
+{
+}
+
+#endif /* HWPMC_HOOKS */
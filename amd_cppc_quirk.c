@@ -0,0 +1,187 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * CPU family/model quirk table, see amd_cppc_quirk.h.
+ */
+
+#include <sys/param.h>
+#ifdef _KERNEL
+#include <sys/kernel.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+
+#include <machine/md_var.h>
+
+#include "amd_cppc_var.h"
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+#include "amd_cppc_quirk.h"
+
+#ifndef nitems
+#define nitems(x)	(sizeof(x) / sizeof((x)[0]))
+#endif
+
+#define EPP_DEFAULT	0x00, 0x80, 0xFF
+
+/*
+ * First match wins, so specific models go before the catch-all of their
+ * family. The last entry matches anything.
+ */
+static const struct amd_cppc_quirk amd_cppc_quirks[] = {
+	/* Zen 2 */
+	{ "Zen/Zen+", 0x17, 0x00, 0x2F, 0x0, 0xF,
+	    AMD_CPPC_QUIRK_NO_CPPC, 0, EPP_DEFAULT },
+	{ "Rome", 0x17, 0x30, 0x3F, 0x0, 0xF,
+	    AMD_CPPC_QUIRK_RANKED, 166, EPP_DEFAULT },
+	{ "Renoir", 0x17, 0x60, 0x6F, 0x0, 0xF,
+	    AMD_CPPC_QUIRK_SMU, 0, EPP_DEFAULT },
+	{ "Matisse", 0x17, 0x70, 0x7F, 0x0, 0xF,
+	    AMD_CPPC_QUIRK_RANKED, 166, EPP_DEFAULT },
+	{ "Zen 2", 0x17, 0x00, 0xFF, 0x0, 0xF,
+	    0, 0, EPP_DEFAULT },
+
+	/* Zen 3 and Zen 4 */
+	{ "Milan", 0x19, 0x00, 0x0F, 0x0, 0xF,
+	    AMD_CPPC_QUIRK_HSMP, 0, EPP_DEFAULT },
+	{ "Genoa", 0x19, 0x10, 0x1F, 0x0, 0xF,
+	    AMD_CPPC_QUIRK_HSMP, 0, EPP_DEFAULT },
+	{ "Vermeer", 0x19, 0x20, 0x2F, 0x0, 0xF,
+	    AMD_CPPC_QUIRK_RANKED, 166, EPP_DEFAULT },
+	{ "Rembrandt", 0x19, 0x40, 0x4F, 0x0, 0xF,
+	    AMD_CPPC_QUIRK_RANKED, 166, EPP_DEFAULT },
+	{ "Cezanne", 0x19, 0x50, 0x5F, 0x0, 0xF,
+	    AMD_CPPC_QUIRK_RANKED | AMD_CPPC_QUIRK_SMU, 166, EPP_DEFAULT },
+	{ "Raphael", 0x19, 0x60, 0x6F, 0x0, 0xF,
+	    AMD_CPPC_QUIRK_RANKED, 166, EPP_DEFAULT },
+	{ "MI300/Bergamo", 0x19, 0x90, 0xAF, 0x0, 0xF,
+	    AMD_CPPC_QUIRK_HSMP, 0, EPP_DEFAULT },
+	{ "Zen 3/4", 0x19, 0x00, 0xFF, 0x0, 0xF,
+	    0, 0, EPP_DEFAULT },
+
+	/* Zen 5 */
+	{ "Turin", 0x1A, 0x00, 0x1F, 0x0, 0xF,
+	    AMD_CPPC_QUIRK_HSMP, 0, EPP_DEFAULT },
+	{ "Zen 5", 0x1A, 0x00, 0xFF, 0x0, 0xF,
+	    AMD_CPPC_QUIRK_RANKED, 166, EPP_DEFAULT },
+
+	{ "generic", 0, 0x00, 0xFF, 0x0, 0xF,
+	    0, 0, EPP_DEFAULT },
+};
+
+const struct amd_cppc_quirk *
+amd_cppc_quirk_lookup(uint32_t cpuid)
+{
+	const struct amd_cppc_quirk *q;
+	u_int		family, model, step;
+	size_t		i;
+
+	family = AMD_CPPC_CPUID_FAMILY(cpuid);
+	model = AMD_CPPC_CPUID_MODEL(cpuid);
+	step = AMD_CPPC_CPUID_STEPPING(cpuid);
+	for (i = 0; i < nitems(amd_cppc_quirks) - 1; i++) {
+		q = &amd_cppc_quirks[i];
+		if (q->family == family && model >= q->model_lo &&
+		    model <= q->model_hi && step >= q->step_lo &&
+		    step <= q->step_hi)
+			return (q);
+	}
+	return (&amd_cppc_quirks[nitems(amd_cppc_quirks) - 1]);
+}
+
+/*
+ * The boost ratio, in perf units, that highest_perf stands for. A ranked
+ * part reports a rank there; only values at or above the table's ratio
+ * are ranks, a lower value is a real (fused down) ratio.
+ */
+int
+amd_cppc_quirk_highest(const struct amd_cppc_quirk *q, int highest,
+		       int nominal)
+{
+
+	if ((q->flags & AMD_CPPC_QUIRK_RANKED) != 0 &&
+	    highest >= q->boost_ratio && q->boost_ratio > nominal)
+		return (q->boost_ratio);
+	return (highest);
+}
+
+/*
+ * Map user EPP 0-100 onto the part's bands: 0-50 onto performance to
+ * balance, 50-100 onto balance to power save.
+ */
+uint8_t
+amd_cppc_quirk_epp(const struct amd_cppc_quirk *q, int epp)
+{
+
+	if (epp <= 0)
+		return (q->epp_perf);
+	if (epp >= 100)
+		return (q->epp_power);
+	if (epp <= 50)
+		return (q->epp_perf + (q->epp_bal - q->epp_perf) * epp / 50);
+	return (q->epp_bal + (q->epp_power - q->epp_bal) * (epp - 50) / 50);
+}
+
+#ifdef _KERNEL
+const struct amd_cppc_quirk *amd_cppc_quirk =
+    &amd_cppc_quirks[nitems(amd_cppc_quirks) - 1];
+
+/*
+ * Resolve the entry of the running CPU. All cores of a system share the
+ * signature, so the boot CPU's is used.
+ */
+void
+amd_cppc_quirk_init(void)
+{
+
+	amd_cppc_quirk = amd_cppc_quirk_lookup(cpu_id);
+}
+
+static int
+amd_cppc_sysctl_quirk(SYSCTL_HANDLER_ARGS)
+{
+	const struct amd_cppc_quirk *q;
+	char		buf[80];
+
+	q = amd_cppc_quirk;
+	snprintf(buf, sizeof(buf), "%s%s%s%s%s boost_ratio=%u epp=%u/%u/%u",
+		 q->name,
+		 (q->flags & AMD_CPPC_QUIRK_NO_CPPC) != 0 ? " no_cppc" : "",
+		 (q->flags & AMD_CPPC_QUIRK_RANKED) != 0 ? " ranked" : "",
+		 (q->flags & AMD_CPPC_QUIRK_HSMP) != 0 ? " hsmp" : "",
+		 (q->flags & AMD_CPPC_QUIRK_SMU) != 0 ? " smu" : "",
+		 q->boost_ratio, q->epp_perf, q->epp_bal, q->epp_power);
+	return (sysctl_handle_string(oidp, buf, sizeof(buf), req));
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, quirk,
+	    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_quirk, "A",
+	    "Quirk table entry of this CPU: name, flags, boost ratio, EPP");
+#endif
@@ -0,0 +1,84 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * CPU family/model quirks.
+ *
+ * Zen generations disagree on what CAP1 means. On parts with preferred
+ * core ranking highest_perf is a rank (166 or 255 on every core, or a
+ * per-core value up to 255) rather than the boost ratio; Zen and Zen+ have
+ * the CPPC CPUID bit on some firmware but not the MSRs; the HSMP mailbox
+ * and the SMU metrics table exist only on some models. One static table
+ * keyed by family, model and stepping records all of it. The driver looks
+ * the running CPU up once at load and afterwards reads plain fields.
+ *
+ * The lookup and the helpers below have no kernel dependencies and build
+ * in userland, so the table can be checked against captured CPUID and CAP1
+ * values.
+ */
+
+#ifndef _AMD_CPPC_QUIRK_H_
+#define _AMD_CPPC_QUIRK_H_
+
+/* Family, model and stepping of a CPUID leaf 1 signature */
+#define AMD_CPPC_CPUID_FAMILY(id)	((((id) >> 8) & 0xf) +		\
+					 (((id) >> 20) & 0xff))
+#define AMD_CPPC_CPUID_MODEL(id)	((((id) >> 4) & 0xf) |		\
+					 (((id) >> 12) & 0xf0))
+#define AMD_CPPC_CPUID_STEPPING(id)	((id) & 0xf)
+
+/* Flags */
+#define AMD_CPPC_QUIRK_NO_CPPC	0x01	/* CPPC MSRs absent */
+#define AMD_CPPC_QUIRK_RANKED	0x02	/* highest_perf is a core rank */
+#define AMD_CPPC_QUIRK_HSMP	0x04	/* HSMP mailbox (server) */
+#define AMD_CPPC_QUIRK_SMU	0x08	/* SMU metrics table (mobile) */
+
+struct amd_cppc_quirk {
+	const char	*name;
+	uint16_t	family;
+	uint8_t		model_lo, model_hi;
+	uint8_t		step_lo, step_hi;
+	uint32_t	flags;		/* AMD_CPPC_QUIRK_* */
+	uint8_t		boost_ratio;	/* highest_perf to use if RANKED */
+	/* Hardware EPP for user EPP 0, 50 and 100 */
+	uint8_t		epp_perf, epp_bal, epp_power;
+};
+
+const struct amd_cppc_quirk *amd_cppc_quirk_lookup(uint32_t cpuid);
+int	amd_cppc_quirk_highest(const struct amd_cppc_quirk *q, int highest,
+			       int nominal);
+uint8_t	amd_cppc_quirk_epp(const struct amd_cppc_quirk *q, int epp);
+
+#ifdef _KERNEL
+extern const struct amd_cppc_quirk *amd_cppc_quirk;
+
+#define AMD_CPPC_QUIRK(f)	((amd_cppc_quirk->flags & (f)) != 0)
+
+void	amd_cppc_quirk_init(void);
+#endif
+
+#endif /* !_AMD_CPPC_QUIRK_H_ */
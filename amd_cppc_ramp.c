@@ -0,0 +1,481 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Predictive pre-ramp for periodic wakeups.
+ *
+ * A service that wakes on a fixed period after a long sleep starts every
+ * period at the low clock the idle core dropped to, and autonomous ramp-up
+ * takes its first slice. With hw.amd_cppc.ramp.enable set, each CPU learns
+ * the period of its wakeups and raises min_perf to ramp.perf shortly before
+ * the next one is due, so the thread starts at speed.
+ *
+ * The input comes from the idle hook (amd_cppc_idle.c): every return from
+ * an idle period of at least ramp.min_idle_us that left a thread runnable
+ * is a wakeup. Consecutive wakeups ramp.lock times in a row the same
+ * interval apart (within ramp.tol_us or 1/16 of it) lock the period. Once
+ * locked, the CPU's callout raises the request ramp.lead_us before the
+ * predicted wakeup. A wakeup within the tolerance of the prediction is a
+ * hit: the request stays raised for ramp.hold_us and the phase is
+ * resynchronised to it. No wakeup by the end of the window is a miss.
+ * Other wakeups in between are ignored, so unrelated threads on the CPU do
+ * not break the lock. If fewer than ramp.min_accuracy percent of the last
+ * 32 predictions hit, the CPU stops predicting for ramp.backoff_s and then
+ * learns again.
+ *
+ * Like the lock owner boost, the raised request is written to the local
+ * MSR by the CPU itself, from its callout, and the watchdog accepts it.
+ */
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/callout.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/pcpu.h>
+#include <sys/proc.h>
+#include <sys/sbuf.h>
+#include <sys/sched.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+
+#include <machine/atomic.h>
+#include <machine/cpufunc.h>
+
+#include "amd_cppc_var.h"
+
+#define AMD_CPPC_RAMP_LEARN	0	/* no period locked */
+#define AMD_CPPC_RAMP_WAIT	1	/* callout raises before next wakeup */
+#define AMD_CPPC_RAMP_RAISED	2	/* callout ends the window */
+#define AMD_CPPC_RAMP_HELD	3	/* hit, callout relaxes */
+#define AMD_CPPC_RAMP_OFF	4	/* backing off after low accuracy */
+
+#define AMD_CPPC_RAMP_WINDOW	32	/* predictions judged for accuracy */
+
+static const char *amd_cppc_ramp_states[] = {
+	"learning", "waiting", "raised", "held", "off"
+};
+
+static int	amd_cppc_ramp = 0;
+static int	amd_cppc_ramp_perf = 0;		/* 0 = highest_perf */
+static int	amd_cppc_ramp_lead_us = 300;
+static int	amd_cppc_ramp_hold_us = 2000;
+static int	amd_cppc_ramp_tol_us = 200;
+static int	amd_cppc_ramp_min_idle_us = 500;
+static int	amd_cppc_ramp_lock = 4;
+static int	amd_cppc_ramp_min_accuracy = 75;
+static int	amd_cppc_ramp_backoff_s = 30;
+static struct amd_cppc_softc *amd_cppc_ramp_sc[MAXCPU];
+
+static void	amd_cppc_ramp_tick(void *arg);
+
+static SYSCTL_NODE(_hw_amd_cppc, OID_AUTO, ramp, CTLFLAG_RD | CTLFLAG_MPSAFE,
+		   NULL, "Predictive pre-ramp for periodic wakeups");
+
+static sbintime_t
+amd_cppc_ramp_tol(sbintime_t period)
+{
+
+	return (MAX(period / 16, amd_cppc_ramp_tol_us * SBT_1US));
+}
+
+/*
+ * Write the raised request, or put back the one in force without it.
+ */
+static void
+amd_cppc_ramp_write(struct amd_cppc_softc *sc, bool raise)
+{
+	uint64_t	base, req;
+	int		floor, min, max;
+
+	base = sc->ob_req != 0 ? sc->ob_req : sc->req_shadow;
+	if (!raise) {
+		if (sc->pr_req != 0 && sc->pr_req != base)
+			wrmsr(MSR_AMD_CPPC_REQ, base);
+		sc->pr_req = 0;
+		return;
+	}
+	floor = amd_cppc_ramp_perf != 0 ? amd_cppc_ramp_perf :
+	    sc->highest_perf;
+	min = (base >> AMD_CPPC_MIN_PERF_SHIFT) & 0xFF;
+	max = (base >> AMD_CPPC_MAX_PERF_SHIFT) & 0xFF;
+	min = MAX(min, MIN(floor, max));
+	req = (base & ~((uint64_t)0xFF << AMD_CPPC_MIN_PERF_SHIFT)) |
+	    (uint64_t)min << AMD_CPPC_MIN_PERF_SHIFT;
+	if (req != base)
+		wrmsr(MSR_AMD_CPPC_REQ, req);
+	sc->pr_req = req;
+}
+
+/*
+ * Record the outcome of a prediction. Returns false if accuracy dropped
+ * and the CPU went off.
+ */
+static bool
+amd_cppc_ramp_judge(struct amd_cppc_softc *sc, bool hit, sbintime_t now)
+{
+	int		hits;
+
+	sc->pr_history = sc->pr_history << 1 | (hit ? 1 : 0);
+	if (sc->pr_judged < AMD_CPPC_RAMP_WINDOW)
+		sc->pr_judged++;
+	if (hit)
+		sc->pr_hits++;
+	else
+		sc->pr_misses++;
+	if (sc->pr_judged < AMD_CPPC_RAMP_WINDOW / 2)
+		return (true);
+	hits = bitcount32(sc->pr_history &
+	    (sc->pr_judged < AMD_CPPC_RAMP_WINDOW ?
+	    (1U << sc->pr_judged) - 1 : ~0U));
+	if (hits * 100 >= amd_cppc_ramp_min_accuracy * sc->pr_judged)
+		return (true);
+	sc->pr_disables++;
+	sc->pr_state = AMD_CPPC_RAMP_OFF;
+	sc->pr_period = 0;
+	sc->pr_next = now + (sbintime_t)amd_cppc_ramp_backoff_s * SBT_1S;
+	return (false);
+}
+
+/*
+ * Schedule the raise for the first predicted wakeup far enough ahead.
+ */
+static void
+amd_cppc_ramp_arm(struct amd_cppc_softc *sc, sbintime_t now)
+{
+	sbintime_t	lead;
+
+	if (sc->pr_period <= 0) {
+		sc->pr_state = AMD_CPPC_RAMP_LEARN;
+		return;
+	}
+	lead = amd_cppc_ramp_lead_us * SBT_1US;
+	while (sc->pr_next - lead <= now)
+		sc->pr_next += sc->pr_period;
+	sc->pr_state = AMD_CPPC_RAMP_WAIT;
+	callout_reset_sbt_on(&sc->pr_callout, sc->pr_next - lead, 0,
+			     amd_cppc_ramp_tick, sc, sc->cpu_id,
+			     C_DIRECT_EXEC | C_ABSOLUTE);
+}
+
+static void
+amd_cppc_ramp_tick(void *arg)
+{
+	struct amd_cppc_softc *sc;
+	sbintime_t	now;
+
+	sc = arg;
+	now = sbinuptime();
+	if (!amd_cppc_ramp || !sc->cppc_enabled || sc->detaching) {
+		amd_cppc_ramp_write(sc, false);
+		return;
+	}
+	switch (sc->pr_state) {
+	case AMD_CPPC_RAMP_WAIT:
+		amd_cppc_ramp_write(sc, true);
+		sc->pr_state = AMD_CPPC_RAMP_RAISED;
+		callout_reset_sbt_on(&sc->pr_callout,
+				     sc->pr_next + amd_cppc_ramp_tol(sc->pr_period),
+				     0, amd_cppc_ramp_tick, sc, sc->cpu_id,
+				     C_DIRECT_EXEC | C_ABSOLUTE);
+		break;
+	case AMD_CPPC_RAMP_RAISED:
+		amd_cppc_ramp_write(sc, false);
+		if (amd_cppc_ramp_judge(sc, false, now))
+			amd_cppc_ramp_arm(sc, now);
+		break;
+	case AMD_CPPC_RAMP_HELD:
+		if (now < sc->pr_hold) {
+			callout_reset_sbt_on(&sc->pr_callout, sc->pr_hold, 0,
+					     amd_cppc_ramp_tick, sc,
+					     sc->cpu_id,
+					     C_DIRECT_EXEC | C_ABSOLUTE);
+			break;
+		}
+		amd_cppc_ramp_write(sc, false);
+		amd_cppc_ramp_arm(sc, now);
+		break;
+	}
+}
+
+/*
+ * Called by the idle hook of the CPU on the way out of an idle period of
+ * idle_us, with interrupts disabled.
+ */
+void
+amd_cppc_ramp_wake(struct amd_cppc_softc *sc, uint32_t idle_us)
+{
+	sbintime_t	iv, now, tol;
+
+	if (!amd_cppc_ramp || sc->pr_off_cpu ||
+	    idle_us < (uint32_t)amd_cppc_ramp_min_idle_us || !sched_runnable())
+		return;
+	now = sbinuptime();
+
+	switch (sc->pr_state) {
+	case AMD_CPPC_RAMP_OFF:
+		if (now < sc->pr_next)
+			return;
+		sc->pr_state = AMD_CPPC_RAMP_LEARN;
+		sc->pr_judged = 0;
+		sc->pr_history = 0;
+		sc->pr_streak = 0;
+		sc->pr_last = 0;
+		/* FALLTHROUGH */
+	case AMD_CPPC_RAMP_LEARN:
+		iv = sc->pr_last != 0 ? now - sc->pr_last : 0;
+		sc->pr_last = now;
+		if (iv == 0)
+			return;
+		if (sc->pr_streak > 0 &&
+		    MAX(iv - sc->pr_cand, sc->pr_cand - iv) <=
+		    amd_cppc_ramp_tol(sc->pr_cand)) {
+			sc->pr_cand += (iv - sc->pr_cand) / 8;
+			sc->pr_streak++;
+		} else {
+			sc->pr_cand = iv;
+			sc->pr_streak = 1;
+		}
+		if (sc->pr_streak < amd_cppc_ramp_lock)
+			return;
+		/* The callout is idle while learning, so it can be armed. */
+		sc->pr_period = sc->pr_cand;
+		sc->pr_next = now + sc->pr_period;
+		sc->pr_locks++;
+		amd_cppc_ramp_arm(sc, now);
+		return;
+	case AMD_CPPC_RAMP_WAIT:
+	case AMD_CPPC_RAMP_RAISED:
+		tol = amd_cppc_ramp_tol(sc->pr_period);
+		if (now < sc->pr_next - tol - amd_cppc_ramp_lead_us * SBT_1US)
+			return;		/* some other wakeup */
+		/* Early inside the lead, or in the window: a hit. */
+		sc->pr_last = now;
+		sc->pr_next = now;
+		sc->pr_hold = now + amd_cppc_ramp_hold_us * SBT_1US;
+		if (!amd_cppc_ramp_judge(sc, true, now)) {
+			/* Gone off; the pending callout finds nothing to do. */
+			amd_cppc_ramp_write(sc, false);
+			return;
+		}
+		if (sc->pr_state == AMD_CPPC_RAMP_WAIT)
+			amd_cppc_ramp_write(sc, true);
+		/* The pending callout sees HELD and relaxes after the hold. */
+		sc->pr_state = AMD_CPPC_RAMP_HELD;
+		return;
+	default:
+		return;
+	}
+}
+
+/*
+ * Stop predicting on a CPU and put back its request.
+ */
+static void
+amd_cppc_ramp_stop(struct amd_cppc_softc *sc)
+{
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	callout_drain(&sc->pr_callout);
+	if (sc->pr_req != 0) {
+		if (sc->cppc_enabled) {
+			amd_cppc_bind_cpu(sc->cpu_id);
+			amd_cppc_ramp_write(sc, false);
+			amd_cppc_unbind_cpu();
+		}
+		sc->pr_req = 0;
+	}
+	sc->pr_state = AMD_CPPC_RAMP_LEARN;
+	sc->pr_streak = 0;
+	sc->pr_last = 0;
+	sc->pr_period = 0;
+	sc->pr_judged = 0;
+	sc->pr_history = 0;
+}
+
+static int
+amd_cppc_sysctl_ramp_enable(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	int		cpu, error, val;
+
+	val = amd_cppc_ramp;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	val = val != 0;
+	sx_xlock(&amd_cppc_lock);
+	if (val && !amd_cppc_ramp) {
+		error = amd_cppc_idle_hook_use(AMD_CPPC_IDLE_USER_RAMP, true);
+		if (error == 0)
+			amd_cppc_ramp = 1;
+	} else if (!val && amd_cppc_ramp) {
+		/* No CPU is in the hook after this, so none can re-arm. */
+		amd_cppc_ramp = 0;
+		(void)amd_cppc_idle_hook_use(AMD_CPPC_IDLE_USER_RAMP, false);
+		CPU_FOREACH(cpu) {
+			if ((sc = amd_cppc_ramp_sc[cpu]) != NULL)
+				amd_cppc_ramp_stop(sc);
+		}
+	}
+	sx_xunlock(&amd_cppc_lock);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc_ramp, OID_AUTO, enable,
+	    CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_ramp_enable, "I",
+	    "Raise min_perf ahead of predicted periodic wakeups");
+SYSCTL_INT(_hw_amd_cppc_ramp, OID_AUTO, perf, CTLFLAG_RWTUN,
+	   &amd_cppc_ramp_perf, 0, "min_perf while raised (0 = highest_perf)");
+SYSCTL_INT(_hw_amd_cppc_ramp, OID_AUTO, lead_us, CTLFLAG_RWTUN,
+	   &amd_cppc_ramp_lead_us, 0, "Raise this long before the wakeup");
+SYSCTL_INT(_hw_amd_cppc_ramp, OID_AUTO, hold_us, CTLFLAG_RWTUN,
+	   &amd_cppc_ramp_hold_us, 0, "Stay raised this long after a hit");
+SYSCTL_INT(_hw_amd_cppc_ramp, OID_AUTO, tol_us, CTLFLAG_RWTUN,
+	   &amd_cppc_ramp_tol_us, 0,
+	   "Least jitter tolerated, also 1/16 of the period");
+SYSCTL_INT(_hw_amd_cppc_ramp, OID_AUTO, min_idle_us, CTLFLAG_RWTUN,
+	   &amd_cppc_ramp_min_idle_us, 0,
+	   "Shortest idle period whose wakeup is learned");
+SYSCTL_INT(_hw_amd_cppc_ramp, OID_AUTO, lock, CTLFLAG_RWTUN,
+	   &amd_cppc_ramp_lock, 0, "Matching intervals that lock a period");
+SYSCTL_INT(_hw_amd_cppc_ramp, OID_AUTO, min_accuracy, CTLFLAG_RWTUN,
+	   &amd_cppc_ramp_min_accuracy, 0,
+	   "Hit percentage below which a CPU stops predicting");
+SYSCTL_INT(_hw_amd_cppc_ramp, OID_AUTO, backoff_s, CTLFLAG_RWTUN,
+	   &amd_cppc_ramp_backoff_s, 0,
+	   "Time a CPU stays off after low accuracy, in seconds");
+
+/*
+ * Setting off stops a CPU that has a period locked. The flag is checked by
+ * the idle hook with interrupts disabled, so once this thread has run on
+ * the CPU no wakeup can arm the callout again.
+ */
+static int
+amd_cppc_sysctl_ramp_off(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	int		error, val;
+
+	sc = arg1;
+	val = sc->pr_off_cpu;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	sx_xlock(&amd_cppc_lock);
+	sc->pr_off_cpu = val != 0;
+	if (sc->pr_off_cpu && !sc->detaching) {
+		amd_cppc_bind_cpu(sc->cpu_id);
+		amd_cppc_unbind_cpu();
+		amd_cppc_ramp_stop(sc);
+	}
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+
+static int
+amd_cppc_sysctl_ramp_state(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	struct sbuf	sb;
+	uint32_t	mask;
+	int		error, hits, judged;
+
+	sc = arg1;
+	sbuf_new_for_sysctl(&sb, NULL, 96, req);
+	judged = sc->pr_judged;
+	mask = judged < AMD_CPPC_RAMP_WINDOW ? (1U << judged) - 1 : ~0U;
+	hits = bitcount32(sc->pr_history & mask);
+	sbuf_printf(&sb, "%s period_us %jd accuracy %d%% (%d/%d)",
+		    amd_cppc_ramp_states[sc->pr_state],
+		    (intmax_t)(sc->pr_period / SBT_1US),
+		    judged != 0 ? hits * 100 / judged : 0, hits, judged);
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	return (error);
+}
+
+void
+amd_cppc_ramp_attach(struct amd_cppc_softc *sc)
+{
+	struct sysctl_ctx_list *ctx;
+	struct sysctl_oid *node;
+
+	callout_init(&sc->pr_callout, 1);
+	sc->pr_state = AMD_CPPC_RAMP_LEARN;
+
+	ctx = device_get_sysctl_ctx(sc->dev);
+	node = SYSCTL_ADD_NODE(ctx,
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)), OID_AUTO,
+	    "ramp", CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, "Predictive pre-ramp");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "state",
+			CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, sc, 0,
+			amd_cppc_sysctl_ramp_state, "A",
+			"Predictor state, period and recent accuracy");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "hits",
+		       CTLFLAG_RD, &sc->pr_hits, 0,
+		       "Wakeups that came as predicted");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "misses",
+		       CTLFLAG_RD, &sc->pr_misses, 0,
+		       "Predicted wakeups that did not come");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "locks",
+		       CTLFLAG_RD, &sc->pr_locks, 0, "Periods learned");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "disables",
+		       CTLFLAG_RD, &sc->pr_disables, 0,
+		       "Times prediction was stopped for low accuracy");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "off",
+			CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_MPSAFE, sc, 0,
+			amd_cppc_sysctl_ramp_off, "I",
+			"Never predict on this CPU");
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_ramp_sc[sc->cpu_id] = sc;
+	sx_xunlock(&amd_cppc_lock);
+}
+
+void
+amd_cppc_ramp_detach(struct amd_cppc_softc *sc)
+{
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	amd_cppc_ramp_sc[sc->cpu_id] = NULL;
+	amd_cppc_ramp_stop(sc);
+}
+
+void
+amd_cppc_ramp_fini(void)
+{
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_ramp = 0;
+	(void)amd_cppc_idle_hook_use(AMD_CPPC_IDLE_USER_RAMP, false);
+	sx_xunlock(&amd_cppc_lock);
+}
@@ -0,0 +1,605 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Declarative policy rules.
+ *
+ * The parser and matcher at the top of this file have no kernel
+ * dependencies and build unchanged in userland, so a rule table can be
+ * checked against recorded inputs before it is loaded. The kernel part
+ * evaluates the loaded table for every CPU from a periodic task and feeds
+ * the matching rule's actions into the request as an override.
+ */
+
+#include <sys/param.h>
+#ifdef _KERNEL
+#include <sys/bus.h>
+#include <sys/cpuset.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/pcpu.h>
+#include <sys/power.h>
+#include <sys/proc.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+#include <sys/taskqueue.h>
+
+#include "amd_cppc_var.h"
+#else
+#ifdef __FreeBSD__
+#include <sys/cpuset.h>
+#else
+#include <sched.h>		/* userland tests on Linux */
+typedef cpu_set_t cpuset_t;
+#endif
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+#include "amd_cppc_rules.h"
+
+static void
+amd_cppc_rule_init(struct amd_cppc_rule *r)
+{
+
+	memset(r, 0, sizeof(*r));
+	r->util_lo = 0;
+	r->util_hi = 100;
+	r->temp_lo = INT16_MIN;
+	r->temp_hi = INT16_MAX;
+	r->ac_mask = 0x3;
+	r->cpuset = -1;
+	r->epp = r->min_perf = r->max_perf = r->boost = -1;
+}
+
+/*
+ * Parse "N" or "LO-HI" into an inclusive range within [min, max].
+ */
+static int
+amd_cppc_rule_range(const char *val, long min, long max, long *lo, long *hi)
+{
+	const char	*p;
+	char		*end;
+
+	*lo = strtol(val, &end, 10);
+	if (end == val)
+		return (EINVAL);
+	if (*end == '-') {
+		p = end + 1;
+		*hi = strtol(p, &end, 10);
+		if (end == p)
+			return (EINVAL);
+	} else
+		*hi = *lo;
+	if (*end != '\0' || *lo < min || *hi > max || *lo > *hi)
+		return (EINVAL);
+	return (0);
+}
+
+static int
+amd_cppc_rule_cond(struct amd_cppc_ruleset *rs, struct amd_cppc_rule *r,
+		   const char *key, const char *val)
+{
+	long		lo, hi;
+
+	if (strcmp(key, "util") == 0) {
+		if (amd_cppc_rule_range(val, 0, 100, &lo, &hi) != 0)
+			return (EINVAL);
+		r->util_lo = lo;
+		r->util_hi = hi;
+	} else if (strcmp(key, "temp") == 0) {
+		if (amd_cppc_rule_range(val, 0, 200, &lo, &hi) != 0)
+			return (EINVAL);
+		r->temp_lo = lo;
+		r->temp_hi = hi;
+		rs->needs |= AMD_CPPC_RULE_NEED_TEMP;
+	} else if (strcmp(key, "ac") == 0) {
+		if (amd_cppc_rule_range(val, 0, 1, &lo, &hi) != 0 || lo != hi)
+			return (EINVAL);
+		r->ac_mask = 1 << lo;
+	} else if (strcmp(key, "time") == 0) {
+		if (amd_cppc_rule_range(val, 0, INT32_MAX, &lo, &hi) != 0 ||
+		    lo != hi)
+			return (EINVAL);
+		r->time_ms = lo;
+	} else if (strcmp(key, "cpuset") == 0) {
+		if (amd_cppc_rule_range(val, 0, INT32_MAX, &lo, &hi) != 0 ||
+		    lo != hi)
+			return (EINVAL);
+		r->cpuset = lo;
+		rs->needs |= AMD_CPPC_RULE_NEED_CPUSET;
+	} else
+		return (EINVAL);
+	return (0);
+}
+
+static int
+amd_cppc_rule_action(struct amd_cppc_rule *r, const char *key,
+		     const char *val)
+{
+	long		lo, hi;
+	int		*field, max;
+
+	if (strcmp(key, "epp") == 0) {
+		field = &r->epp;
+		max = 100;
+	} else if (strcmp(key, "min") == 0) {
+		field = &r->min_perf;
+		max = 255;
+	} else if (strcmp(key, "max") == 0) {
+		field = &r->max_perf;
+		max = 255;
+	} else if (strcmp(key, "boost") == 0) {
+		field = &r->boost;
+		max = 1;
+	} else
+		return (EINVAL);
+	if (amd_cppc_rule_range(val, 0, max, &lo, &hi) != 0 || lo != hi)
+		return (EINVAL);
+	*field = lo;
+	return (0);
+}
+
+/*
+ * Parse a whitespace separated list of key=value conditions or actions.
+ */
+static int
+amd_cppc_rule_list(struct amd_cppc_ruleset *rs, struct amd_cppc_rule *r,
+		   char *list, bool actions, char *err, size_t errlen)
+{
+	char		*key, *val;
+	int		error;
+
+	while ((key = strsep(&list, " \t")) != NULL) {
+		if (*key == '\0')
+			continue;
+		if ((val = strchr(key, '=')) == NULL) {
+			snprintf(err, errlen, "rule %d: expected key=value, "
+				 "got '%s'", rs->nrules, key);
+			return (EINVAL);
+		}
+		*val++ = '\0';
+		if (actions)
+			error = amd_cppc_rule_action(r, key, val);
+		else
+			error = amd_cppc_rule_cond(rs, r, key, val);
+		if (error != 0) {
+			snprintf(err, errlen, "rule %d: bad %s '%s=%s'",
+				 rs->nrules, actions ? "action" : "condition",
+				 key, val);
+			return (error);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Compile a rule table. On error, a description is left in err and rs is
+ * undefined.
+ */
+int
+amd_cppc_rules_parse(const char *text, struct amd_cppc_ruleset *rs,
+		     char *err, size_t errlen)
+{
+	struct amd_cppc_rule *r;
+	char		buf[AMD_CPPC_RULES_TEXTLEN];
+	char		*actions, *line, *next, *p;
+	int		error;
+
+	if (strlen(text) >= sizeof(buf)) {
+		snprintf(err, errlen, "rule table too long");
+		return (E2BIG);
+	}
+	memcpy(buf, text, strlen(text) + 1);
+	memset(rs, 0, sizeof(*rs));
+
+	next = buf;
+	while ((line = strsep(&next, ";\n")) != NULL) {
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		for (p = line; *p == ' ' || *p == '\t'; p++)
+			;
+		if (*p == '\0')
+			continue;
+
+		if (rs->nrules == AMD_CPPC_RULES_MAX) {
+			snprintf(err, errlen, "more than %d rules",
+				 AMD_CPPC_RULES_MAX);
+			return (E2BIG);
+		}
+		r = &rs->rules[rs->nrules];
+		amd_cppc_rule_init(r);
+
+		actions = p;
+		p = strsep(&actions, ":");
+		if (actions == NULL) {
+			snprintf(err, errlen, "rule %d: missing ':'",
+				 rs->nrules);
+			return (EINVAL);
+		}
+		error = amd_cppc_rule_list(rs, r, p, false, err, errlen);
+		if (error == 0)
+			error = amd_cppc_rule_list(rs, r, actions, true, err,
+						   errlen);
+		if (error != 0)
+			return (error);
+		rs->nrules++;
+	}
+	return (0);
+}
+
+/*
+ * Do the conditions of a rule other than time= hold?
+ */
+static bool
+amd_cppc_rule_holds(const struct amd_cppc_rule *r,
+		    const struct amd_cppc_rule_input *in)
+{
+
+	if (in->util < r->util_lo || in->util > r->util_hi)
+		return (false);
+	if (in->temp < r->temp_lo || in->temp > r->temp_hi)
+		return (false);
+	if ((r->ac_mask & (1 << (in->ac != 0))) == 0)
+		return (false);
+	if (r->cpuset >= 0 && !CPU_ISSET(in->cpu, &r->cpus))
+		return (false);
+	return (true);
+}
+
+/*
+ * Return the index of the first rule matching the inputs at in->now_ms,
+ * or -1, timing time= conditions in hold. Every rule is looked at, so the
+ * ones behind the selected rule keep their timing. A zeroed hold, or one
+ * from another rule table, starts over.
+ */
+int
+amd_cppc_rules_select(const struct amd_cppc_ruleset *rs,
+		      const struct amd_cppc_rule_input *in,
+		      struct amd_cppc_rule_hold *hold)
+{
+	const struct amd_cppc_rule *r;
+	uint32_t	bit;
+	int		i, idx;
+
+	idx = -1;
+	for (i = 0; i < rs->nrules; i++) {
+		r = &rs->rules[i];
+		bit = 1U << i;
+		if (!amd_cppc_rule_holds(r, in)) {
+			hold->held &= ~bit;
+			continue;
+		}
+		if ((hold->held & bit) == 0) {
+			hold->held |= bit;
+			hold->since_ms[i] = in->now_ms;
+		}
+		if (idx < 0 && in->now_ms - hold->since_ms[i] >= r->time_ms)
+			idx = i;
+	}
+	return (idx);
+}
+
+#ifdef _KERNEL
+
+static MALLOC_DEFINE(M_AMD_CPPC_RULES, "amd_cppc_rules",
+		     "AMD CPPC policy rules");
+
+/* Current rule table, protected by amd_cppc_lock */
+static struct amd_cppc_ruleset *amd_cppc_ruleset;
+static char	amd_cppc_rules_text[AMD_CPPC_RULES_TEXTLEN];
+
+static int	amd_cppc_rules_interval_ms = 250;
+static uint64_t	amd_cppc_rules_evals;
+static bool	amd_cppc_rules_ready;
+static struct timeout_task amd_cppc_rules_task;
+
+static void
+amd_cppc_rules_arm(void)
+{
+	int		ms;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	ms = amd_cppc_rules_interval_ms;
+	if (!amd_cppc_rules_ready || ms <= 0 ||
+	    (amd_cppc_ruleset == NULL && !amd_cppc_shadow_active()))
+		return;
+	taskqueue_enqueue_timeout(taskqueue_thread, &amd_cppc_rules_task,
+				  MAX(1, (int)((int64_t)ms * hz / 1000)));
+}
+
+/*
+ * Temperature of a CPU in degrees C, as reported by amdtemp(4).
+ */
+static int
+amd_cppc_rules_temp(int cpu)
+{
+	char		name[32];
+	size_t		len;
+	int		val;
+
+	snprintf(name, sizeof(name), "dev.cpu.%d.temperature", cpu);
+	len = sizeof(val);
+	if (kernel_sysctlbyname(curthread, name, &val, &len, NULL, 0, NULL,
+				0) != 0)
+		return (AMD_CPPC_TEMP_UNKNOWN);
+	return ((val - 2731) / 10);	/* deci-Kelvin */
+}
+
+/*
+ * Resolve the cpuset conditions to CPU masks. Membership can change at
+ * any time, so this is redone on every pass.
+ */
+static void
+amd_cppc_rules_resolve(struct amd_cppc_ruleset *rs)
+{
+	struct amd_cppc_rule *r;
+	struct cpuset	*set;
+	int		i;
+
+	for (i = 0; i < rs->nrules; i++) {
+		r = &rs->rules[i];
+		if (r->cpuset < 0)
+			continue;
+		CPU_ZERO(&r->cpus);
+		set = cpuset_lookup(r->cpuset, curthread);
+		if (set == NULL)
+			continue;
+		CPU_COPY(&set->cs_mask, &r->cpus);
+		cpuset_rel(set);
+	}
+}
+
+/*
+ * Inputs needed by the active and the shadow table together: the shadow
+ * policy is evaluated with the same inputs.
+ */
+static int
+amd_cppc_rules_needs(void)
+{
+	struct amd_cppc_ruleset *srs;
+	int		needs;
+
+	sx_assert(&amd_cppc_lock, SA_LOCKED);
+	needs = amd_cppc_ruleset != NULL ? amd_cppc_ruleset->needs : 0;
+	if ((srs = amd_cppc_shadow_ruleset()) != NULL)
+		needs |= srs->needs;
+	return (needs);
+}
+
+static void
+amd_cppc_rules_eval(void *arg __unused, int pending __unused)
+{
+	struct amd_cppc_rule_input in;
+	struct amd_cppc_ruleset *rs, *srs;
+	struct amd_cppc_rule *r;
+	struct amd_cppc_softc *sc;
+	struct amd_cppc_batch *b;
+	sbintime_t	now;
+	int		*temps, ac, cpu, idx, needs;
+
+	/* Sensor reads go through sysctl, so do them before locking. */
+	temps = malloc(sizeof(int) * (mp_maxid + 1), M_TEMP, M_WAITOK);
+	CPU_FOREACH(cpu)
+		temps[cpu] = AMD_CPPC_TEMP_UNKNOWN;
+	sx_slock(&amd_cppc_lock);
+	needs = amd_cppc_rules_needs();
+	sx_sunlock(&amd_cppc_lock);
+	if (needs & AMD_CPPC_RULE_NEED_TEMP)
+		CPU_FOREACH(cpu)
+			temps[cpu] = amd_cppc_rules_temp(cpu);
+
+	sx_xlock(&amd_cppc_lock);
+	rs = amd_cppc_ruleset;
+	if (!amd_cppc_rules_ready ||
+	    (rs == NULL && !amd_cppc_shadow_active())) {
+		sx_xunlock(&amd_cppc_lock);
+		free(temps, M_TEMP);
+		return;
+	}
+	if (amd_cppc_rules_needs() & AMD_CPPC_RULE_NEED_CPUSET) {
+		if (rs != NULL)
+			amd_cppc_rules_resolve(rs);
+		if ((srs = amd_cppc_shadow_ruleset()) != NULL)
+			amd_cppc_rules_resolve(srs);
+	}
+
+	ac = power_profile_get_state() != POWER_PROFILE_ECONOMY;
+	now = sbinuptime();
+	b = amd_cppc_batch_alloc();
+	CPU_FOREACH(cpu) {
+		if ((sc = amd_cppc_softc_get(cpu)) == NULL)
+			continue;
+
+		in.cpu = cpu;
+		in.util = amd_cppc_cpu_util(cpu, sc->rule_cp_time);
+		in.temp = temps[cpu];
+		in.ac = ac;
+		in.now_ms = sbttoms(now);
+
+		idx = rs != NULL ? amd_cppc_rules_select(rs, &in,
+		    &sc->rule_hold) : -1;
+		if (idx != sc->rule_idx) {
+			sc->rule_idx = idx;
+			sc->rule_changes++;
+		}
+		amd_cppc_override_clear(&sc->rule_ovr);
+		if (idx >= 0) {
+			r = &rs->rules[idx];
+			sc->rule_ovr.epp = r->epp;
+			sc->rule_ovr.min_perf = r->min_perf;
+			sc->rule_ovr.max_perf = r->max_perf;
+			sc->rule_ovr.boost = r->boost;
+		}
+		amd_cppc_batch_add(b, sc);
+
+		if (amd_cppc_shadow_active())
+			amd_cppc_shadow_eval(sc, &in);
+	}
+	amd_cppc_batch_commit(b);
+	amd_cppc_rules_evals++;
+	amd_cppc_rules_arm();
+	sx_xunlock(&amd_cppc_lock);
+	free(temps, M_TEMP);
+}
+
+/*
+ * Drop all rule overrides, e.g. when the table is cleared.
+ */
+static void
+amd_cppc_rules_reset(void)
+{
+	struct amd_cppc_softc *sc;
+	struct amd_cppc_batch *b;
+	int		cpu;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	b = amd_cppc_batch_alloc();
+	CPU_FOREACH(cpu) {
+		if ((sc = amd_cppc_softc_get(cpu)) == NULL)
+			continue;
+		sc->rule_idx = -1;
+		memset(&sc->rule_hold, 0, sizeof(sc->rule_hold));
+		amd_cppc_override_clear(&sc->rule_ovr);
+		amd_cppc_batch_add(b, sc);
+	}
+	amd_cppc_batch_commit(b);
+}
+
+static int
+amd_cppc_sysctl_rules(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_ruleset *rs, *old;
+	char		*text, errbuf[80];
+	int		error;
+
+	text = malloc(AMD_CPPC_RULES_TEXTLEN, M_TEMP, M_WAITOK);
+	sx_slock(&amd_cppc_lock);
+	strlcpy(text, amd_cppc_rules_text, AMD_CPPC_RULES_TEXTLEN);
+	sx_sunlock(&amd_cppc_lock);
+
+	error = sysctl_handle_string(oidp, text, AMD_CPPC_RULES_TEXTLEN, req);
+	if (error || req->newptr == NULL)
+		goto out;
+
+	rs = malloc(sizeof(*rs), M_AMD_CPPC_RULES, M_WAITOK);
+	error = amd_cppc_rules_parse(text, rs, errbuf, sizeof(errbuf));
+	if (error != 0) {
+		printf("amd_cppc: rules: %s\n", errbuf);
+		free(rs, M_AMD_CPPC_RULES);
+		goto out;
+	}
+	if (rs->nrules == 0) {
+		free(rs, M_AMD_CPPC_RULES);
+		rs = NULL;
+	}
+
+	sx_xlock(&amd_cppc_lock);
+	old = amd_cppc_ruleset;
+	amd_cppc_ruleset = rs;
+	strlcpy(amd_cppc_rules_text, text, sizeof(amd_cppc_rules_text));
+	amd_cppc_rules_reset();
+	amd_cppc_rules_arm();
+	sx_xunlock(&amd_cppc_lock);
+	free(old, M_AMD_CPPC_RULES);
+out:
+	free(text, M_TEMP);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, rules,
+	    CTLTYPE_STRING | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_rules, "A",
+	    "Policy rule table (conditions : actions; ...)");
+
+static int
+amd_cppc_sysctl_rules_interval(SYSCTL_HANDLER_ARGS)
+{
+	int		error, ms;
+
+	ms = amd_cppc_rules_interval_ms;
+	error = sysctl_handle_int(oidp, &ms, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (ms < 0)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_rules_interval_ms = ms;
+	amd_cppc_rules_arm();
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, rules_interval_ms,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_rules_interval, "I",
+	    "Interval in ms between rule evaluations (0 = paused)");
+
+SYSCTL_U64(_hw_amd_cppc, OID_AUTO, rules_evals, CTLFLAG_RD,
+	   &amd_cppc_rules_evals, 0, "Number of rule evaluation passes");
+
+/*
+ * Start the evaluation pass if it has become necessary.
+ */
+void
+amd_cppc_rules_kick(void)
+{
+
+	amd_cppc_rules_arm();
+}
+
+void
+amd_cppc_rules_init(void)
+{
+
+	TIMEOUT_TASK_INIT(taskqueue_thread, &amd_cppc_rules_task, 0,
+			  amd_cppc_rules_eval, NULL);
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_rules_ready = true;
+	amd_cppc_rules_arm();
+	sx_xunlock(&amd_cppc_lock);
+}
+
+void
+amd_cppc_rules_fini(void)
+{
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_rules_ready = false;
+	sx_xunlock(&amd_cppc_lock);
+	taskqueue_drain_timeout(taskqueue_thread, &amd_cppc_rules_task);
+	free(amd_cppc_ruleset, M_AMD_CPPC_RULES);
+	amd_cppc_ruleset = NULL;
+}
+
+#endif /* _KERNEL */
@@ -0,0 +1,117 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Policy rule table shared by the kernel and userland tools.
+ *
+ * Rules are written as a compact text table, one rule per line or separated
+ * by ';'. Each rule is a list of conditions, a ':' and a list of actions:
+ *
+ *	util=80-100 ac=1 : epp=0 boost=1
+ *	util=0-10 time=5000 : epp=90 max=60
+ *	temp=90-200 : boost=0
+ *
+ * Conditions (all must hold, omitted ones always hold):
+ *	util=LO-HI	busy percentage band
+ *	temp=LO-HI	temperature band in degrees C
+ *	ac=0|1		running on battery (0) or AC (1)
+ *	time=MS		the other conditions have held for at least MS
+ *	cpuset=ID	CPU is a member of cpuset ID
+ *
+ * Actions (omitted ones keep the admin setting):
+ *	epp=N		EPP, 0-100
+ *	min=N		min_perf floor
+ *	max=N		max_perf ceiling
+ *	boost=0|1	allow perf above nominal
+ *
+ * The first matching rule wins. Parsing compiles every rule into plain
+ * inclusive ranges so matching is a handful of compares per rule.
+ *
+ * time= is measured per rule, from the pass at which the rest of that
+ * rule's conditions started to hold, and restarts when they stop holding.
+ * Which rule was in effect meanwhile does not matter, so a rule selected
+ * after holding long enough keeps matching for as long as it holds.
+ * amd_cppc_rules_select() keeps this state in a struct amd_cppc_rule_hold,
+ * one per CPU.
+ */
+
+#ifndef _AMD_CPPC_RULES_H_
+#define _AMD_CPPC_RULES_H_
+
+#define AMD_CPPC_RULES_MAX	32
+#define AMD_CPPC_RULES_TEXTLEN	1024
+
+/* Temperature input when no sensor is available */
+#define AMD_CPPC_TEMP_UNKNOWN	INT16_MIN
+
+/* Inputs gathered by the caller only when some rule needs them */
+#define AMD_CPPC_RULE_NEED_TEMP		0x01
+#define AMD_CPPC_RULE_NEED_CPUSET	0x02
+
+struct amd_cppc_rule_input {
+	int		cpu;
+	int		util;		/* percent busy */
+	int		temp;		/* degrees C or AMD_CPPC_TEMP_UNKNOWN */
+	int		ac;		/* 1 on AC power */
+	uint64_t	now_ms;		/* monotonic clock, for time= */
+};
+
+struct amd_cppc_rule {
+	/* Conditions, inclusive ranges */
+	int16_t		util_lo, util_hi;
+	int16_t		temp_lo, temp_hi;
+	uint8_t		ac_mask;	/* bit 0 battery, bit 1 AC */
+	uint32_t	time_ms;
+	int		cpuset;		/* -1 = any CPU */
+	cpuset_t	cpus;		/* members of cpuset, set by caller */
+
+	/* Actions, -1 = unchanged */
+	int		epp;
+	int		min_perf;
+	int		max_perf;
+	int		boost;
+};
+
+struct amd_cppc_ruleset {
+	int		nrules;
+	int		needs;		/* AMD_CPPC_RULE_NEED_* */
+	struct amd_cppc_rule rules[AMD_CPPC_RULES_MAX];
+};
+
+/* Per-CPU condition timing, AMD_CPPC_RULES_MAX bits */
+struct amd_cppc_rule_hold {
+	uint32_t	held;		/* bit i: rule i's conditions hold */
+	uint64_t	since_ms[AMD_CPPC_RULES_MAX];
+};
+
+int	amd_cppc_rules_parse(const char *text, struct amd_cppc_ruleset *rs,
+			     char *err, size_t errlen);
+int	amd_cppc_rules_select(const struct amd_cppc_ruleset *rs,
+			      const struct amd_cppc_rule_input *in,
+			      struct amd_cppc_rule_hold *hold);
+
+#endif /* !_AMD_CPPC_RULES_H_ */
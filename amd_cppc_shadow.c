@@ -0,0 +1,373 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Shadow policy evaluation.
+ *
+ * A second policy (a request mode and a rule table) is evaluated on every
+ * rule pass from the same inputs as the active one, but its decisions are
+ * only recorded, never written. Per CPU we count how often it disagrees
+ * with the active request, keep a histogram of the performance level it
+ * would have settled at, and accumulate the energy and throughput the
+ * driver's energy model predicts for both.
+ */
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/cpuset.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/sbuf.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+#include <sys/taskqueue.h>
+
+#include "amd_cppc_var.h"
+#include "amd_cppc_rules.h"
+
+static MALLOC_DEFINE(M_AMD_CPPC_SHADOW, "amd_cppc_shadow",
+		     "AMD CPPC shadow policy");
+
+/* Shadow policy, protected by amd_cppc_lock */
+static bool	amd_cppc_shadow_enabled;
+static int	amd_cppc_shadow_mode = -1;	/* -1 = same as active */
+static struct amd_cppc_ruleset *amd_cppc_shadow_rs;
+static char	amd_cppc_shadow_text[AMD_CPPC_RULES_TEXTLEN];
+
+bool
+amd_cppc_shadow_active(void)
+{
+
+	return (amd_cppc_shadow_enabled);
+}
+
+/*
+ * The shadow table while the shadow policy runs, so that the rule pass
+ * gathers the inputs it needs. NULL otherwise.
+ */
+struct amd_cppc_ruleset *
+amd_cppc_shadow_ruleset(void)
+{
+
+	sx_assert(&amd_cppc_lock, SA_LOCKED);
+	return (amd_cppc_shadow_enabled ? amd_cppc_shadow_rs : NULL);
+}
+
+static void
+amd_cppc_shadow_reset(struct amd_cppc_softc *sc)
+{
+
+	sc->shadow_idx = -1;
+	memset(&sc->shadow_hold, 0, sizeof(sc->shadow_hold));
+	sc->shadow_evals = 0;
+	sc->shadow_diverged = 0;
+	memset(sc->shadow_energy, 0, sizeof(sc->shadow_energy));
+	memset(sc->shadow_work, 0, sizeof(sc->shadow_work));
+	memset(sc->shadow_hist, 0, sizeof(sc->shadow_hist));
+}
+
+static void
+amd_cppc_shadow_reset_all(void)
+{
+	struct amd_cppc_softc *sc;
+	int		cpu;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	CPU_FOREACH(cpu)
+		if ((sc = amd_cppc_softc_get(cpu)) != NULL)
+			amd_cppc_shadow_reset(sc);
+}
+
+static int
+amd_cppc_shadow_bucket(struct amd_cppc_softc *sc, int perf)
+{
+	int		range;
+
+	range = sc->highest_perf - sc->lowest_perf + 1;
+	perf = MIN(MAX(perf, sc->lowest_perf), sc->highest_perf);
+	return ((perf - sc->lowest_perf) * AMD_CPPC_SHADOW_BUCKETS / range);
+}
+
+/*
+ * Evaluate the shadow policy for one CPU. Called from the rule pass after
+ * the active request has been recomputed, with the same inputs.
+ */
+void
+amd_cppc_shadow_eval(struct amd_cppc_softc *sc,
+		     const struct amd_cppc_rule_input *in)
+{
+	struct amd_cppc_override ovr;
+	struct amd_cppc_req act, shadow;
+	struct amd_cppc_rule *r;
+	int		idx, opp_act, opp_shadow;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+
+	idx = -1;
+	if (amd_cppc_shadow_rs != NULL) {
+		idx = amd_cppc_rules_select(amd_cppc_shadow_rs, in,
+		    &sc->shadow_hold);
+	}
+	sc->shadow_idx = idx;
+
+	amd_cppc_override_clear(&ovr);
+	if (idx >= 0) {
+		r = &amd_cppc_shadow_rs->rules[idx];
+		ovr.epp = r->epp;
+		ovr.min_perf = r->min_perf;
+		ovr.max_perf = r->max_perf;
+		ovr.boost = r->boost;
+	}
+	ovr.mode = amd_cppc_shadow_mode;
+	amd_cppc_req_eval(sc, sc->mode, &ovr, &shadow, NULL);
+	/* Compare like with like: the active request has been clamped. */
+	amd_cppc_req_clamp(sc, &shadow, NULL);
+
+	act.max_perf = sc->req_max_perf;
+	act.min_perf = sc->req_min_perf;
+	act.des_perf = sc->req_des_perf;
+	act.epp = sc->req_epp;
+
+	sc->shadow_evals++;
+	if (memcmp(&act, &shadow, sizeof(act)) != 0)
+		sc->shadow_diverged++;
+
+	opp_act = amd_cppc_req_opp(&act);
+	opp_shadow = amd_cppc_req_opp(&shadow);
+	sc->shadow_hist[amd_cppc_shadow_bucket(sc, opp_shadow)]++;
+
+	/* Weight by utilization: an idle CPU costs nothing either way. */
+	sc->shadow_energy[0] += in->util * amd_cppc_model_energy(sc, opp_act);
+	sc->shadow_energy[1] += in->util *
+	    amd_cppc_model_energy(sc, opp_shadow);
+	sc->shadow_work[0] += in->util * opp_act;
+	sc->shadow_work[1] += in->util * opp_shadow;
+}
+
+/*
+ * Relative difference of shadow over active in percent.
+ */
+static int
+amd_cppc_shadow_delta(const uint64_t *v)
+{
+
+	if (v[0] == 0)
+		return (0);
+	return ((int)(((int64_t)v[1] - (int64_t)v[0]) * 100 / (int64_t)v[0]));
+}
+
+static int
+amd_cppc_sysctl_shadow_delta(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	int		val;
+
+	sc = arg1;
+	sx_slock(&amd_cppc_lock);
+	val = amd_cppc_shadow_delta(arg2 == 0 ? sc->shadow_energy :
+	    sc->shadow_work);
+	sx_sunlock(&amd_cppc_lock);
+	return (sysctl_handle_int(oidp, &val, 0, req));
+}
+
+static int
+amd_cppc_sysctl_shadow_hist(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	struct sbuf	*sb;
+	int		error, i, lo, hi, range;
+
+	sc = arg1;
+	sb = sbuf_new_for_sysctl(NULL, NULL, 256, req);
+	if (sb == NULL)
+		return (ENOMEM);
+
+	sx_slock(&amd_cppc_lock);
+	range = sc->highest_perf - sc->lowest_perf + 1;
+	for (i = 0; i < AMD_CPPC_SHADOW_BUCKETS; i++) {
+		lo = sc->lowest_perf +
+		    howmany(i * range, AMD_CPPC_SHADOW_BUCKETS);
+		hi = sc->lowest_perf +
+		    howmany((i + 1) * range, AMD_CPPC_SHADOW_BUCKETS) - 1;
+		sbuf_printf(sb, "\n%4d-%4d MHz: %ju",
+			    amd_cppc_perf_to_mhz(sc, lo),
+			    amd_cppc_perf_to_mhz(sc, hi),
+			    (uintmax_t)sc->shadow_hist[i]);
+	}
+	sx_sunlock(&amd_cppc_lock);
+
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+	return (error);
+}
+
+/*
+ * Per-CPU shadow sysctls, called from attach.
+ */
+void
+amd_cppc_shadow_attach(struct amd_cppc_softc *sc)
+{
+	struct sysctl_ctx_list *ctx;
+	struct sysctl_oid *node;
+
+	amd_cppc_shadow_reset(sc);
+
+	ctx = device_get_sysctl_ctx(sc->dev);
+	node = SYSCTL_ADD_NODE(ctx,
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)), OID_AUTO,
+	    "shadow", CTLFLAG_RD | CTLFLAG_MPSAFE, NULL,
+	    "Shadow policy evaluation");
+
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "evals",
+		       CTLFLAG_RD, &sc->shadow_evals, 0,
+		       "Number of shadow decisions");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "diverged",
+		       CTLFLAG_RD, &sc->shadow_diverged, 0,
+		       "Shadow decisions differing from the active request");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(node), OID_AUTO, "rule",
+		       CTLFLAG_RD, &sc->shadow_idx, 0,
+		       "Matching shadow rule (-1 = none)");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(node), OID_AUTO,
+			"energy_delta", CTLTYPE_INT | CTLFLAG_RD | CTLFLAG_MPSAFE,
+			sc, 0, amd_cppc_sysctl_shadow_delta, "I",
+			"Predicted energy of shadow vs. active policy (%)");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(node), OID_AUTO,
+			"perf_delta", CTLTYPE_INT | CTLFLAG_RD | CTLFLAG_MPSAFE,
+			sc, 1, amd_cppc_sysctl_shadow_delta, "I",
+			"Predicted throughput of shadow vs. active policy (%)");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(node), OID_AUTO,
+			"histogram", CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE,
+			sc, 0, amd_cppc_sysctl_shadow_hist, "A",
+			"Histogram of shadow operating points");
+}
+
+static int
+amd_cppc_sysctl_shadow(SYSCTL_HANDLER_ARGS)
+{
+	int		error, val;
+
+	val = amd_cppc_shadow_enabled;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	sx_xlock(&amd_cppc_lock);
+	if ((val != 0) != amd_cppc_shadow_enabled) {
+		amd_cppc_shadow_enabled = val != 0;
+		amd_cppc_shadow_reset_all();
+		amd_cppc_rules_kick();
+	}
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, shadow,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_shadow, "I",
+	    "Evaluate the shadow policy alongside the active one");
+
+static int
+amd_cppc_sysctl_shadow_mode(SYSCTL_HANDLER_ARGS)
+{
+	char		buf[16];
+	int		error, mode;
+
+	mode = amd_cppc_shadow_mode;
+	strlcpy(buf, mode < 0 ? "active" : amd_cppc_mode_name(mode),
+		sizeof(buf));
+	error = sysctl_handle_string(oidp, buf, sizeof(buf), req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (strcmp(buf, "active") == 0)
+		mode = -1;
+	else if ((mode = amd_cppc_mode_parse(buf)) < 0)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_shadow_mode = mode;
+	amd_cppc_shadow_reset_all();
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, shadow_mode,
+	    CTLTYPE_STRING | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_shadow_mode, "A",
+	    "Request mode of the shadow policy (active, cap, autonomous, "
+	    "guided)");
+
+static int
+amd_cppc_sysctl_shadow_rules(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_ruleset *rs, *old;
+	char		*text, errbuf[80];
+	int		error;
+
+	text = malloc(AMD_CPPC_RULES_TEXTLEN, M_TEMP, M_WAITOK);
+	sx_slock(&amd_cppc_lock);
+	strlcpy(text, amd_cppc_shadow_text, AMD_CPPC_RULES_TEXTLEN);
+	sx_sunlock(&amd_cppc_lock);
+
+	error = sysctl_handle_string(oidp, text, AMD_CPPC_RULES_TEXTLEN, req);
+	if (error || req->newptr == NULL)
+		goto out;
+
+	rs = malloc(sizeof(*rs), M_AMD_CPPC_SHADOW, M_WAITOK);
+	error = amd_cppc_rules_parse(text, rs, errbuf, sizeof(errbuf));
+	if (error != 0) {
+		printf("amd_cppc: shadow rules: %s\n", errbuf);
+		free(rs, M_AMD_CPPC_SHADOW);
+		goto out;
+	}
+	if (rs->nrules == 0) {
+		free(rs, M_AMD_CPPC_SHADOW);
+		rs = NULL;
+	}
+
+	sx_xlock(&amd_cppc_lock);
+	old = amd_cppc_shadow_rs;
+	amd_cppc_shadow_rs = rs;
+	strlcpy(amd_cppc_shadow_text, text, sizeof(amd_cppc_shadow_text));
+	amd_cppc_shadow_reset_all();
+	sx_xunlock(&amd_cppc_lock);
+	free(old, M_AMD_CPPC_SHADOW);
+out:
+	free(text, M_TEMP);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, shadow_rules,
+	    CTLTYPE_STRING | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_shadow_rules, "A",
+	    "Rule table of the shadow policy");
+
+void
+amd_cppc_shadow_fini(void)
+{
+
+	free(amd_cppc_shadow_rs, M_AMD_CPPC_SHADOW);
+	amd_cppc_shadow_rs = NULL;
+}
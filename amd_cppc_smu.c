@@ -0,0 +1,552 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SMU metrics table reader for mobile Ryzen.
+ *
+ * The table parser at the top of this file is portable, see
+ * amd_cppc_smu.h. The kernel part talks to the SMU's RSMU mailbox through
+ * amdsmn(4) to learn the table version and DRAM address, maps the table,
+ * and on every refresh asks the SMU to update it and copies it out. The
+ * parsed fields are exported under hw.amd_cppc.smu and, per core, under
+ * dev.amd_cppc.N.smu.
+ */
+
+#include <sys/param.h>
+#ifdef _KERNEL
+#include <sys/bus.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/sbuf.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+#include <sys/taskqueue.h>
+
+#include <vm/vm.h>
+#include <vm/pmap.h>
+
+#include <machine/cpufunc.h>
+#include <machine/md_var.h>
+#include <machine/specialreg.h>
+
+#include <dev/amdsmn/amdsmn.h>
+
+#include "amd_cppc_var.h"
+#include "amd_cppc_quirk.h"
+#else
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#endif
+
+#include "amd_cppc_smu.h"
+
+#ifndef nitems
+#define nitems(x)	(sizeof(x) / sizeof((x)[0]))
+#endif
+
+/*
+ * Known table layouts. Renoir/Lucienne and Cezanne/Barcelo share the limit
+ * block and place eight-entry per-core arrays of power, voltage,
+ * temperature, FIT, IDDmax, clock, effective clock, C0, CC1 and CC6
+ * residency back to back from 0x300.
+ */
+static const struct amd_cppc_smu_layout amd_cppc_smu_layouts[] = {
+	{
+		.version = 0x370005, .name = "renoir", .size = 0x794,
+		.limit = { 0x00, 0x08, 0x10, 0x20, 0x30, 0x58 },
+		.value = { 0x04, 0x0C, 0x14, 0x24, 0x34, 0x5C },
+		.core_power = 0x300, .core_volt = 0x320, .core_temp = 0x340,
+		.core_freq = 0x3C0, .core_c0 = 0x3E0, .core_cc6 = 0x420,
+	},
+	{
+		.version = 0x400005, .name = "cezanne", .size = 0x944,
+		.limit = { 0x00, 0x08, 0x10, 0x20, 0x30, 0x58 },
+		.value = { 0x04, 0x0C, 0x14, 0x24, 0x34, 0x5C },
+		.core_power = 0x300, .core_volt = 0x320, .core_temp = 0x340,
+		.core_freq = 0x3C0, .core_c0 = 0x3E0, .core_cc6 = 0x420,
+	},
+};
+
+const struct amd_cppc_smu_layout *
+amd_cppc_smu_layout(uint32_t version)
+{
+	u_int		i;
+
+	for (i = 0; i < nitems(amd_cppc_smu_layouts); i++)
+		if (amd_cppc_smu_layouts[i].version == version)
+			return (&amd_cppc_smu_layouts[i]);
+	return (NULL);
+}
+
+/*
+ * An IEEE 754 single precision value times 1000, in integer arithmetic so
+ * it can run in the kernel. NaN and infinity read as 0.
+ */
+int64_t
+amd_cppc_smu_milli(uint32_t bits)
+{
+	uint64_t	man;
+	int64_t		v;
+	int		exp, shift;
+
+	exp = (bits >> 23) & 0xFF;
+	if (exp == 0 || exp == 0xFF)
+		return (0);
+	man = ((bits & 0x7FFFFF) | 0x800000) * (uint64_t)1000;
+	shift = exp - 150;		/* value = man * 2^shift / 1000 */
+	if (shift >= 0)
+		v = shift > 28 ? INT64_MAX : (int64_t)(man << shift);
+	else
+		v = shift < -63 ? 0 : (int64_t)(man >> -shift);
+	return ((bits & 0x80000000) != 0 ? -v : v);
+}
+
+static int32_t
+amd_cppc_smu_field(const uint8_t *table, uint16_t off)
+{
+	uint32_t	bits;
+	int64_t		v;
+
+	memcpy(&bits, table + off, sizeof(bits));
+	v = amd_cppc_smu_milli(bits);
+	return ((int32_t)MAX(MIN(v, INT32_MAX), INT32_MIN));
+}
+
+/*
+ * Decode a table copy. Returns EINVAL if it is shorter than the layout.
+ */
+int
+amd_cppc_smu_parse(const struct amd_cppc_smu_layout *lay, const void *table,
+		   size_t len, struct amd_cppc_smu_metrics *m)
+{
+	const uint8_t	*t;
+	struct amd_cppc_smu_core *c;
+	int		i;
+
+	if (len < lay->size)
+		return (EINVAL);
+	t = table;
+	for (i = 0; i < AMD_CPPC_SMU_NLIMITS; i++) {
+		m->limit[i] = amd_cppc_smu_field(t, lay->limit[i]);
+		m->value[i] = amd_cppc_smu_field(t, lay->value[i]);
+	}
+	for (i = 0; i < AMD_CPPC_SMU_MAX_CORES; i++) {
+		c = &m->core[i];
+		c->power_mw = amd_cppc_smu_field(t, lay->core_power + i * 4);
+		c->volt_mv = amd_cppc_smu_field(t, lay->core_volt + i * 4);
+		c->temp_mc = amd_cppc_smu_field(t, lay->core_temp + i * 4);
+		c->freq_mhz = amd_cppc_smu_field(t, lay->core_freq + i * 4);
+		c->c0_pm = amd_cppc_smu_field(t, lay->core_c0 + i * 4) / 100;
+		c->cc6_pm = amd_cppc_smu_field(t, lay->core_cc6 + i * 4) / 100;
+	}
+	return (0);
+}
+
+#ifdef _KERNEL
+
+/* RSMU mailbox in SMN space */
+#define AMD_CPPC_SMU_SMN_MSG		0x3B10A20
+#define AMD_CPPC_SMU_SMN_RESP		0x3B10A80
+#define AMD_CPPC_SMU_SMN_ARG		0x3B10A88
+#define AMD_CPPC_SMU_NARGS		6
+
+#define AMD_CPPC_SMU_MSG_TABLE_VERSION	0x06
+#define AMD_CPPC_SMU_MSG_TABLE_TO_DRAM	0x65
+#define AMD_CPPC_SMU_MSG_TABLE_ADDR	0x66
+
+#define AMD_CPPC_SMU_RESP_OK		0x01
+#define AMD_CPPC_SMU_TIMEOUT_US		100000
+
+static MALLOC_DEFINE(M_AMD_CPPC_SMU, "amd_cppc_smu", "AMD CPPC SMU metrics");
+
+/*
+ * Reader state. The mailbox and table are serialized by their own lock,
+ * since a refresh can take a millisecond and must not hold up requests.
+ */
+static struct sx amd_cppc_smu_lock;
+SX_SYSINIT(amd_cppc_smu_lock, &amd_cppc_smu_lock, "amd_cppc_smu");
+
+static int	amd_cppc_smu_enable = 0;
+static int	amd_cppc_smu_interval_ms = 1000;
+static uint64_t	amd_cppc_smu_refreshes;
+static uint64_t	amd_cppc_smu_errors;
+static bool	amd_cppc_smu_ready;
+static device_t	amd_cppc_smu_dev;
+static const struct amd_cppc_smu_layout *amd_cppc_smu_lay;
+static uint32_t	amd_cppc_smu_version;
+static void	*amd_cppc_smu_map;
+static void	*amd_cppc_smu_copy;
+static struct amd_cppc_smu_metrics amd_cppc_smu_metrics;
+static struct timeout_task amd_cppc_smu_task;
+
+static SYSCTL_NODE(_hw_amd_cppc, OID_AUTO, smu, CTLFLAG_RD | CTLFLAG_MPSAFE,
+		   NULL, "SMU metrics table");
+
+static const char *const amd_cppc_smu_limit_names[AMD_CPPC_SMU_NLIMITS] = {
+	"stapm", "ppt_fast", "ppt_slow", "tdc", "edc", "tctl",
+};
+
+/*
+ * Send one RSMU message. args holds the arguments on entry and the reply
+ * on return.
+ */
+static int
+amd_cppc_smu_send(uint32_t msg, uint32_t *args)
+{
+	uint32_t	resp;
+	int		error, i, waited;
+
+	sx_assert(&amd_cppc_smu_lock, SA_XLOCKED);
+	error = amdsmn_write(amd_cppc_smu_dev, AMD_CPPC_SMU_SMN_RESP, 0);
+	for (i = 0; error == 0 && i < AMD_CPPC_SMU_NARGS; i++)
+		error = amdsmn_write(amd_cppc_smu_dev,
+				     AMD_CPPC_SMU_SMN_ARG + i * 4, args[i]);
+	if (error == 0)
+		error = amdsmn_write(amd_cppc_smu_dev, AMD_CPPC_SMU_SMN_MSG,
+				     msg);
+	if (error != 0)
+		return (error);
+
+	resp = 0;
+	for (waited = 0; waited < AMD_CPPC_SMU_TIMEOUT_US; waited += 10) {
+		DELAY(10);
+		error = amdsmn_read(amd_cppc_smu_dev, AMD_CPPC_SMU_SMN_RESP,
+				    &resp);
+		if (error != 0 || resp != 0)
+			break;
+	}
+	if (error != 0)
+		return (error);
+	if (resp == 0)
+		return (ETIMEDOUT);
+	if (resp != AMD_CPPC_SMU_RESP_OK)
+		return (EIO);
+
+	for (i = 0; error == 0 && i < AMD_CPPC_SMU_NARGS; i++)
+		error = amdsmn_read(amd_cppc_smu_dev,
+				    AMD_CPPC_SMU_SMN_ARG + i * 4, &args[i]);
+	return (error);
+}
+
+static bool
+amd_cppc_smu_supported(void)
+{
+
+	return (AMD_CPPC_QUIRK(AMD_CPPC_QUIRK_SMU));
+}
+
+/*
+ * Find the table: its version selects the layout, its DRAM address is
+ * mapped once and stays mapped until unload.
+ */
+static int
+amd_cppc_smu_locate(void)
+{
+	uint32_t	args[AMD_CPPC_SMU_NARGS];
+	vm_paddr_t	pa;
+	devclass_t	dc;
+	int		error;
+
+	sx_assert(&amd_cppc_smu_lock, SA_XLOCKED);
+	if (amd_cppc_smu_map != NULL)
+		return (0);
+	if (!amd_cppc_smu_supported())
+		return (ENXIO);
+	if ((dc = devclass_find("amdsmn")) == NULL ||
+	    (amd_cppc_smu_dev = devclass_get_device(dc, 0)) == NULL ||
+	    !device_is_attached(amd_cppc_smu_dev))
+		return (ENXIO);
+
+	memset(args, 0, sizeof(args));
+	if ((error = amd_cppc_smu_send(AMD_CPPC_SMU_MSG_TABLE_VERSION,
+	    args)) != 0)
+		return (error);
+	amd_cppc_smu_version = args[0];
+	if ((amd_cppc_smu_lay = amd_cppc_smu_layout(args[0])) == NULL) {
+		printf("amd_cppc: unknown SMU table version %#x\n", args[0]);
+		return (EOPNOTSUPP);
+	}
+
+	memset(args, 0, sizeof(args));
+	if ((error = amd_cppc_smu_send(AMD_CPPC_SMU_MSG_TABLE_ADDR,
+	    args)) != 0)
+		return (error);
+	pa = (vm_paddr_t)args[1] << 32 | args[0];
+	if (pa == 0)
+		return (ENXIO);
+
+	amd_cppc_smu_copy = malloc(amd_cppc_smu_lay->size, M_AMD_CPPC_SMU,
+				   M_WAITOK | M_ZERO);
+	amd_cppc_smu_map = pmap_mapdev(pa, amd_cppc_smu_lay->size);
+	return (0);
+}
+
+static void
+amd_cppc_smu_refresh(void)
+{
+	uint32_t	args[AMD_CPPC_SMU_NARGS];
+	int		error;
+
+	sx_assert(&amd_cppc_smu_lock, SA_XLOCKED);
+	if ((error = amd_cppc_smu_locate()) == 0) {
+		memset(args, 0, sizeof(args));
+		error = amd_cppc_smu_send(AMD_CPPC_SMU_MSG_TABLE_TO_DRAM,
+					  args);
+	}
+	if (error == 0) {
+		memcpy(amd_cppc_smu_copy, amd_cppc_smu_map,
+		       amd_cppc_smu_lay->size);
+		error = amd_cppc_smu_parse(amd_cppc_smu_lay, amd_cppc_smu_copy,
+		    amd_cppc_smu_lay->size, &amd_cppc_smu_metrics);
+	}
+	if (error == 0)
+		amd_cppc_smu_refreshes++;
+	else
+		amd_cppc_smu_errors++;
+}
+
+static void
+amd_cppc_smu_arm(void)
+{
+	int		ms;
+
+	sx_assert(&amd_cppc_smu_lock, SA_XLOCKED);
+	ms = amd_cppc_smu_interval_ms;
+	if (!amd_cppc_smu_ready || !amd_cppc_smu_enable || ms <= 0)
+		return;
+	taskqueue_enqueue_timeout(taskqueue_thread, &amd_cppc_smu_task,
+				  MAX(1, (int)((int64_t)ms * hz / 1000)));
+}
+
+static void
+amd_cppc_smu_task_fn(void *arg __unused, int pending __unused)
+{
+
+	sx_xlock(&amd_cppc_smu_lock);
+	if (amd_cppc_smu_ready && amd_cppc_smu_enable) {
+		amd_cppc_smu_refresh();
+		amd_cppc_smu_arm();
+	}
+	sx_xunlock(&amd_cppc_smu_lock);
+}
+
+static int
+amd_cppc_sysctl_smu_enable(SYSCTL_HANDLER_ARGS)
+{
+	int		error, val;
+
+	val = amd_cppc_smu_enable;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	sx_xlock(&amd_cppc_smu_lock);
+	if (val != 0 && !amd_cppc_smu_supported())
+		error = ENODEV;
+	else {
+		amd_cppc_smu_enable = val != 0;
+		amd_cppc_smu_arm();
+	}
+	sx_xunlock(&amd_cppc_smu_lock);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc_smu, OID_AUTO, enable,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_smu_enable, "I",
+	    "Read the SMU metrics table (Renoir and Cezanne mobile parts)");
+
+static int
+amd_cppc_sysctl_smu_interval(SYSCTL_HANDLER_ARGS)
+{
+	int		error, val;
+
+	val = amd_cppc_smu_interval_ms;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val < 0)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_smu_lock);
+	amd_cppc_smu_interval_ms = val;
+	amd_cppc_smu_arm();
+	sx_xunlock(&amd_cppc_smu_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc_smu, OID_AUTO, interval_ms,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_smu_interval, "I",
+	    "Interval in ms between metrics table refreshes");
+
+SYSCTL_U64(_hw_amd_cppc_smu, OID_AUTO, refreshes, CTLFLAG_RD,
+	   &amd_cppc_smu_refreshes, 0, "Number of table refreshes");
+
+SYSCTL_U64(_hw_amd_cppc_smu, OID_AUTO, errors, CTLFLAG_RD,
+	   &amd_cppc_smu_errors, 0, "Number of failed table refreshes");
+
+SYSCTL_UINT(_hw_amd_cppc_smu, OID_AUTO, version, CTLFLAG_RD,
+	    &amd_cppc_smu_version, 0, "Metrics table version");
+
+/*
+ * Package limits, one "name limit value" line each.
+ */
+static int
+amd_cppc_sysctl_smu_limits(SYSCTL_HANDLER_ARGS)
+{
+	struct sbuf	sb;
+	int		error, i;
+
+	sbuf_new_for_sysctl(&sb, NULL, 128, req);
+	sx_slock(&amd_cppc_smu_lock);
+	for (i = 0; amd_cppc_smu_lay != NULL && i < AMD_CPPC_SMU_NLIMITS;
+	    i++)
+		sbuf_printf(&sb, "%s%s %d %d", i == 0 ? "" : "\n",
+			    amd_cppc_smu_limit_names[i],
+			    amd_cppc_smu_metrics.limit[i],
+			    amd_cppc_smu_metrics.value[i]);
+	sx_sunlock(&amd_cppc_smu_lock);
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc_smu, OID_AUTO, limits,
+	    CTLTYPE_STRING | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_smu_limits, "A",
+	    "Package limits and current values (mW, mA, m°C)");
+
+/*
+ * The table as last copied, for checking a layout against the firmware;
+ * tests/smu_test.c reads it as a hexdump(1) of 32-bit words.
+ */
+static int
+amd_cppc_sysctl_smu_table(SYSCTL_HANDLER_ARGS)
+{
+	int		error;
+
+	sx_slock(&amd_cppc_smu_lock);
+	if (amd_cppc_smu_refreshes == 0)
+		error = ENOENT;
+	else
+		error = SYSCTL_OUT(req, amd_cppc_smu_copy,
+				   amd_cppc_smu_lay->size);
+	sx_sunlock(&amd_cppc_smu_lock);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc_smu, OID_AUTO, table,
+	    CTLTYPE_OPAQUE | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_smu_table, "",
+	    "Raw metrics table of the last refresh");
+
+/*
+ * One per-core field; arg2 is its offset in struct amd_cppc_smu_core.
+ */
+static int
+amd_cppc_sysctl_smu_core(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_softc *sc;
+	int		core, val;
+
+	sc = arg1;
+	core = sc->cpu_id / MAX(1, smp_threads_per_core);
+	sx_slock(&amd_cppc_smu_lock);
+	val = amd_cppc_smu_lay == NULL || core >= AMD_CPPC_SMU_MAX_CORES ? 0 :
+	    *(int32_t *)((char *)&amd_cppc_smu_metrics.core[core] + arg2);
+	sx_sunlock(&amd_cppc_smu_lock);
+	return (sysctl_handle_int(oidp, &val, 0, req));
+}
+
+void
+amd_cppc_smu_attach(struct amd_cppc_softc *sc)
+{
+	static const struct {
+		const char	*name;
+		size_t		off;
+		const char	*descr;
+	} fields[] = {
+		{ "power_mw", offsetof(struct amd_cppc_smu_core, power_mw),
+		  "Core power in mW" },
+		{ "volt_mv", offsetof(struct amd_cppc_smu_core, volt_mv),
+		  "Core voltage in mV" },
+		{ "temp_mc", offsetof(struct amd_cppc_smu_core, temp_mc),
+		  "Core temperature in m°C" },
+		{ "freq_mhz", offsetof(struct amd_cppc_smu_core, freq_mhz),
+		  "Effective core clock in MHz" },
+		{ "c0_pm", offsetof(struct amd_cppc_smu_core, c0_pm),
+		  "C0 residency, per mille" },
+		{ "cc6_pm", offsetof(struct amd_cppc_smu_core, cc6_pm),
+		  "CC6 residency, per mille" },
+	};
+	struct sysctl_ctx_list *ctx;
+	struct sysctl_oid *node;
+	u_int		i;
+
+	if (!amd_cppc_smu_supported())
+		return;
+
+	ctx = device_get_sysctl_ctx(sc->dev);
+	node = SYSCTL_ADD_NODE(ctx,
+	    SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)), OID_AUTO,
+	    "smu", CTLFLAG_RD | CTLFLAG_MPSAFE, NULL,
+	    "SMU metrics of this core");
+	for (i = 0; i < nitems(fields); i++)
+		SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(node), OID_AUTO,
+				fields[i].name,
+				CTLTYPE_INT | CTLFLAG_RD | CTLFLAG_MPSAFE, sc,
+				fields[i].off, amd_cppc_sysctl_smu_core, "I",
+				fields[i].descr);
+}
+
+void
+amd_cppc_smu_init(void)
+{
+
+	TIMEOUT_TASK_INIT(taskqueue_thread, &amd_cppc_smu_task, 0,
+			  amd_cppc_smu_task_fn, NULL);
+	sx_xlock(&amd_cppc_smu_lock);
+	amd_cppc_smu_ready = true;
+	amd_cppc_smu_arm();
+	sx_xunlock(&amd_cppc_smu_lock);
+}
+
+void
+amd_cppc_smu_fini(void)
+{
+
+	sx_xlock(&amd_cppc_smu_lock);
+	amd_cppc_smu_ready = false;
+	sx_xunlock(&amd_cppc_smu_lock);
+	taskqueue_drain_timeout(taskqueue_thread, &amd_cppc_smu_task);
+	if (amd_cppc_smu_map != NULL)
+		pmap_unmapdev(amd_cppc_smu_map, amd_cppc_smu_lay->size);
+	free(amd_cppc_smu_copy, M_AMD_CPPC_SMU);
+}
+
+#endif /* _KERNEL */
@@ -0,0 +1,91 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * SMU metrics (PM) table of mobile Ryzen parts.
+ *
+ * The SMU periodically publishes a table of floats in DRAM: package power
+ * limits and their current values, and per-core power, voltage, temperature,
+ * clock and C-state residency. Its layout changes with every firmware table
+ * version, so each known version has a descriptor of field offsets. The
+ * parser below has no kernel dependencies and builds in userland, so a
+ * descriptor can be checked against a captured table dump.
+ */
+
+#ifndef _AMD_CPPC_SMU_H_
+#define _AMD_CPPC_SMU_H_
+
+#define AMD_CPPC_SMU_MAX_CORES	8
+
+/* Package limits: limit and current value of each */
+#define AMD_CPPC_SMU_STAPM	0	/* sustained power, mW */
+#define AMD_CPPC_SMU_PPT_FAST	1	/* fast PPT, mW */
+#define AMD_CPPC_SMU_PPT_SLOW	2	/* slow PPT, mW */
+#define AMD_CPPC_SMU_TDC	3	/* VDD thermal current, mA */
+#define AMD_CPPC_SMU_EDC	4	/* VDD peak current, mA */
+#define AMD_CPPC_SMU_TCTL	5	/* control temperature, m°C */
+#define AMD_CPPC_SMU_NLIMITS	6
+
+struct amd_cppc_smu_layout {
+	uint32_t	version;	/* table version reported by the SMU */
+	const char	*name;
+	uint32_t	size;		/* table size in bytes */
+	/* Offsets of the limit/value float pairs, by AMD_CPPC_SMU_* */
+	uint16_t	limit[AMD_CPPC_SMU_NLIMITS];
+	uint16_t	value[AMD_CPPC_SMU_NLIMITS];
+	/* Offsets of per-core float arrays */
+	uint16_t	core_power;
+	uint16_t	core_volt;
+	uint16_t	core_temp;
+	uint16_t	core_freq;	/* effective clock */
+	uint16_t	core_c0;
+	uint16_t	core_cc6;
+};
+
+/* Parsed values, in integer milli-units of the table's units */
+struct amd_cppc_smu_core {
+	int32_t		power_mw;
+	int32_t		volt_mv;
+	int32_t		temp_mc;
+	int32_t		freq_mhz;
+	int32_t		c0_pm;		/* residency, per mille */
+	int32_t		cc6_pm;
+};
+
+struct amd_cppc_smu_metrics {
+	int32_t		limit[AMD_CPPC_SMU_NLIMITS];
+	int32_t		value[AMD_CPPC_SMU_NLIMITS];
+	struct amd_cppc_smu_core core[AMD_CPPC_SMU_MAX_CORES];
+};
+
+const struct amd_cppc_smu_layout *amd_cppc_smu_layout(uint32_t version);
+int	amd_cppc_smu_parse(const struct amd_cppc_smu_layout *lay,
+			   const void *table, size_t len,
+			   struct amd_cppc_smu_metrics *m);
+int64_t	amd_cppc_smu_milli(uint32_t bits);
+
+#endif /* !_AMD_CPPC_SMU_H_ */
@@ -0,0 +1,256 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Bulk read and write interfaces, see amd_cppc_snap.h.
+ */
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/pcpu.h>
+#include <sys/smp.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+
+#include <machine/cpufunc.h>
+#include <machine/specialreg.h>
+
+#include "amd_cppc_var.h"
+
+#define MSR_AMD_RAPL_PWR_UNIT		0xC0010299
+#define MSR_AMD_CORE_ENERGY		0xC001029A
+
+static MALLOC_DEFINE(M_AMD_CPPC_SNAP, "amd_cppc_snap",
+		     "AMD CPPC bulk interfaces");
+
+/*
+ * smp_rendezvous() action filling the calling CPU's slot of a struct
+ * amd_cppc_ctr array indexed by CPU id.
+ */
+void
+amd_cppc_ctr_read(void *arg)
+{
+	struct amd_cppc_ctr *c;
+	uint64_t	v;
+
+	c = &((struct amd_cppc_ctr *)arg)[curcpu];
+	c->tsc = rdtsc();
+	c->aperf = rdmsr(MSR_APERF);
+	c->mperf = rdmsr(MSR_MPERF);
+	c->esu = -1;
+	if (rdmsr_safe(MSR_AMD_RAPL_PWR_UNIT, &v) == 0) {
+		c->esu = (v >> 8) & 0x1F;
+		if (rdmsr_safe(MSR_AMD_CORE_ENERGY, &v) == 0)
+			c->energy = (uint32_t)v;
+		else
+			c->esu = -1;
+	}
+}
+
+static void
+amd_cppc_snap_fill(struct amd_cppc_softc *sc, struct amd_cppc_snap *s)
+{
+
+	bzero(s, sizeof(*s));
+	s->snap_version = AMD_CPPC_SNAP_VERSION;
+	s->snap_size = sizeof(*s);
+	s->cpu = sc->cpu_id;
+	s->highest_perf = sc->highest_perf;
+	s->nominal_perf = sc->nominal_perf;
+	s->lowest_nonlinear_perf = sc->lowest_nonlinear_perf;
+	s->lowest_perf = sc->lowest_perf;
+	s->base_mhz = sc->base_freq_mhz;
+	s->req = sc->req_shadow;
+	s->max_perf = (sc->req_shadow >> AMD_CPPC_MAX_PERF_SHIFT) & 0xFF;
+	s->min_perf = (sc->req_shadow >> AMD_CPPC_MIN_PERF_SHIFT) & 0xFF;
+	s->des_perf = (sc->req_shadow >> AMD_CPPC_DES_PERF_SHIFT) & 0xFF;
+	s->epp_hw = (sc->req_shadow >> AMD_CPPC_EPP_PERF_SHIFT) & 0xFF;
+	s->max_mhz = amd_cppc_perf_to_mhz(sc, s->max_perf);
+	s->min_mhz = amd_cppc_perf_to_mhz(sc, s->min_perf);
+	s->des_mhz = s->des_perf != 0 ? amd_cppc_perf_to_mhz(sc, s->des_perf) :
+	    0;
+	s->epp = sc->epp;
+	s->mode = sc->mode;
+	s->boost = sc->boost;
+	s->floor_perf = sc->floor_perf;
+	s->ceil_perf = sc->ceil_perf;
+	s->domain = sc->domain;
+	s->tamper_count = sc->tamper_count;
+	s->rule = sc->rule_idx;
+	s->set_policy = sc->set_policy;
+	if (sc->boost_capped)
+		s->flags |= AMD_CPPC_SNAP_F_CAPPED;
+	if (sc->ccd_parked)
+		s->flags |= AMD_CPPC_SNAP_F_PARKED;
+	if (amd_cppc_phase_open())
+		s->flags |= AMD_CPPC_SNAP_F_PHASE;
+	if (sc->ob_req != 0)
+		s->flags |= AMD_CPPC_SNAP_F_OWNER;
+	amd_cppc_arb_binding(sc, s->bind);
+}
+
+static int
+amd_cppc_sysctl_snapshot(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_ctr *ctr;
+	struct amd_cppc_softc *sc;
+	struct amd_cppc_snap *snap;
+	int		cpu, error, n;
+
+	/* Size probes need no counters. */
+	if (req->oldptr == NULL)
+		return (SYSCTL_OUT(req, NULL,
+				   sizeof(*snap) * (mp_maxid + 1)));
+
+	snap = malloc(sizeof(*snap) * (mp_maxid + 1), M_AMD_CPPC_SNAP,
+		      M_WAITOK);
+	ctr = malloc(sizeof(*ctr) * (mp_maxid + 1), M_AMD_CPPC_SNAP,
+		     M_WAITOK | M_ZERO);
+	n = 0;
+	sx_slock(&amd_cppc_lock);
+	smp_rendezvous(NULL, amd_cppc_ctr_read, NULL, ctr);
+	CPU_FOREACH(cpu) {
+		sc = amd_cppc_softc_get(cpu);
+		if (sc == NULL || !sc->cppc_enabled || sc->detaching)
+			continue;
+		amd_cppc_snap_fill(sc, &snap[n]);
+		snap[n].tsc = ctr[cpu].tsc;
+		snap[n].aperf = ctr[cpu].aperf;
+		snap[n].mperf = ctr[cpu].mperf;
+		snap[n].energy = ctr[cpu].energy;
+		snap[n].energy_esu = ctr[cpu].esu;
+		n++;
+	}
+	sx_sunlock(&amd_cppc_lock);
+	free(ctr, M_AMD_CPPC_SNAP);
+	error = SYSCTL_OUT(req, snap, n * sizeof(*snap));
+	free(snap, M_AMD_CPPC_SNAP);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, snapshot,
+	    CTLTYPE_OPAQUE | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_snapshot, "S,amd_cppc_snap",
+	    "State of every CPU, struct amd_cppc_snap[]");
+
+static int
+amd_cppc_set_check(const struct amd_cppc_set *s)
+{
+
+	if (s->cpu < 0 || s->cpu > mp_maxid || CPU_ABSENT(s->cpu))
+		return (ENOENT);
+	switch (s->field) {
+	case AMD_CPPC_SET_EPP:
+		return (s->value < 0 || s->value > 100 ? EINVAL : 0);
+	case AMD_CPPC_SET_MODE:
+		return (s->value < 0 || s->value >= AMD_CPPC_MODE_COUNT ?
+			EINVAL : 0);
+	case AMD_CPPC_SET_BOOST:
+		return (s->value != 0 && s->value != 1 ? EINVAL : 0);
+	case AMD_CPPC_SET_MIN_PERF:
+	case AMD_CPPC_SET_MAX_PERF:
+		return (s->value < 0 || s->value > 255 ? EINVAL : 0);
+	default:
+		return (EINVAL);
+	}
+}
+
+static int
+amd_cppc_sysctl_apply(SYSCTL_HANDLER_ARGS)
+{
+	struct amd_cppc_batch *b;
+	struct amd_cppc_softc *sc;
+	struct amd_cppc_set *set;
+	cpuset_t	touched;
+	size_t		len;
+	int		cpu, error, i, n;
+
+	if (req->newptr == NULL)
+		return (SYSCTL_OUT(req, NULL, 0));
+	len = req->newlen - req->newidx;
+	if (len == 0 || len % sizeof(*set) != 0 ||
+	    len / sizeof(*set) > AMD_CPPC_SET_MAX)
+		return (EINVAL);
+	n = len / sizeof(*set);
+	set = malloc(len, M_AMD_CPPC_SNAP, M_WAITOK);
+	error = SYSCTL_IN(req, set, len);
+	for (i = 0; error == 0 && i < n; i++)
+		error = amd_cppc_set_check(&set[i]);
+	if (error) {
+		free(set, M_AMD_CPPC_SNAP);
+		return (error);
+	}
+
+	CPU_ZERO(&touched);
+	sx_xlock(&amd_cppc_lock);
+	for (i = 0; i < n; i++) {
+		sc = amd_cppc_softc_get(set[i].cpu);
+		if (sc == NULL || !sc->cppc_enabled || sc->detaching) {
+			error = ENOENT;
+			break;
+		}
+	}
+	for (i = 0; error == 0 && i < n; i++) {
+		sc = amd_cppc_softc_get(set[i].cpu);
+		switch (set[i].field) {
+		case AMD_CPPC_SET_EPP:
+			sc->epp = set[i].value;
+			break;
+		case AMD_CPPC_SET_MODE:
+			sc->mode = set[i].value;
+			break;
+		case AMD_CPPC_SET_BOOST:
+			sc->boost = set[i].value != 0;
+			break;
+		case AMD_CPPC_SET_MIN_PERF:
+			sc->floor_perf = set[i].value;
+			break;
+		default:
+			sc->ceil_perf = set[i].value;
+			break;
+		}
+		CPU_SET(set[i].cpu, &touched);
+	}
+	if (error == 0) {
+		b = amd_cppc_batch_alloc();
+		CPU_FOREACH(cpu) {
+			if (CPU_ISSET(cpu, &touched))
+				amd_cppc_batch_add(b, amd_cppc_softc_get(cpu));
+		}
+		amd_cppc_batch_commit(b);
+	}
+	sx_xunlock(&amd_cppc_lock);
+	free(set, M_AMD_CPPC_SNAP);
+	return (error);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, apply,
+	    CTLTYPE_OPAQUE | CTLFLAG_WR | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_apply, "S,amd_cppc_set",
+	    "Apply struct amd_cppc_set[] in one batch");
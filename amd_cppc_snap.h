@@ -0,0 +1,171 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Bulk interfaces shared by the kernel and userland tools.
+ *
+ * hw.amd_cppc.snapshot reads the capabilities, policy inputs and request
+ * of every attached CPU as an array of struct amd_cppc_snap in one call.
+ * hw.amd_cppc.apply takes an array of struct amd_cppc_set and applies all
+ * of it under one lock acquisition, writing the changed requests in one
+ * rendezvous. Either all entries are valid and applied, or none is.
+ *
+ * Records carry their size so that fields can be appended; readers must
+ * step through the array by snap_size and ignore what they do not know.
+ */
+
+#ifndef _AMD_CPPC_SNAP_H_
+#define _AMD_CPPC_SNAP_H_
+
+/*
+ * Request modes. They decide how a cpufreq setting from powerd is mapped
+ * onto the request register.
+ */
+#define AMD_CPPC_MODE_CAP		0	/* setting caps max_perf */
+#define AMD_CPPC_MODE_AUTONOMOUS	1	/* setting ignored, EPP only */
+#define AMD_CPPC_MODE_GUIDED		2	/* setting is desired_perf */
+#define AMD_CPPC_MODE_COUNT		3
+
+/*
+ * Sources of the request, in the order they are merged. Each one can move
+ * the fields decided by the ones before it; the last one that moved a
+ * field binds it. New sources are numbered last so that recorded
+ * snapshots keep their meaning: PROFILE is merged right after ADMIN.
+ */
+#define AMD_CPPC_SRC_NONE		0
+#define AMD_CPPC_SRC_HW			1	/* capability limits */
+#define AMD_CPPC_SRC_ADMIN		2	/* dev.amd_cppc.N */
+#define AMD_CPPC_SRC_CPUFREQ		3	/* powerd through cpufreq */
+#define AMD_CPPC_SRC_POLICY		4	/* cpuset/jail policy */
+#define AMD_CPPC_SRC_GOVERNOR		5	/* policy rule table */
+#define AMD_CPPC_SRC_VCACHE		6	/* 3D V-Cache preference */
+#define AMD_CPPC_SRC_POWERCAP		7	/* boost budget */
+#define AMD_CPPC_SRC_PARK		8	/* CCD parking */
+#define AMD_CPPC_SRC_THERMAL		9	/* registered by other drivers */
+#define AMD_CPPC_SRC_LEASE		10	/* registered by other drivers */
+#define AMD_CPPC_SRC_LIMIT		11	/* hw.amd_cppc.limit_* */
+#define AMD_CPPC_SRC_PHASE		12	/* boot/resume/shutdown window */
+#define AMD_CPPC_SRC_DOMAIN		13	/* coordination domain merge */
+#define AMD_CPPC_SRC_PROFILE		14	/* ac/battery power profile */
+#define AMD_CPPC_SRC_COUNT		15
+
+#define AMD_CPPC_SRC_NAMES {						\
+	"none", "hw", "admin", "cpufreq", "policy", "governor",		\
+	"vcache", "powercap", "park", "thermal", "lease", "limit",	\
+	"phase", "domain", "profile",					\
+}
+
+/* Request fields a source can bind */
+#define AMD_CPPC_BIND_MAX		0
+#define AMD_CPPC_BIND_MIN		1
+#define AMD_CPPC_BIND_DES		2
+#define AMD_CPPC_BIND_EPP		3
+#define AMD_CPPC_BIND_COUNT		4
+
+#define AMD_CPPC_SNAP_VERSION		2
+
+struct amd_cppc_snap {
+	uint16_t	snap_version;
+	uint16_t	snap_size;	/* sizeof(struct amd_cppc_snap) */
+	int32_t		cpu;
+
+	/* Capabilities */
+	uint8_t		highest_perf;
+	uint8_t		nominal_perf;
+	uint8_t		lowest_nonlinear_perf;
+	uint8_t		lowest_perf;
+	int32_t		base_mhz;
+
+	/* Request in force */
+	uint8_t		max_perf;
+	uint8_t		min_perf;
+	uint8_t		des_perf;
+	uint8_t		epp_hw;		/* 0-255 */
+	uint64_t	req;		/* CPPC_REQ as last written */
+
+	/* Admin settings, as in dev.amd_cppc.N */
+	int32_t		epp;		/* 0-100 */
+	int32_t		mode;		/* AMD_CPPC_MODE_* */
+	int32_t		boost;
+	int32_t		floor_perf;	/* min_perf, 0 = lowest */
+	int32_t		ceil_perf;	/* max_perf, 0 = highest */
+
+	int32_t		domain;		/* coordination domain, -1 = none */
+	uint64_t	tamper_count;
+
+	/* Policy layers in effect */
+	uint32_t	flags;		/* AMD_CPPC_SNAP_F_* */
+	int32_t		rule;		/* matching policy rule, -1 = none */
+	int32_t		set_policy;	/* cpuset policy, -1 = none */
+	int32_t		energy_esu;	/* energy unit 2^-esu J, -1 = none */
+
+	/*
+	 * Free running counters read together at snapshot time. Rates come
+	 * from the difference of two snapshots: delivered clock is base_mhz
+	 * scaled by aperf/mperf, busy share is mperf over tsc. The energy
+	 * counter is per core and wraps at 32 bits.
+	 */
+	uint64_t	tsc;
+	uint64_t	aperf;
+	uint64_t	mperf;
+	uint32_t	energy;
+
+	/* AMD_CPPC_SRC_* that decided max, min, desired perf and EPP */
+	uint8_t		bind[AMD_CPPC_BIND_COUNT];
+
+	/*
+	 * The request in force as clocks, through the driver's perf to MHz
+	 * map: the calibrated one where there is one. Since version 2.
+	 */
+	int32_t		max_mhz;
+	int32_t		min_mhz;
+	int32_t		des_mhz;	/* 0 = no desired level */
+};
+
+/* Snapshot flags */
+#define AMD_CPPC_SNAP_F_CAPPED		0x01	/* boost budget exceeded */
+#define AMD_CPPC_SNAP_F_PARKED		0x02	/* CCD parked */
+#define AMD_CPPC_SNAP_F_PHASE		0x04	/* boost window open */
+#define AMD_CPPC_SNAP_F_OWNER		0x08	/* lock owner boost */
+
+/* Fields of struct amd_cppc_set */
+#define AMD_CPPC_SET_EPP		0	/* 0-100 */
+#define AMD_CPPC_SET_MODE		1	/* AMD_CPPC_MODE_* */
+#define AMD_CPPC_SET_BOOST		2	/* 0 or 1 */
+#define AMD_CPPC_SET_MIN_PERF		3	/* 0-255 */
+#define AMD_CPPC_SET_MAX_PERF		4	/* 0-255 */
+#define AMD_CPPC_SET_COUNT		5
+
+#define AMD_CPPC_SET_MAX		4096	/* entries per call */
+
+struct amd_cppc_set {
+	int32_t		cpu;
+	int32_t		field;		/* AMD_CPPC_SET_* */
+	int32_t		value;
+};
+
+#endif /* !_AMD_CPPC_SNAP_H_ */
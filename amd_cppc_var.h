@@ -0,0 +1,442 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _AMD_CPPC_VAR_H_
+#define _AMD_CPPC_VAR_H_
+
+#include <sys/cpuset.h>
+
+#include "amd_cppc_calib.h"
+#include "amd_cppc_rules.h"
+#include "amd_cppc_snap.h"
+
+/*
+ * AMD CPPC MSR definitions.
+ */
+#define MSR_AMD_CPPC_CAP1		0xC00102B0
+#define MSR_AMD_CPPC_ENABLE		0xC00102B1
+#define MSR_AMD_CPPC_REQ		0xC00102B3
+
+/* CPPC_CAP1 fields (read-only) */
+#define AMD_CPPC_LOWEST_PERF(x)		(((x) >> 0) & 0xFF)
+#define AMD_CPPC_LOWNONLIN_PERF(x)	(((x) >> 8) & 0xFF)
+#define AMD_CPPC_NOMINAL_PERF(x)	(((x) >> 16) & 0xFF)
+#define AMD_CPPC_HIGHEST_PERF(x)	(((x) >> 24) & 0xFF)
+
+/* CPPC_REQ fields (read-write) */
+#define AMD_CPPC_MAX_PERF_SHIFT		0
+#define AMD_CPPC_MIN_PERF_SHIFT		8
+#define AMD_CPPC_DES_PERF_SHIFT		16
+#define AMD_CPPC_EPP_PERF_SHIFT		24
+
+#define AMD_CPPC_REQ_BUILD(max, min, des, epp)	\
+	(((uint64_t)(epp) << AMD_CPPC_EPP_PERF_SHIFT) |	\
+	 ((uint64_t)(des) << AMD_CPPC_DES_PERF_SHIFT) |	\
+	 ((uint64_t)(min) << AMD_CPPC_MIN_PERF_SHIFT) |	\
+	 ((uint64_t)(max) << AMD_CPPC_MAX_PERF_SHIFT))
+
+/* CPPC_ENABLE */
+#define AMD_CPPC_ENABLE_BIT		(1ULL << 0)
+
+/* Number of firmware tamper events remembered per CPU */
+#define AMD_CPPC_TAMPER_LOG		8
+
+/* Idle states tracked for residency statistics */
+#define AMD_CPPC_IDLE_STATES		8
+
+/* Users of the idle hook (amd_cppc_idle.c) */
+#define AMD_CPPC_IDLE_USER_EPP		0x01
+#define AMD_CPPC_IDLE_USER_RAMP		0x02
+
+/* Shadow policy operating point histogram buckets */
+#define AMD_CPPC_SHADOW_BUCKETS		8
+
+/* Perf levels of the energy model */
+#define AMD_CPPC_EM_LEVELS		8
+
+/* 3D V-Cache CCD preference */
+#define AMD_CPPC_VCACHE_NONE		0
+#define AMD_CPPC_VCACHE_CACHE		1	/* large L3 CCD first */
+#define AMD_CPPC_VCACHE_FREQ		2	/* high clock CCD first */
+#define AMD_CPPC_VCACHE_COUNT		3
+
+/*
+ * A partial request supplied by a policy layer on top of the admin
+ * settings. Fields set to -1 leave the admin setting alone.
+ */
+struct amd_cppc_override {
+	int		epp;
+	int		min_perf;
+	int		max_perf;
+	int		boost;
+	int		mode;
+	int		vcache;
+};
+
+/*
+ * A contribution of a registered source (thermal, lease, global limit) to
+ * the request. Fields set to -1 contribute nothing. Ceilings win over
+ * floors; a later source's desired_perf and EPP replace earlier ones.
+ */
+struct amd_cppc_contrib {
+	int		floor;		/* min_perf at least */
+	int		ceil;		/* max_perf at most */
+	int		des;		/* desired_perf, 0 = autonomous */
+	int		epp;		/* 0-100 */
+};
+
+#define AMD_CPPC_ARB_SLOTS	2	/* per-CPU: thermal, lease */
+
+/*
+ * Contents of CPPC_REQ.
+ */
+struct amd_cppc_req {
+	uint8_t		max_perf;
+	uint8_t		min_perf;
+	uint8_t		des_perf;
+	uint8_t		epp;
+};
+
+extern struct sx	amd_cppc_lock;
+extern int	amd_cppc_verbose;
+extern uint64_t	tsc_freq;
+
+SYSCTL_DECL(_hw_amd_cppc);
+
+#define CPPC_DEBUG(dev, fmt, ...)					\
+	do {								\
+		if (amd_cppc_verbose)					\
+			device_printf(dev, fmt, ## __VA_ARGS__);	\
+	} while (0)
+
+struct amd_cppc_softc {
+	device_t	dev;
+	int		cpu_id;
+
+	/* Capabilities from CPPC_CAP1 */
+	uint8_t		highest_perf;
+	uint8_t		nominal_perf;
+	uint8_t		lowest_nonlinear_perf;
+	uint8_t		lowest_perf;
+	uint8_t		boost_ratio;	/* ratio highest_perf stands for */
+
+	/* Current request state */
+	uint8_t		req_max_perf;
+	uint8_t		req_min_perf;
+	uint8_t		req_des_perf;
+	uint8_t		req_epp;
+
+	/* Frequency mapping */
+	int		base_freq_mhz;	/* nominal frequency in MHz */
+
+	/* Measured perf to MHz map (amd_cppc_calib.c), ascending */
+	volatile int	cal_n;		/* points, 0 = linear */
+	int		cal_perf[AMD_CPPC_CAL_POINTS];
+	int		cal_mhz[AMD_CPPC_CAL_POINTS];
+	struct task	cal_task;
+
+	/* EPP control */
+	int		epp;	/* 0-100 user-facing scale */
+
+	/* Policy inputs the request is computed from */
+	int		mode;		/* AMD_CPPC_MODE_* */
+	bool		boost;		/* allow perf above nominal */
+	uint8_t		floor_perf;	/* admin min_perf, 0 = lowest */
+	uint8_t		ceil_perf;	/* admin max_perf, 0 = highest */
+	uint8_t		cf_perf;	/* last cpufreq setting */
+
+	/* 3D V-Cache preference (amd_cppc_vcache.c) */
+	u_int		l3_kb;
+
+	/* Idle depth (amd_cppc_idle.c) */
+	int		idle_depth;	/* applied cx_lowest, 0 = untouched */
+	char		idle_saved[8];	/* cx_lowest before the driver */
+	int		idle_nbase;
+	uint64_t	idle_base[AMD_CPPC_IDLE_STATES];
+
+	/* Idle-entry EPP, written by the CPU's idle thread */
+	uint32_t	ie_avg_us;	/* running average idle period */
+	uint64_t	ie_entries;
+	uint64_t	ie_elided;
+	uint64_t	ie_gated;
+	uint64_t	ie_cost_cycles;	/* TSC cycles spent in MSR writes */
+	uint64_t	ie_efficient_us;
+
+	/* Lock owner boost (amd_cppc_owner.c), written by the callout */
+	struct callout	ob_callout;
+	uint64_t	ob_req;		/* boosted request written, 0 = none */
+	uint64_t	ob_base;	/* req_shadow it was derived from */
+	int		ob_ticks;	/* when the boost started */
+	bool		ob_expired;
+	uint64_t	ob_boosts;
+	uint64_t	ob_expirations;
+	uint64_t	ob_ms;
+
+	/* Predictive pre-ramp (amd_cppc_ramp.c), written by the CPU itself */
+	struct callout	pr_callout;
+	uint64_t	pr_req;		/* raised request written, 0 = none */
+	int		pr_state;
+	int		pr_streak;	/* intervals matching pr_cand */
+	sbintime_t	pr_cand;	/* candidate period while learning */
+	sbintime_t	pr_period;	/* locked period */
+	sbintime_t	pr_last;	/* last learned wakeup */
+	sbintime_t	pr_next;	/* predicted wakeup, or end of backoff */
+	sbintime_t	pr_hold;	/* stay raised until */
+	uint32_t	pr_history;	/* recent predictions, bit set = hit */
+	int		pr_judged;	/* predictions in pr_history */
+	bool		pr_off_cpu;
+	uint64_t	pr_hits;
+	uint64_t	pr_misses;
+	uint64_t	pr_locks;
+	uint64_t	pr_disables;
+
+	/* HSMP socket (amd_cppc_hsmp.c), -1 = no mailbox */
+	int		hsmp_socket;
+
+	/* Boost budget (amd_cppc_boost.c) */
+	int		boost_prio;
+	bool		boost_capped;
+	int		boost_util;
+	long		boost_cp_time[CPUSTATES];
+
+	/* CCD parking (amd_cppc_ccd.c) */
+	bool		ccd_parked;
+	long		ccd_cp_time[CPUSTATES];
+
+	/* Coordination domain (amd_cppc_domain.c) */
+	int		domain;		/* index, -1 = not grouped yet */
+	int		psd_domain;	/* _PSD domain number, -1 = none */
+	int		psd_coord;	/* _PSD coordination type */
+
+	/* cpuset/jail policy (amd_cppc_cpuset.c) */
+	struct amd_cppc_override set_ovr;
+	int		set_policy;	/* applying policy, -1 = none */
+
+	/* Policy rule state (amd_cppc_rules.c) */
+	struct amd_cppc_override rule_ovr;
+	int		rule_idx;	/* matching rule, -1 = none */
+	struct amd_cppc_rule_hold rule_hold;
+	uint64_t	rule_changes;
+	long		rule_cp_time[CPUSTATES];
+
+	/* Shadow policy evaluation (amd_cppc_shadow.c) */
+	int		shadow_idx;	/* matching shadow rule */
+	struct amd_cppc_rule_hold shadow_hold;
+	uint64_t	shadow_evals;
+	uint64_t	shadow_diverged;
+	uint64_t	shadow_energy[2];	/* modelled, active/shadow */
+	uint64_t	shadow_work[2];		/* modelled, active/shadow */
+	uint64_t	shadow_hist[AMD_CPPC_SHADOW_BUCKETS];
+
+	/* Request arbitration (amd_cppc_arb.c) */
+	struct amd_cppc_contrib arb_contrib[AMD_CPPC_ARB_SLOTS];
+	uint8_t		arb_bind[AMD_CPPC_BIND_COUNT];	/* AMD_CPPC_SRC_* */
+	uint64_t	arb_rebinds;	/* binding of some field changed */
+
+	bool		cppc_enabled;
+	bool		detaching;
+
+	/* Last value written to CPPC_REQ, compared by the watchdog */
+	uint64_t	req_shadow;
+
+	/* Firmware tamper watchdog */
+	struct timeout_task wdog_task;
+	uint64_t	tamper_count;
+	u_int		tamper_next;
+	struct amd_cppc_tamper {
+		struct timespec	ts;		/* wall clock at detection */
+		uint64_t	expected_req;
+		uint64_t	observed_req;
+		uint64_t	observed_enable;
+	}		tamper_log[AMD_CPPC_TAMPER_LOG];
+};
+
+/*
+ * CPPC_REQ values for a set of CPUs, written in one rendezvous.
+ */
+struct amd_cppc_batch {
+	cpuset_t	cpus;
+	uint64_t	req[MAXCPU];
+};
+
+/* Energy model of one CPU (amd_cppc_em.c) */
+struct amd_cppc_em_state {
+	int		cpu;
+	int		nlevels;
+	struct {
+		int	perf;
+		int	mhz;
+		int	power_mw;	/* active power at this level */
+		bool	measured;	/* from RAPL, else modelled */
+	} level[AMD_CPPC_EM_LEVELS];
+	bool		sampling;	/* operating point below is current */
+	int		busy;		/* C0 percent */
+	int		cur_mhz;	/* delivered while in C0 */
+	int		wake_mhz;	/* clock an idle wakeup ramps to */
+};
+
+/* Counters of one CPU, read for every CPU in one rendezvous */
+struct amd_cppc_ctr {
+	uint64_t	tsc;
+	uint64_t	aperf;
+	uint64_t	mperf;
+	uint32_t	energy;		/* RAPL core energy */
+	int32_t		esu;		/* energy unit 2^-esu J, -1 = none */
+};
+
+void		amd_cppc_bind_cpu(int cpu_id);
+void		amd_cppc_unbind_cpu(void);
+int		amd_cppc_perf_to_mhz(struct amd_cppc_softc *sc, uint8_t perf);
+uint8_t		amd_cppc_epp_to_hw(int epp);
+int		amd_cppc_cpu_util(int cpu, long *prev);
+void		amd_cppc_override_clear(struct amd_cppc_override *o);
+void		amd_cppc_req_eval(struct amd_cppc_softc *sc, int mode,
+				  const struct amd_cppc_override *ovr,
+				  struct amd_cppc_req *req, uint8_t *bind);
+void		amd_cppc_req_clamp(struct amd_cppc_softc *sc,
+				   struct amd_cppc_req *req, uint8_t *bind);
+int		amd_cppc_req_opp(const struct amd_cppc_req *req);
+uint64_t	amd_cppc_model_energy(struct amd_cppc_softc *sc, int perf);
+struct amd_cppc_softc *amd_cppc_softc_get(int unit);
+void		amd_cppc_update_req(struct amd_cppc_softc *sc);
+struct amd_cppc_batch *amd_cppc_batch_alloc(void);
+void		amd_cppc_batch_add(struct amd_cppc_batch *b,
+				   struct amd_cppc_softc *sc);
+int		amd_cppc_batch_commit(struct amd_cppc_batch *b);
+void		amd_cppc_ctr_read(void *arg);
+
+const char	*amd_cppc_mode_name(int mode);
+int		amd_cppc_mode_parse(const char *name);
+
+void		amd_cppc_calib_attach(struct amd_cppc_softc *sc);
+void		amd_cppc_calib_detach(struct amd_cppc_softc *sc);
+int		amd_cppc_calib_mhz(struct amd_cppc_softc *sc, int perf);
+int		amd_cppc_calib_perf(struct amd_cppc_softc *sc, int mhz);
+
+void		amd_cppc_arb_attach(struct amd_cppc_softc *sc);
+void		amd_cppc_arb_note(const struct amd_cppc_req *prev,
+				  const struct amd_cppc_req *req, int src,
+				  uint8_t *bind);
+void		amd_cppc_arb_apply(struct amd_cppc_softc *sc,
+				   struct amd_cppc_req *req, uint8_t *bind);
+void		amd_cppc_arb_binding(struct amd_cppc_softc *sc, uint8_t *bind);
+const char	*amd_cppc_arb_name(int src);
+int		amd_cppc_arb_set(int cpu, int src,
+				 const struct amd_cppc_contrib *c);
+
+void		amd_cppc_rules_init(void);
+void		amd_cppc_rules_fini(void);
+void		amd_cppc_rules_kick(void);
+
+bool		amd_cppc_shadow_active(void);
+struct amd_cppc_ruleset *amd_cppc_shadow_ruleset(void);
+void		amd_cppc_shadow_attach(struct amd_cppc_softc *sc);
+void		amd_cppc_shadow_eval(struct amd_cppc_softc *sc,
+				     const struct amd_cppc_rule_input *in);
+void		amd_cppc_shadow_fini(void);
+
+void		amd_cppc_boost_attach(struct amd_cppc_softc *sc);
+void		amd_cppc_boost_clamp(struct amd_cppc_softc *sc,
+				     struct amd_cppc_req *req);
+void		amd_cppc_boost_init(void);
+void		amd_cppc_boost_fini(void);
+
+void		amd_cppc_ccd_clamp(struct amd_cppc_softc *sc,
+				   struct amd_cppc_req *req);
+void		amd_cppc_ccd_init(void);
+void		amd_cppc_ccd_fini(void);
+
+void		amd_cppc_domain_attach(struct amd_cppc_softc *sc);
+void		amd_cppc_domain_cpus(struct amd_cppc_softc *sc,
+				     cpuset_t *mask);
+void		amd_cppc_domain_members(struct amd_cppc_softc *sc,
+					cpuset_t *mask);
+bool		amd_cppc_topo_group(int cpu, int level, cpuset_t *mask);
+void		amd_cppc_domain_req(struct amd_cppc_softc *sc,
+				    struct amd_cppc_req *req);
+
+void		amd_cppc_idle_apply(int depth);
+void		amd_cppc_idle_attach(struct amd_cppc_softc *sc);
+void		amd_cppc_idle_detach(struct amd_cppc_softc *sc);
+void		amd_cppc_idle_fini(void);
+int		amd_cppc_idle_hook_use(int user, bool on);
+
+void		amd_cppc_ramp_attach(struct amd_cppc_softc *sc);
+void		amd_cppc_ramp_detach(struct amd_cppc_softc *sc);
+void		amd_cppc_ramp_fini(void);
+void		amd_cppc_ramp_wake(struct amd_cppc_softc *sc, uint32_t idle_us);
+
+int		amd_cppc_owner_block(struct thread *owner);
+void		amd_cppc_owner_unblock(int cookie);
+void		amd_cppc_owner_attach(struct amd_cppc_softc *sc);
+void		amd_cppc_owner_detach(struct amd_cppc_softc *sc);
+void		amd_cppc_owner_fini(void);
+
+void		amd_cppc_em_attach(struct amd_cppc_softc *sc);
+void		amd_cppc_em_detach(struct amd_cppc_softc *sc);
+void		amd_cppc_em_remap(struct amd_cppc_softc *sc);
+void		amd_cppc_em_init(void);
+void		amd_cppc_em_fini(void);
+int		amd_cppc_em_get(int cpu, struct amd_cppc_em_state *st);
+int		amd_cppc_em_pick(const cpuset_t *mask, int cpu, int util,
+				 int *saved);
+
+void		amd_cppc_energy_attach(struct amd_cppc_softc *sc);
+void		amd_cppc_energy_detach(struct amd_cppc_softc *sc);
+void		amd_cppc_energy_init(void);
+void		amd_cppc_energy_fini(void);
+
+void		amd_cppc_pmc_attach(struct amd_cppc_softc *sc);
+void		amd_cppc_pmc_detach(struct amd_cppc_softc *sc);
+
+bool		amd_cppc_phase_open(void);
+void		amd_cppc_phase_clamp(struct amd_cppc_softc *sc,
+				     struct amd_cppc_req *req);
+void		amd_cppc_phase_resume(void);
+void		amd_cppc_phase_init(void);
+void		amd_cppc_phase_fini(void);
+
+void		amd_cppc_hsmp_attach(struct amd_cppc_softc *sc);
+void		amd_cppc_hsmp_fini(void);
+
+void		amd_cppc_smu_attach(struct amd_cppc_softc *sc);
+void		amd_cppc_smu_init(void);
+void		amd_cppc_smu_fini(void);
+
+void		amd_cppc_vcache_attach(struct amd_cppc_softc *sc);
+void		amd_cppc_vcache_bias(struct amd_cppc_softc *sc,
+				     struct amd_cppc_override *eff,
+				     uint8_t *hi);
+const char	*amd_cppc_vcache_name(int mode);
+int		amd_cppc_vcache_parse(const char *name);
+int		amd_cppc_vcache_rank(struct amd_cppc_softc *sc, int mode);
+
+void		amd_cppc_cpuset_attach(struct amd_cppc_softc *sc);
+void		amd_cppc_cpuset_init(void);
+void		amd_cppc_cpuset_fini(void);
+
+#endif /* !_AMD_CPPC_VAR_H_ */
@@ -0,0 +1,263 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * 3D V-Cache CCD preference.
+ *
+ * On X3D parts one CCD carries the stacked L3 and runs at lower clocks,
+ * the other has the normal L3 and clocks higher. CAP1 does not tell them
+ * apart, so each CPU's L3 size is read from the CPUID cache topology leaf
+ * at attach, and the CPUs with the largest L3 are the cache CCD.
+ *
+ * hw.amd_cppc.vcache selects which CCD should take load first:
+ *	none		no bias (default)
+ *	cache		prefer the large-L3 CCD
+ *	frequency	prefer the high-clock CCD
+ * and a cpuset policy can override it with vcache=. CPUs on the preferred
+ * CCD get their EPP lowered by vcache_epp_bias and rank first for boost
+ * grants. CPUs on the other CCD are held at nominal_perf with their EPP
+ * raised by the same amount, so they stay the slower choice while the
+ * preferred CCD has headroom. Parts with uniform L3 are left alone.
+ */
+
+#include <sys/param.h>
+#include <sys/bus.h>
+#include <sys/cpuset.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/systm.h>
+
+#include <machine/cpufunc.h>
+#include <machine/md_var.h>
+#include <machine/specialreg.h>
+
+#include "amd_cppc_var.h"
+
+#define CPUID_AMD_CACHE_TOPOLOGY	0x8000001D
+
+static const char *const amd_cppc_vcache_names[AMD_CPPC_VCACHE_COUNT] = {
+	"none", "cache", "frequency",
+};
+
+/* Preference and L3 layout, protected by amd_cppc_lock */
+static int	amd_cppc_vcache_mode = AMD_CPPC_VCACHE_NONE;
+static int	amd_cppc_vcache_epp_bias = 20;
+static u_int	amd_cppc_vcache_min_kb;
+static u_int	amd_cppc_vcache_max_kb;
+
+const char *
+amd_cppc_vcache_name(int mode)
+{
+
+	if (mode < 0 || mode >= AMD_CPPC_VCACHE_COUNT)
+		return ("unknown");
+	return (amd_cppc_vcache_names[mode]);
+}
+
+int
+amd_cppc_vcache_parse(const char *name)
+{
+	int		i;
+
+	for (i = 0; i < AMD_CPPC_VCACHE_COUNT; i++)
+		if (strcmp(name, amd_cppc_vcache_names[i]) == 0)
+			return (i);
+	return (-1);
+}
+
+/*
+ * L3 size in KB of the calling CPU, 0 if the topology leaf is missing.
+ */
+static u_int
+amd_cppc_vcache_l3_kb(void)
+{
+	u_int		regs[4];
+	u_int		i, size;
+
+	if ((amd_feature2 & AMDID2_TOPOLOGY) == 0)
+		return (0);
+	for (i = 0; i < 8; i++) {
+		cpuid_count(CPUID_AMD_CACHE_TOPOLOGY, i, regs);
+		if ((regs[0] & 0x1F) == 0)
+			break;
+		if (((regs[0] >> 5) & 0x7) != 3)
+			continue;
+		size = (((regs[1] >> 22) & 0x3FF) + 1) *	/* ways */
+		    (((regs[1] >> 12) & 0x3FF) + 1) *		/* partitions */
+		    ((regs[1] & 0xFFF) + 1) *			/* line size */
+		    (regs[2] + 1);				/* sets */
+		return (size / 1024);
+	}
+	return (0);
+}
+
+/*
+ * Where a CPU stands under a preference mode: 1 on the preferred CCD, -1 on
+ * the other one, 0 when there is nothing to prefer. A negative mode means
+ * the CPU's configured preference.
+ */
+int
+amd_cppc_vcache_rank(struct amd_cppc_softc *sc, int mode)
+{
+	bool		big;
+
+	if (mode < 0)
+		mode = sc->set_ovr.vcache >= 0 ? sc->set_ovr.vcache :
+		    amd_cppc_vcache_mode;
+	if (mode == AMD_CPPC_VCACHE_NONE || sc->l3_kb == 0 ||
+	    amd_cppc_vcache_min_kb == amd_cppc_vcache_max_kb)
+		return (0);
+	big = sc->l3_kb == amd_cppc_vcache_max_kb;
+	return (big == (mode == AMD_CPPC_VCACHE_CACHE) ? 1 : -1);
+}
+
+/*
+ * Bias the effective settings of a CPU by its preference rank.
+ */
+void
+amd_cppc_vcache_bias(struct amd_cppc_softc *sc, struct amd_cppc_override *eff,
+		     uint8_t *hi)
+{
+
+	switch (amd_cppc_vcache_rank(sc, eff->vcache)) {
+	case 1:
+		eff->epp = MAX(0, eff->epp - amd_cppc_vcache_epp_bias);
+		break;
+	case -1:
+		eff->epp = MIN(100, eff->epp + amd_cppc_vcache_epp_bias);
+		*hi = MIN(*hi, sc->nominal_perf);
+		break;
+	}
+}
+
+static void
+amd_cppc_vcache_apply(void)
+{
+	struct amd_cppc_softc *sc;
+	struct amd_cppc_batch *b;
+	int		cpu;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	b = amd_cppc_batch_alloc();
+	CPU_FOREACH(cpu)
+		if ((sc = amd_cppc_softc_get(cpu)) != NULL)
+			amd_cppc_batch_add(b, sc);
+	amd_cppc_batch_commit(b);
+}
+
+static int
+amd_cppc_sysctl_vcache(SYSCTL_HANDLER_ARGS)
+{
+	char		buf[16];
+	int		error, mode;
+
+	strlcpy(buf, amd_cppc_vcache_name(amd_cppc_vcache_mode), sizeof(buf));
+	error = sysctl_handle_string(oidp, buf, sizeof(buf), req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if ((mode = amd_cppc_vcache_parse(buf)) < 0)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_vcache_mode = mode;
+	amd_cppc_vcache_apply();
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, vcache,
+	    CTLTYPE_STRING | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_vcache, "A",
+	    "CCD to load first on X3D parts (none, cache, frequency)");
+
+static int
+amd_cppc_sysctl_vcache_epp_bias(SYSCTL_HANDLER_ARGS)
+{
+	int		error, val;
+
+	val = amd_cppc_vcache_epp_bias;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val < 0 || val > 100)
+		return (EINVAL);
+
+	sx_xlock(&amd_cppc_lock);
+	amd_cppc_vcache_epp_bias = val;
+	amd_cppc_vcache_apply();
+	sx_xunlock(&amd_cppc_lock);
+	return (0);
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, vcache_epp_bias,
+	    CTLTYPE_INT | CTLFLAG_RWTUN | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_vcache_epp_bias, "I",
+	    "EPP shift (0-100 scale) applied towards the preferred CCD");
+
+static int
+amd_cppc_sysctl_vcache_split(SYSCTL_HANDLER_ARGS)
+{
+	int		val;
+
+	sx_slock(&amd_cppc_lock);
+	val = amd_cppc_vcache_min_kb != amd_cppc_vcache_max_kb;
+	sx_sunlock(&amd_cppc_lock);
+	return (sysctl_handle_int(oidp, &val, 0, req));
+}
+SYSCTL_PROC(_hw_amd_cppc, OID_AUTO, vcache_split,
+	    CTLTYPE_INT | CTLFLAG_RD | CTLFLAG_MPSAFE, NULL, 0,
+	    amd_cppc_sysctl_vcache_split, "I",
+	    "CCDs differ in L3 size (X3D part)");
+
+void
+amd_cppc_vcache_attach(struct amd_cppc_softc *sc)
+{
+	bool		split;
+
+	sx_assert(&amd_cppc_lock, SA_XLOCKED);
+	split = amd_cppc_vcache_min_kb != amd_cppc_vcache_max_kb;
+	amd_cppc_bind_cpu(sc->cpu_id);
+	sc->l3_kb = amd_cppc_vcache_l3_kb();
+	amd_cppc_unbind_cpu();
+
+	if (sc->l3_kb != 0) {
+		if (amd_cppc_vcache_min_kb == 0 ||
+		    sc->l3_kb < amd_cppc_vcache_min_kb)
+			amd_cppc_vcache_min_kb = sc->l3_kb;
+		amd_cppc_vcache_max_kb = MAX(amd_cppc_vcache_max_kb,
+					     sc->l3_kb);
+	}
+
+	/* The first CPU of the second CCD changes everyone's rank. */
+	if (split != (amd_cppc_vcache_min_kb != amd_cppc_vcache_max_kb))
+		amd_cppc_vcache_apply();
+
+	SYSCTL_ADD_UINT(device_get_sysctl_ctx(sc->dev),
+			SYSCTL_CHILDREN(device_get_sysctl_tree(sc->dev)),
+			OID_AUTO, "l3_kb", CTLFLAG_RD, &sc->l3_kb, 0,
+			"L3 cache size in KB");
+}
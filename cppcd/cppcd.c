@@ -0,0 +1,319 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * cppcd main loop: sample, match, write the differences in one batch,
+ * sleep until the next interval or a devd notification.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __FreeBSD__
+#include <libutil.h>
+#endif
+
+#include "cppcd.h"
+
+int		cppcd_verbose;
+static FILE	*cppcd_logfp;		/* NULL = syslog */
+
+static volatile sig_atomic_t cppcd_quit;
+static volatile sig_atomic_t cppcd_reload;
+
+static const char *cppcd_fields[AMD_CPPC_SET_COUNT] = {
+	[AMD_CPPC_SET_EPP] = "epp",
+	[AMD_CPPC_SET_MODE] = "mode",
+	[AMD_CPPC_SET_BOOST] = "boost",
+	[AMD_CPPC_SET_MIN_PERF] = "min",
+	[AMD_CPPC_SET_MAX_PERF] = "max",
+};
+
+void
+cppcd_log(int pri, const char *fmt, ...)
+{
+	va_list		ap;
+
+	if (pri == LOG_DEBUG && !cppcd_verbose)
+		return;
+	va_start(ap, fmt);
+	if (cppcd_logfp != NULL) {
+		vfprintf(cppcd_logfp, fmt, ap);
+		fputc('\n', cppcd_logfp);
+		fflush(cppcd_logfp);
+	} else
+		vsyslog(pri, fmt, ap);
+	va_end(ap);
+}
+
+/*
+ * Write a batch of changes through one commit.
+ */
+int
+cppcd_apply(struct amdcppc *h, const struct amd_cppc_set *set, int n,
+	    uint64_t now_ms)
+{
+	int		i;
+
+	for (i = 0; i < n; i++) {
+		cppcd_log(LOG_DEBUG, "t=%ju cpu %d: %s=%d", (uintmax_t)now_ms,
+			  set[i].cpu, cppcd_fields[set[i].field],
+			  set[i].value);
+		if (amdcppc_queue(h, set[i].cpu, set[i].field,
+				  set[i].value) != 0) {
+			amdcppc_discard(h);
+			return (-1);
+		}
+	}
+	return (amdcppc_commit(h));
+}
+
+static void
+cppcd_sig(int sig)
+{
+
+	if (sig == SIGHUP)
+		cppcd_reload = 1;
+	else
+		cppcd_quit = 1;
+}
+
+#ifdef __FreeBSD__
+static uint64_t
+cppcd_now_ms(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC_FAST, &ts);
+	return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/*
+ * In a dry run the policy works on a copy of the driver state, so the
+ * log shows what would change once rather than on every pass.
+ */
+static struct amdcppc *
+cppcd_mirror(struct amdcppc *h)
+{
+	struct amd_cppc_snap *snap;
+	struct amdcppc	*m;
+	int		i, n;
+
+	n = amdcppc_ncpus(h);
+	if ((snap = calloc(n + 1, sizeof(*snap))) == NULL)
+		return (NULL);
+	for (i = 0; i < n; i++)
+		snap[i] = *amdcppc_cpu(h, i);
+	m = amdcppc_open_memory(snap, n);
+	free(snap);
+	return (m);
+}
+
+static void
+cppcd_run(const char *confpath, struct cppcd_conf *conf, bool dryrun)
+{
+	struct cppcd_state st;
+	struct amd_cppc_set *set;
+	struct amdcppc	*drv, *h;
+	struct pollfd	pfd;
+	char		errbuf[128];
+	uint64_t	start;
+	int		ev, max, n, ready;
+
+	if ((drv = amdcppc_open()) == NULL)
+		err(1, "amd_cppc");
+	h = drv;
+	if (dryrun && (h = cppcd_mirror(drv)) == NULL)
+		err(1, "dry run");
+	if (cppcd_sys_open() != 0)
+		err(1, "kern.cp_times");
+	max = amdcppc_ncpus(h) * AMD_CPPC_SET_COUNT;
+	if (cppcd_state_init(&st, h) != 0 ||
+	    (set = calloc(max + 1, sizeof(*set))) == NULL)
+		err(1, "malloc");
+	start = cppcd_now_ms();
+	cppcd_log(LOG_INFO, "started on %d CPUs, %d rules%s", st.ncpus,
+		  conf->rules.nrules, dryrun ? ", dry run" : "");
+
+	ev = 0;
+	while (!cppcd_quit) {
+		if (cppcd_reload) {
+			cppcd_reload = 0;
+			if (cppcd_conf_load(confpath, conf, errbuf,
+					    sizeof(errbuf)) != 0)
+				cppcd_log(LOG_ERR, "reload: %s, keeping the "
+					  "old configuration", errbuf);
+			else {
+				cppcd_log(LOG_INFO, "reloaded %s", confpath);
+				cppcd_state_reset(&st);
+			}
+		}
+
+		/* Timer and devd wake-ups both lead to a full pass. */
+		st.now_ms = cppcd_now_ms() - start;
+		if (cppcd_sys_sample(&st, (conf->rules.needs &
+		    AMD_CPPC_RULE_NEED_TEMP) != 0) != 0)
+			cppcd_log(LOG_ERR, "sample: %s", strerror(errno));
+		if (!dryrun && amdcppc_refresh(h) != 0)
+			cppcd_log(LOG_ERR, "refresh: %s", strerror(errno));
+		if (ev != 0)
+			cppcd_log(LOG_DEBUG, "event%s%s ac=%d",
+				  ev & CPPCD_EV_AC ? " ac" : "",
+				  ev & CPPCD_EV_THERMAL ? " thermal" : "",
+				  st.ac);
+		cppcd_conf_resolve(conf, cppcd_sys_cpuset);
+		n = cppcd_eval(conf, &st, h, set, max);
+		if (n > 0 && cppcd_apply(h, set, n, st.now_ms) != 0)
+			cppcd_log(LOG_ERR, "apply: %s", strerror(errno));
+
+		pfd.fd = cppcd_sys_event_fd();
+		pfd.events = POLLIN;
+		ready = poll(&pfd, 1, cppcd_idle(conf, &st) ?
+			     conf->idle_interval_ms : conf->interval_ms);
+		ev = ready > 0 ? cppcd_sys_event_read() : 0;
+	}
+
+	if (!dryrun && amdcppc_refresh(h) == 0 &&
+	    (n = cppcd_restore(&st, h, set, max)) > 0 &&
+	    cppcd_apply(h, set, n, cppcd_now_ms() - start) != 0)
+		cppcd_log(LOG_ERR, "restore: %s", strerror(errno));
+	cppcd_log(LOG_INFO, "exiting");
+	free(set);
+	cppcd_state_fini(&st);
+	cppcd_sys_close();
+	if (h != drv)
+		amdcppc_close(h);
+	amdcppc_close(drv);
+}
+#endif /* __FreeBSD__ */
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: cppcd [-dnv] [-f config] [-P pidfile] [-s script]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct cppcd_conf conf;
+	const char	*confpath, *pidpath, *script;
+	char		errbuf[128];
+	bool		dryrun, foreground;
+	int		ch;
+#ifdef __FreeBSD__
+	struct pidfh	*pfh;
+	pid_t		otherpid;
+#endif
+
+	confpath = CPPCD_CONF;
+	pidpath = CPPCD_PIDFILE;
+	script = NULL;
+	dryrun = foreground = false;
+	while ((ch = getopt(argc, argv, "df:nP:s:v")) != -1) {
+		switch (ch) {
+		case 'd':
+			foreground = true;
+			break;
+		case 'f':
+			confpath = optarg;
+			break;
+		case 'n':
+			dryrun = true;
+			break;
+		case 'P':
+			pidpath = optarg;
+			break;
+		case 's':
+			script = optarg;
+			break;
+		case 'v':
+			cppcd_verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	if (cppcd_conf_load(confpath, &conf, errbuf, sizeof(errbuf)) != 0)
+		errx(1, "%s", errbuf);
+
+	signal(SIGHUP, cppcd_sig);
+	signal(SIGINT, cppcd_sig);
+	signal(SIGTERM, cppcd_sig);
+
+	if (script != NULL) {
+		/* The simulator logs every change for comparison. */
+		cppcd_logfp = stdout;
+		cppcd_verbose = 1;
+		return (cppcd_sim(script, confpath, &conf));
+	}
+
+#ifdef __FreeBSD__
+	if (foreground || dryrun) {
+		cppcd_logfp = stderr;
+		cppcd_run(confpath, &conf, dryrun);
+		return (0);
+	}
+	pfh = pidfile_open(pidpath, 0600, &otherpid);
+	if (pfh == NULL) {
+		if (errno == EEXIST)
+			errx(1, "already running, pid %d", otherpid);
+		warn("cannot open pid file");
+	}
+	openlog("cppcd", LOG_PID, LOG_DAEMON);
+	if (daemon(0, 0) != 0) {
+		warn("cannot enter background mode");
+		pidfile_remove(pfh);
+		exit(1);
+	}
+	pidfile_write(pfh);
+	cppcd_run(confpath, &conf, dryrun);
+	pidfile_remove(pfh);
+	return (0);
+#else
+	(void)pidpath;
+	(void)foreground;
+	(void)dryrun;
+	errx(1, "only simulation (-s) is available on this system");
+#endif
+}
@@ -0,0 +1,142 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * cppcd: userspace policy daemon for amd_cppc(4).
+ *
+ * The daemon samples per-CPU utilization on a timer and wakes early on
+ * AC and thermal notifications from devd. Every pass matches a rule table
+ * (the same language as hw.amd_cppc.rules, see amd_cppc_rules.h) per CPU
+ * and writes the differences from the current settings as one batch.
+ *
+ * The policy pass only sees struct cppcd_state and a libamdcppc handle,
+ * so it runs the same against the driver, a dry-run mirror of it, or the
+ * simulator in cppcd_sim.c.
+ */
+
+#ifndef _CPPCD_H_
+#define _CPPCD_H_
+
+#ifdef __FreeBSD__
+#include <sys/cpuset.h>
+#else
+#include <sched.h>
+typedef cpu_set_t cpuset_t;
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "amd_cppc_rules.h"
+#include "amdcppc.h"
+
+#ifndef __printflike
+#define __printflike(f, a)	__attribute__((__format__(__printf__, f, a)))
+#endif
+
+#define CPPCD_CONF		"/usr/local/etc/cppcd.conf"
+#define CPPCD_PIDFILE		"/var/run/cppcd.pid"
+
+struct cppcd_conf {
+	int		interval_ms;	/* sampling while busy */
+	int		idle_interval_ms; /* sampling while all CPUs idle */
+	int		idle_util;	/* busy % below which a CPU is idle */
+	int		mode;		/* AMD_CPPC_MODE_*, -1 = keep */
+
+	/* Settings when no rule sets them, -1 = as found at startup */
+	int		epp;
+	int		boost;
+	int		min_perf;
+	int		max_perf;
+
+	struct amd_cppc_ruleset rules;
+};
+
+struct cppcd_cpu {
+	int		cpu;
+	int		util;		/* percent busy over the last interval */
+	int		temp;		/* degrees C or AMD_CPPC_TEMP_UNKNOWN */
+	int		rule;		/* matching rule, -1 = none */
+	struct amd_cppc_rule_hold hold;	/* time= condition state */
+
+	/* Admin settings found at startup, restored on exit */
+	int		base_mode;
+	int		base_epp;
+	int		base_boost;
+	int		base_min;
+	int		base_max;
+};
+
+struct cppcd_state {
+	int		ncpus;
+	struct cppcd_cpu *cpus;
+	int		ac;		/* 1 on AC power */
+	uint64_t	now_ms;
+};
+
+/* Notifications that call for an early pass */
+#define CPPCD_EV_AC		0x01
+#define CPPCD_EV_THERMAL	0x02
+
+/* cppcd.c */
+extern int	cppcd_verbose;
+void	cppcd_log(int pri, const char *fmt, ...) __printflike(2, 3);
+int	cppcd_apply(struct amdcppc *h, const struct amd_cppc_set *set, int n,
+		    uint64_t now_ms);
+
+/* cppcd_conf.c */
+int	cppcd_conf_load(const char *path, struct cppcd_conf *conf, char *err,
+			size_t errlen);
+int	cppcd_conf_parse(const char *text, struct cppcd_conf *conf,
+			 char *err, size_t errlen);
+void	cppcd_conf_resolve(struct cppcd_conf *conf,
+			   int (*lookup)(int id, cpuset_t *mask));
+
+/* cppcd_policy.c */
+int	cppcd_state_init(struct cppcd_state *st, struct amdcppc *h);
+void	cppcd_state_reset(struct cppcd_state *st);
+void	cppcd_state_fini(struct cppcd_state *st);
+int	cppcd_eval(const struct cppcd_conf *conf, struct cppcd_state *st,
+		   struct amdcppc *h, struct amd_cppc_set *set, int max);
+int	cppcd_restore(struct cppcd_state *st, struct amdcppc *h,
+		      struct amd_cppc_set *set, int max);
+bool	cppcd_idle(const struct cppcd_conf *conf,
+		   const struct cppcd_state *st);
+
+/* cppcd_sim.c */
+int	cppcd_sim(const char *script, const char *confpath,
+		  struct cppcd_conf *conf);
+
+/* cppcd_sys.c, FreeBSD only */
+int	cppcd_sys_open(void);
+void	cppcd_sys_close(void);
+int	cppcd_sys_sample(struct cppcd_state *st, bool temps);
+int	cppcd_sys_cpuset(int id, cpuset_t *mask);
+int	cppcd_sys_event_fd(void);
+int	cppcd_sys_event_read(void);
+
+#endif /* !_CPPCD_H_ */
@@ -0,0 +1,229 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Configuration file, one setting per line:
+ *
+ *	interval 250		ms between samples while any CPU is busy
+ *	idle_interval 1000	ms between samples while all CPUs are idle
+ *	idle_util 5		busy % below which a CPU counts as idle
+ *	mode autonomous		request mode to set at startup
+ *	epp 50			settings where no rule decides; by default
+ *	boost 1			the ones found at startup are kept
+ *	min 0
+ *	max 0
+ *	rule util=80-100 ac=1 : epp=0 boost=1
+ *
+ * rule lines form the rule table in order, in the hw.amd_cppc.rules
+ * language. '#' starts a comment.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cppcd.h"
+
+#define CPPCD_CONF_MAXLEN	16384
+
+static void
+cppcd_conf_defaults(struct cppcd_conf *conf)
+{
+
+	memset(conf, 0, sizeof(*conf));
+	conf->interval_ms = 250;
+	conf->idle_interval_ms = 1000;
+	conf->idle_util = 5;
+	conf->mode = -1;
+	conf->epp = conf->boost = conf->min_perf = conf->max_perf = -1;
+}
+
+static int
+cppcd_conf_int(const char *val, int min, int max, int *out)
+{
+	char		*end;
+	long		v;
+
+	errno = 0;
+	v = strtol(val, &end, 10);
+	if (end == val || *end != '\0' || errno != 0 || v < min || v > max)
+		return (EINVAL);
+	*out = v;
+	return (0);
+}
+
+static int
+cppcd_conf_set(struct cppcd_conf *conf, const char *key, const char *val)
+{
+
+	if (strcmp(key, "interval") == 0)
+		return (cppcd_conf_int(val, 10, 60000, &conf->interval_ms));
+	if (strcmp(key, "idle_interval") == 0)
+		return (cppcd_conf_int(val, 10, 60000,
+				       &conf->idle_interval_ms));
+	if (strcmp(key, "idle_util") == 0)
+		return (cppcd_conf_int(val, 0, 100, &conf->idle_util));
+	if (strcmp(key, "epp") == 0)
+		return (cppcd_conf_int(val, 0, 100, &conf->epp));
+	if (strcmp(key, "boost") == 0)
+		return (cppcd_conf_int(val, 0, 1, &conf->boost));
+	if (strcmp(key, "min") == 0)
+		return (cppcd_conf_int(val, 0, 255, &conf->min_perf));
+	if (strcmp(key, "max") == 0)
+		return (cppcd_conf_int(val, 0, 255, &conf->max_perf));
+	if (strcmp(key, "mode") == 0) {
+		conf->mode = amdcppc_mode_parse(val);
+		return (conf->mode < 0 ? EINVAL : 0);
+	}
+	return (ENOENT);
+}
+
+/*
+ * Parse a configuration. On error, a description is left in err and conf
+ * is unchanged, so a bad reload keeps the running configuration.
+ */
+int
+cppcd_conf_parse(const char *text, struct cppcd_conf *conf, char *err,
+		 size_t errlen)
+{
+	struct cppcd_conf new;
+	char		*buf, *key, *line, *next, *p, *rules, *val;
+	size_t		rlen;
+	int		error, lineno;
+
+	cppcd_conf_defaults(&new);
+	if ((buf = strdup(text)) == NULL ||
+	    (rules = calloc(1, AMD_CPPC_RULES_TEXTLEN)) == NULL) {
+		free(buf);
+		snprintf(err, errlen, "out of memory");
+		return (ENOMEM);
+	}
+	rlen = 0;
+	error = 0;
+	lineno = 0;
+	next = buf;
+	while ((line = strsep(&next, "\n")) != NULL) {
+		lineno++;
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		key = line + strspn(line, " \t");
+		if (*key == '\0')
+			continue;
+		val = key + strcspn(key, " \t");
+		if (*val != '\0')
+			*val++ = '\0';
+		val += strspn(val, " \t");
+		for (p = val + strlen(val); p > val &&
+		    (p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\r'); p--)
+			p[-1] = '\0';
+
+		if (strcmp(key, "rule") == 0) {
+			if (rlen + strlen(val) + 2 > AMD_CPPC_RULES_TEXTLEN) {
+				snprintf(err, errlen, "line %d: rule table "
+					 "too long", lineno);
+				error = E2BIG;
+				break;
+			}
+			rlen += sprintf(rules + rlen, "%s\n", val);
+			continue;
+		}
+		if ((error = cppcd_conf_set(&new, key, val)) != 0) {
+			snprintf(err, errlen, "line %d: %s '%s'", lineno,
+				 error == ENOENT ? "unknown setting" :
+				 "bad value for", key);
+			error = EINVAL;
+			break;
+		}
+	}
+	if (error == 0)
+		error = amd_cppc_rules_parse(rules, &new.rules, err, errlen);
+	if (error == 0)
+		*conf = new;
+	free(rules);
+	free(buf);
+	return (error);
+}
+
+int
+cppcd_conf_load(const char *path, struct cppcd_conf *conf, char *err,
+		size_t errlen)
+{
+	FILE		*fp;
+	char		*text;
+	size_t		len;
+	int		error;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		error = errno;
+		snprintf(err, errlen, "%s: %s", path, strerror(error));
+		return (error);
+	}
+	if ((text = malloc(CPPCD_CONF_MAXLEN)) == NULL) {
+		fclose(fp);
+		snprintf(err, errlen, "out of memory");
+		return (ENOMEM);
+	}
+	len = fread(text, 1, CPPCD_CONF_MAXLEN, fp);
+	error = ferror(fp) ? EIO : len == CPPCD_CONF_MAXLEN ? E2BIG : 0;
+	fclose(fp);
+	if (error != 0) {
+		snprintf(err, errlen, "%s: %s", path, error == EIO ?
+			 "read error" : "file too large");
+		free(text);
+		return (error);
+	}
+	text[len] = '\0';
+	error = cppcd_conf_parse(text, conf, err, errlen);
+	free(text);
+	return (error);
+}
+
+/*
+ * Resolve the cpuset conditions of the rule table to CPU masks. Members
+ * can change at any time, so this is redone before every pass.
+ */
+void
+cppcd_conf_resolve(struct cppcd_conf *conf,
+		   int (*lookup)(int id, cpuset_t *mask))
+{
+	struct amd_cppc_rule *r;
+	int		i;
+
+	if ((conf->rules.needs & AMD_CPPC_RULE_NEED_CPUSET) == 0)
+		return;
+	for (i = 0; i < conf->rules.nrules; i++) {
+		r = &conf->rules.rules[i];
+		if (r->cpuset < 0)
+			continue;
+		CPU_ZERO(&r->cpus);
+		if (lookup != NULL)
+			(void)lookup(r->cpuset, &r->cpus);
+	}
+}
@@ -0,0 +1,212 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Policy pass: match the rule table for every CPU and list the settings
+ * that differ from what the driver has. Nothing here touches the system,
+ * so the pass behaves the same against the simulator.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "cppcd.h"
+
+int
+cppcd_state_init(struct cppcd_state *st, struct amdcppc *h)
+{
+	const struct amd_cppc_snap *s;
+	struct cppcd_cpu *c;
+	int		i, n;
+
+	memset(st, 0, sizeof(*st));
+	n = amdcppc_ncpus(h);
+	if ((st->cpus = calloc(n + 1, sizeof(*st->cpus))) == NULL)
+		return (-1);
+	for (i = 0; i < n; i++) {
+		s = amdcppc_cpu(h, i);
+		c = &st->cpus[i];
+		c->cpu = s->cpu;
+		c->temp = AMD_CPPC_TEMP_UNKNOWN;
+		c->rule = -1;
+		c->base_mode = s->mode;
+		c->base_epp = s->epp;
+		c->base_boost = s->boost;
+		c->base_min = s->floor_perf;
+		c->base_max = s->ceil_perf;
+	}
+	st->ncpus = n;
+	st->ac = 1;
+	return (0);
+}
+
+/*
+ * Forget the matching rules, e.g. after the rule table was reloaded.
+ */
+void
+cppcd_state_reset(struct cppcd_state *st)
+{
+	int		i;
+
+	for (i = 0; i < st->ncpus; i++) {
+		st->cpus[i].rule = -1;
+		memset(&st->cpus[i].hold, 0, sizeof(st->cpus[i].hold));
+	}
+}
+
+void
+cppcd_state_fini(struct cppcd_state *st)
+{
+
+	free(st->cpus);
+	memset(st, 0, sizeof(*st));
+}
+
+static void
+cppcd_emit(struct amd_cppc_set *set, int *n, int max, int cpu, int field,
+	   int value, int cur)
+{
+
+	if (value == cur || *n >= max)
+		return;
+	set[*n].cpu = cpu;
+	set[*n].field = field;
+	set[*n].value = value;
+	(*n)++;
+}
+
+static int
+cppcd_pick(int rule, int conf, int base)
+{
+
+	if (rule >= 0)
+		return (rule);
+	return (conf >= 0 ? conf : base);
+}
+
+/*
+ * Fill set with the changes the configuration calls for, at most max
+ * entries. Returns the number of entries.
+ */
+int
+cppcd_eval(const struct cppcd_conf *conf, struct cppcd_state *st,
+	   struct amdcppc *h, struct amd_cppc_set *set, int max)
+{
+	static const struct amd_cppc_rule none = {
+		.epp = -1, .min_perf = -1, .max_perf = -1, .boost = -1,
+	};
+	struct amd_cppc_rule_input in;
+	const struct amd_cppc_snap *s;
+	const struct amd_cppc_rule *r;
+	struct cppcd_cpu *c;
+	int		i, idx, n;
+
+	n = 0;
+	for (i = 0; i < st->ncpus; i++) {
+		c = &st->cpus[i];
+		if ((s = amdcppc_find(h, c->cpu)) == NULL)
+			continue;	/* detached */
+
+		in.cpu = c->cpu;
+		in.util = c->util;
+		in.temp = c->temp;
+		in.ac = st->ac;
+		in.now_ms = st->now_ms;
+		idx = amd_cppc_rules_select(&conf->rules, &in, &c->hold);
+		if (idx != c->rule) {
+			if (cppcd_verbose)
+				cppcd_log(LOG_DEBUG, "cpu %d: rule %d -> %d",
+					  c->cpu, c->rule, idx);
+			c->rule = idx;
+		}
+		r = idx >= 0 ? &conf->rules.rules[idx] : &none;
+
+		if (conf->mode >= 0)
+			cppcd_emit(set, &n, max, c->cpu, AMD_CPPC_SET_MODE,
+				   conf->mode, s->mode);
+		cppcd_emit(set, &n, max, c->cpu, AMD_CPPC_SET_EPP,
+			   cppcd_pick(r->epp, conf->epp, c->base_epp), s->epp);
+		cppcd_emit(set, &n, max, c->cpu, AMD_CPPC_SET_BOOST,
+			   cppcd_pick(r->boost, conf->boost, c->base_boost),
+			   s->boost);
+		cppcd_emit(set, &n, max, c->cpu, AMD_CPPC_SET_MIN_PERF,
+			   cppcd_pick(r->min_perf, conf->min_perf, c->base_min),
+			   s->floor_perf);
+		cppcd_emit(set, &n, max, c->cpu, AMD_CPPC_SET_MAX_PERF,
+			   cppcd_pick(r->max_perf, conf->max_perf, c->base_max),
+			   s->ceil_perf);
+	}
+	return (n);
+}
+
+/*
+ * Changes that put back the settings found at startup.
+ */
+int
+cppcd_restore(struct cppcd_state *st, struct amdcppc *h,
+	      struct amd_cppc_set *set, int max)
+{
+	const struct amd_cppc_snap *s;
+	struct cppcd_cpu *c;
+	int		i, n;
+
+	n = 0;
+	for (i = 0; i < st->ncpus; i++) {
+		c = &st->cpus[i];
+		if ((s = amdcppc_find(h, c->cpu)) == NULL)
+			continue;
+		cppcd_emit(set, &n, max, c->cpu, AMD_CPPC_SET_MODE,
+			   c->base_mode, s->mode);
+		cppcd_emit(set, &n, max, c->cpu, AMD_CPPC_SET_EPP,
+			   c->base_epp, s->epp);
+		cppcd_emit(set, &n, max, c->cpu, AMD_CPPC_SET_BOOST,
+			   c->base_boost, s->boost);
+		cppcd_emit(set, &n, max, c->cpu, AMD_CPPC_SET_MIN_PERF,
+			   c->base_min, s->floor_perf);
+		cppcd_emit(set, &n, max, c->cpu, AMD_CPPC_SET_MAX_PERF,
+			   c->base_max, s->ceil_perf);
+	}
+	return (n);
+}
+
+/*
+ * True if no CPU was busy over the last interval.
+ */
+bool
+cppcd_idle(const struct cppcd_conf *conf, const struct cppcd_state *st)
+{
+	int		i;
+
+	for (i = 0; i < st->ncpus; i++)
+		if (st->cpus[i].util >= conf->idle_util)
+			return (false);
+	return (true);
+}
@@ -0,0 +1,235 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Simulated driver. A script sets the inputs step by step and every step
+ * runs a policy pass against the libamdcppc memory backend, whose state
+ * starts at the driver's defaults. Changes are logged to stdout, so a
+ * script and its output form a test case that runs on any system:
+ *
+ *	cpus 4			CPUs to simulate, must come first
+ *	cpuset 2 0 1		members of cpuset 2
+ *	at 0 util=5 ac=1	at 0 ms, all CPUs 5% busy, on AC
+ *	at 250 util=90,90,5,5	per-CPU utilization
+ *	at 500 temp=95 ac=0	temperature of all CPUs, on battery
+ *	reload			read the configuration file again
+ *
+ * Time only moves with the at lines; the sampling intervals of the
+ * configuration are not simulated.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "cppcd.h"
+
+#define CPPCD_SIM_CPUSETS	16
+
+struct cppcd_sim_cpuset {
+	int		id;
+	cpuset_t	mask;
+};
+
+static struct cppcd_sim_cpuset cppcd_sim_sets[CPPCD_SIM_CPUSETS];
+static int	cppcd_sim_nsets;
+
+static int
+cppcd_sim_cpuset(int id, cpuset_t *mask)
+{
+	int		i;
+
+	for (i = 0; i < cppcd_sim_nsets; i++)
+		if (cppcd_sim_sets[i].id == id) {
+			*mask = cppcd_sim_sets[i].mask;
+			return (0);
+		}
+	errno = ESRCH;
+	return (-1);
+}
+
+static struct amdcppc *
+cppcd_sim_open(int n)
+{
+	struct amd_cppc_snap *snap;
+	struct amdcppc	*h;
+	int		i;
+
+	if ((snap = calloc(n, sizeof(*snap))) == NULL)
+		return (NULL);
+	for (i = 0; i < n; i++) {
+		snap[i].cpu = i;
+		snap[i].highest_perf = 228;
+		snap[i].nominal_perf = 166;
+		snap[i].lowest_nonlinear_perf = 80;
+		snap[i].lowest_perf = 31;
+		snap[i].base_mhz = 4200;
+		snap[i].epp = 50;
+		snap[i].mode = AMD_CPPC_MODE_CAP;
+		snap[i].boost = 1;
+		snap[i].domain = -1;
+		snap[i].rule = -1;
+		snap[i].set_policy = -1;
+		snap[i].energy_esu = -1;
+	}
+	h = amdcppc_open_memory(snap, n);
+	free(snap);
+	return (h);
+}
+
+/*
+ * Apply "key=v" or "key=v,v,..." to every CPU, one value per CPU.
+ */
+static int
+cppcd_sim_inputs(struct cppcd_state *st, char *arg)
+{
+	struct cppcd_cpu *c;
+	char		*key, *val, *end;
+	long		v;
+	int		i;
+
+	if ((val = strchr(arg, '=')) == NULL)
+		return (-1);
+	key = arg;
+	*val++ = '\0';
+	if (strcmp(key, "ac") == 0) {
+		st->ac = strtol(val, &end, 10) != 0;
+		return (*end == '\0' ? 0 : -1);
+	}
+	for (i = 0; i < st->ncpus; i++) {
+		c = &st->cpus[i];
+		v = strtol(val, &end, 10);
+		if (end == val)
+			return (-1);
+		if (strcmp(key, "util") == 0)
+			c->util = v;
+		else if (strcmp(key, "temp") == 0)
+			c->temp = v;
+		else
+			return (-1);
+		if (*end == ',')
+			val = end + 1;	/* else the last value repeats */
+	}
+	return (0);
+}
+
+int
+cppcd_sim(const char *script, const char *confpath, struct cppcd_conf *conf)
+{
+	struct cppcd_state st;
+	struct amd_cppc_set *set;
+	struct amdcppc	*h;
+	FILE		*fp;
+	char		line[512], errbuf[128], *arg, *p, *word;
+	long		v;
+	int		cpu, lineno, n;
+
+	if ((fp = fopen(script, "r")) == NULL)
+		err(1, "%s", script);
+	h = NULL;
+	set = NULL;
+	memset(&st, 0, sizeof(st));
+	lineno = 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		p = line;
+		if ((word = strsep(&p, " \t\n")) == NULL || *word == '\0')
+			continue;
+
+		if (strcmp(word, "cpus") == 0) {
+			if (h != NULL || p == NULL ||
+			    (v = strtol(p, NULL, 10)) < 1 || v > CPU_SETSIZE)
+				errx(1, "%s:%d: bad cpus", script, lineno);
+			if ((h = cppcd_sim_open(v)) == NULL ||
+			    cppcd_state_init(&st, h) != 0 ||
+			    (set = calloc(v * AMD_CPPC_SET_COUNT,
+			    sizeof(*set))) == NULL)
+				err(1, "simulated driver");
+			continue;
+		}
+		if (h == NULL)
+			errx(1, "%s:%d: cpus must come first", script, lineno);
+
+		if (strcmp(word, "cpuset") == 0) {
+			if (cppcd_sim_nsets == CPPCD_SIM_CPUSETS || p == NULL)
+				errx(1, "%s:%d: bad cpuset", script, lineno);
+			cppcd_sim_sets[cppcd_sim_nsets].id = strtol(p, &p, 10);
+			CPU_ZERO(&cppcd_sim_sets[cppcd_sim_nsets].mask);
+			while ((arg = strsep(&p, " \t\n")) != NULL) {
+				if (*arg == '\0')
+					continue;
+				cpu = strtol(arg, NULL, 10);
+				if (cpu < 0 || cpu >= CPU_SETSIZE)
+					errx(1, "%s:%d: bad cpu", script,
+					     lineno);
+				CPU_SET(cpu, &cppcd_sim_sets[cppcd_sim_nsets].
+				    mask);
+			}
+			cppcd_sim_nsets++;
+		} else if (strcmp(word, "reload") == 0) {
+			if (cppcd_conf_load(confpath, conf, errbuf,
+					    sizeof(errbuf)) != 0)
+				cppcd_log(LOG_ERR, "reload: %s", errbuf);
+			else {
+				cppcd_log(LOG_INFO, "reloaded %s", confpath);
+				cppcd_state_reset(&st);
+			}
+		} else if (strcmp(word, "at") == 0) {
+			if (p == NULL || (v = strtol(p, &p, 10)) < 0 ||
+			    (uint64_t)v < st.now_ms)
+				errx(1, "%s:%d: bad time", script, lineno);
+			st.now_ms = v;
+			while ((arg = strsep(&p, " \t\n")) != NULL) {
+				if (*arg == '\0')
+					continue;
+				if (cppcd_sim_inputs(&st, arg) != 0)
+					errx(1, "%s:%d: bad input", script,
+					     lineno);
+			}
+			cppcd_conf_resolve(conf, cppcd_sim_cpuset);
+			n = cppcd_eval(conf, &st, h, set,
+				       st.ncpus * AMD_CPPC_SET_COUNT);
+			if (n > 0 && cppcd_apply(h, set, n, st.now_ms) != 0)
+				cppcd_log(LOG_ERR, "apply: %s",
+					  strerror(errno));
+		} else
+			errx(1, "%s:%d: unknown command '%s'", script, lineno,
+			     word);
+	}
+	fclose(fp);
+	free(set);
+	cppcd_state_fini(&st);
+	amdcppc_close(h);
+	return (0);
+}
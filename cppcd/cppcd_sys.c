@@ -0,0 +1,219 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * System inputs: per-CPU utilization from kern.cp_times, AC state from
+ * hw.acpi.acline, temperatures from dev.cpu.N.temperature and ACAD and
+ * thermal zone notifications from the devd(8) seqpacket socket.
+ */
+
+#ifdef __FreeBSD__
+
+#include <sys/param.h>
+#include <sys/cpuset.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cppcd.h"
+
+#define CPPCD_DEVD_PIPE		"/var/run/devd.seqpacket.pipe"
+
+static int	cppcd_sys_cp_mib[2];
+static int	cppcd_sys_ac_mib[3];
+static bool	cppcd_sys_has_ac;
+static long	*cppcd_sys_cp_prev;
+static long	*cppcd_sys_cp_cur;
+static size_t	cppcd_sys_cp_len;
+static int	cppcd_sys_devd = -1;
+
+int
+cppcd_sys_open(void)
+{
+	size_t		len;
+
+	len = nitems(cppcd_sys_cp_mib);
+	if (sysctlnametomib("kern.cp_times", cppcd_sys_cp_mib, &len) != 0)
+		return (-1);
+	if (sysctl(cppcd_sys_cp_mib, 2, NULL, &cppcd_sys_cp_len, NULL,
+		   0) != 0)
+		return (-1);
+	cppcd_sys_cp_prev = calloc(1, cppcd_sys_cp_len);
+	cppcd_sys_cp_cur = calloc(1, cppcd_sys_cp_len);
+	if (cppcd_sys_cp_prev == NULL || cppcd_sys_cp_cur == NULL)
+		return (-1);
+	if (sysctl(cppcd_sys_cp_mib, 2, cppcd_sys_cp_prev, &cppcd_sys_cp_len,
+		   NULL, 0) != 0)
+		return (-1);
+
+	len = nitems(cppcd_sys_ac_mib);
+	cppcd_sys_has_ac = sysctlnametomib("hw.acpi.acline", cppcd_sys_ac_mib,
+					   &len) == 0;
+	(void)cppcd_sys_event_fd();	/* devd may start later */
+	return (0);
+}
+
+void
+cppcd_sys_close(void)
+{
+
+	if (cppcd_sys_devd >= 0)
+		close(cppcd_sys_devd);
+	cppcd_sys_devd = -1;
+	free(cppcd_sys_cp_prev);
+	free(cppcd_sys_cp_cur);
+	cppcd_sys_cp_prev = cppcd_sys_cp_cur = NULL;
+}
+
+static int
+cppcd_sys_temp(int cpu)
+{
+	char		name[32];
+	size_t		len;
+	int		val;
+
+	snprintf(name, sizeof(name), "dev.cpu.%d.temperature", cpu);
+	len = sizeof(val);
+	if (sysctlbyname(name, &val, &len, NULL, 0) != 0)
+		return (AMD_CPPC_TEMP_UNKNOWN);
+	return ((val - 2731) / 10);	/* deci-Kelvin */
+}
+
+/*
+ * Fill in utilization since the last call, the AC state and, if asked
+ * for, temperatures.
+ */
+int
+cppcd_sys_sample(struct cppcd_state *st, bool temps)
+{
+	struct cppcd_cpu *c;
+	long		busy, total, *p, *q, *t;
+	size_t		len;
+	int		ac, i, s;
+
+	len = cppcd_sys_cp_len;
+	if (sysctl(cppcd_sys_cp_mib, 2, cppcd_sys_cp_cur, &len, NULL, 0) != 0)
+		return (-1);
+	for (i = 0; i < st->ncpus; i++) {
+		c = &st->cpus[i];
+		if ((size_t)(c->cpu + 1) * CPUSTATES * sizeof(long) > len)
+			continue;
+		p = &cppcd_sys_cp_cur[c->cpu * CPUSTATES];
+		q = &cppcd_sys_cp_prev[c->cpu * CPUSTATES];
+		total = 0;
+		for (s = 0; s < CPUSTATES; s++)
+			total += p[s] - q[s];
+		busy = total - (p[CP_IDLE] - q[CP_IDLE]);
+		c->util = total > 0 ? busy * 100 / total : 0;
+		if (temps)
+			c->temp = cppcd_sys_temp(c->cpu);
+	}
+	t = cppcd_sys_cp_prev;
+	cppcd_sys_cp_prev = cppcd_sys_cp_cur;
+	cppcd_sys_cp_cur = t;
+
+	len = sizeof(ac);
+	if (cppcd_sys_has_ac && sysctl(cppcd_sys_ac_mib, 3, &ac, &len, NULL,
+				       0) == 0)
+		st->ac = ac != 0;
+	else
+		st->ac = 1;
+	return (0);
+}
+
+int
+cppcd_sys_cpuset(int id, cpuset_t *mask)
+{
+
+	return (cpuset_getaffinity(CPU_LEVEL_CPUSET, CPU_WHICH_CPUSET, id,
+				   sizeof(*mask), mask));
+}
+
+int
+cppcd_sys_event_fd(void)
+{
+	struct sockaddr_un sun;
+	int		fd;
+
+	if (cppcd_sys_devd >= 0)
+		return (cppcd_sys_devd);
+	fd = socket(PF_LOCAL, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		    0);
+	if (fd < 0)
+		return (-1);
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_LOCAL;
+	strlcpy(sun.sun_path, CPPCD_DEVD_PIPE, sizeof(sun.sun_path));
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+		close(fd);
+		return (-1);
+	}
+	cppcd_sys_devd = fd;
+	return (fd);
+}
+
+/*
+ * Drain pending devd notifications and return the CPPCD_EV_* bits they
+ * call for.
+ */
+int
+cppcd_sys_event_read(void)
+{
+	char		line[512];
+	ssize_t		n;
+	int		ev;
+
+	ev = 0;
+	while (cppcd_sys_devd >= 0) {
+		n = recv(cppcd_sys_devd, line, sizeof(line) - 1, 0);
+		if (n < 0)
+			break;
+		if (n == 0) {
+			/* devd went away; reconnect on a later pass. */
+			close(cppcd_sys_devd);
+			cppcd_sys_devd = -1;
+			break;
+		}
+		line[n] = '\0';
+		if (strncmp(line, "!system=ACPI ", 13) != 0)
+			continue;
+		if (strstr(line, " subsystem=ACAD") != NULL)
+			ev |= CPPCD_EV_AC;
+		else if (strstr(line, " subsystem=Thermal") != NULL)
+			ev |= CPPCD_EV_THERMAL;
+	}
+	return (ev);
+}
+
+#endif /* __FreeBSD__ */
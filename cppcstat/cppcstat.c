@@ -0,0 +1,588 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * cppcstat: live per-CPU view of amd_cppc(4) and metrics exporter.
+ *
+ * Each refresh reads the state of every CPU with one snapshot call and
+ * derives rates from the previous one: delivered clock from APERF/MPERF,
+ * busy share from MPERF/TSC and core power from the RAPL energy counter.
+ *
+ * Snapshots can be recorded to a file (-w) and played back (-r) in place
+ * of the driver, so the views can be checked against captured data on any
+ * system. A recording is the magic string, then one frame per refresh:
+ * a 64-bit timestamp in ns, a 32-bit record count and the records.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "amdcppc.h"
+
+#define CPPCSTAT_MAGIC		"CPPCSNAP2\n"
+#define CPPCSTAT_MAXCPU		4096
+
+#ifndef __unused
+#define __unused	__attribute__((__unused__))
+#endif
+
+/* Rates of one CPU between two snapshots */
+struct cppcstat_rate {
+	int		valid;
+	double		mhz;		/* delivered */
+	double		busy;		/* 0-1 */
+	double		watts;		/* core, -1 = unknown */
+};
+
+struct cppcstat_frame {
+	uint64_t	ns;
+	int		n;
+	struct amd_cppc_snap *cpus;
+};
+
+/* Replay backend state */
+struct cppcstat_replay {
+	FILE		*fp;
+	uint64_t	ns;		/* time of the frame handed out last */
+	struct cppcstat_frame next;
+	int		eof;
+};
+
+static volatile sig_atomic_t cppcstat_quit;
+static struct cppcstat_replay *cppcstat_replay;
+
+static void
+cppcstat_sig(int sig __unused)
+{
+
+	cppcstat_quit = 1;
+}
+
+static uint64_t
+cppcstat_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static int
+cppcstat_frame_read(FILE *fp, struct cppcstat_frame *f)
+{
+	uint32_t	n;
+
+	if (fread(&f->ns, sizeof(f->ns), 1, fp) != 1 ||
+	    fread(&n, sizeof(n), 1, fp) != 1 || n > CPPCSTAT_MAXCPU)
+		return (-1);
+	free(f->cpus);
+	if ((f->cpus = calloc(n + 1, sizeof(*f->cpus))) == NULL)
+		return (-1);
+	if (fread(f->cpus, sizeof(*f->cpus), n, fp) != n)
+		return (-1);
+	f->n = n;
+	return (0);
+}
+
+static int
+cppcstat_frame_write(FILE *fp, struct amdcppc *h, uint64_t ns)
+{
+	struct amd_cppc_snap s;
+	uint32_t	n;
+	int		i;
+
+	n = amdcppc_ncpus(h);
+	if (fwrite(&ns, sizeof(ns), 1, fp) != 1 ||
+	    fwrite(&n, sizeof(n), 1, fp) != 1)
+		return (-1);
+	for (i = 0; i < (int)n; i++) {
+		s = *amdcppc_cpu(h, i);
+		s.snap_size = sizeof(s);
+		if (fwrite(&s, sizeof(s), 1, fp) != 1)
+			return (-1);
+	}
+	return (fflush(fp));
+}
+
+/*
+ * Replay backend: each data read hands out the next recorded frame.
+ */
+static int
+cppcstat_replay_snapshot(void *ctx, struct amd_cppc_snap *snap, size_t *len)
+{
+	struct cppcstat_replay *r;
+	size_t		need;
+
+	r = ctx;
+	if (r->eof) {
+		errno = EIO;
+		return (-1);
+	}
+	need = r->next.n * sizeof(*snap);
+	if (snap != NULL) {
+		if (*len < need) {
+			errno = ENOMEM;
+			return (-1);
+		}
+		memcpy(snap, r->next.cpus, need);
+		r->ns = r->next.ns;
+		if (cppcstat_frame_read(r->fp, &r->next) != 0)
+			r->eof = 1;
+	}
+	*len = need;
+	return (0);
+}
+
+static const struct amdcppc_backend cppcstat_replay_backend = {
+	.snapshot = cppcstat_replay_snapshot,
+};
+
+static struct amdcppc *
+cppcstat_open_replay(const char *path)
+{
+	struct cppcstat_replay *r;
+	char		magic[sizeof(CPPCSTAT_MAGIC) - 1];
+
+	if ((r = calloc(1, sizeof(*r))) == NULL)
+		err(1, "calloc");
+	if ((r->fp = fopen(path, "r")) == NULL)
+		err(1, "%s", path);
+	if (fread(magic, sizeof(magic), 1, r->fp) != 1 ||
+	    memcmp(magic, CPPCSTAT_MAGIC, sizeof(magic)) != 0)
+		errx(1, "%s: not a cppcstat recording", path);
+	if (cppcstat_frame_read(r->fp, &r->next) != 0)
+		errx(1, "%s: no frames", path);
+	cppcstat_replay = r;
+	return (amdcppc_open_backend(&cppcstat_replay_backend, r));
+}
+
+/*
+ * Refresh the handle and note when: the recorded time on replay, the
+ * clock otherwise.
+ */
+static int
+cppcstat_refresh(struct amdcppc *h, uint64_t *ns)
+{
+
+	if (amdcppc_refresh(h) != 0)
+		return (-1);
+	*ns = cppcstat_replay != NULL ? cppcstat_replay->ns : cppcstat_now();
+	return (0);
+}
+
+static void
+cppcstat_frame_save(struct amdcppc *h, uint64_t ns, struct cppcstat_frame *f)
+{
+	int		i;
+
+	free(f->cpus);
+	f->n = amdcppc_ncpus(h);
+	if ((f->cpus = calloc(f->n + 1, sizeof(*f->cpus))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < f->n; i++)
+		f->cpus[i] = *amdcppc_cpu(h, i);
+	f->ns = ns;
+}
+
+static void
+cppcstat_rate(const struct cppcstat_frame *prev, const struct amd_cppc_snap *c,
+	      uint64_t ns, struct cppcstat_rate *r)
+{
+	const struct amd_cppc_snap *p;
+	uint64_t	da, dm, dt;
+	double		sec;
+	int		i;
+
+	memset(r, 0, sizeof(*r));
+	r->watts = -1;
+	p = NULL;
+	for (i = 0; prev != NULL && i < prev->n; i++)
+		if (prev->cpus[i].cpu == c->cpu)
+			p = &prev->cpus[i];
+	if (p == NULL || ns <= prev->ns || c->tsc == 0)
+		return;	/* first frame or no counters in the snapshot */
+
+	da = c->aperf - p->aperf;
+	dm = c->mperf - p->mperf;
+	dt = c->tsc - p->tsc;
+	sec = (double)(ns - prev->ns) / 1e9;
+	r->valid = 1;
+	r->mhz = dm != 0 ? (double)c->base_mhz * da / dm : 0;
+	r->busy = dt != 0 ? (double)dm / dt : 0;
+	if (r->busy > 1)
+		r->busy = 1;
+	if (c->energy_esu >= 0 && p->energy_esu >= 0)
+		r->watts = (double)(uint32_t)(c->energy - p->energy) /
+		    (double)(1ULL << c->energy_esu) / sec;
+}
+
+static int
+cppcstat_perf_mhz(const struct amd_cppc_snap *c, int perf)
+{
+
+	if (c->nominal_perf == 0)
+		return (0);
+	return (c->base_mhz * perf / c->nominal_perf);
+}
+
+/*
+ * Requested clocks as the driver maps them, calibrated or not. Snapshots
+ * older than version 2 and the per-CPU interface lack them; fall back to
+ * the linear map there.
+ */
+static int
+cppcstat_min_mhz(const struct amd_cppc_snap *c)
+{
+
+	if (c->snap_version < 2)
+		return (cppcstat_perf_mhz(c, c->min_perf));
+	return (c->min_mhz);
+}
+
+static int
+cppcstat_req_mhz(const struct amd_cppc_snap *c)
+{
+
+	if (c->snap_version < 2)
+		return (cppcstat_perf_mhz(c, c->des_perf != 0 ? c->des_perf :
+		    c->max_perf));
+	return (c->des_perf != 0 ? c->des_mhz : c->max_mhz);
+}
+
+static const char *
+cppcstat_flags(const struct amd_cppc_snap *c, char *buf)
+{
+	char		*p;
+
+	p = buf;
+	if (c->flags & AMD_CPPC_SNAP_F_CAPPED)
+		*p++ = 'C';
+	if (c->flags & AMD_CPPC_SNAP_F_PARKED)
+		*p++ = 'P';
+	if (c->flags & AMD_CPPC_SNAP_F_PHASE)
+		*p++ = 'W';
+	if (c->flags & AMD_CPPC_SNAP_F_OWNER)
+		*p++ = 'L';
+	if (p == buf)
+		*p++ = '-';
+	*p = '\0';
+	return (buf);
+}
+
+static void
+cppcstat_table(struct amdcppc *h, const struct cppcstat_frame *prev,
+	       uint64_t ns, int screen)
+{
+	const struct amd_cppc_snap *c;
+	struct cppcstat_rate r;
+	double		sum;
+	char		flags[8], mhz[16], busy[8], watts[16];
+	int		i, nvalid;
+
+	if (screen)
+		printf("\033[H\033[J");
+	sum = 0;
+	nvalid = 0;
+	for (i = 0; i < amdcppc_ncpus(h); i++) {
+		cppcstat_rate(prev, amdcppc_cpu(h, i), ns, &r);
+		if (r.valid) {
+			sum += r.mhz;
+			nvalid++;
+		}
+	}
+	printf("amd_cppc: %d CPUs, %s interface, %.0f MHz average delivered"
+	       "\n\n", amdcppc_ncpus(h), amdcppc_bulk(h) ? "snapshot" :
+	       "per-CPU", nvalid != 0 ? sum / nvalid : 0.0);
+	printf("%4s %-10s %3s %5s %8s %8s %-8s %8s %5s %7s %5s\n", "CPU",
+	       "MODE", "EPP", "BOOST", "MIN_MHZ", "REQ_MHZ", "LIMIT", "DELIV",
+	       "BUSY", "CORE_W", "FLAGS");
+	for (i = 0; i < amdcppc_ncpus(h); i++) {
+		c = amdcppc_cpu(h, i);
+		cppcstat_rate(prev, c, ns, &r);
+		snprintf(mhz, sizeof(mhz), r.valid ? "%.0f" : "-", r.mhz);
+		snprintf(busy, sizeof(busy), r.valid ? "%.0f%%" : "-",
+			 r.busy * 100);
+		snprintf(watts, sizeof(watts), r.watts >= 0 ? "%.2f" : "-",
+			 r.watts);
+		printf("%4d %-10s %3d %5s %8d %8d %-8s %8s %5s %7s %5s\n",
+		       c->cpu, amdcppc_mode_name(c->mode), c->epp,
+		       c->boost ? "on" : "off",
+		       cppcstat_min_mhz(c), cppcstat_req_mhz(c),
+		       amdcppc_source_name(c->bind[AMD_CPPC_BIND_MAX]), mhz,
+		       busy, watts, cppcstat_flags(c, flags));
+	}
+	if (screen)
+		printf("\nLIMIT: source deciding max_perf\n"
+		       "flags: C boost capped, P CCD parked, W boost window, "
+		       "L lock owner boost\n");
+	fflush(stdout);
+}
+
+static void
+cppcstat_metric_head(const char *name, const char *type, const char *help)
+{
+
+	printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/*
+ * Prometheus text exposition format.
+ */
+static void
+cppcstat_metrics(struct amdcppc *h, const struct cppcstat_frame *prev,
+		 uint64_t ns)
+{
+	static const struct {
+		uint32_t	flag;
+		const char	*name;
+	} reasons[] = {
+		{ AMD_CPPC_SNAP_F_CAPPED, "boost_budget" },
+		{ AMD_CPPC_SNAP_F_PARKED, "ccd_parked" },
+		{ AMD_CPPC_SNAP_F_PHASE, "boost_window" },
+		{ AMD_CPPC_SNAP_F_OWNER, "lock_owner" },
+	};
+	static const char *const fields[AMD_CPPC_BIND_COUNT] = {
+		[AMD_CPPC_BIND_MAX] = "max_perf",
+		[AMD_CPPC_BIND_MIN] = "min_perf",
+		[AMD_CPPC_BIND_DES] = "des_perf",
+		[AMD_CPPC_BIND_EPP] = "epp",
+	};
+	const struct amd_cppc_snap *c;
+	struct cppcstat_rate r;
+	int		i, j, n;
+
+	n = amdcppc_ncpus(h);
+
+	cppcstat_metric_head("amd_cppc_epp", "gauge",
+			     "Energy performance preference, 0-100");
+	for (i = 0; i < n; i++) {
+		c = amdcppc_cpu(h, i);
+		printf("amd_cppc_epp{cpu=\"%d\"} %d\n", c->cpu, c->epp);
+	}
+	cppcstat_metric_head("amd_cppc_mode", "gauge",
+			     "Request mode, 1 for the mode in use");
+	for (i = 0; i < n; i++) {
+		c = amdcppc_cpu(h, i);
+		printf("amd_cppc_mode{cpu=\"%d\",mode=\"%s\"} 1\n", c->cpu,
+		       amdcppc_mode_name(c->mode));
+	}
+	cppcstat_metric_head("amd_cppc_boost", "gauge",
+			     "1 if performance above nominal is allowed");
+	for (i = 0; i < n; i++) {
+		c = amdcppc_cpu(h, i);
+		printf("amd_cppc_boost{cpu=\"%d\"} %d\n", c->cpu, c->boost);
+	}
+	cppcstat_metric_head("amd_cppc_min_mhz", "gauge",
+			     "Requested minimum clock in MHz");
+	for (i = 0; i < n; i++) {
+		c = amdcppc_cpu(h, i);
+		printf("amd_cppc_min_mhz{cpu=\"%d\"} %d\n", c->cpu,
+		       cppcstat_min_mhz(c));
+	}
+	cppcstat_metric_head("amd_cppc_requested_mhz", "gauge",
+			     "Requested clock in MHz, desired or maximum");
+	for (i = 0; i < n; i++) {
+		c = amdcppc_cpu(h, i);
+		printf("amd_cppc_requested_mhz{cpu=\"%d\"} %d\n", c->cpu,
+		       cppcstat_req_mhz(c));
+	}
+	cppcstat_metric_head("amd_cppc_delivered_mhz", "gauge",
+			     "Average clock while not idle over the interval");
+	for (i = 0; i < n; i++) {
+		c = amdcppc_cpu(h, i);
+		cppcstat_rate(prev, c, ns, &r);
+		if (r.valid)
+			printf("amd_cppc_delivered_mhz{cpu=\"%d\"} %.0f\n",
+			       c->cpu, r.mhz);
+	}
+	cppcstat_metric_head("amd_cppc_busy_ratio", "gauge",
+			     "Share of the interval not idle");
+	for (i = 0; i < n; i++) {
+		c = amdcppc_cpu(h, i);
+		cppcstat_rate(prev, c, ns, &r);
+		if (r.valid)
+			printf("amd_cppc_busy_ratio{cpu=\"%d\"} %.3f\n",
+			       c->cpu, r.busy);
+	}
+	cppcstat_metric_head("amd_cppc_core_power_watts", "gauge",
+	    "Core power over the interval; SMT siblings report the same core");
+	for (i = 0; i < n; i++) {
+		c = amdcppc_cpu(h, i);
+		cppcstat_rate(prev, c, ns, &r);
+		if (r.watts >= 0)
+			printf("amd_cppc_core_power_watts{cpu=\"%d\"} %.3f\n",
+			       c->cpu, r.watts);
+	}
+	cppcstat_metric_head("amd_cppc_throttled", "gauge",
+			     "1 while the request is limited for the reason");
+	for (i = 0; i < n; i++) {
+		c = amdcppc_cpu(h, i);
+		for (j = 0; j < (int)(sizeof(reasons) / sizeof(reasons[0]));
+		     j++)
+			printf("amd_cppc_throttled{cpu=\"%d\",reason=\"%s\"} "
+			       "%d\n", c->cpu, reasons[j].name,
+			       (c->flags & reasons[j].flag) != 0);
+	}
+	cppcstat_metric_head("amd_cppc_binding", "gauge",
+			     "Source deciding each request field, always 1");
+	for (i = 0; i < n; i++) {
+		c = amdcppc_cpu(h, i);
+		for (j = 0; j < AMD_CPPC_BIND_COUNT; j++)
+			printf("amd_cppc_binding{cpu=\"%d\",field=\"%s\","
+			       "source=\"%s\"} 1\n", c->cpu, fields[j],
+			       amdcppc_source_name(c->bind[j]));
+	}
+	cppcstat_metric_head("amd_cppc_tamper_total", "counter",
+			     "Times firmware rewrote the request");
+	for (i = 0; i < n; i++) {
+		c = amdcppc_cpu(h, i);
+		printf("amd_cppc_tamper_total{cpu=\"%d\"} %" PRIu64 "\n",
+		       c->cpu, c->tamper_count);
+	}
+	fflush(stdout);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: cppcstat [-1m] [-c count] [-i ms] [-r file] [-w file]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct cppcstat_frame prev;
+	struct amdcppc	*h;
+	FILE		*rec;
+	const char	*rpath, *wpath;
+	uint64_t	ns;
+	long		count, interval;
+	int		ch, metrics, once, screen;
+
+	count = -1;
+	interval = 100;
+	metrics = once = 0;
+	rpath = wpath = NULL;
+	while ((ch = getopt(argc, argv, "1c:i:mr:w:")) != -1) {
+		switch (ch) {
+		case '1':
+			once = 1;
+			break;
+		case 'c':
+			count = strtol(optarg, NULL, 10);
+			break;
+		case 'i':
+			interval = strtol(optarg, NULL, 10);
+			if (interval < 0)
+				usage();
+			break;
+		case 'm':
+			metrics = 1;
+			break;
+		case 'r':
+			rpath = optarg;
+			break;
+		case 'w':
+			wpath = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	/* Rates need two snapshots: one-shot output waits one interval. */
+	if ((once || metrics) && count < 0)
+		count = 2;
+	screen = !once && !metrics && isatty(STDOUT_FILENO);
+
+	if (rpath != NULL)
+		h = cppcstat_open_replay(rpath);
+	else {
+#ifdef __FreeBSD__
+		h = amdcppc_open();
+#else
+		errno = ENOTSUP;
+		h = NULL;
+#endif
+	}
+	if (h == NULL)
+		err(1, "amd_cppc");
+
+	rec = NULL;
+	if (wpath != NULL) {
+		if ((rec = fopen(wpath, "w")) == NULL)
+			err(1, "%s", wpath);
+		fputs(CPPCSTAT_MAGIC, rec);
+	}
+
+	signal(SIGINT, cppcstat_sig);
+	signal(SIGTERM, cppcstat_sig);
+	memset(&prev, 0, sizeof(prev));
+	ns = cppcstat_replay != NULL ? cppcstat_replay->ns : cppcstat_now();
+	cppcstat_frame_save(h, ns, &prev);
+	if (rec != NULL && cppcstat_frame_write(rec, h, ns) != 0)
+		err(1, "%s", wpath);
+
+	while (!cppcstat_quit && count != 1) {
+		if (interval > 0 && (cppcstat_replay == NULL || screen))
+			usleep(interval * 1000);
+		if (count > 0)
+			count--;
+		if (cppcstat_refresh(h, &ns) != 0) {
+			if (cppcstat_replay != NULL && cppcstat_replay->eof)
+				break;
+			err(1, "refresh");
+		}
+		if (rec != NULL && cppcstat_frame_write(rec, h, ns) != 0)
+			err(1, "%s", wpath);
+		if (!metrics && (!once || count == 1))
+			cppcstat_table(h, &prev, ns, screen);
+		else if (metrics && count == 1)
+			cppcstat_metrics(h, &prev, ns);
+		cppcstat_frame_save(h, ns, &prev);
+	}
+
+	if (rec != NULL)
+		fclose(rec);
+	amdcppc_close(h);
+	return (0);
+}
@@ -0,0 +1,533 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Backend independent part of libamdcppc: the state cache, the write
+ * queue and event parsing.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "amdcppc.h"
+#include "amdcppc_impl.h"
+
+#define AMDCPPC_MAXCPU		4096
+
+static const char *amdcppc_modes[AMD_CPPC_MODE_COUNT] = {
+	[AMD_CPPC_MODE_CAP] = "cap",
+	[AMD_CPPC_MODE_AUTONOMOUS] = "autonomous",
+	[AMD_CPPC_MODE_GUIDED] = "guided",
+};
+
+/* Per-CPU knob written for each AMD_CPPC_SET_* field */
+static const int amdcppc_set_knob[AMD_CPPC_SET_COUNT] = {
+	[AMD_CPPC_SET_EPP] = AMDCPPC_KNOB_EPP,
+	[AMD_CPPC_SET_MODE] = AMDCPPC_KNOB_MODE,
+	[AMD_CPPC_SET_BOOST] = AMDCPPC_KNOB_BOOST,
+	[AMD_CPPC_SET_MIN_PERF] = AMDCPPC_KNOB_MIN_PERF,
+	[AMD_CPPC_SET_MAX_PERF] = AMDCPPC_KNOB_MAX_PERF,
+};
+
+const char *
+amdcppc_mode_name(int mode)
+{
+
+	if (mode < 0 || mode >= AMD_CPPC_MODE_COUNT)
+		return ("unknown");
+	return (amdcppc_modes[mode]);
+}
+
+/*
+ * Name of an AMD_CPPC_SRC_* request source, as in snapshot bind[].
+ */
+const char *
+amdcppc_source_name(int src)
+{
+	static const char *const names[AMD_CPPC_SRC_COUNT] =
+	    AMD_CPPC_SRC_NAMES;
+
+	if (src < 0 || src >= AMD_CPPC_SRC_COUNT)
+		return ("unknown");
+	return (names[src]);
+}
+
+int
+amdcppc_mode_parse(const char *name)
+{
+	int		i;
+
+	for (i = 0; i < AMD_CPPC_MODE_COUNT; i++)
+		if (strcasecmp(name, amdcppc_modes[i]) == 0)
+			return (i);
+	return (-1);
+}
+
+struct amdcppc *
+amdcppc_open_backend(const struct amdcppc_backend *be, void *ctx)
+{
+	struct amdcppc	*h;
+
+	if ((h = calloc(1, sizeof(*h))) == NULL)
+		return (NULL);
+	h->be = be;
+	h->ctx = ctx;
+	h->bulk = h->bulk_apply = 1;
+	if (amdcppc_refresh(h) != 0) {
+		h->be = NULL;		/* the caller still owns ctx */
+		amdcppc_close(h);
+		return (NULL);
+	}
+	return (h);
+}
+
+void
+amdcppc_close(struct amdcppc *h)
+{
+
+	if (h == NULL)
+		return;
+	if (h->be != NULL && h->be->close != NULL)
+		h->be->close(h->ctx);
+	free(h->cpus);
+	free(h->queue);
+	free(h);
+}
+
+/*
+ * Read the state of every CPU in one call. Records are copied by their
+ * own size so that a newer driver with longer records still works.
+ */
+static int
+amdcppc_refresh_bulk(struct amdcppc *h)
+{
+	struct amd_cppc_snap *snap;
+	const char	*p, *end;
+	size_t		len, rsize;
+	int		n;
+
+	for (;;) {
+		if (h->be->snapshot(h->ctx, NULL, &len) != 0)
+			return (-1);
+		len += 4 * sizeof(*snap);	/* CPUs may attach meanwhile */
+		if ((snap = malloc(len)) == NULL)
+			return (-1);
+		if (h->be->snapshot(h->ctx, snap, &len) == 0)
+			break;
+		free(snap);
+		if (errno != ENOMEM)
+			return (-1);
+	}
+
+	free(h->cpus);
+	h->cpus = calloc(len / offsetof(struct amd_cppc_snap, highest_perf) +
+			 1, sizeof(*h->cpus));
+	if (h->cpus == NULL) {
+		free(snap);
+		h->ncpus = 0;
+		return (-1);
+	}
+	n = 0;
+	p = (const char *)snap;
+	end = p + len;
+	while (p + offsetof(struct amd_cppc_snap, cpu) <= end) {
+		rsize = ((const struct amd_cppc_snap *)(const void *)p)->
+		    snap_size;
+		if (rsize < offsetof(struct amd_cppc_snap, highest_perf) ||
+		    p + rsize > end)
+			break;
+		memcpy(&h->cpus[n], p, MIN(rsize, sizeof(*h->cpus)));
+		n++;
+		p += rsize;
+	}
+	h->ncpus = n;
+	free(snap);
+	return (0);
+}
+
+/*
+ * Read the state CPU by CPU from the per-CPU knobs.
+ */
+static int
+amdcppc_refresh_knobs(struct amdcppc *h)
+{
+	struct amd_cppc_snap *s;
+	uint64_t	v[AMDCPPC_KNOB_COUNT];
+	int		*list;
+	int		i, k, n;
+
+	if ((list = malloc(AMDCPPC_MAXCPU * sizeof(*list))) == NULL)
+		return (-1);
+	if ((n = h->be->cpus(h->ctx, list, AMDCPPC_MAXCPU)) < 0) {
+		free(list);
+		return (-1);
+	}
+	free(h->cpus);
+	if ((h->cpus = calloc(MAX(n, 1), sizeof(*h->cpus))) == NULL) {
+		h->ncpus = 0;
+		free(list);
+		return (-1);
+	}
+	h->ncpus = 0;
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < AMDCPPC_KNOB_COUNT; k++)
+			if (h->be->read(h->ctx, list[i], k, &v[k]) != 0)
+				break;
+		if (k < AMDCPPC_KNOB_COUNT)
+			continue;	/* detached meanwhile */
+		s = &h->cpus[h->ncpus++];
+		s->snap_version = 0;
+		s->snap_size = sizeof(*s);
+		s->cpu = list[i];
+		s->highest_perf = v[AMDCPPC_KNOB_HIGHEST_PERF];
+		s->nominal_perf = v[AMDCPPC_KNOB_NOMINAL_PERF];
+		s->lowest_perf = v[AMDCPPC_KNOB_LOWEST_PERF];
+		s->epp = v[AMDCPPC_KNOB_EPP];
+		s->mode = v[AMDCPPC_KNOB_MODE];
+		s->boost = v[AMDCPPC_KNOB_BOOST];
+		s->floor_perf = v[AMDCPPC_KNOB_MIN_PERF];
+		s->ceil_perf = v[AMDCPPC_KNOB_MAX_PERF];
+		s->tamper_count = v[AMDCPPC_KNOB_TAMPER_COUNT];
+		s->domain = -1;
+		s->rule = -1;
+		s->set_policy = -1;
+		s->energy_esu = -1;
+	}
+	free(list);
+	return (0);
+}
+
+int
+amdcppc_refresh(struct amdcppc *h)
+{
+
+	if (h->bulk && h->be->snapshot != NULL) {
+		if (amdcppc_refresh_bulk(h) == 0)
+			return (0);
+		if (errno != ENOENT)
+			return (-1);
+		h->bulk = 0;
+	}
+	if (h->be->cpus == NULL || h->be->read == NULL) {
+		errno = ENOTSUP;
+		return (-1);
+	}
+	return (amdcppc_refresh_knobs(h));
+}
+
+int
+amdcppc_bulk(const struct amdcppc *h)
+{
+
+	return (h->bulk);
+}
+
+int
+amdcppc_ncpus(const struct amdcppc *h)
+{
+
+	return (h->ncpus);
+}
+
+const struct amd_cppc_snap *
+amdcppc_cpu(const struct amdcppc *h, int idx)
+{
+
+	if (idx < 0 || idx >= h->ncpus)
+		return (NULL);
+	return (&h->cpus[idx]);
+}
+
+const struct amd_cppc_snap *
+amdcppc_find(const struct amdcppc *h, int cpu)
+{
+	int		i;
+
+	for (i = 0; i < h->ncpus; i++)
+		if (h->cpus[i].cpu == cpu)
+			return (&h->cpus[i]);
+	return (NULL);
+}
+
+int
+amdcppc_queue(struct amdcppc *h, int cpu, int field, int value)
+{
+	struct amd_cppc_set *q;
+	int		i;
+
+	if (field < 0 || field >= AMD_CPPC_SET_COUNT) {
+		errno = EINVAL;
+		return (-1);
+	}
+	/* A later value for the same field replaces the queued one. */
+	for (i = 0; i < h->nqueue; i++) {
+		if (h->queue[i].cpu == cpu && h->queue[i].field == field) {
+			h->queue[i].value = value;
+			return (0);
+		}
+	}
+	if (h->nqueue == AMD_CPPC_SET_MAX) {
+		errno = E2BIG;
+		return (-1);
+	}
+	if (h->nqueue == h->qcap) {
+		q = realloc(h->queue, MAX(16, h->qcap * 2) * sizeof(*q));
+		if (q == NULL)
+			return (-1);
+		h->queue = q;
+		h->qcap = MAX(16, h->qcap * 2);
+	}
+	q = &h->queue[h->nqueue++];
+	q->cpu = cpu;
+	q->field = field;
+	q->value = value;
+	return (0);
+}
+
+void
+amdcppc_discard(struct amdcppc *h)
+{
+
+	h->nqueue = 0;
+}
+
+/*
+ * Reflect a committed value in the cached state until the next refresh.
+ */
+static void
+amdcppc_cache_set(struct amdcppc *h, const struct amd_cppc_set *s)
+{
+	struct amd_cppc_snap *c;
+
+	if ((c = (struct amd_cppc_snap *)amdcppc_find(h, s->cpu)) == NULL)
+		return;
+	switch (s->field) {
+	case AMD_CPPC_SET_EPP:
+		c->epp = s->value;
+		break;
+	case AMD_CPPC_SET_MODE:
+		c->mode = s->value;
+		break;
+	case AMD_CPPC_SET_BOOST:
+		c->boost = s->value;
+		break;
+	case AMD_CPPC_SET_MIN_PERF:
+		c->floor_perf = s->value;
+		break;
+	case AMD_CPPC_SET_MAX_PERF:
+		c->ceil_perf = s->value;
+		break;
+	}
+}
+
+/*
+ * Apply the queued values. With the bulk interface the driver applies all
+ * or none of them; without it they are written one by one and the first
+ * failure stops the commit, leaving the rest queued.
+ */
+int
+amdcppc_commit(struct amdcppc *h)
+{
+	const struct amd_cppc_set *s;
+	int		i;
+
+	if (h->nqueue == 0)
+		return (0);
+	if (h->bulk_apply && h->be->apply != NULL) {
+		if (h->be->apply(h->ctx, h->queue, h->nqueue) == 0) {
+			for (i = 0; i < h->nqueue; i++)
+				amdcppc_cache_set(h, &h->queue[i]);
+			h->nqueue = 0;
+			return (0);
+		}
+		if (errno != ENOENT)
+			return (-1);
+		h->bulk_apply = 0;
+	}
+	if (h->be->write == NULL) {
+		errno = ENOTSUP;
+		return (-1);
+	}
+	for (i = 0; i < h->nqueue; i++) {
+		s = &h->queue[i];
+		if (h->be->write(h->ctx, s->cpu, amdcppc_set_knob[s->field],
+				 s->value) != 0) {
+			memmove(h->queue, s, (h->nqueue - i) * sizeof(*s));
+			h->nqueue -= i;
+			return (-1);
+		}
+		amdcppc_cache_set(h, s);
+	}
+	h->nqueue = 0;
+	return (0);
+}
+
+static int
+amdcppc_set_list(struct amdcppc *h, const int *cpus, int ncpus, int field,
+		 int value)
+{
+	int		i;
+
+	if (cpus == NULL) {
+		for (i = 0; i < h->ncpus; i++)
+			if (amdcppc_queue(h, h->cpus[i].cpu, field, value) != 0)
+				return (-1);
+	} else {
+		for (i = 0; i < ncpus; i++)
+			if (amdcppc_queue(h, cpus[i], field, value) != 0)
+				return (-1);
+	}
+	return (0);
+}
+
+int
+amdcppc_set_epp(struct amdcppc *h, const int *cpus, int ncpus, int epp)
+{
+
+	if (amdcppc_set_list(h, cpus, ncpus, AMD_CPPC_SET_EPP, epp) != 0)
+		return (-1);
+	return (amdcppc_commit(h));
+}
+
+int
+amdcppc_set_mode(struct amdcppc *h, const int *cpus, int ncpus, int mode)
+{
+
+	if (amdcppc_set_list(h, cpus, ncpus, AMD_CPPC_SET_MODE, mode) != 0)
+		return (-1);
+	return (amdcppc_commit(h));
+}
+
+int
+amdcppc_set_boost(struct amdcppc *h, const int *cpus, int ncpus, int boost)
+{
+
+	if (amdcppc_set_list(h, cpus, ncpus, AMD_CPPC_SET_BOOST, boost) != 0)
+		return (-1);
+	return (amdcppc_commit(h));
+}
+
+int
+amdcppc_set_caps(struct amdcppc *h, const int *cpus, int ncpus,
+		 int min_perf, int max_perf)
+{
+
+	if (amdcppc_set_list(h, cpus, ncpus, AMD_CPPC_SET_MIN_PERF,
+			     min_perf) != 0 ||
+	    amdcppc_set_list(h, cpus, ncpus, AMD_CPPC_SET_MAX_PERF,
+			     max_perf) != 0)
+		return (-1);
+	return (amdcppc_commit(h));
+}
+
+/*
+ * Parse a devd notification from the driver:
+ *
+ *	!system=AMD_CPPC subsystem=ccd type=park [data]
+ *
+ * Returns -1 with errno ENOMSG for notifications of other systems.
+ */
+int
+amdcppc_event_parse(const char *line, struct amdcppc_event *ev)
+{
+	static const char sys[] = "!system=AMD_CPPC ";
+	const char	*p, *q;
+	size_t		n;
+
+	memset(ev, 0, sizeof(*ev));
+	if (strncmp(line, sys, sizeof(sys) - 1) != 0) {
+		errno = ENOMSG;
+		return (-1);
+	}
+	p = line + sizeof(sys) - 1;
+	if (strncmp(p, "subsystem=", 10) != 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	p += 10;
+	n = strcspn(p, " \n");
+	if (n >= sizeof(ev->subsystem)) {
+		errno = EINVAL;
+		return (-1);
+	}
+	memcpy(ev->subsystem, p, n);
+	p += n;
+	p += strspn(p, " ");
+	if (strncmp(p, "type=", 5) == 0) {
+		p += 5;
+		n = strcspn(p, " \n");
+		if (n >= sizeof(ev->type)) {
+			errno = EINVAL;
+			return (-1);
+		}
+		memcpy(ev->type, p, n);
+		p += n;
+		p += strspn(p, " ");
+	}
+	q = p + strcspn(p, "\n");
+	n = MIN((size_t)(q - p), sizeof(ev->data) - 1);
+	memcpy(ev->data, p, n);
+	return (0);
+}
+
+int
+amdcppc_event_fd(struct amdcppc *h)
+{
+
+	if (h->be->event_fd == NULL) {
+		errno = ENOTSUP;
+		return (-1);
+	}
+	return (h->be->event_fd(h->ctx));
+}
+
+/*
+ * Return the next driver event. Fails with EAGAIN when none is pending;
+ * wait for amdcppc_event_fd() to become readable and call again.
+ */
+int
+amdcppc_event_next(struct amdcppc *h, struct amdcppc_event *ev)
+{
+	char		line[512];
+
+	if (h->be->event_read == NULL) {
+		errno = ENOTSUP;
+		return (-1);
+	}
+	for (;;) {
+		if (h->be->event_read(h->ctx, line, sizeof(line)) != 0)
+			return (-1);
+		if (amdcppc_event_parse(line, ev) == 0)
+			return (0);
+	}
+}
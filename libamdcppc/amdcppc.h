@@ -0,0 +1,129 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * libamdcppc: access to the amd_cppc(4) driver.
+ *
+ * A handle holds the state of every CPU the driver attached to, read in
+ * one call through hw.amd_cppc.snapshot, or CPU by CPU from dev.amd_cppc.N
+ * on modules that predate it. Changes are queued and committed together
+ * through hw.amd_cppc.apply, again falling back to one sysctl per value.
+ * Sysctl MIBs are looked up once per handle.
+ *
+ * The sysctl access sits behind struct amdcppc_backend. Besides the
+ * driver backend there is a memory backend that keeps the state in the
+ * handle and applies changes to it; it builds on any system and serves
+ * dry runs and replays.
+ *
+ * Functions returning int return 0 on success and -1 with errno set on
+ * failure.
+ */
+
+#ifndef _AMDCPPC_H_
+#define _AMDCPPC_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "amd_cppc_snap.h"
+
+/* Per-CPU values reachable without the bulk interfaces */
+#define AMDCPPC_KNOB_HIGHEST_PERF	0
+#define AMDCPPC_KNOB_NOMINAL_PERF	1
+#define AMDCPPC_KNOB_LOWEST_PERF	2
+#define AMDCPPC_KNOB_EPP		3
+#define AMDCPPC_KNOB_MODE		4
+#define AMDCPPC_KNOB_BOOST		5
+#define AMDCPPC_KNOB_MIN_PERF		6
+#define AMDCPPC_KNOB_MAX_PERF		7
+#define AMDCPPC_KNOB_TAMPER_COUNT	8
+#define AMDCPPC_KNOB_COUNT		9
+
+struct amdcppc_event {
+	char		subsystem[32];
+	char		type[32];
+	char		data[256];	/* key=value pairs, may be empty */
+};
+
+/*
+ * Backend operations. snapshot and apply return -1 with errno ENOENT when
+ * the driver has no bulk interface; the library then uses cpus, read and
+ * write. event_fd and event_read may be NULL if events are not supported.
+ */
+struct amdcppc_backend {
+	int	(*snapshot)(void *ctx, struct amd_cppc_snap *snap,
+			    size_t *len);
+	int	(*apply)(void *ctx, const struct amd_cppc_set *set, int n);
+	int	(*cpus)(void *ctx, int *cpus, int max);
+	int	(*read)(void *ctx, int cpu, int knob, uint64_t *val);
+	int	(*write)(void *ctx, int cpu, int knob, int val);
+	int	(*event_fd)(void *ctx);
+	int	(*event_read)(void *ctx, char *line, size_t len);
+	void	(*close)(void *ctx);
+};
+
+struct amdcppc;
+
+struct amdcppc *amdcppc_open(void);
+struct amdcppc *amdcppc_open_backend(const struct amdcppc_backend *be,
+				     void *ctx);
+struct amdcppc *amdcppc_open_memory(const struct amd_cppc_snap *snap,
+				    int n);
+void	amdcppc_close(struct amdcppc *h);
+
+int	amdcppc_refresh(struct amdcppc *h);
+int	amdcppc_bulk(const struct amdcppc *h);
+int	amdcppc_ncpus(const struct amdcppc *h);
+const struct amd_cppc_snap *amdcppc_cpu(const struct amdcppc *h, int idx);
+const struct amd_cppc_snap *amdcppc_find(const struct amdcppc *h, int cpu);
+
+int	amdcppc_queue(struct amdcppc *h, int cpu, int field, int value);
+int	amdcppc_commit(struct amdcppc *h);
+void	amdcppc_discard(struct amdcppc *h);
+
+/* Queue and commit one field for a CPU list, all CPUs if cpus is NULL */
+int	amdcppc_set_epp(struct amdcppc *h, const int *cpus, int ncpus,
+			int epp);
+int	amdcppc_set_mode(struct amdcppc *h, const int *cpus, int ncpus,
+			 int mode);
+int	amdcppc_set_boost(struct amdcppc *h, const int *cpus, int ncpus,
+			  int boost);
+int	amdcppc_set_caps(struct amdcppc *h, const int *cpus, int ncpus,
+			 int min_perf, int max_perf);
+
+const char *amdcppc_mode_name(int mode);
+const char *amdcppc_source_name(int src);
+int	amdcppc_mode_parse(const char *name);
+
+int	amdcppc_event_fd(struct amdcppc *h);
+int	amdcppc_event_next(struct amdcppc *h, struct amdcppc_event *ev);
+int	amdcppc_event_parse(const char *line, struct amdcppc_event *ev);
+
+/* Memory backend only: queue an event line as devd would deliver it */
+int	amdcppc_memory_event(struct amdcppc *h, const char *line);
+
+#endif /* !_AMDCPPC_H_ */
@@ -0,0 +1,368 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Memory backend. The state lives in the backend and changes are applied
+ * to it with the driver's validation rules; the request fields are
+ * recomputed from the admin settings the way the driver does without any
+ * policy layers. Events are queued by amdcppc_memory_event() and signalled
+ * through a pipe so that callers can poll for them as for devd.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "amdcppc.h"
+#include "amdcppc_impl.h"
+
+#define AMDCPPC_MEM_EVENTS	64
+
+struct amdcppc_mem {
+	struct amd_cppc_snap *cpus;
+	int		ncpus;
+	int		pipe[2];
+	char		*events[AMDCPPC_MEM_EVENTS];
+	int		ev_head;
+	int		ev_count;
+};
+
+static struct amd_cppc_snap *
+amdcppc_mem_find(struct amdcppc_mem *m, int cpu)
+{
+	int		i;
+
+	for (i = 0; i < m->ncpus; i++)
+		if (m->cpus[i].cpu == cpu)
+			return (&m->cpus[i]);
+	return (NULL);
+}
+
+static void
+amdcppc_mem_compute(struct amd_cppc_snap *s)
+{
+	int		hi, lo;
+
+	hi = s->boost ? s->highest_perf : s->nominal_perf;
+	if (s->ceil_perf != 0 && s->ceil_perf < hi)
+		hi = s->ceil_perf;
+	lo = MAX(s->lowest_perf, s->floor_perf);
+	if (lo > hi)
+		lo = hi;
+	s->max_perf = hi;
+	s->min_perf = lo;
+	s->des_perf = 0;
+	s->epp_hw = s->epp * 255 / 100;
+	s->req = (uint64_t)s->epp_hw << 24 | (uint64_t)s->min_perf << 8 |
+	    s->max_perf;
+	/* No calibration to go by here, so the linear map */
+	if (s->nominal_perf != 0) {
+		s->max_mhz = s->base_mhz * s->max_perf / s->nominal_perf;
+		s->min_mhz = s->base_mhz * s->min_perf / s->nominal_perf;
+	}
+	s->des_mhz = 0;
+}
+
+static int
+amdcppc_mem_check(struct amdcppc_mem *m, const struct amd_cppc_set *s)
+{
+
+	if (amdcppc_mem_find(m, s->cpu) == NULL)
+		return (ENOENT);
+	switch (s->field) {
+	case AMD_CPPC_SET_EPP:
+		return (s->value < 0 || s->value > 100 ? EINVAL : 0);
+	case AMD_CPPC_SET_MODE:
+		return (s->value < 0 || s->value >= AMD_CPPC_MODE_COUNT ?
+			EINVAL : 0);
+	case AMD_CPPC_SET_BOOST:
+		return (s->value != 0 && s->value != 1 ? EINVAL : 0);
+	case AMD_CPPC_SET_MIN_PERF:
+	case AMD_CPPC_SET_MAX_PERF:
+		return (s->value < 0 || s->value > 255 ? EINVAL : 0);
+	default:
+		return (EINVAL);
+	}
+}
+
+static int
+amdcppc_mem_snapshot(void *ctx, struct amd_cppc_snap *snap, size_t *len)
+{
+	struct amdcppc_mem *m;
+	size_t		need;
+
+	m = ctx;
+	need = m->ncpus * sizeof(*snap);
+	if (snap != NULL) {
+		if (*len < need) {
+			errno = ENOMEM;
+			return (-1);
+		}
+		memcpy(snap, m->cpus, need);
+	}
+	*len = need;
+	return (0);
+}
+
+static int
+amdcppc_mem_apply(void *ctx, const struct amd_cppc_set *set, int n)
+{
+	struct amdcppc_mem *m;
+	struct amd_cppc_snap *s;
+	int		error, i;
+
+	m = ctx;
+	if (n <= 0 || n > AMD_CPPC_SET_MAX) {
+		errno = EINVAL;
+		return (-1);
+	}
+	for (i = 0; i < n; i++) {
+		if ((error = amdcppc_mem_check(m, &set[i])) != 0) {
+			errno = error;
+			return (-1);
+		}
+	}
+	for (i = 0; i < n; i++) {
+		s = amdcppc_mem_find(m, set[i].cpu);
+		switch (set[i].field) {
+		case AMD_CPPC_SET_EPP:
+			s->epp = set[i].value;
+			break;
+		case AMD_CPPC_SET_MODE:
+			s->mode = set[i].value;
+			break;
+		case AMD_CPPC_SET_BOOST:
+			s->boost = set[i].value;
+			break;
+		case AMD_CPPC_SET_MIN_PERF:
+			s->floor_perf = set[i].value;
+			break;
+		default:
+			s->ceil_perf = set[i].value;
+			break;
+		}
+		amdcppc_mem_compute(s);
+	}
+	return (0);
+}
+
+static int
+amdcppc_mem_cpus(void *ctx, int *cpus, int max)
+{
+	struct amdcppc_mem *m;
+	int		i;
+
+	m = ctx;
+	for (i = 0; i < m->ncpus && i < max; i++)
+		cpus[i] = m->cpus[i].cpu;
+	return (i);
+}
+
+static int
+amdcppc_mem_read(void *ctx, int cpu, int knob, uint64_t *val)
+{
+	struct amd_cppc_snap *s;
+
+	if ((s = amdcppc_mem_find(ctx, cpu)) == NULL) {
+		errno = ENOENT;
+		return (-1);
+	}
+	switch (knob) {
+	case AMDCPPC_KNOB_HIGHEST_PERF:
+		*val = s->highest_perf;
+		break;
+	case AMDCPPC_KNOB_NOMINAL_PERF:
+		*val = s->nominal_perf;
+		break;
+	case AMDCPPC_KNOB_LOWEST_PERF:
+		*val = s->lowest_perf;
+		break;
+	case AMDCPPC_KNOB_EPP:
+		*val = s->epp;
+		break;
+	case AMDCPPC_KNOB_MODE:
+		*val = s->mode;
+		break;
+	case AMDCPPC_KNOB_BOOST:
+		*val = s->boost;
+		break;
+	case AMDCPPC_KNOB_MIN_PERF:
+		*val = s->floor_perf;
+		break;
+	case AMDCPPC_KNOB_MAX_PERF:
+		*val = s->ceil_perf;
+		break;
+	case AMDCPPC_KNOB_TAMPER_COUNT:
+		*val = s->tamper_count;
+		break;
+	default:
+		errno = EINVAL;
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+amdcppc_mem_write(void *ctx, int cpu, int knob, int val)
+{
+	static const int field[AMDCPPC_KNOB_COUNT] = {
+		-1, -1, -1, AMD_CPPC_SET_EPP, AMD_CPPC_SET_MODE,
+		AMD_CPPC_SET_BOOST, AMD_CPPC_SET_MIN_PERF,
+		AMD_CPPC_SET_MAX_PERF, -1,
+	};
+	struct amd_cppc_set s;
+
+	if (knob < 0 || knob >= AMDCPPC_KNOB_COUNT || field[knob] < 0) {
+		errno = EPERM;
+		return (-1);
+	}
+	s.cpu = cpu;
+	s.field = field[knob];
+	s.value = val;
+	return (amdcppc_mem_apply(ctx, &s, 1));
+}
+
+static int
+amdcppc_mem_event_fd(void *ctx)
+{
+
+	return (((struct amdcppc_mem *)ctx)->pipe[0]);
+}
+
+static int
+amdcppc_mem_event_read(void *ctx, char *line, size_t len)
+{
+	struct amdcppc_mem *m;
+	char		c;
+	char		*ev;
+
+	m = ctx;
+	if (m->ev_count == 0) {
+		errno = EAGAIN;
+		return (-1);
+	}
+	(void)read(m->pipe[0], &c, 1);
+	ev = m->events[m->ev_head];
+	m->ev_head = (m->ev_head + 1) % AMDCPPC_MEM_EVENTS;
+	m->ev_count--;
+	strncpy(line, ev, len - 1);
+	line[len - 1] = '\0';
+	free(ev);
+	return (0);
+}
+
+static void
+amdcppc_mem_close(void *ctx)
+{
+	struct amdcppc_mem *m;
+
+	m = ctx;
+	while (m->ev_count > 0) {
+		free(m->events[m->ev_head]);
+		m->ev_head = (m->ev_head + 1) % AMDCPPC_MEM_EVENTS;
+		m->ev_count--;
+	}
+	close(m->pipe[0]);
+	close(m->pipe[1]);
+	free(m->cpus);
+	free(m);
+}
+
+static const struct amdcppc_backend amdcppc_mem_backend = {
+	.snapshot = amdcppc_mem_snapshot,
+	.apply = amdcppc_mem_apply,
+	.cpus = amdcppc_mem_cpus,
+	.read = amdcppc_mem_read,
+	.write = amdcppc_mem_write,
+	.event_fd = amdcppc_mem_event_fd,
+	.event_read = amdcppc_mem_event_read,
+	.close = amdcppc_mem_close,
+};
+
+/*
+ * Open a handle on n CPUs in the given state. The request fields are
+ * recomputed from the admin settings.
+ */
+struct amdcppc *
+amdcppc_open_memory(const struct amd_cppc_snap *snap, int n)
+{
+	struct amdcppc_mem *m;
+	struct amdcppc	*h;
+	int		i;
+
+	if (n < 0) {
+		errno = EINVAL;
+		return (NULL);
+	}
+	if ((m = calloc(1, sizeof(*m))) == NULL)
+		return (NULL);
+	if ((m->cpus = calloc(MAX(n, 1), sizeof(*m->cpus))) == NULL ||
+	    pipe(m->pipe) != 0) {
+		free(m->cpus);
+		free(m);
+		return (NULL);
+	}
+	(void)fcntl(m->pipe[0], F_SETFL, O_NONBLOCK);
+	memcpy(m->cpus, snap, n * sizeof(*snap));
+	m->ncpus = n;
+	for (i = 0; i < n; i++) {
+		m->cpus[i].snap_version = AMD_CPPC_SNAP_VERSION;
+		m->cpus[i].snap_size = sizeof(m->cpus[i]);
+		amdcppc_mem_compute(&m->cpus[i]);
+	}
+	if ((h = amdcppc_open_backend(&amdcppc_mem_backend, m)) == NULL)
+		amdcppc_mem_close(m);
+	return (h);
+}
+
+int
+amdcppc_memory_event(struct amdcppc *h, const char *line)
+{
+	struct amdcppc_mem *m;
+	char		*ev;
+
+	if (h->be != &amdcppc_mem_backend) {
+		errno = EINVAL;
+		return (-1);
+	}
+	m = h->ctx;
+	if (m->ev_count == AMDCPPC_MEM_EVENTS) {
+		errno = ENOSPC;
+		return (-1);
+	}
+	if ((ev = strdup(line)) == NULL)
+		return (-1);
+	m->events[(m->ev_head + m->ev_count) % AMDCPPC_MEM_EVENTS] = ev;
+	m->ev_count++;
+	(void)write(m->pipe[1], "", 1);
+	return (0);
+}
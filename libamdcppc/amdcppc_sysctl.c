@@ -0,0 +1,332 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Driver backend: sysctl(3) for state and changes, the devd(8) seqpacket
+ * socket for events. Every MIB is translated once and kept; a per-CPU
+ * MIB is only looked up the first time that CPU and knob are used.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "amdcppc.h"
+#include "amdcppc_impl.h"
+
+#define AMDCPPC_DEVD_PIPE	"/var/run/devd.seqpacket.pipe"
+
+struct amdcppc_mib {
+	int		mib[CTL_MAXNAME];
+	u_int		len;		/* 0 = not looked up, -1u = absent */
+};
+
+struct amdcppc_sysctl {
+	struct amdcppc_mib snapshot;
+	struct amdcppc_mib apply;
+	struct amdcppc_mib *knobs;	/* [maxcpu][AMDCPPC_KNOB_COUNT] */
+	int		maxcpu;
+	int		devd;		/* -1 until subscribed */
+};
+
+static const char *amdcppc_knob_names[AMDCPPC_KNOB_COUNT] = {
+	[AMDCPPC_KNOB_HIGHEST_PERF] = "highest_perf",
+	[AMDCPPC_KNOB_NOMINAL_PERF] = "nominal_perf",
+	[AMDCPPC_KNOB_LOWEST_PERF] = "lowest_perf",
+	[AMDCPPC_KNOB_EPP] = "epp",
+	[AMDCPPC_KNOB_MODE] = "mode",
+	[AMDCPPC_KNOB_BOOST] = "boost",
+	[AMDCPPC_KNOB_MIN_PERF] = "min_perf",
+	[AMDCPPC_KNOB_MAX_PERF] = "max_perf",
+	[AMDCPPC_KNOB_TAMPER_COUNT] = "tamper_count",
+};
+
+static int
+amdcppc_mib_get(struct amdcppc_mib *m, const char *name)
+{
+	size_t		len;
+
+	if (m->len == 0) {
+		len = nitems(m->mib);
+		if (sysctlnametomib(name, m->mib, &len) != 0) {
+			if (errno != ENOENT)
+				return (-1);
+			m->len = -1u;
+		} else
+			m->len = len;
+	}
+	if (m->len == -1u) {
+		errno = ENOENT;
+		return (-1);
+	}
+	return (0);
+}
+
+static struct amdcppc_mib *
+amdcppc_knob_mib(struct amdcppc_sysctl *s, int cpu, int knob)
+{
+	struct amdcppc_mib *m;
+	char		name[64];
+
+	if (cpu < 0 || cpu >= s->maxcpu || knob < 0 ||
+	    knob >= AMDCPPC_KNOB_COUNT) {
+		errno = ENOENT;
+		return (NULL);
+	}
+	m = &s->knobs[cpu * AMDCPPC_KNOB_COUNT + knob];
+	snprintf(name, sizeof(name), "dev.amd_cppc.%d.%s", cpu,
+		 amdcppc_knob_names[knob]);
+	if (amdcppc_mib_get(m, name) != 0)
+		return (NULL);
+	return (m);
+}
+
+static int
+amdcppc_sysctl_snapshot(void *ctx, struct amd_cppc_snap *snap, size_t *len)
+{
+	struct amdcppc_sysctl *s;
+
+	s = ctx;
+	if (amdcppc_mib_get(&s->snapshot, "hw.amd_cppc.snapshot") != 0)
+		return (-1);
+	if (snap == NULL)
+		*len = 0;
+	return (sysctl(s->snapshot.mib, s->snapshot.len, snap, len, NULL, 0));
+}
+
+static int
+amdcppc_sysctl_apply(void *ctx, const struct amd_cppc_set *set, int n)
+{
+	struct amdcppc_sysctl *s;
+
+	s = ctx;
+	if (amdcppc_mib_get(&s->apply, "hw.amd_cppc.apply") != 0)
+		return (-1);
+	return (sysctl(s->apply.mib, s->apply.len, NULL, NULL, set,
+		       n * sizeof(*set)));
+}
+
+static int
+amdcppc_sysctl_cpus(void *ctx, int *cpus, int max)
+{
+	struct amdcppc_sysctl *s;
+	int		cpu, n;
+
+	s = ctx;
+	n = 0;
+	for (cpu = 0; cpu < s->maxcpu && n < max; cpu++) {
+		if (amdcppc_knob_mib(s, cpu, AMDCPPC_KNOB_EPP) != NULL)
+			cpus[n++] = cpu;
+		else if (errno != ENOENT)
+			return (-1);
+	}
+	return (n);
+}
+
+static int
+amdcppc_sysctl_read(void *ctx, int cpu, int knob, uint64_t *val)
+{
+	struct amdcppc_mib *m;
+	char		buf[32];
+	size_t		len;
+	uint64_t	v64;
+	uint8_t		v8;
+	int		v;
+
+	if ((m = amdcppc_knob_mib(ctx, cpu, knob)) == NULL)
+		return (-1);
+	switch (knob) {
+	case AMDCPPC_KNOB_HIGHEST_PERF:
+	case AMDCPPC_KNOB_NOMINAL_PERF:
+	case AMDCPPC_KNOB_LOWEST_PERF:
+		len = sizeof(v8);
+		if (sysctl(m->mib, m->len, &v8, &len, NULL, 0) != 0)
+			return (-1);
+		*val = v8;
+		break;
+	case AMDCPPC_KNOB_TAMPER_COUNT:
+		len = sizeof(v64);
+		if (sysctl(m->mib, m->len, &v64, &len, NULL, 0) != 0)
+			return (-1);
+		*val = v64;
+		break;
+	case AMDCPPC_KNOB_MODE:
+		len = sizeof(buf) - 1;
+		if (sysctl(m->mib, m->len, buf, &len, NULL, 0) != 0)
+			return (-1);
+		buf[len] = '\0';
+		if ((v = amdcppc_mode_parse(buf)) < 0) {
+			errno = EINVAL;
+			return (-1);
+		}
+		*val = v;
+		break;
+	default:
+		len = sizeof(v);
+		if (sysctl(m->mib, m->len, &v, &len, NULL, 0) != 0)
+			return (-1);
+		*val = v;
+		break;
+	}
+	return (0);
+}
+
+static int
+amdcppc_sysctl_write(void *ctx, int cpu, int knob, int val)
+{
+	struct amdcppc_mib *m;
+	const char	*name;
+
+	if ((m = amdcppc_knob_mib(ctx, cpu, knob)) == NULL)
+		return (-1);
+	if (knob == AMDCPPC_KNOB_MODE) {
+		if (val < 0 || val >= AMD_CPPC_MODE_COUNT) {
+			errno = EINVAL;
+			return (-1);
+		}
+		name = amdcppc_mode_name(val);
+		return (sysctl(m->mib, m->len, NULL, NULL, name,
+			       strlen(name) + 1));
+	}
+	return (sysctl(m->mib, m->len, NULL, NULL, &val, sizeof(val)));
+}
+
+static int
+amdcppc_sysctl_event_fd(void *ctx)
+{
+	struct amdcppc_sysctl *s;
+	struct sockaddr_un sun;
+	int		fd;
+
+	s = ctx;
+	if (s->devd >= 0)
+		return (s->devd);
+	fd = socket(PF_LOCAL, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		    0);
+	if (fd < 0)
+		return (-1);
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_LOCAL;
+	strlcpy(sun.sun_path, AMDCPPC_DEVD_PIPE, sizeof(sun.sun_path));
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+		close(fd);
+		return (-1);
+	}
+	s->devd = fd;
+	return (fd);
+}
+
+static int
+amdcppc_sysctl_event_read(void *ctx, char *line, size_t len)
+{
+	struct amdcppc_sysctl *s;
+	ssize_t		n;
+
+	s = ctx;
+	if (s->devd < 0 && amdcppc_sysctl_event_fd(s) < 0)
+		return (-1);
+	n = recv(s->devd, line, len - 1, 0);
+	if (n < 0)
+		return (-1);
+	if (n == 0) {
+		/* devd went away; a later call reconnects. */
+		close(s->devd);
+		s->devd = -1;
+		errno = EAGAIN;
+		return (-1);
+	}
+	line[n] = '\0';
+	return (0);
+}
+
+static void
+amdcppc_sysctl_close(void *ctx)
+{
+	struct amdcppc_sysctl *s;
+
+	s = ctx;
+	if (s->devd >= 0)
+		close(s->devd);
+	free(s->knobs);
+	free(s);
+}
+
+static const struct amdcppc_backend amdcppc_sysctl_backend = {
+	.snapshot = amdcppc_sysctl_snapshot,
+	.apply = amdcppc_sysctl_apply,
+	.cpus = amdcppc_sysctl_cpus,
+	.read = amdcppc_sysctl_read,
+	.write = amdcppc_sysctl_write,
+	.event_fd = amdcppc_sysctl_event_fd,
+	.event_read = amdcppc_sysctl_event_read,
+	.close = amdcppc_sysctl_close,
+};
+
+/*
+ * Open a handle on the running driver. Fails with ENOENT if amd_cppc is
+ * not loaded.
+ */
+struct amdcppc *
+amdcppc_open(void)
+{
+	struct amdcppc_sysctl *s;
+	struct amdcppc	*h;
+	size_t		len;
+	int		maxid;
+
+	len = sizeof(maxid);
+	if (sysctlbyname("kern.smp.maxid", &maxid, &len, NULL, 0) != 0)
+		maxid = 0;
+	if ((s = calloc(1, sizeof(*s))) == NULL)
+		return (NULL);
+	s->maxcpu = maxid + 1;
+	s->devd = -1;
+	s->knobs = calloc(s->maxcpu * AMDCPPC_KNOB_COUNT, sizeof(*s->knobs));
+	if (s->knobs == NULL) {
+		free(s);
+		return (NULL);
+	}
+	if ((h = amdcppc_open_backend(&amdcppc_sysctl_backend, s)) == NULL) {
+		amdcppc_sysctl_close(s);
+		return (NULL);
+	}
+	if (h->ncpus == 0) {
+		amdcppc_close(h);
+		errno = ENOENT;
+		return (NULL);
+	}
+	return (h);
+}
@@ -0,0 +1,135 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Check stored calibrations the way the driver does when one is set
+ * through dev.amd_cppc.N.calibration, and print the map's conversions:
+ *
+ *	caps LOWEST HIGHEST	the CPU's lowest and highest perf
+ *	map TEXT		parse and check TEXT against the caps
+ *	mhz PERF ...		MHz of each perf level from the map
+ *	perf MHZ ...		perf level delivering each MHz
+ */
+
+#include <sys/param.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "amd_cppc_calib.h"
+
+static int	lowest, highest;
+static int	cal_perf[AMD_CPPC_CAL_POINTS], cal_mhz[AMD_CPPC_CAL_POINTS];
+static int	cal_n;
+
+static void
+map(char *text, int lineno)
+{
+	int		mhz[AMD_CPPC_CAL_POINTS], perf[AMD_CPPC_CAL_POINTS];
+	int		error, i, n;
+
+	cal_n = 0;
+	if ((error = amd_cppc_calib_parse(text, perf, mhz, &n)) != 0) {
+		printf("%d: parse error %d\n", lineno, error);
+		return;
+	}
+	if (n == 0) {
+		printf("%d: linear\n", lineno);
+		return;
+	}
+	if ((error = amd_cppc_calib_check(perf, mhz, n, lowest,
+	    highest)) != 0) {
+		printf("%d: refused, error %d\n", lineno, error);
+		return;
+	}
+	printf("%d: %d points\n", lineno, n);
+	for (i = 0; i < n; i++) {
+		cal_perf[i] = perf[i];
+		cal_mhz[i] = mhz[i];
+	}
+	cal_n = n;
+}
+
+static void
+convert(char *args, int lineno, int to_mhz)
+{
+	char		*tok;
+	int		v;
+
+	printf("%d:", lineno);
+	while ((tok = strsep(&args, " \t")) != NULL) {
+		if (*tok == '\0')
+			continue;
+		v = atoi(tok);
+		if (cal_n == 0)
+			printf(" %d=-", v);
+		else if (to_mhz)
+			printf(" %d=%d", v, amd_cppc_calib_interp(v, cal_perf,
+			       cal_mhz, cal_n));
+		else
+			printf(" %d=%d", v, amd_cppc_calib_interp(v, cal_mhz,
+			       cal_perf, cal_n));
+	}
+	printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE		*fp;
+	char		line[256], *p, *cmd;
+	int		lineno;
+
+	if (argc != 2)
+		errx(1, "usage: calib_test file");
+	if ((fp = fopen(argv[1], "r")) == NULL)
+		err(1, "%s", argv[1]);
+	for (lineno = 1; fgets(line, sizeof(line), fp) != NULL; lineno++) {
+		line[strcspn(line, "\n")] = '\0';
+		p = line + strspn(line, " \t");
+		if (*p == '\0' || *p == '#')
+			continue;
+		cmd = strsep(&p, " \t");
+		if (p == NULL)
+			p = cmd + strlen(cmd);
+		if (strcmp(cmd, "caps") == 0) {
+			if (sscanf(p, "%d %d", &lowest, &highest) != 2)
+				errx(1, "line %d: caps LOWEST HIGHEST", lineno);
+		} else if (strcmp(cmd, "map") == 0)
+			map(p, lineno);
+		else if (strcmp(cmd, "mhz") == 0)
+			convert(p, lineno, 1);
+		else if (strcmp(cmd, "perf") == 0)
+			convert(p, lineno, 0);
+		else
+			errx(1, "line %d: unknown command %s", lineno, cmd);
+	}
+	fclose(fp);
+	return (0);
+}
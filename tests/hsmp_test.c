@@ -0,0 +1,321 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * The HSMP message code against an emulated mailbox.
+ *
+ * The emulation keeps the SMN registers of one socket's mailbox. Writing
+ * the message ID starts the message; the SMU posts the response after
+ * latency_us of delay() calls, as the firmware does after some
+ * microseconds, and then places the results in the argument registers.
+ * It implements the messages the driver sends with the argument checks
+ * of a Milan SMU: the power cap must not exceed the maximum, boost limits
+ * are per APIC ID, and there are four fabric P-states.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "amd_cppc_hsmp.h"
+
+#ifndef __unused
+#define __unused	__attribute__((__unused__))
+#endif
+
+#define CHECK(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failed++;						\
+	}								\
+} while (0)
+
+#define EMUL_APICS	16
+
+struct emul {
+	/* Mailbox registers */
+	uint32_t	msg_id;
+	uint32_t	resp;
+	uint32_t	arg[AMD_CPPC_HSMP_MAX_ARGS];
+
+	/* SMU state */
+	uint32_t	power_mw;
+	uint32_t	limit_mw;
+	uint32_t	limit_max_mw;
+	uint32_t	boost_mhz[EMUL_APICS];
+	int		df_pstate;	/* -1 = automatic */
+
+	/* Behaviour */
+	u_int		latency_us;	/* time to answer a message */
+	bool		hang;		/* never answer */
+	bool		busy;		/* answer BUSY */
+	bool		smn_fail;	/* SMN access fails */
+
+	/* Message in flight */
+	bool		running;
+	u_int		elapsed_us;
+	u_int		waited_us;	/* delay() total, all messages */
+	int		sent;
+};
+
+static int	failed;
+
+static void
+emul_run(struct emul *e)
+{
+	uint32_t	*a;
+	u_int		apic, i;
+
+	a = e->arg;
+	e->resp = AMD_CPPC_HSMP_RESP_OK;
+	switch (e->msg_id) {
+	case AMD_CPPC_HSMP_TEST:
+		a[0]++;
+		break;
+	case AMD_CPPC_HSMP_GET_SMU_VER:
+		a[0] = 0x00452A00;
+		break;
+	case AMD_CPPC_HSMP_GET_PROTO_VER:
+		a[0] = 4;
+		break;
+	case AMD_CPPC_HSMP_GET_SOCKET_POWER:
+		a[0] = e->power_mw;
+		break;
+	case AMD_CPPC_HSMP_SET_SOCKET_POWER_LIMIT:
+		if (a[0] > e->limit_max_mw)
+			e->resp = AMD_CPPC_HSMP_RESP_INVALID_ARGS;
+		else
+			e->limit_mw = a[0];
+		break;
+	case AMD_CPPC_HSMP_GET_SOCKET_POWER_LIMIT:
+		a[0] = e->limit_mw;
+		break;
+	case AMD_CPPC_HSMP_GET_SOCKET_POWER_LIMIT_MAX:
+		a[0] = e->limit_max_mw;
+		break;
+	case AMD_CPPC_HSMP_SET_BOOST_LIMIT:
+		if ((apic = a[0] >> 16) >= EMUL_APICS)
+			e->resp = AMD_CPPC_HSMP_RESP_INVALID_ARGS;
+		else
+			e->boost_mhz[apic] = a[0] & 0xFFFF;
+		break;
+	case AMD_CPPC_HSMP_SET_BOOST_LIMIT_SOCKET:
+		for (i = 0; i < EMUL_APICS; i++)
+			e->boost_mhz[i] = a[0] & 0xFFFF;
+		break;
+	case AMD_CPPC_HSMP_GET_BOOST_LIMIT:
+		if (a[0] >= EMUL_APICS)
+			e->resp = AMD_CPPC_HSMP_RESP_INVALID_ARGS;
+		else
+			a[0] = e->boost_mhz[a[0]];
+		break;
+	case AMD_CPPC_HSMP_SET_DF_PSTATE:
+		if (a[0] >= AMD_CPPC_HSMP_DF_PSTATES)
+			e->resp = AMD_CPPC_HSMP_RESP_INVALID_ARGS;
+		else
+			e->df_pstate = a[0];
+		break;
+	case AMD_CPPC_HSMP_SET_AUTO_DF_PSTATE:
+		e->df_pstate = -1;
+		break;
+	default:
+		e->resp = AMD_CPPC_HSMP_RESP_INVALID_MSG;
+		break;
+	}
+}
+
+static uint32_t *
+emul_reg(struct emul *e, uint32_t addr)
+{
+
+	if (addr == AMD_CPPC_HSMP_SMN_MSG_ID)
+		return (&e->msg_id);
+	if (addr == AMD_CPPC_HSMP_SMN_MSG_RESP)
+		return (&e->resp);
+	if (addr >= AMD_CPPC_HSMP_SMN_MSG_ARG &&
+	    addr < AMD_CPPC_HSMP_SMN_MSG_ARG + AMD_CPPC_HSMP_MAX_ARGS * 4 &&
+	    addr % 4 == 0)
+		return (&e->arg[(addr - AMD_CPPC_HSMP_SMN_MSG_ARG) / 4]);
+	return (NULL);
+}
+
+static int
+emul_smn_read(void *ctx, uint32_t addr, uint32_t *val)
+{
+	struct emul	*e;
+	uint32_t	*reg;
+
+	e = ctx;
+	if (e->smn_fail || (reg = emul_reg(e, addr)) == NULL)
+		return (EIO);
+	*val = *reg;
+	return (0);
+}
+
+static int
+emul_smn_write(void *ctx, uint32_t addr, uint32_t val)
+{
+	struct emul	*e;
+	uint32_t	*reg;
+
+	e = ctx;
+	if (e->smn_fail || (reg = emul_reg(e, addr)) == NULL)
+		return (EIO);
+	*reg = val;
+	if (addr == AMD_CPPC_HSMP_SMN_MSG_ID) {
+		e->running = true;
+		e->elapsed_us = 0;
+		e->sent++;
+	}
+	return (0);
+}
+
+static void
+emul_delay(void *ctx, u_int us)
+{
+	struct emul	*e;
+
+	e = ctx;
+	e->waited_us += us;
+	if (!e->running || e->hang)
+		return;
+	e->elapsed_us += us;
+	if (e->elapsed_us < e->latency_us)
+		return;
+	e->running = false;
+	if (e->busy)
+		e->resp = AMD_CPPC_HSMP_RESP_BUSY;
+	else
+		emul_run(e);
+}
+
+static const struct amd_cppc_hsmp_ops emul_ops = {
+	.smn_read = emul_smn_read,
+	.smn_write = emul_smn_write,
+	.delay = emul_delay,
+};
+
+static void
+emul_init(struct emul *e, struct amd_cppc_hsmp *h)
+{
+
+	memset(e, 0, sizeof(*e));
+	e->power_mw = 143250;
+	e->limit_mw = 225000;
+	e->limit_max_mw = 280000;
+	e->df_pstate = -1;
+	e->latency_us = 30;
+	h->ops = &emul_ops;
+	h->ctx = e;
+	h->timeout_us = 500000;
+}
+
+int
+main(void)
+{
+	struct amd_cppc_hsmp h;
+	struct emul	e;
+	uint32_t	args[AMD_CPPC_HSMP_MAX_ARGS];
+
+	/* The probe handshake and the read-only values. */
+	emul_init(&e, &h);
+	args[0] = 0xA5;
+	CHECK(amd_cppc_hsmp_send(&h, AMD_CPPC_HSMP_TEST, args) == 0);
+	CHECK(args[0] == 0xA6);
+	CHECK(amd_cppc_hsmp_send(&h, AMD_CPPC_HSMP_GET_PROTO_VER, args) == 0);
+	CHECK(args[0] == 4);
+	CHECK(amd_cppc_hsmp_send(&h, AMD_CPPC_HSMP_GET_SOCKET_POWER,
+	    args) == 0);
+	CHECK(args[0] == 143250);
+
+	/* Power cap: set, read back, refuse above the maximum. */
+	args[0] = 200000;
+	CHECK(amd_cppc_hsmp_send(&h, AMD_CPPC_HSMP_SET_SOCKET_POWER_LIMIT,
+	    args) == 0);
+	CHECK(amd_cppc_hsmp_send(&h, AMD_CPPC_HSMP_GET_SOCKET_POWER_LIMIT,
+	    args) == 0);
+	CHECK(args[0] == 200000);
+	args[0] = 300000;
+	CHECK(amd_cppc_hsmp_send(&h, AMD_CPPC_HSMP_SET_SOCKET_POWER_LIMIT,
+	    args) == EINVAL);
+	CHECK(e.limit_mw == 200000);
+
+	/* Boost limit of one core, as the per-CPU sysctl sends it. */
+	args[0] = 5 << 16 | 3200;
+	CHECK(amd_cppc_hsmp_send(&h, AMD_CPPC_HSMP_SET_BOOST_LIMIT, args) == 0);
+	args[0] = 5;
+	CHECK(amd_cppc_hsmp_send(&h, AMD_CPPC_HSMP_GET_BOOST_LIMIT, args) == 0);
+	CHECK(args[0] == 3200);
+	CHECK(e.boost_mhz[4] == 0);
+
+	/* Fabric P-state and back to automatic. */
+	args[0] = 2;
+	CHECK(amd_cppc_hsmp_send(&h, AMD_CPPC_HSMP_SET_DF_PSTATE, args) == 0);
+	CHECK(e.df_pstate == 2);
+	args[0] = AMD_CPPC_HSMP_DF_PSTATES;
+	CHECK(amd_cppc_hsmp_send(&h, AMD_CPPC_HSMP_SET_DF_PSTATE,
+	    args) == EINVAL);
+	CHECK(amd_cppc_hsmp_send(&h, AMD_CPPC_HSMP_SET_AUTO_DF_PSTATE,
+	    args) == 0);
+	CHECK(e.df_pstate == -1);
+
+	/* Unknown messages never reach the mailbox. */
+	e.sent = 0;
+	CHECK(amd_cppc_hsmp_send(&h, 0x7F, args) == EINVAL);
+	CHECK(e.sent == 0);
+
+	/* A slow SMU is waited for, with growing steps. */
+	emul_init(&e, &h);
+	e.latency_us = 5000;
+	CHECK(amd_cppc_hsmp_send(&h, AMD_CPPC_HSMP_GET_SMU_VER, args) == 0);
+	CHECK(args[0] == 0x00452A00);
+	CHECK(e.waited_us >= 5000 && e.waited_us < 7000);
+
+	/* Status codes. */
+	emul_init(&e, &h);
+	e.busy = true;
+	CHECK(amd_cppc_hsmp_send(&h, AMD_CPPC_HSMP_GET_SOCKET_POWER,
+	    args) == EBUSY);
+
+	/* No answer: give up after timeout_us, as the probe does. */
+	emul_init(&e, &h);
+	e.hang = true;
+	h.timeout_us = 20000;
+	CHECK(amd_cppc_hsmp_send(&h, AMD_CPPC_HSMP_TEST, args) == ETIMEDOUT);
+	CHECK(e.waited_us >= 20000 && e.waited_us < 22000);
+
+	/* SMN errors are passed up. */
+	emul_init(&e, &h);
+	e.smn_fail = true;
+	CHECK(amd_cppc_hsmp_send(&h, AMD_CPPC_HSMP_TEST, args) == EIO);
+
+	return (failed != 0);
+}
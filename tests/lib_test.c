@@ -0,0 +1,250 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * libamdcppc against its memory backend and against a fake driver that
+ * predates the bulk sysctls, so that both the snapshot/apply path and the
+ * per-CPU fallback run.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "amdcppc.h"
+
+#ifndef __unused
+#define __unused	__attribute__((__unused__))
+#endif
+
+#define NCPU	4
+
+#define CHECK(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failed++;						\
+	}								\
+} while (0)
+
+static int	failed;
+
+/* A module with only dev.amd_cppc.N.*: the knobs, one value each */
+struct fake {
+	uint64_t	knob[NCPU][AMDCPPC_KNOB_COUNT];
+	int		writes;
+	int		fail_cpu;	/* write to this CPU fails, -1 = none */
+};
+
+static int
+fake_snapshot(void *ctx __unused, struct amd_cppc_snap *snap __unused,
+	      size_t *len __unused)
+{
+
+	errno = ENOENT;
+	return (-1);
+}
+
+static int
+fake_apply(void *ctx __unused, const struct amd_cppc_set *set __unused,
+	   int n __unused)
+{
+
+	errno = ENOENT;
+	return (-1);
+}
+
+static int
+fake_cpus(void *ctx __unused, int *cpus, int max)
+{
+	int		i;
+
+	for (i = 0; i < NCPU && i < max; i++)
+		cpus[i] = i;
+	return (i);
+}
+
+static int
+fake_read(void *ctx, int cpu, int knob, uint64_t *val)
+{
+	struct fake	*f;
+
+	f = ctx;
+	if (cpu < 0 || cpu >= NCPU || knob < 0 || knob >= AMDCPPC_KNOB_COUNT) {
+		errno = ENOENT;
+		return (-1);
+	}
+	*val = f->knob[cpu][knob];
+	return (0);
+}
+
+static int
+fake_write(void *ctx, int cpu, int knob, int val)
+{
+	struct fake	*f;
+
+	f = ctx;
+	if (cpu == f->fail_cpu) {
+		errno = EIO;
+		return (-1);
+	}
+	f->knob[cpu][knob] = val;
+	f->writes++;
+	return (0);
+}
+
+static const struct amdcppc_backend fake_backend = {
+	.snapshot = fake_snapshot,
+	.apply = fake_apply,
+	.cpus = fake_cpus,
+	.read = fake_read,
+	.write = fake_write,
+};
+
+static void
+test_memory(void)
+{
+	struct amd_cppc_snap snap[NCPU];
+	struct amdcppc_event ev;
+	const struct amd_cppc_snap *c;
+	struct amdcppc	*h;
+	int		cpus[2] = { 1, 3 };
+	int		i;
+
+	memset(snap, 0, sizeof(snap));
+	for (i = 0; i < NCPU; i++) {
+		snap[i].snap_version = AMD_CPPC_SNAP_VERSION;
+		snap[i].snap_size = sizeof(snap[i]);
+		snap[i].cpu = i;
+		snap[i].highest_perf = 166;
+		snap[i].nominal_perf = 120;
+		snap[i].lowest_perf = 20;
+		snap[i].epp = 50;
+		snap[i].boost = 1;
+	}
+	h = amdcppc_open_memory(snap, NCPU);
+	CHECK(h != NULL);
+	if (h == NULL)
+		return;
+	CHECK(amdcppc_ncpus(h) == NCPU);
+	CHECK(amdcppc_bulk(h) == 1);
+
+	/* A CPU list, then all CPUs; the cache follows the commit. */
+	CHECK(amdcppc_set_epp(h, cpus, 2, 80) == 0);
+	CHECK(amdcppc_find(h, 1)->epp == 80);
+	CHECK(amdcppc_find(h, 0)->epp == 50);
+	CHECK(amdcppc_set_caps(h, NULL, 0, 50, 100) == 0);
+	CHECK(amdcppc_refresh(h) == 0);
+	for (i = 0; i < NCPU; i++) {
+		c = amdcppc_cpu(h, i);
+		CHECK(c->epp == (i == 1 || i == 3 ? 80 : 50));
+		CHECK(c->min_perf == 50 && c->max_perf == 100);
+	}
+
+	/* The driver applies all or nothing; the queue stays for a retry. */
+	CHECK(amdcppc_queue(h, 0, AMD_CPPC_SET_BOOST, 0) == 0);
+	CHECK(amdcppc_set_epp(h, NULL, 0, 101) == -1 && errno == EINVAL);
+	amdcppc_discard(h);
+	CHECK(amdcppc_refresh(h) == 0);
+	CHECK(amdcppc_find(h, 0)->boost == 1);
+
+	/* A later value for a queued field replaces it. */
+	CHECK(amdcppc_queue(h, 2, AMD_CPPC_SET_EPP, 10) == 0);
+	CHECK(amdcppc_queue(h, 2, AMD_CPPC_SET_EPP, 20) == 0);
+	CHECK(amdcppc_commit(h) == 0);
+	CHECK(amdcppc_refresh(h) == 0);
+	CHECK(amdcppc_find(h, 2)->epp == 20);
+
+	/* Only AMD_CPPC notifications come through. */
+	CHECK(amdcppc_memory_event(h,
+	    "!system=AMD_CPPC subsystem=ccd type=park ccd=1\n") == 0);
+	CHECK(amdcppc_memory_event(h,
+	    "!system=ACPI subsystem=ACAD type=\\_SB_.AC notify=0x01\n") == 0);
+	CHECK(amdcppc_memory_event(h,
+	    "!system=AMD_CPPC subsystem=phase type=boot\n") == 0);
+	CHECK(amdcppc_event_next(h, &ev) == 0);
+	CHECK(strcmp(ev.subsystem, "ccd") == 0 &&
+	      strcmp(ev.type, "park") == 0 && strcmp(ev.data, "ccd=1") == 0);
+	CHECK(amdcppc_event_next(h, &ev) == 0);
+	CHECK(strcmp(ev.subsystem, "phase") == 0 && ev.data[0] == '\0');
+	CHECK(amdcppc_event_next(h, &ev) == -1 && errno == EAGAIN);
+	amdcppc_close(h);
+}
+
+static void
+test_fallback(void)
+{
+	struct fake	f;
+	struct amdcppc	*h;
+	int		i;
+
+	memset(&f, 0, sizeof(f));
+	f.fail_cpu = -1;
+	for (i = 0; i < NCPU; i++) {
+		f.knob[i][AMDCPPC_KNOB_HIGHEST_PERF] = 255;
+		f.knob[i][AMDCPPC_KNOB_NOMINAL_PERF] = 166;
+		f.knob[i][AMDCPPC_KNOB_LOWEST_PERF] = 20;
+		f.knob[i][AMDCPPC_KNOB_EPP] = 50;
+		f.knob[i][AMDCPPC_KNOB_BOOST] = 1;
+	}
+	h = amdcppc_open_backend(&fake_backend, &f);
+	CHECK(h != NULL);
+	if (h == NULL)
+		return;
+	CHECK(amdcppc_bulk(h) == 0);
+	CHECK(amdcppc_ncpus(h) == NCPU);
+	CHECK(amdcppc_find(h, 3)->highest_perf == 255);
+	CHECK(amdcppc_find(h, 3)->rule == -1);
+
+	/* One sysctl per value. */
+	CHECK(amdcppc_set_mode(h, NULL, 0, AMD_CPPC_MODE_GUIDED) == 0);
+	CHECK(f.writes == NCPU);
+	for (i = 0; i < NCPU; i++)
+		CHECK(f.knob[i][AMDCPPC_KNOB_MODE] == AMD_CPPC_MODE_GUIDED);
+
+	/* The first failure stops the commit and keeps the rest queued. */
+	f.fail_cpu = 2;
+	CHECK(amdcppc_set_epp(h, NULL, 0, 0) == -1 && errno == EIO);
+	CHECK(f.knob[1][AMDCPPC_KNOB_EPP] == 0);
+	CHECK(f.knob[3][AMDCPPC_KNOB_EPP] == 50);
+	f.fail_cpu = -1;
+	CHECK(amdcppc_commit(h) == 0);
+	CHECK(f.knob[2][AMDCPPC_KNOB_EPP] == 0);
+	CHECK(f.knob[3][AMDCPPC_KNOB_EPP] == 0);
+	amdcppc_close(h);
+}
+
+int
+main(void)
+{
+
+	test_memory();
+	test_fallback();
+	return (failed != 0);
+}
@@ -0,0 +1,108 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Look CPUID and CAP1 values up in the quirk table and print what the
+ * driver would make of them. Each line of the corpus is a CPUID leaf 1
+ * signature and a CAP1 value, as
+ *
+ *	cpuctl -i 1 /dev/cpuctl0
+ *	cpucontrol -m 0xc00102b0 /dev/cpuctl0
+ *
+ * report them, and a comment naming the part:
+ *
+ *	0x00A20F12 0xFF7C1E10	# Ryzen 9 5950X
+ */
+
+#include <sys/param.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "amd_cppc_quirk.h"
+
+static void
+entry(uint32_t cpuid, uint64_t cap1, const char *comment)
+{
+	const struct amd_cppc_quirk *q;
+	int		highest, nominal;
+
+	q = amd_cppc_quirk_lookup(cpuid);
+	highest = (cap1 >> 24) & 0xff;
+	nominal = (cap1 >> 16) & 0xff;
+	printf("%08x %-24s family %#x model 0x%02x stepping %u\n", cpuid,
+	       comment, AMD_CPPC_CPUID_FAMILY(cpuid),
+	       AMD_CPPC_CPUID_MODEL(cpuid), AMD_CPPC_CPUID_STEPPING(cpuid));
+	printf("  %s%s%s%s%s\n", q->name,
+	       (q->flags & AMD_CPPC_QUIRK_NO_CPPC) != 0 ? " no_cppc" : "",
+	       (q->flags & AMD_CPPC_QUIRK_RANKED) != 0 ? " ranked" : "",
+	       (q->flags & AMD_CPPC_QUIRK_HSMP) != 0 ? " hsmp" : "",
+	       (q->flags & AMD_CPPC_QUIRK_SMU) != 0 ? " smu" : "");
+	printf("  highest %d nominal %d boost ratio %d\n", highest, nominal,
+	       amd_cppc_quirk_highest(q, highest, nominal));
+	printf("  epp 0/25/50/75/100 -> %u/%u/%u/%u/%u\n",
+	       amd_cppc_quirk_epp(q, 0), amd_cppc_quirk_epp(q, 25),
+	       amd_cppc_quirk_epp(q, 50), amd_cppc_quirk_epp(q, 75),
+	       amd_cppc_quirk_epp(q, 100));
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE		*fp;
+	char		line[256], *p, *end;
+	uint64_t	cap1;
+	uint32_t	cpuid;
+	int		lineno;
+
+	if (argc != 2)
+		errx(1, "usage: quirk_test corpus");
+	if ((fp = fopen(argv[1], "r")) == NULL)
+		err(1, "%s", argv[1]);
+	for (lineno = 1; fgets(line, sizeof(line), fp) != NULL; lineno++) {
+		line[strcspn(line, "\n")] = '\0';
+		p = line + strspn(line, " \t");
+		if (*p == '\0' || *p == '#')
+			continue;
+		cpuid = strtoul(p, &end, 16);
+		if (end == p)
+			errx(1, "line %d: expected CPUID", lineno);
+		p = end;
+		cap1 = strtoull(p, &end, 16);
+		if (end == p)
+			errx(1, "line %d: expected CAP1", lineno);
+		p = end + strspn(end, " \t");
+		if (*p == '#')
+			p += 1 + strspn(p + 1, " \t");
+		entry(cpuid, cap1, p);
+	}
+	fclose(fp);
+	return (0);
+}
@@ -0,0 +1,176 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Replay recorded rule inputs through the rule table parser and
+ * amd_cppc_rules_select(), printing the rule picked at every pass:
+ *
+ *	rules TEXT		load a rule table, prints the parse result
+ *	cpuset ID CPU ...	members of cpuset ID for the loaded table
+ *	at MS cpu=N util=N [temp=N] [ac=0|1]
+ *				one pass for one CPU at MS
+ *
+ * Each CPU keeps its own struct amd_cppc_rule_hold, as in the driver;
+ * loading a table starts them over.
+ */
+
+#ifdef __FreeBSD__
+#include <sys/param.h>
+#include <sys/cpuset.h>
+#else
+#include <sched.h>
+typedef cpu_set_t cpuset_t;
+#endif
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "amd_cppc_rules.h"
+
+#define NCPU	8
+
+static struct amd_cppc_ruleset rs;
+static struct amd_cppc_rule_hold hold[NCPU];
+
+static void
+load(char *text, int lineno)
+{
+	char		err[128];
+
+	memset(hold, 0, sizeof(hold));
+	if (amd_cppc_rules_parse(text, &rs, err, sizeof(err)) != 0) {
+		printf("%d: error: %s\n", lineno, err);
+		memset(&rs, 0, sizeof(rs));
+		return;
+	}
+	printf("%d: %d rules, needs%s%s\n", lineno, rs.nrules,
+	       (rs.needs & AMD_CPPC_RULE_NEED_TEMP) != 0 ? " temp" : "",
+	       (rs.needs & AMD_CPPC_RULE_NEED_CPUSET) != 0 ? " cpuset" : "");
+}
+
+static void
+cpuset(char *args, int lineno)
+{
+	cpuset_t	mask;
+	char		*tok;
+	int		cpu, i, id;
+
+	if ((tok = strsep(&args, " \t")) == NULL)
+		errx(1, "line %d: cpuset needs an ID", lineno);
+	id = atoi(tok);
+	CPU_ZERO(&mask);
+	while ((tok = strsep(&args, " \t")) != NULL) {
+		if (*tok == '\0')
+			continue;
+		if ((cpu = atoi(tok)) < 0 || cpu >= NCPU)
+			errx(1, "line %d: bad CPU %s", lineno, tok);
+		CPU_SET(cpu, &mask);
+	}
+	for (i = 0; i < rs.nrules; i++)
+		if (rs.rules[i].cpuset == id)
+			rs.rules[i].cpus = mask;
+}
+
+static void
+pass(char *args, int lineno)
+{
+	struct amd_cppc_rule_input in;
+	const struct amd_cppc_rule *r;
+	char		*tok, *val;
+	int		idx;
+
+	memset(&in, 0, sizeof(in));
+	in.temp = AMD_CPPC_TEMP_UNKNOWN;
+	in.ac = 1;
+	if ((tok = strsep(&args, " \t")) == NULL)
+		errx(1, "line %d: at needs a time", lineno);
+	in.now_ms = strtoull(tok, NULL, 10);
+	while ((tok = strsep(&args, " \t")) != NULL) {
+		if (*tok == '\0')
+			continue;
+		if ((val = strchr(tok, '=')) == NULL)
+			errx(1, "line %d: bad input %s", lineno, tok);
+		*val++ = '\0';
+		if (strcmp(tok, "cpu") == 0)
+			in.cpu = atoi(val);
+		else if (strcmp(tok, "util") == 0)
+			in.util = atoi(val);
+		else if (strcmp(tok, "temp") == 0)
+			in.temp = atoi(val);
+		else if (strcmp(tok, "ac") == 0)
+			in.ac = atoi(val);
+		else
+			errx(1, "line %d: unknown input %s", lineno, tok);
+	}
+	if (in.cpu < 0 || in.cpu >= NCPU)
+		errx(1, "line %d: bad CPU %d", lineno, in.cpu);
+
+	idx = amd_cppc_rules_select(&rs, &in, &hold[in.cpu]);
+	printf("%d: t=%ju cpu %d: ", lineno, (uintmax_t)in.now_ms, in.cpu);
+	if (idx < 0) {
+		printf("none\n");
+		return;
+	}
+	r = &rs.rules[idx];
+	printf("rule %d epp=%d min=%d max=%d boost=%d\n", idx, r->epp,
+	       r->min_perf, r->max_perf, r->boost);
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE		*fp;
+	char		line[AMD_CPPC_RULES_TEXTLEN + 16], *p, *cmd;
+	int		lineno;
+
+	if (argc != 2)
+		errx(1, "usage: rules_test file");
+	if ((fp = fopen(argv[1], "r")) == NULL)
+		err(1, "%s", argv[1]);
+	for (lineno = 1; fgets(line, sizeof(line), fp) != NULL; lineno++) {
+		line[strcspn(line, "\n")] = '\0';
+		p = line + strspn(line, " \t");
+		if (*p == '\0' || *p == '#')
+			continue;
+		cmd = strsep(&p, " \t");
+		if (p == NULL)
+			p = cmd + strlen(cmd);
+		if (strcmp(cmd, "rules") == 0)
+			load(p, lineno);
+		else if (strcmp(cmd, "cpuset") == 0)
+			cpuset(p, lineno);
+		else if (strcmp(cmd, "at") == 0)
+			pass(p, lineno);
+		else
+			errx(1, "line %d: unknown command %s", lineno, cmd);
+	}
+	fclose(fp);
+	return (0);
+}
@@ -0,0 +1,159 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Decode SMU metrics table dumps with the driver's layouts and print the
+ * parsed fields. A dump is the table version and the table as 32-bit
+ * words, the way
+ *
+ *	sysctl -n hw.amd_cppc.smu.version
+ *	sysctl -b hw.amd_cppc.smu.table | \
+ *	    hexdump -v -e '"%04_ax:" 8/4 " %08x" "\n"'
+ *
+ * print them, with "version" in front of the first:
+ *
+ *	version 0x370005
+ *	0000: 41700000 41448f5c ...
+ */
+
+#include <sys/param.h>
+
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "amd_cppc_smu.h"
+
+#define DUMP_MAX	8192
+
+static const char *const limit_names[AMD_CPPC_SMU_NLIMITS] = {
+	"stapm", "ppt_fast", "ppt_slow", "tdc", "edc", "tctl",
+};
+
+static int	failed;
+
+static void
+dump(const char *path)
+{
+	const struct amd_cppc_smu_layout *lay;
+	struct amd_cppc_smu_metrics m;
+	struct amd_cppc_smu_core *c;
+	FILE		*fp;
+	uint8_t		table[DUMP_MAX];
+	char		line[256], *p, *end;
+	unsigned long	off, word;
+	uint32_t	version, w;
+	size_t		len;
+	int		error, i, lineno;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		err(1, "%s", path);
+	version = 0;
+	len = 0;
+	for (lineno = 1; fgets(line, sizeof(line), fp) != NULL; lineno++) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (strncmp(line, "version ", 8) == 0) {
+			version = strtoul(line + 8, NULL, 0);
+			continue;
+		}
+		off = strtoul(line, &end, 16);
+		if (*end != ':' || off != len)
+			errx(1, "%s:%d: expected offset %zx", path, lineno,
+			     len);
+		for (p = end + 1;; p = end) {
+			word = strtoul(p, &end, 16);
+			if (end == p)
+				break;
+			if (len + 4 > sizeof(table))
+				errx(1, "%s:%d: dump too long", path, lineno);
+			w = word;
+			memcpy(table + len, &w, 4);	/* little endian */
+			len += 4;
+		}
+	}
+	fclose(fp);
+
+	printf("%s: version %#x, %zu bytes\n", path, version, len);
+	if ((lay = amd_cppc_smu_layout(version)) == NULL) {
+		printf("  unknown version\n");
+		return;
+	}
+	memset(&m, 0, sizeof(m));
+	if ((error = amd_cppc_smu_parse(lay, table, len, &m)) != 0) {
+		printf("  %s layout: error %d\n", lay->name, error);
+		return;
+	}
+	printf("  %s layout\n", lay->name);
+	for (i = 0; i < AMD_CPPC_SMU_NLIMITS; i++)
+		printf("  %-8s %7d %7d\n", limit_names[i], m.limit[i],
+		       m.value[i]);
+	printf("  core power_mw volt_mv temp_mc freq_mhz c0_pm cc6_pm\n");
+	for (i = 0; i < AMD_CPPC_SMU_MAX_CORES; i++) {
+		c = &m.core[i];
+		printf("  %4d %8d %7d %7d %8d %5d %6d\n", i, c->power_mw,
+		       c->volt_mv, c->temp_mc, c->freq_mhz, c->c0_pm,
+		       c->cc6_pm);
+	}
+}
+
+static void
+milli(uint32_t bits, int64_t want)
+{
+	int64_t		v;
+
+	if ((v = amd_cppc_smu_milli(bits)) != want) {
+		fprintf(stderr, "milli(%#x) = %jd, want %jd\n", bits,
+			(intmax_t)v, (intmax_t)want);
+		failed++;
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	int		i;
+
+	/* The float conversion on its own, edge cases included. */
+	milli(0x3F800000, 1000);		/* 1.0 */
+	milli(0x41700000, 15000);		/* 15.0 */
+	milli(0x3F733333, 949);			/* 0.94999999, truncated */
+	milli(0xC0200000, -2500);		/* -2.5 */
+	milli(0x3A83126F, 1);			/* 0.001 */
+	milli(0x3A03126F, 0);			/* 0.0005, truncated */
+	milli(0x00000001, 0);			/* denormal */
+	milli(0x7F800000, 0);			/* infinity */
+	milli(0x7FC00000, 0);			/* NaN */
+	milli(0x7F7FFFFF, INT64_MAX);		/* FLT_MAX saturates */
+
+	for (i = 1; i < argc; i++)
+		dump(argv[i]);
+	return (failed != 0);
+}
@@ -0,0 +1,214 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Copyright (c) 2026 Rob Augustinus
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Build a cppcstat recording from its text form, so recorded snapshots
+ * can be kept and reviewed as text:
+ *
+ *	frame NS		start a frame taken at NS ns
+ *	defaults FIELD=V ...	values of every following record
+ *	cpu N FIELD=V ...	one record, other fields from defaults
+ *
+ * A cpu line naming the same CPU as the line before it adds to that
+ * record.
+ *
+ * FIELD is a member of struct amd_cppc_snap; bind takes four source
+ * names, e.g. bind=powercap,admin,hw,admin.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "amd_cppc_snap.h"
+
+#define CPPCSTAT_MAGIC		"CPPCSNAP2\n"
+#define SNAPGEN_MAXCPU		256
+
+#define FIELD(f)	{ #f, offsetof(struct amd_cppc_snap, f),	\
+			  sizeof(((struct amd_cppc_snap *)0)->f) }
+
+static const struct {
+	const char	*name;
+	size_t		off;
+	size_t		size;
+} fields[] = {
+	FIELD(highest_perf), FIELD(nominal_perf),
+	FIELD(lowest_nonlinear_perf), FIELD(lowest_perf), FIELD(base_mhz),
+	FIELD(max_perf), FIELD(min_perf), FIELD(des_perf), FIELD(epp_hw),
+	FIELD(req), FIELD(epp), FIELD(mode), FIELD(boost), FIELD(floor_perf),
+	FIELD(ceil_perf), FIELD(domain), FIELD(tamper_count), FIELD(flags),
+	FIELD(rule), FIELD(set_policy), FIELD(energy_esu), FIELD(tsc),
+	FIELD(aperf), FIELD(mperf), FIELD(energy), FIELD(max_mhz),
+	FIELD(min_mhz), FIELD(des_mhz),
+};
+
+static const char *const sources[AMD_CPPC_SRC_COUNT] = AMD_CPPC_SRC_NAMES;
+
+static struct amd_cppc_snap defaults;
+static struct amd_cppc_snap frame[SNAPGEN_MAXCPU];
+static uint64_t	frame_ns;
+static int	frame_n = -1;		/* -1 = no frame started */
+
+static void
+set_bind(struct amd_cppc_snap *s, char *val, int lineno)
+{
+	char		*name;
+	int		i, src;
+
+	for (i = 0; i < AMD_CPPC_BIND_COUNT; i++) {
+		if ((name = strsep(&val, ",")) == NULL)
+			errx(1, "line %d: bind needs %d sources", lineno,
+			     AMD_CPPC_BIND_COUNT);
+		for (src = 0; src < AMD_CPPC_SRC_COUNT; src++)
+			if (strcmp(name, sources[src]) == 0)
+				break;
+		if (src == AMD_CPPC_SRC_COUNT)
+			errx(1, "line %d: unknown source %s", lineno, name);
+		s->bind[i] = src;
+	}
+}
+
+static void
+set_fields(struct amd_cppc_snap *s, char *args, int lineno)
+{
+	char		*tok, *val;
+	uint64_t	v;
+	u_int		i;
+
+	while ((tok = strsep(&args, " \t")) != NULL) {
+		if (*tok == '\0')
+			continue;
+		if ((val = strchr(tok, '=')) == NULL)
+			errx(1, "line %d: expected FIELD=V: %s", lineno, tok);
+		*val++ = '\0';
+		if (strcmp(tok, "bind") == 0) {
+			set_bind(s, val, lineno);
+			continue;
+		}
+		for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+			if (strcmp(tok, fields[i].name) == 0)
+				break;
+		if (i == sizeof(fields) / sizeof(fields[0]))
+			errx(1, "line %d: unknown field %s", lineno, tok);
+		v = val[0] == '-' ? (uint64_t)strtoll(val, NULL, 0) :
+		    strtoull(val, NULL, 0);
+		switch (fields[i].size) {
+		case 1:
+			*((uint8_t *)s + fields[i].off) = v;
+			break;
+		case 2:
+			*(uint16_t *)(void *)((char *)s + fields[i].off) = v;
+			break;
+		case 4:
+			*(uint32_t *)(void *)((char *)s + fields[i].off) = v;
+			break;
+		default:
+			*(uint64_t *)(void *)((char *)s + fields[i].off) = v;
+			break;
+		}
+	}
+}
+
+static void
+flush(FILE *out)
+{
+	uint32_t	n;
+
+	if (frame_n < 0)
+		return;
+	n = frame_n;
+	if (fwrite(&frame_ns, sizeof(frame_ns), 1, out) != 1 ||
+	    fwrite(&n, sizeof(n), 1, out) != 1 ||
+	    fwrite(frame, sizeof(frame[0]), n, out) != n)
+		err(1, "write");
+}
+
+int
+main(int argc, char **argv)
+{
+	struct amd_cppc_snap *s;
+	FILE		*in, *out;
+	char		line[1024], *p, *cmd;
+	int		cpu, lineno;
+
+	if (argc != 3)
+		errx(1, "usage: snapgen in.txt out.snap");
+	if ((in = fopen(argv[1], "r")) == NULL)
+		err(1, "%s", argv[1]);
+	if ((out = fopen(argv[2], "w")) == NULL)
+		err(1, "%s", argv[2]);
+	fputs(CPPCSTAT_MAGIC, out);
+
+	memset(&defaults, 0, sizeof(defaults));
+	defaults.domain = defaults.rule = defaults.set_policy = -1;
+	defaults.energy_esu = -1;
+	for (lineno = 1; fgets(line, sizeof(line), in) != NULL; lineno++) {
+		line[strcspn(line, "\n")] = '\0';
+		p = line + strspn(line, " \t");
+		if (*p == '\0' || *p == '#')
+			continue;
+		cmd = strsep(&p, " \t");
+		if (p == NULL)
+			p = cmd + strlen(cmd);
+		if (strcmp(cmd, "frame") == 0) {
+			flush(out);
+			frame_ns = strtoull(p, NULL, 0);
+			frame_n = 0;
+		} else if (strcmp(cmd, "defaults") == 0)
+			set_fields(&defaults, p, lineno);
+		else if (strcmp(cmd, "cpu") == 0) {
+			if (frame_n < 0)
+				errx(1, "line %d: cpu before frame", lineno);
+			cpu = strtol(strsep(&p, " \t"), NULL, 10);
+			if (frame_n == 0 || frame[frame_n - 1].cpu != cpu) {
+				if (frame_n == SNAPGEN_MAXCPU)
+					errx(1, "line %d: too many CPUs",
+					     lineno);
+				s = &frame[frame_n++];
+				*s = defaults;
+				s->snap_version = AMD_CPPC_SNAP_VERSION;
+				s->snap_size = sizeof(*s);
+				s->cpu = cpu;
+			} else
+				s = &frame[frame_n - 1];
+			if (p != NULL)
+				set_fields(s, p, lineno);
+		} else
+			errx(1, "line %d: unknown command %s", lineno, cmd);
+	}
+	flush(out);
+	fclose(in);
+	if (fclose(out) != 0)
+		err(1, "%s", argv[2]);
+	return (0);
+}